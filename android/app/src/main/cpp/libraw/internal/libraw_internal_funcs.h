@@ -312,6 +312,7 @@ it under the terms of the one of two licenses as you choose:
 
 	void kodak_thumb_loader();
 	void dng_ycbcr_thumb_loader();
+	void bitmap_thumb_layout();
 #ifdef USE_X3FTOOLS
     void x3f_thumb_loader();
     int x3f_thumb_size();
@@ -122,6 +122,7 @@ it under the terms of the one of two licenses as you choose:
 #define med_passes        (imgdata.params.med_passes)
 #define no_auto_bright    (imgdata.params.no_auto_bright)
 #define auto_bright_thr   (imgdata.params.auto_bright_thr)
+#define auto_bright_quant (imgdata.params.auto_bright_quant)
 #define use_fuji_rotate   (imgdata.params.use_fuji_rotate)
 #define filtering_mode    (imgdata.params.filtering_mode)
 
@@ -208,6 +208,9 @@ public:
 #endif
   int open_buffer(const void *buffer, size_t size);
   virtual int open_datastream(LibRaw_abstract_datastream *);
+  /* Exif thumbnail and capture time of a plain JPEG file, for
+     dcraw_make_mem_thumb() */
+  int open_jpeg_thumb(LibRaw_abstract_datastream *);
   virtual int open_bayer(const unsigned char *data, unsigned datalen,
                          ushort _raw_width, ushort _raw_height,
                          ushort _left_margin, ushort _top_margin,
@@ -271,6 +274,13 @@ public:
   /* dcraw emulation */
   int dcraw_ppm_tiff_writer(const char *filename);
   int dcraw_thumb_writer(const char *fname);
+  /* streaming writer of the processed image, format is one of
+     LibRaw_export_formats, quality (1..100) is for JPEG only */
+  int dcraw_export_writer(const char *filename, int format, int quality = 90);
+#if defined(_WIN32) || defined(WIN32)
+  int dcraw_export_writer(const wchar_t *filename, int format,
+                          int quality = 90);
+#endif
   int dcraw_process(void);
   /* information calls */
   int is_fuji_rotated()
@@ -288,11 +298,29 @@ public:
   virtual libraw_processed_image_t *dcraw_make_mem_image(int *errcode = NULL);
   virtual libraw_processed_image_t *dcraw_make_mem_thumb(int *errcode = NULL);
   static void dcraw_clear_mem(libraw_processed_image_t *);
+  /* bitmap from the calls above scaled to exactly width x height, free with
+     dcraw_clear_mem(). With flip (as sizes.flip) it is turned on the way;
+     width x height is the turned size. */
+  libraw_processed_image_t *resample_mem_image(
+      const libraw_processed_image_t *src, int width, int height,
+      int *errcode = NULL, int flip = 0);
 
   /* Additional calls for make_mem_image */
   void get_mem_image_format(int *width, int *height, int *colors,
                             int *bps) const;
   int copy_mem_image(void *scan0, int stride, int bgr);
+  /* rows of a progressive dcraw_process() reported final by
+     LIBRAW_PROGRESS_OUTPUT_BAND: 8-bit, 3 per pixel, sensor orientation */
+  int copy_mem_band(void *scan0, int stride, int bgr, int row0, int rows);
+
+  /* Raw-domain exposure statistics, available after unpack(). The optional
+     clip mask gets one byte per cell: bit c set when a pixel of color c is
+     clipped, bit c+4 when one is at or below black. */
+  int get_raw_stats(libraw_raw_stats_t *stats, uchar *clip_mask = NULL,
+                    int mask_width = 0, int mask_height = 0);
+
+  /* drop the parsed dark frame and bad pixel list kept between images */
+  static void clear_calibration_cache();
 
   /* free all internal data structures */
   void recycle();
@@ -437,12 +465,18 @@ protected:
                                 char **list);
   void write_ppm_tiff();
   void convert_to_rgb();
+  void convert_to_rgb_prepare(float out_cam[3][4]);
   void remove_zeroes();
   void crop_masked_pixels();
 #ifndef NO_LCMS
   void apply_profile(const char *, const char *);
 #endif
   void pre_interpolate();
+  void interpolate_image(int quality, int iterations, int dcb_enhance,
+                         int noiserd);
+  int progressive_band_margin(int quality);
+  void interpolate_bands(int quality, int iterations, int dcb_enhance,
+                         int noiserd, int margin);
   void border_interpolate(int border);
   void lin_interpolate();
   void vng_interpolate();
@@ -456,20 +490,30 @@ protected:
   void dcb(int iterations, int dcb_enhance);
   void fbdd(int noiserd);
   void exp_bef(float expos, float preser);
+  void exp_bef_prepare(float expos, float preser);
 
-  void bad_pixels(const char *);
-  void subtract(const char *);
+  void bad_pixels(const char *, int crop_top = 0, int crop_left = 0);
+  void bad_pixel_fix(int row, int col);
+  void subtract(const char *, int crop_top = 0, int crop_left = 0,
+                int frame_width = 0, int frame_height = 0);
   void hat_transform(float *temp, float *base, int st, int size, int sc);
   void wavelet_denoise();
   void scale_colors();
+  int needs_auto_wb();
   void median_filter();
   void blend_highlights();
   void recover_highlights();
   void green_matching();
+  int develop_cache_restore();
+  void develop_cache_store();
+  void develop_cache_free();
 
   void stretch();
 
   void jpeg_thumb_writer(FILE *tfp, char *thumb, int thumb_length);
+  int export_writer(FILE *f, int format, int quality);
+  void write_export_tiff(FILE *f);
+  void write_export_jpeg(FILE *f, int quality);
 #if 0
   void jpeg_thumb();
   void ppm_thumb();
@@ -482,7 +526,9 @@ protected:
   unsigned get4();
 
   int flip_index(int row, int col);
+  void copy_mem_rows(void *scan0, int stride, int bgr, int row0, int rows);
   void gamma_curve(double pwr, double ts, int mode, int imax);
+  int output_white_level(int perc);
   void cubic_spline(const int *x_, const int *y_, const int len);
 
   /* RawSpeed data */
@@ -686,7 +686,12 @@ enum LibRaw_processing_options
   LIBRAW_RAWOPTIONS_CANON_IGNORE_MAKERNOTES_ROTATION = 1 << 23,
   LIBRAW_RAWOPTIONS_ALLOW_JPEGXL_PREVIEWS = 1 << 24,
   LIBRAW_RAWOPTIONS_CANON_CHECK_CAMERA_AUTO_ROTATION_MODE = 1 << 26,
-  LIBRAW_RAWOPTIONS_DNG_STAGE23_IFPRESENT_JPGJXL = 1 << 27
+  LIBRAW_RAWOPTIONS_DNG_STAGE23_IFPRESENT_JPGJXL = 1 << 27,
+  /* 8-bit bitmap thumbnails as 3-channel BGR, grey ones expanded */
+  LIBRAW_RAWOPTIONS_BGR_BITMAP_THUMBS = 1 << 28,
+  /* JPEG thumbnails from dcraw_make_mem_thumb() always carry sizes.flip as
+     their Exif orientation */
+  LIBRAW_RAWOPTIONS_THUMB_EXIF_ORIENTATION = 1 << 29
 };
 
 enum LibRaw_decoder_flags
@@ -787,8 +792,10 @@ enum LibRaw_progress
   LIBRAW_PROGRESS_APPLY_PROFILE = 1 << 17,
   LIBRAW_PROGRESS_CONVERT_RGB = 1 << 18,
   LIBRAW_PROGRESS_STRETCH = 1 << 19,
+  /* progress callback only: rows [0, iteration) of a progressive
+     dcraw_process() are final, see copy_mem_band() */
+  LIBRAW_PROGRESS_OUTPUT_BAND = 1 << 20,
   /* reserved */
-  LIBRAW_PROGRESS_STAGE20 = 1 << 20,
   LIBRAW_PROGRESS_STAGE21 = 1 << 21,
   LIBRAW_PROGRESS_STAGE22 = 1 << 22,
   LIBRAW_PROGRESS_STAGE23 = 1 << 23,
@@ -863,4 +870,10 @@ enum LibRaw_image_formats
   LIBRAW_IMAGE_H265 = 4
 };
 
+enum LibRaw_export_formats
+{
+  LIBRAW_EXPORT_TIFF = 0,
+  LIBRAW_EXPORT_JPEG = 1 /* baseline, 8 bit */
+};
+
 #endif
@@ -101,8 +101,48 @@ typedef struct
 {
   int (*histogram)[LIBRAW_HISTOGRAM_SIZE];
   unsigned *oprof;
+  ushort *exp_lut;     /* exp_bef() curve, see exp_bef_prepare() */
+  int exp_lut_applied; /* set by scale_colors_loop() */
 } output_data_t;
 
+/* auto white balance sums of one 8x8 greybox block */
+typedef struct
+{
+  unsigned sum[4];
+  ushort max;
+  uchar count[4];
+} wb_block_t;
+
+/* gathered by copy_bayer() while it fills image[], used by scale_colors() */
+typedef struct
+{
+  wb_block_t *blocks;
+  unsigned top, left, bottom, right;
+  unsigned rows, cols;
+  int valid;
+} ingest_stats_t;
+
+/* dcraw_process() state right after black subtraction, kept when
+ * params.develop_cache is set; see develop_cache_restore() */
+typedef struct
+{
+  ushort (*image)[4];
+  size_t pixels;
+  libraw_colordata_t color;
+  libraw_image_sizes_t sizes;
+  libraw_iparams_t idata;
+  libraw_internal_output_params_t ioparams;
+  unsigned progress_flags, process_warnings;
+  /* parameters the stages up to the snapshot depend on */
+  int half_size, user_flip, user_black, user_cblack[4], use_p1_correction,
+      user_sat;
+  float threshold, adjust_maximum_thr;
+  double aber[4];
+  unsigned cropbox[4];
+  char *bad_pixels, *dark_frame;
+  process_step_callback pre_subtractblack_cb;
+} develop_cache_t;
+
 typedef struct
 {
   unsigned olympus_exif_cfa;
@@ -216,6 +256,8 @@ typedef struct
   internal_data_t internal_data;
   libraw_internal_output_params_t internal_output_params;
   output_data_t output_data;
+  ingest_stats_t ingest_stats;
+  develop_cache_t develop_cache;
   identify_data_t identify_data;
   unpacker_data_t unpacker_data;
 } libraw_internal_data_t;
@@ -185,6 +185,20 @@ typedef unsigned long long UINT64;
     unsigned char data[1];
   } libraw_processed_image_t;
 
+#define LIBRAW_RAW_STATS_BINS 256
+
+  typedef struct
+  {
+    unsigned pixels[4];  /* visible pixels per CFA color */
+    unsigned clipped[4]; /* at or above the white level */
+    unsigned crushed[4]; /* at or below the black level */
+    float black_mean[4]; /* masked (optical black) area level and noise, */
+    float black_noise[4]; /* 0 when the sensor has no masked area */
+    unsigned white;
+    int hist_shift; /* histogram bin = raw value >> hist_shift */
+    unsigned histogram[4][LIBRAW_RAW_STATS_BINS];
+  } libraw_raw_stats_t;
+
   typedef struct
   {
     char guard[4];
@@ -954,6 +968,12 @@ typedef unsigned long long UINT64;
     int user_sat;          /* -S */
     int med_passes;        /* -m */
     float auto_bright_thr;
+    int auto_bright_quant; /* round auto-bright white to 1/N stop, 0 = exact */
+    int keep_histogram;    /* build the output histogram without auto-bright */
+    int develop_cache;     /* keep the black-subtracted image between
+                              dcraw_process() calls */
+    int progressive_rows;  /* demosaic and convert in bands of this many
+                              rows, reporting each, 0 = whole image */
     float adjust_maximum_thr;
     int no_auto_bright;    /* -W */
     int use_fuji_rotate;   /* -j */
@@ -28,6 +28,74 @@ static void jpegErrorExit(j_common_ptr cinfo)
 }
 #endif
 
+/*
+ * Interleave three 8-bit planes into packed RGB, or BGR, rows in parallel.
+ * With one plane (r == g == b) this expands grey.
+ */
+static void interleave_thumb_planes(uchar *dst, const uchar *r, const uchar *g,
+                                    const uchar *b, int width, int height,
+                                    int bgr)
+{
+  if (bgr)
+  {
+    const uchar *t = r;
+    r = b;
+    b = t;
+  }
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (int row = 0; row < height; row++)
+  {
+    const size_t off = size_t(row) * width;
+    uchar *d = dst + off * 3;
+    for (int col = 0; col < width; col++)
+    {
+      d[col * 3] = r[off + col];
+      d[col * 3 + 1] = g[off + col];
+      d[col * 3 + 2] = b[off + col];
+    }
+  }
+}
+
+/*
+ * 16-bit samples to 8 bits, keeping the channels or as packed BGR (colors
+ * 1 or 3 only), rows in parallel
+ */
+static void ppm16_to_thumb(uchar *dst, const ushort *src, int width, int height,
+                           int colors, int bgr)
+{
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (int row = 0; row < height; row++)
+  {
+    const ushort *s = src + size_t(row) * width * colors;
+    if (!bgr)
+    {
+      uchar *d = dst + size_t(row) * width * colors;
+      for (int i = 0; i < width * colors; i++)
+        d[i] = s[i] >> 8;
+    }
+    else if (colors == 3)
+    {
+      uchar *d = dst + size_t(row) * width * 3;
+      for (int col = 0; col < width; col++, d += 3, s += 3)
+      {
+        d[0] = s[2] >> 8;
+        d[1] = s[1] >> 8;
+        d[2] = s[0] >> 8;
+      }
+    }
+    else
+    {
+      uchar *d = dst + size_t(row) * width * 3;
+      for (int col = 0; col < width; col++, d += 3)
+        d[0] = d[1] = d[2] = s[col] >> 8;
+    }
+  }
+}
+
 int LibRaw::unpack_thumb_ex(int idx)
 {
 	if (idx < 0 || idx >= imgdata.thumbs_list.thumbcount || idx >= LIBRAW_THUMBNAIL_MAXCOUNT)
@@ -226,10 +294,11 @@ int LibRaw::unpack_thumb(void)
 
         THUMB_SIZE_CHECKWH(T.twidth, T.theight);
 
+        const int bgr = (imgdata.rawparams.options & LIBRAW_RAWOPTIONS_BGR_BITMAP_THUMBS) ? 1 : 0;
         int tlength = T.twidth * T.theight;
         if (T.thumb)
           free(T.thumb);
-        T.thumb = (char *)calloc(colors, tlength);
+        T.thumb = (char *)calloc(bgr ? 3 : colors, tlength);
 		if(!T.thumb)
 			return LIBRAW_NO_THUMBNAIL;
         unsigned char *tbuf = (unsigned char *)calloc(colors, tlength);
@@ -243,19 +312,17 @@ int LibRaw::unpack_thumb(void)
         ID.input->read(tbuf, colors, tlength);
         if (libraw_internal_data.unpacker_data.thumb_misc >> 8 &&
             colors == 3) // GRB order
-          for (int i = 0; i < tlength; i++)
-          {
-            T.thumb[i * 3] = tbuf[i + tlength];
-            T.thumb[i * 3 + 1] = tbuf[i];
-            T.thumb[i * 3 + 2] = tbuf[i + 2 * tlength];
-          }
+          interleave_thumb_planes((uchar *)T.thumb, tbuf + tlength, tbuf,
+                                  tbuf + 2 * tlength, T.twidth, T.theight, bgr);
         else if (colors == 3) // RGB or 1-channel
-          for (int i = 0; i < tlength; i++)
-          {
-            T.thumb[i * 3] = tbuf[i];
-            T.thumb[i * 3 + 1] = tbuf[i + tlength];
-            T.thumb[i * 3 + 2] = tbuf[i + 2 * tlength];
-          }
+          interleave_thumb_planes((uchar *)T.thumb, tbuf, tbuf + tlength,
+                                  tbuf + 2 * tlength, T.twidth, T.theight, bgr);
+        else if (bgr)
+        {
+          interleave_thumb_planes((uchar *)T.thumb, tbuf, tbuf, tbuf, T.twidth,
+                                  T.theight, bgr);
+          colors = 3;
+        }
         else if (colors == 1)
         {
           free(T.thumb);
@@ -290,11 +357,12 @@ int LibRaw::unpack_thumb(void)
         }
 		try {
   		  read_shorts(tbuf, tlength);
+          const int r = (imgdata.rawparams.options & LIBRAW_RAWOPTIONS_BGR_BITMAP_THUMBS) ? 2 : 0;
           for (i = 0; i < tlength; i++)
           {
-            T.thumb[i * 3] = (tbuf[i] << 3) & 0xff;
+            T.thumb[i * 3 + r] = (tbuf[i] << 3) & 0xff;
             T.thumb[i * 3 + 1] = (tbuf[i] >> 5 << 2) & 0xff;
-            T.thumb[i * 3 + 2] = (tbuf[i] >> 11 << 3) & 0xff;
+            T.thumb[i * 3 + 2 - r] = (tbuf[i] >> 11 << 3) & 0xff;
           }
           free(tbuf);
           T.tlength = T.tcolors * tlength;
@@ -367,6 +435,7 @@ int LibRaw::unpack_thumb(void)
             }
             ID.input->seek(pos, SEEK_SET);
             T.tformat = LIBRAW_THUMBNAIL_BITMAP;
+            bitmap_thumb_layout();
             SET_PROC_FLAG(LIBRAW_PROGRESS_THUMB_LOAD);
             return 0;
           }
@@ -392,6 +461,7 @@ int LibRaw::unpack_thumb(void)
         ID.input->read(T.thumb, 1, T.tlength);
 
         T.tformat = LIBRAW_THUMBNAIL_BITMAP;
+        bitmap_thumb_layout();
         SET_PROC_FLAG(LIBRAW_PROGRESS_THUMB_LOAD);
         return 0;
       }
@@ -425,6 +495,10 @@ int LibRaw::unpack_thumb(void)
         }
         else
         {
+          const int bgr = (imgdata.rawparams.options & LIBRAW_RAWOPTIONS_BGR_BITMAP_THUMBS) &&
+                          (t_colors == 1 || t_colors == 3);
+          if (bgr)
+            o_length = T.twidth * T.theight * 3;
 #ifdef LIBRAW_CALLOC_RAWSTORE
           T.thumb = (char *)calloc(o_length,1);
 #else
@@ -435,9 +509,10 @@ int LibRaw::unpack_thumb(void)
 			  free(t_thumb);
 			  return LIBRAW_NO_THUMBNAIL;
 		  }
-          for (int i = 0; i < o_length; i++)
-            T.thumb[i] = t_thumb[i] >> 8;
+          ppm16_to_thumb((uchar *)T.thumb, t_thumb, T.twidth, T.theight, t_colors, bgr);
           free(t_thumb);
+          if (bgr)
+            T.tcolors = 3;
           T.tformat = LIBRAW_THUMBNAIL_BITMAP;
           T.tlength = o_length;
         }
@@ -23,6 +23,11 @@
  */
 
 #include "../../internal/dmp_include.h"
+#if defined(LIBRAW_USE_OPENMP)
+#include <atomic>
+#include <thread>
+#include <vector>
+#endif
 
 static inline float calc_dist(float c1, float c2)
 {
@@ -54,11 +59,25 @@ struct DHT
   static inline float Thot(void) throw() { return 64.0f; }
   static inline float Tg(void) throw() { return 256.0f; }
   static inline float T(void) throw() { return 1.4f; }
+  static const int DLINE_CHUNK = 256;
+  static const int WAVE_CHUNK = 128;
   char *ndir;
   inline int nr_offset(int row, int col) throw()
   {
     return (row * nr_width + col);
   }
+  /*
+   * выбор направления арифметикой вместо вложенных ?: -- в цикле по строке
+   * не остаётся ветвлений.
+   */
+  static inline int hv_dir(float dh, float dv, float e)
+  {
+    return VER + (HOR - VER) * int(dh < dv) + HVSH * int(e > Tg());
+  }
+  static inline int diag_dir(float dlurd, float druld, float e)
+  {
+    return LURD + (RULD - LURD) * int(druld < dlurd) + DIASH * int(e > T());
+  }
   int get_hv_grb(int x, int y, int kc)
   {
     float hv1 = 2 * nraw[nr_offset(y - 1, x)][1] /
@@ -92,8 +111,7 @@ struct DHT
         calc_dist(nraw[nr_offset(y, x - 3)][1] * nraw[nr_offset(y, x + 3)][1],
                   nraw[nr_offset(y, x - 1)][1] * nraw[nr_offset(y, x + 1)][1]);
     float e = calc_dist(dh, dv);
-    char d = dh < dv ? (e > Tg() ? HORSH : HOR) : (e > Tg() ? VERSH : VER);
-    return d;
+    return hv_dir(dh, dv, e);
   }
   int get_hv_rbg(int x, int y, int hc)
   {
@@ -128,8 +146,7 @@ struct DHT
                  nraw[nr_offset(y, x - 3)][hc] * nraw[nr_offset(y, x + 3)][hc],
                  nraw[nr_offset(y, x - 1)][hc] * nraw[nr_offset(y, x + 1)][hc]);
     float e = calc_dist(dh, dv);
-    char d = dh < dv ? (e > Tg() ? HORSH : HOR) : (e > Tg() ? VERSH : VER);
-    return d;
+    return hv_dir(dh, dv, e);
   }
   int get_diag_grb(int x, int y, int kc)
   {
@@ -148,9 +165,7 @@ struct DHT
                       nraw[nr_offset(y + 1, x - 1)][1],
                   nraw[nr_offset(y, x)][1] * nraw[nr_offset(y, x)][1]);
     float e = calc_dist(dlurd, druld);
-    char d =
-        druld < dlurd ? (e > T() ? RULDSH : RULD) : (e > T() ? LURDSH : LURD);
-    return d;
+    return diag_dir(dlurd, druld, e);
   }
   int get_diag_rbg(int x, int y, int /* hc */)
   {
@@ -161,9 +176,7 @@ struct DHT
         nraw[nr_offset(y - 1, x + 1)][1] * nraw[nr_offset(y + 1, x - 1)][1],
         nraw[nr_offset(y, x)][1] * nraw[nr_offset(y, x)][1]);
     float e = calc_dist(dlurd, druld);
-    char d =
-        druld < dlurd ? (e > T() ? RULDSH : RULD) : (e > T() ? LURDSH : LURD);
-    return d;
+    return diag_dir(dlurd, druld, e);
   }
   static inline float scale_over(float ec, float base)
   {
@@ -178,15 +191,21 @@ struct DHT
     return base - sqrt(s * (o + s)) + s;
   }
   ~DHT();
-  DHT(LibRaw &_libraw);
+  DHT(LibRaw &_libraw, float (*_nraw)[3], char *_ndir);
+  static size_t nr_size(LibRaw &_libraw)
+  {
+    return size_t(_libraw.imgdata.sizes.iheight + nr_topmargin * 2) *
+           size_t(_libraw.imgdata.sizes.iwidth + nr_leftmargin * 2);
+  }
   void copy_to_image();
   void make_greens();
   void make_diag_dirs();
   void make_hv_dirs();
   void refine_hv_dirs(int i, int js);
   void refine_diag_dirs(int i, int js);
-  void refine_ihv_dirs(int i);
-  void refine_idiag_dirs(int i);
+  void refine_ihv_dirs(int i, int js, int je);
+  void refine_idiag_dirs(int i, int js, int je);
+  void refine_wavefront(void (DHT::*refine)(int, int, int));
   void illustrate_dirs();
   void illustrate_dline(int i);
   void make_hv_dline(int i);
@@ -213,42 +232,71 @@ typedef float float3[3];
  * получился 0 при округлении, иначе проблема при интерпретации синих и красных.
  *
  */
-DHT::DHT(LibRaw &_libraw) : libraw(_libraw)
+DHT::DHT(LibRaw &_libraw, float (*_nraw)[3], char *_ndir)
+    : nraw(_nraw), libraw(_libraw), ndir(_ndir)
 {
   nr_height = libraw.imgdata.sizes.iheight + nr_topmargin * 2;
   nr_width = libraw.imgdata.sizes.iwidth + nr_leftmargin * 2;
-  nraw = (float3 *)malloc(nr_height * nr_width * sizeof(float3));
   int iwidth = libraw.imgdata.sizes.iwidth;
-  ndir = (char *)calloc(nr_height * nr_width, 1);
+  int iheight = libraw.imgdata.sizes.iheight;
   channel_maximum[0] = channel_maximum[1] = channel_maximum[2] = 0;
   channel_minimum[0] = libraw.imgdata.image[0][0];
   channel_minimum[1] = libraw.imgdata.image[0][1];
   channel_minimum[2] = libraw.imgdata.image[0][2];
-  for (int i = 0; i < nr_height * nr_width; ++i)
-    nraw[i][0] = nraw[i][1] = nraw[i][2] = 0.5;
-  for (int i = 0; i < libraw.imgdata.sizes.iheight; ++i)
+  /*
+   * каждый поток заполняет свои строки и считает свои минимумы/максимумы,
+   * общие значения собираются в конце.
+   */
+#if defined(LIBRAW_USE_OPENMP)
+#pragma omp parallel firstprivate(iwidth, iheight)
+#endif
   {
-    int col_cache[48];
-    for (int j = 0; j < 48; ++j)
-    {
-      int l = libraw.COLOR(i, j);
-      if (l == 3)
-        l = 1;
-      col_cache[j] = l;
-    }
-    for (int j = 0; j < iwidth; ++j)
+    ushort t_max[3] = {0, 0, 0};
+    float t_min[3] = {channel_minimum[0], channel_minimum[1],
+                      channel_minimum[2]};
+#if defined(LIBRAW_USE_OPENMP)
+#pragma omp for schedule(static)
+#endif
+    for (int y = 0; y < nr_height; ++y)
     {
-      int l = col_cache[j % 48];
-      unsigned short c = libraw.imgdata.image[i * iwidth + j][l];
-      if (c != 0)
+      float *row = nraw[nr_offset(y, 0)];
+      for (int k = 0; k < nr_width * 3; ++k)
+        row[k] = 0.5f;
+      int i = y - nr_topmargin;
+      if (i < 0 || i >= iheight)
+        continue;
+      int col_cache[48];
+      for (int j = 0; j < 48; ++j)
       {
-        if (channel_maximum[l] < c)
-          channel_maximum[l] = c;
-        if (channel_minimum[l] > c)
-          channel_minimum[l] = c;
-        nraw[nr_offset(i + nr_topmargin, j + nr_leftmargin)][l] = (float)c;
+        int l = libraw.COLOR(i, j);
+        if (l == 3)
+          l = 1;
+        col_cache[j] = l;
+      }
+      for (int j = 0; j < iwidth; ++j)
+      {
+        int l = col_cache[j % 48];
+        unsigned short c = libraw.imgdata.image[i * iwidth + j][l];
+        if (c != 0)
+        {
+          if (t_max[l] < c)
+            t_max[l] = c;
+          if (t_min[l] > c)
+            t_min[l] = c;
+          nraw[nr_offset(y, j + nr_leftmargin)][l] = (float)c;
+        }
       }
     }
+#if defined(LIBRAW_USE_OPENMP)
+#pragma omp critical(dht_channel_limits)
+#endif
+    for (int l = 0; l < 3; ++l)
+    {
+      if (channel_maximum[l] < t_max[l])
+        channel_maximum[l] = t_max[l];
+      if (channel_minimum[l] > t_min[l])
+        channel_minimum[l] = t_min[l];
+    }
   }
   channel_minimum[0] += .5;
   channel_minimum[1] += .5;
@@ -441,13 +489,7 @@ void DHT::make_diag_dirs()
 //	for (int i = 0; i < libraw.imgdata.sizes.iheight; ++i) {
 //		refine_diag_dirs(i, (i & 1) ^ 1);
 //	}
-#if defined(LIBRAW_USE_OPENMP)
-#pragma omp parallel for schedule(guided)
-#endif
-  for (int i = 0; i < libraw.imgdata.sizes.iheight; ++i)
-  {
-    refine_idiag_dirs(i);
-  }
+  refine_wavefront(&DHT::refine_idiag_dirs);
 }
 
 void DHT::make_hv_dirs()
@@ -473,13 +515,46 @@ void DHT::make_hv_dirs()
   {
     refine_hv_dirs(i, (i & 1) ^ 1);
   }
+  refine_wavefront(&DHT::refine_ihv_dirs);
+}
+
+/*
+ * refine_ihv_dirs и refine_idiag_dirs меняют ndir на месте: точка видит уже
+ * уточнённые строку выше и точку слева, а строку ниже -- ещё нет. строки
+ * идут волновым фронтом: блок столбцов строки i начинается, только когда
+ * строка i - 1 прошла на столбец дальше его конца. порядок чтений и записей
+ * тот же, что при последовательном проходе, и результат от числа потоков не
+ * зависит.
+ */
+void DHT::refine_wavefront(void (DHT::*refine)(int, int, int))
+{
+  int iheight = libraw.imgdata.sizes.iheight;
+  int iwidth = libraw.imgdata.sizes.iwidth;
 #if defined(LIBRAW_USE_OPENMP)
-#pragma omp parallel for schedule(guided)
-#endif
-  for (int i = 0; i < libraw.imgdata.sizes.iheight; ++i)
+  std::vector<std::atomic<int> > done(iheight);
+  for (int i = 0; i < iheight; ++i)
+    done[i].store(0, std::memory_order_relaxed);
+  /* строки раздаются по возрастанию, так что ждать всегда есть кого */
+#pragma omp parallel for schedule(static, 1)
+  for (int i = 0; i < iheight; ++i)
   {
-    refine_ihv_dirs(i);
+    for (int js = 0; js < iwidth; js += WAVE_CHUNK)
+    {
+      int je = MIN(js + WAVE_CHUNK, iwidth);
+      if (i > 0)
+      {
+        int need = MIN(je + 1, iwidth);
+        while (done[i - 1].load(std::memory_order_acquire) < need)
+          std::this_thread::yield();
+      }
+      (this->*refine)(i, js, je);
+      done[i].store(je, std::memory_order_release);
+    }
   }
+#else
+  for (int i = 0; i < iheight; ++i)
+    (this->*refine)(i, 0, iwidth);
+#endif
 }
 
 void DHT::refine_hv_dirs(int i, int js)
@@ -517,10 +592,9 @@ void DHT::refine_hv_dirs(int i, int js)
   }
 }
 
-void DHT::refine_ihv_dirs(int i)
+void DHT::refine_ihv_dirs(int i, int js, int je)
 {
-  int iwidth = libraw.imgdata.sizes.iwidth;
-  for (int j = 0; j < iwidth; j++)
+  for (int j = js; j < je; j++)
   {
     int x = j + nr_leftmargin;
     int y = i + nr_topmargin;
@@ -546,6 +620,12 @@ void DHT::refine_ihv_dirs(int i)
     }
   }
 }
+/*
+ * точки с известным зелёным и без него обрабатываются отдельными проходами с
+ * шагом 2: внутри прохода нет ветвлений и цикл векторизуется. направления
+ * сначала пишутся в локальный буфер -- запись в ndir через char* иначе
+ * мешает компилятору держать nraw в регистре.
+ */
 void DHT::make_hv_dline(int i)
 {
   int iwidth = libraw.imgdata.sizes.iwidth;
@@ -555,20 +635,21 @@ void DHT::make_hv_dline(int i)
    * js -- начальная х-координата, которая попадает мимо известного зелёного
    * kc -- известный цвет в точке интерполирования
    */
-  for (int j = 0; j < iwidth; j++)
+  int y = i + nr_topmargin;
+  char *nd = ndir + nr_offset(y, nr_leftmargin);
+  char dirs[DLINE_CHUNK];
+  for (int j0 = 0; j0 < iwidth; j0 += DLINE_CHUNK * 2)
   {
-    int x = j + nr_leftmargin;
-    int y = i + nr_topmargin;
-    char d = 0;
-    if ((j & 1) == js)
-    {
-      d = get_hv_grb(x, y, kc);
-    }
-    else
-    {
-      d = get_hv_rbg(x, y, kc);
-    }
-    ndir[nr_offset(y, x)] |= d;
+    int n = MIN(DLINE_CHUNK, (iwidth - j0 - js + 1) / 2);
+    for (int k = 0; k < n; ++k)
+      dirs[k] = get_hv_grb(j0 + js + k * 2 + nr_leftmargin, y, kc);
+    for (int k = 0; k < n; ++k)
+      nd[j0 + js + k * 2] |= dirs[k];
+    n = MIN(DLINE_CHUNK, (iwidth - j0 - (js ^ 1) + 1) / 2);
+    for (int k = 0; k < n; ++k)
+      dirs[k] = get_hv_rbg(j0 + (js ^ 1) + k * 2 + nr_leftmargin, y, kc);
+    for (int k = 0; k < n; ++k)
+      nd[j0 + (js ^ 1) + k * 2] |= dirs[k];
   }
 }
 
@@ -581,20 +662,21 @@ void DHT::make_diag_dline(int i)
    * js -- начальная х-координата, которая попадает мимо известного зелёного
    * kc -- известный цвет в точке интерполирования
    */
-  for (int j = 0; j < iwidth; j++)
+  int y = i + nr_topmargin;
+  char *nd = ndir + nr_offset(y, nr_leftmargin);
+  char dirs[DLINE_CHUNK];
+  for (int j0 = 0; j0 < iwidth; j0 += DLINE_CHUNK * 2)
   {
-    int x = j + nr_leftmargin;
-    int y = i + nr_topmargin;
-    char d = 0;
-    if ((j & 1) == js)
-    {
-      d = get_diag_grb(x, y, kc);
-    }
-    else
-    {
-      d = get_diag_rbg(x, y, kc);
-    }
-    ndir[nr_offset(y, x)] |= d;
+    int n = MIN(DLINE_CHUNK, (iwidth - j0 - js + 1) / 2);
+    for (int k = 0; k < n; ++k)
+      dirs[k] = get_diag_grb(j0 + js + k * 2 + nr_leftmargin, y, kc);
+    for (int k = 0; k < n; ++k)
+      nd[j0 + js + k * 2] |= dirs[k];
+    n = MIN(DLINE_CHUNK, (iwidth - j0 - (js ^ 1) + 1) / 2);
+    for (int k = 0; k < n; ++k)
+      dirs[k] = get_diag_rbg(j0 + (js ^ 1) + k * 2 + nr_leftmargin, y, kc);
+    for (int k = 0; k < n; ++k)
+      nd[j0 + (js ^ 1) + k * 2] |= dirs[k];
   }
 }
 
@@ -643,10 +725,9 @@ void DHT::refine_diag_dirs(int i, int js)
   }
 }
 
-void DHT::refine_idiag_dirs(int i)
+void DHT::refine_idiag_dirs(int i, int js, int je)
 {
-  int iwidth = libraw.imgdata.sizes.iwidth;
-  for (int j = 0; j < iwidth; j++)
+  for (int j = js; j < je; j++)
   {
     int x = j + nr_leftmargin;
     int y = i + nr_topmargin;
@@ -1003,11 +1084,7 @@ void DHT::copy_to_image()
   }
 }
 
-DHT::~DHT()
-{
-  free(nraw);
-  free(ndir);
-}
+DHT::~DHT() {}
 
 void LibRaw::dht_interpolate()
 {
@@ -1020,7 +1097,11 @@ void LibRaw::dht_interpolate()
 		ahd_interpolate();
 		return;
 	}
-  DHT dht(*this);
+  /* рабочие буферы берутся из memmgr: освобождаются и при исключении */
+  size_t nr_size = DHT::nr_size(*this);
+  float(*nraw)[3] = (float(*)[3])malloc(nr_size * sizeof(float3));
+  char *ndir = (char *)calloc(nr_size, 1);
+  DHT dht(*this, nraw, ndir);
   dht.hide_hots();
   dht.make_hv_dirs();
   //	dht.illustrate_dirs();
@@ -1030,4 +1111,6 @@ void LibRaw::dht_interpolate()
   dht.make_rb();
   dht.restore_hots();
   dht.copy_to_image();
+  free(ndir);
+  free(nraw);
 }
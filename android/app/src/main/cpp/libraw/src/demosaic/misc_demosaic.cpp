@@ -105,8 +105,12 @@ void LibRaw::border_interpolate(int border)
 
 void LibRaw::lin_interpolate_loop(int *code, int size)
 {
-  int row;
-  for (row = 1; row < height - 1; row++)
+  /* only non-native channels are written and only native ones are read,
+   * so rows are independent */
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(dynamic, 16)
+#endif
+  for (int row = 1; row < height - 1; row++)
   {
     int col, *ip;
     ushort *pix;
@@ -125,6 +129,53 @@ void LibRaw::lin_interpolate_loop(int *code, int size)
   }
 }
 
+/*
+ * Bilinear interpolation for CFAs that repeat every 2x2 pixels, with the
+ * weights lin_interpolate() puts in its code table: 2 for the four direct
+ * neighbours, 1 for the diagonals. A pixel has its horizontal, vertical and
+ * diagonal neighbours each in a single colour, so one column phase needs
+ * only three 0/1 multipliers and a scale per output channel. Native
+ * samples are copied into int lines first and the loops run over those.
+ */
+#define LIN_BAND 64
+
+struct lin_phase_t
+{
+  int nout;
+  int ch[3], mh[3], mv[3], md[3], w[3];
+};
+
+static void lin_cfa_line(const ushort (*pix)[4], int cols, int c0, int c1,
+                         int *out)
+{
+  for (int col = 0; col < cols; col += 2)
+    out[col] = pix[col][c0];
+  for (int col = 1; col < cols; col += 2)
+    out[col] = pix[col][c1];
+}
+
+static void lin_bayer_row(ushort (*pix)[4], const int *up, const int *mid,
+                          const int *down, int cols, const lin_phase_t *phase)
+{
+  for (int p = 0; p < 2; p++)
+  {
+    const lin_phase_t &q = phase[p];
+    for (int k = 0; k < q.nout; k++)
+    {
+      const int c = q.ch[k], mh = q.mh[k] * 2, mv = q.mv[k] * 2,
+                md = q.md[k], w = q.w[k];
+      for (int col = 2 - p; col < cols - 1; col += 2)
+      {
+        int sum = (mid[col - 1] + mid[col + 1]) * mh +
+                  (up[col] + down[col]) * mv +
+                  (up[col - 1] + up[col + 1] + down[col - 1] + down[col + 1]) *
+                      md;
+        pix[col][c] = sum * w >> 8;
+      }
+    }
+  }
+}
+
 void LibRaw::lin_interpolate()
 {
   std::vector<int> code_buffer(16 * 16 * 32);
@@ -136,6 +187,76 @@ void LibRaw::lin_interpolate()
   if (filters == 9)
     size = 6;
   border_interpolate(1);
+
+  if (filters > 1000 && filters == (filters & 0xff) * 0x01010101U &&
+      width > 2 && height > 2)
+  {
+    lin_phase_t phase[2][2];
+    bool fast = true;
+    for (row = 0; row < 2; row++)
+      for (col = 0; col < 2; col++)
+      {
+        lin_phase_t &q = phase[row][col];
+        f = fcol(row, col);
+        int ch = fcol(row, col + 1), cv = fcol(row + 1, col),
+            cd = fcol(row + 1, col + 1);
+        fast &= f < colors;
+        q.nout = 0;
+        FORCC
+        if (c != f && q.nout < 3)
+        {
+          int k = q.nout++;
+          q.ch[k] = c;
+          q.mh[k] = ch == c;
+          q.mv[k] = cv == c;
+          q.md[k] = cd == c;
+          int total = 4 * (q.mh[k] + q.mv[k] + q.md[k]);
+          q.w[k] = total > 0 ? 256 / total : 0;
+        }
+      }
+    if (fast)
+    {
+      RUN_CALLBACK(LIBRAW_PROGRESS_INTERPOLATE, 1, 3);
+      int nbands = (height - 2 + LIN_BAND - 1) / LIN_BAND;
+#ifdef LIBRAW_USE_OPENMP
+      int buffer_count = omp_get_max_threads();
+#else
+      int buffer_count = 1;
+#endif
+      char **buffers =
+          malloc_omp_buffers(buffer_count, size_t(width) * 3 * sizeof(int));
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+      for (int band = 0; band < nbands; band++)
+      {
+#ifdef LIBRAW_USE_OPENMP
+        int *buf = (int *)buffers[omp_get_thread_num()];
+#else
+        int *buf = (int *)buffers[0];
+#endif
+        int *ring[3] = {buf, buf + width, buf + 2 * width};
+        int top = 1 + band * LIN_BAND;
+        int bottom = MIN(top + LIN_BAND, height - 1);
+        for (int r = top - 1; r <= top; r++)
+          lin_cfa_line(image + size_t(r) * width, width, fcol(r, 0),
+                       fcol(r, 1), ring[(r - top + 1) % 3]);
+        for (int r = top; r < bottom; r++)
+        {
+          int k = r - top;
+          lin_cfa_line(image + size_t(r + 1) * width, width, fcol(r + 1, 0),
+                       fcol(r + 1, 1), ring[(k + 2) % 3]);
+          lin_bayer_row(image + size_t(r) * width, ring[k % 3],
+                        ring[(k + 1) % 3], ring[(k + 2) % 3], width,
+                        phase[r & 1]);
+        }
+      }
+      free_omp_buffers(buffers, buffer_count);
+      RUN_CALLBACK(LIBRAW_PROGRESS_INTERPOLATE, 2, 3);
+      return;
+    }
+  }
+
   for (row = 0; row < size; row++)
     for (col = 0; col < size; col++)
     {
@@ -166,6 +287,7 @@ void LibRaw::lin_interpolate()
   lin_interpolate_loop(code, size);
   RUN_CALLBACK(LIBRAW_PROGRESS_INTERPOLATE, 2, 3);
 }
+#undef LIN_BAND
 
 /*
    This algorithm is officially called:
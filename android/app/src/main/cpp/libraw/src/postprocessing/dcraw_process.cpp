@@ -16,7 +16,7 @@
 
 int LibRaw::dcraw_process(void)
 {
-  int quality, i;
+  int quality;
 
   int iterations = -1, dcb_enhance = 1, noiserd = 0;
   float preser = 0;
@@ -37,83 +37,117 @@ int LibRaw::dcraw_process(void)
 		if (O.aber[c]< 0.001 || O.aber[c] > 1000.f)
 			O.aber[c] = 1.0;
 
-    libraw_decoder_info_t di;
-    get_decoder_info(&di);
-
-    bool is_bayer = (imgdata.idata.filters || P1.colors == 1);
-    int subtract_inline =
-        !O.bad_pixels && !O.dark_frame && is_bayer && !IO.zero_is_bad;
+    int save_4color = O.four_color_rgb;
 
-    int rc = raw2image_ex(subtract_inline); // allocate imgdata.image and copy data!
-	if (rc != LIBRAW_SUCCESS)
-		return rc;
+    /* everything up to black subtraction comes from the develop cache when
+     * the parameters it depends on are unchanged */
+    if (!develop_cache_restore())
+    {
+      libraw_decoder_info_t di;
+      get_decoder_info(&di);
 
-    // Adjust sizes
+      bool is_bayer = (imgdata.idata.filters || P1.colors == 1);
+      int subtract_inline =
+          !O.bad_pixels && !O.dark_frame && is_bayer && !IO.zero_is_bad;
 
-    int save_4color = O.four_color_rgb;
+      int rc = raw2image_ex(subtract_inline); // allocate imgdata.image and copy data!
+      if (rc != LIBRAW_SUCCESS)
+        return rc;
 
-    if (IO.zero_is_bad)
-    {
-      remove_zeroes();
-      SET_PROC_FLAG(LIBRAW_PROGRESS_REMOVE_ZEROES);
-    }
+      // Adjust sizes
 
-    if (O.bad_pixels && no_crop)
-    {
-      bad_pixels(O.bad_pixels);
-      SET_PROC_FLAG(LIBRAW_PROGRESS_BAD_PIXELS);
-    }
+      if (IO.zero_is_bad)
+      {
+        remove_zeroes();
+        SET_PROC_FLAG(LIBRAW_PROGRESS_REMOVE_ZEROES);
+      }
 
-    if (O.dark_frame && no_crop)
-    {
-      subtract(O.dark_frame);
-      SET_PROC_FLAG(LIBRAW_PROGRESS_DARK_FRAME);
-    }
-    /* pre subtract black callback: check for it above to disable subtract
-     * inline */
+      /* calibration files cover the uncropped frame; Fuji crops are rotated */
+      const libraw_image_sizes_t &full = imgdata.rawdata.sizes;
+      int crop_top = 0, crop_left = 0, frame_width = 0, frame_height = 0;
+      if (!no_crop)
+      {
+        crop_top = S.top_margin - full.top_margin;
+        crop_left = S.left_margin - full.left_margin;
+        frame_width = full.width;
+        frame_height = full.height;
+      }
+      int calib_ok = no_crop || !IO.fuji_width;
 
-    if (callbacks.pre_subtractblack_cb)
-      (callbacks.pre_subtractblack_cb)(this);
+      if (O.bad_pixels && calib_ok)
+      {
+        bad_pixels(O.bad_pixels, crop_top, crop_left);
+        SET_PROC_FLAG(LIBRAW_PROGRESS_BAD_PIXELS);
+      }
 
-    quality = 2 + !IO.fuji_width;
+      if (O.dark_frame && calib_ok)
+      {
+        subtract(O.dark_frame, crop_top, crop_left, frame_width, frame_height);
+        SET_PROC_FLAG(LIBRAW_PROGRESS_DARK_FRAME);
+      }
+      /* pre subtract black callback: check for it above to disable subtract
+       * inline */
 
-    if (O.user_qual >= 0)
-      quality = O.user_qual;
+      if (callbacks.pre_subtractblack_cb)
+      {
+        (callbacks.pre_subtractblack_cb)(this);
+        libraw_internal_data.ingest_stats.valid = 0;
+      }
 
-    if (!subtract_inline || !C.data_maximum)
-    {
-      adjust_bl();
-      subtract_black_internal();
-    }
+      if (!subtract_inline || !C.data_maximum)
+      {
+        adjust_bl();
+        subtract_black_internal();
+      }
 
-    if (!(di.decoder_flags & LIBRAW_DECODER_FIXEDMAXC))
-      adjust_maximum();
+      if (!(di.decoder_flags & LIBRAW_DECODER_FIXEDMAXC))
+        adjust_maximum();
 
-    if (O.user_sat > 0)
-      C.maximum = O.user_sat;
+      if (O.user_sat > 0)
+        C.maximum = O.user_sat;
 
-    if (P1.is_foveon)
-    {
-      if (load_raw == &LibRaw::x3f_load_raw)
+      if (P1.is_foveon)
       {
-        // Filter out zeroes
-        for (int q = 0; q < S.height * S.width; q++)
+        if (load_raw == &LibRaw::x3f_load_raw)
         {
-          for (int c = 0; c < 4; c++)
-            if ((short)imgdata.image[q][c] < 0)
-              imgdata.image[q][c] = 0;
+          // Filter out zeroes
+          for (int q = 0; q < S.height * S.width; q++)
+          {
+            for (int c = 0; c < 4; c++)
+              if ((short)imgdata.image[q][c] < 0)
+                imgdata.image[q][c] = 0;
+          }
         }
+        SET_PROC_FLAG(LIBRAW_PROGRESS_FOVEON_INTERPOLATE);
       }
-      SET_PROC_FLAG(LIBRAW_PROGRESS_FOVEON_INTERPOLATE);
+
+      if (O.develop_cache)
+        develop_cache_store();
     }
 
+    quality = 2 + !IO.fuji_width;
+
+    if (O.user_qual >= 0)
+      quality = O.user_qual;
+
     if (O.green_matching && !O.half_size)
     {
       green_matching();
+      libraw_internal_data.ingest_stats.valid = 0;
     }
 
     if (callbacks.pre_scalecolors_cb)
+    {
       (callbacks.pre_scalecolors_cb)(this);
+      libraw_internal_data.ingest_stats.valid = 0;
+    }
+
+    /* exposure correction goes into scale_colors_loop() when nothing up to
+       exp_bef() sees or resamples the scaled image */
+    if (O.exp_correc > 0 && !O.no_auto_scale && !callbacks.pre_preinterpolate_cb &&
+        O.aber[0] == 1 && O.aber[2] == 1 &&
+        !(O.half_size && P1.filters == LIBRAW_XTRANS))
+      exp_bef_prepare(O.exp_shift, O.exp_preser);
 
     if (!O.no_auto_scale)
     {
@@ -147,77 +181,21 @@ int LibRaw::dcraw_process(void)
     if (callbacks.pre_interpolate_cb)
       (callbacks.pre_interpolate_cb)(this);
 
-    /* post-exposure correction fallback */
-    if (P1.filters && !O.no_interpolation)
-    {
-	  int real_colors = P1.colors;
-	  if (P1.filters > 1000)
-		  for (int r = 0; r < 4; r++)
-			  for (int c = 0; c < 4; c++)
-				real_colors = MAX(COLOR(r, c) + 1, real_colors);
-
-      if (noiserd > 0 && P1.colors == 3 && real_colors == 3 && P1.filters > 1000)
-        fbdd(noiserd);
-
-      if (P1.filters > 1000 && callbacks.interpolate_bayer_cb)
-        (callbacks.interpolate_bayer_cb)(this);
-      else if (P1.filters == 9 && callbacks.interpolate_xtrans_cb)
-        (callbacks.interpolate_xtrans_cb)(this);
-      else if (quality == 0)
-        lin_interpolate();
-      else if (quality == 1 || P1.colors > 3 || real_colors > 3 || (P1.filters != LIBRAW_XTRANS && P1.filters <= 1000))
-        vng_interpolate();
-      else if (quality == 2 && P1.filters > 1000)
-        ppg_interpolate();
-      else if (P1.filters == LIBRAW_XTRANS)
-      {
-        // Fuji X-Trans
-        xtrans_interpolate(quality > 2 ? 3 : 1);
-      }
-      else if (quality == 3)
-        ahd_interpolate(); // really don't need it here due to fallback op
-      else if (quality == 4)
-        dcb(iterations, dcb_enhance);
-
-      else if (quality == 11)
-        dht_interpolate();
-      else if (quality == 12)
-        aahd_interpolate();
-      // fallback to AHD
-      else
-      {
-        ahd_interpolate();
-        imgdata.process_warnings |= LIBRAW_WARN_FALLBACK_TO_AHD;
-      }
-
-      SET_PROC_FLAG(LIBRAW_PROGRESS_INTERPOLATE);
-    }
-    if (IO.mix_green)
-    {
-      for (P1.colors = 3, i = 0; i < S.height * S.width; i++)
-        imgdata.image[i][1] = (imgdata.image[i][1] + imgdata.image[i][3]) >> 1;
-      SET_PROC_FLAG(LIBRAW_PROGRESS_MIX_GREEN);
-    }
-
-    if (callbacks.post_interpolate_cb)
-      (callbacks.post_interpolate_cb)(this);
-    else if (!P1.is_foveon && P1.colors == 3 && O.med_passes > 0)
-    {
-      median_filter();
-      SET_PROC_FLAG(LIBRAW_PROGRESS_MEDIAN_FILTER);
-    }
-
-    if (O.highlight == 2)
+    if (!libraw_internal_data.output_data.histogram)
     {
-      blend_highlights();
-      SET_PROC_FLAG(LIBRAW_PROGRESS_HIGHLIGHTS);
+      libraw_internal_data.output_data.histogram =
+          (int(*)[LIBRAW_HISTOGRAM_SIZE])calloc(1,
+              sizeof(*libraw_internal_data.output_data.histogram) * 4);
     }
 
-    if (O.highlight > 2)
-    {
-      recover_highlights();
-      SET_PROC_FLAG(LIBRAW_PROGRESS_HIGHLIGHTS);
-    }
+    /* with progressive_rows set, demosaic through colour conversion run in
+       bands that are reported to the progress callback as they finish */
+    int band_margin = progressive_band_margin(quality);
+    if (band_margin)
+      interpolate_bands(quality, iterations, dcb_enhance, noiserd,
+                        band_margin);
+    else
+      interpolate_image(quality, iterations, dcb_enhance, noiserd);
 
     if (O.use_fuji_rotate)
     {
@@ -225,12 +203,6 @@ int LibRaw::dcraw_process(void)
       SET_PROC_FLAG(LIBRAW_PROGRESS_FUJI_ROTATE);
     }
 
-    if (!libraw_internal_data.output_data.histogram)
-    {
-      libraw_internal_data.output_data.histogram =
-          (int(*)[LIBRAW_HISTOGRAM_SIZE])calloc(1,
-              sizeof(*libraw_internal_data.output_data.histogram) * 4);
-    }
 #ifndef NO_LCMS
     if (O.camera_profile)
     {
@@ -242,7 +214,8 @@ int LibRaw::dcraw_process(void)
     if (callbacks.pre_converttorgb_cb)
       (callbacks.pre_converttorgb_cb)(this);
 
-    convert_to_rgb();
+    if (!band_margin)
+      convert_to_rgb();
     SET_PROC_FLAG(LIBRAW_PROGRESS_CONVERT_RGB);
 
     if (callbacks.post_converttorgb_cb)
@@ -267,3 +240,194 @@ int LibRaw::dcraw_process(void)
     EXCEPTION_HANDLER(err);
   }
 }
+
+/*
+ * Demosaic through highlight handling, the stages interpolate_bands() runs
+ * on each band.
+ */
+void LibRaw::interpolate_image(int quality, int iterations, int dcb_enhance,
+                               int noiserd)
+{
+  int i;
+
+/* post-exposure correction fallback */
+  if (P1.filters && !O.no_interpolation)
+  {
+	  int real_colors = P1.colors;
+	  if (P1.filters > 1000)
+		  for (int r = 0; r < 4; r++)
+			  for (int c = 0; c < 4; c++)
+				real_colors = MAX(COLOR(r, c) + 1, real_colors);
+
+    if (noiserd > 0 && P1.colors == 3 && real_colors == 3 && P1.filters > 1000)
+      fbdd(noiserd);
+
+    if (P1.filters > 1000 && callbacks.interpolate_bayer_cb)
+      (callbacks.interpolate_bayer_cb)(this);
+    else if (P1.filters == 9 && callbacks.interpolate_xtrans_cb)
+      (callbacks.interpolate_xtrans_cb)(this);
+    else if (quality == 0)
+      lin_interpolate();
+    else if (quality == 1 || P1.colors > 3 || real_colors > 3 || (P1.filters != LIBRAW_XTRANS && P1.filters <= 1000))
+      vng_interpolate();
+    else if (quality == 2 && P1.filters > 1000)
+      ppg_interpolate();
+    else if (P1.filters == LIBRAW_XTRANS)
+    {
+      // Fuji X-Trans
+      xtrans_interpolate(quality > 2 ? 3 : 1);
+    }
+    else if (quality == 3)
+      ahd_interpolate(); // really don't need it here due to fallback op
+    else if (quality == 4)
+      dcb(iterations, dcb_enhance);
+
+    else if (quality == 11)
+      dht_interpolate();
+    else if (quality == 12)
+      aahd_interpolate();
+    // fallback to AHD
+    else
+    {
+      ahd_interpolate();
+      imgdata.process_warnings |= LIBRAW_WARN_FALLBACK_TO_AHD;
+    }
+
+    SET_PROC_FLAG(LIBRAW_PROGRESS_INTERPOLATE);
+  }
+  if (IO.mix_green)
+  {
+    for (P1.colors = 3, i = 0; i < S.height * S.width; i++)
+      imgdata.image[i][1] = (imgdata.image[i][1] + imgdata.image[i][3]) >> 1;
+    SET_PROC_FLAG(LIBRAW_PROGRESS_MIX_GREEN);
+  }
+
+  if (callbacks.post_interpolate_cb)
+    (callbacks.post_interpolate_cb)(this);
+  else if (!P1.is_foveon && P1.colors == 3 && O.med_passes > 0)
+  {
+    median_filter();
+    SET_PROC_FLAG(LIBRAW_PROGRESS_MEDIAN_FILTER);
+  }
+
+  if (O.highlight == 2)
+  {
+    blend_highlights();
+    SET_PROC_FLAG(LIBRAW_PROGRESS_HIGHLIGHTS);
+  }
+
+  if (O.highlight > 2)
+  {
+    recover_highlights();
+    SET_PROC_FLAG(LIBRAW_PROGRESS_HIGHLIGHTS);
+  }
+}
+
+/*
+ * Rows of mosaic each band of interpolate_bands() takes from above and below
+ * it, or 0 when these stages have to see the whole image: progressive output
+ * is off, the image is not a full-size mosaic, DHT and AAHD take channel
+ * limits over all of it, X-Trans tiles are laid from its top edge, FBDD
+ * carries its corrections down the whole height, and highlight rebuilding,
+ * Fuji rotation, profiles and the stage callbacks work on the whole image
+ * too.
+ */
+int LibRaw::progressive_band_margin(int quality)
+{
+  if (O.progressive_rows <= 0 || !callbacks.progress_cb)
+    return 0;
+  if (!P1.filters || P1.filters == LIBRAW_XTRANS || O.no_interpolation ||
+      IO.shrink || P1.colors < 3)
+    return 0;
+  if (quality == 11 || quality == 12 || O.fbdd_noiserd > 0 ||
+      O.highlight > 2 || O.camera_profile)
+    return 0;
+  if (O.use_fuji_rotate && (IO.fuji_width || S.pixel_aspect != 1))
+    return 0;
+  if (callbacks.interpolate_bayer_cb || callbacks.interpolate_xtrans_cb ||
+      callbacks.post_interpolate_cb || callbacks.pre_converttorgb_cb ||
+      callbacks.post_converttorgb_cb)
+    return 0;
+  /* the reach of the widest demosaic (twice that with DCB refinement passes)
+     and a row per median pass, in whole CFA periods so that every band
+     starts on the same colour */
+  int period = P1.filters > 1000 ? 8 : 16;
+  int margin = (O.dcb_iterations > 0 ? 48 : 24) +
+               MAX(O.med_passes, 0);
+  return (margin + period - 1) / period * period;
+}
+
+/*
+ * interpolate_image() and convert_to_rgb() in bands of progressive_rows rows,
+ * top to bottom. A band is demosaiced as a stripe with margin rows of mosaic
+ * on either side, so its own rows come out as from the whole image, then it
+ * is converted and reported as LIBRAW_PROGRESS_OUTPUT_BAND. The histogram
+ * covers the rows reported so far.
+ */
+void LibRaw::interpolate_bands(int quality, int iterations, int dcb_enhance,
+                               int noiserd, int margin)
+{
+  const int height = S.height, width = S.width, colors = P1.colors;
+  const int rows = (MAX(O.progressive_rows, margin) + margin - 1) / margin *
+                   margin;
+  const size_t row_size = size_t(width) * sizeof(*imgdata.image);
+  int(*hist)[LIBRAW_HISTOGRAM_SIZE] =
+      libraw_internal_data.output_data.histogram;
+  std::vector<int> total(LIBRAW_HISTOGRAM_SIZE * 4);
+  float out_cam[3][4];
+
+  ushort(*image)[4] = imgdata.image;
+  /* the stripe, then the mosaic of the margin above the next band, which
+     this band overwrites */
+  ushort(*stripe)[4] =
+      (ushort(*)[4])malloc(size_t(rows + 3 * margin) * row_size);
+  ushort(*above)[4] = stripe + size_t(rows + 2 * margin) * width;
+
+  try
+  {
+    for (int top = 0; top < height; top += rows)
+    {
+      int bottom = MIN(height, top + rows);
+      int first = MAX(0, top - margin), last = MIN(height, bottom + margin);
+      ushort(*own)[4] = stripe + size_t(top - first) * width;
+
+      memcpy(stripe, above, size_t(top - first) * row_size);
+      memcpy(own, image + size_t(top) * width, size_t(last - top) * row_size);
+      if (bottom < height)
+        memcpy(above, image + size_t(bottom - margin) * width,
+               size_t(margin) * row_size);
+
+      imgdata.image = stripe;
+      S.height = S.iheight = last - first;
+      P1.colors = colors;
+      interpolate_image(quality, iterations, dcb_enhance, noiserd);
+      if (!top)
+        convert_to_rgb_prepare(out_cam);
+      imgdata.image = own;
+      S.height = S.iheight = bottom - top;
+      convert_to_rgb_loop(out_cam);
+      imgdata.image = image;
+      S.height = S.iheight = height;
+
+      memcpy(image + size_t(top) * width, own,
+             size_t(bottom - top) * row_size);
+      for (int i = 0; i < LIBRAW_HISTOGRAM_SIZE * 4; i++)
+        total[i] += hist[0][i];
+      memcpy(hist, total.data(), total.size() * sizeof(int));
+      RUN_CALLBACK(LIBRAW_PROGRESS_OUTPUT_BAND, bottom, height);
+    }
+  }
+  catch (...)
+  {
+    imgdata.image = image;
+    S.height = S.iheight = height;
+    free(stripe);
+    throw;
+  }
+  free(stripe);
+
+  if (P1.colors == 4 && O.output_color)
+    P1.colors = 3;
+
+  RUN_CALLBACK(LIBRAW_PROGRESS_CONVERT_RGB, 1, 2);
+}
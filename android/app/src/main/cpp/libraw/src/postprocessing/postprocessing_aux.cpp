@@ -23,19 +23,44 @@ void LibRaw::hat_transform(float *temp, float *base, int st, int size, int sc)
   int i;
   for (i = 0; i < sc; i++)
     temp[i] = 2 * base[st * i] + base[st * (sc - i)] + base[st * (i + sc)];
-  for (; i + sc < size; i++)
-    temp[i] = 2 * base[st * i] + base[st * (i - sc)] + base[st * (i + sc)];
+  if (st == 1)
+    for (; i + sc < size; i++)
+      temp[i] = 2 * base[i] + base[i - sc] + base[i + sc];
+  else
+    for (; i + sc < size; i++)
+      temp[i] = 2 * base[st * i] + base[st * (i - sc)] + base[st * (i + sc)];
   for (; i < size; i++)
     temp[i] = 2 * base[st * i] + base[st * (i - sc)] +
               base[st * (2 * size - 2 - (i + sc))];
 }
 
-#if !defined(LIBRAW_USE_OPENMP)
+/*
+ * Column pass of the hat transform for a block of ncols adjacent columns:
+ * source rows are read whole, so every access is contiguous and the inner
+ * loop runs across columns. Same terms in the same order as hat_transform().
+ */
+#define HAT_COLS 16
+
+static void hat_transform_cols(float *tile, const float *base, int stride,
+                               int size, int sc, int ncols)
+{
+  for (int i = 0; i < size; i++)
+  {
+    int a = i < sc ? sc - i : i - sc;
+    int b = i + sc < size ? i + sc : 2 * size - 2 - (i + sc);
+    const float *p = base + size_t(i) * stride;
+    const float *pa = base + size_t(a) * stride;
+    const float *pb = base + size_t(b) * stride;
+    float *t = tile + i * ncols;
+    for (int k = 0; k < ncols; k++)
+      t[k] = 2 * p[k] + pa[k] + pb[k];
+  }
+}
+
 void LibRaw::wavelet_denoise()
 {
-  float *fimg = 0, *temp, thold, mul[2], avg, diff;
-  int scale = 1, size, lev, hpass, lpass, row, col, nc, c, i, wlast, blk[2];
-  ushort *window[4];
+  float *fimg = 0, mul[2];
+  int scale = 1, size, lev, hpass, lpass, nc, c, blk[2];
   static const float noise[] = {0.8002f, 0.2735f, 0.1202f, 0.0585f,
                                 0.0291f, 0.0152f, 0.0080f, 0.0044f};
 
@@ -47,74 +72,128 @@ void LibRaw::wavelet_denoise()
   black <<= scale;
   FORC4 cblack[c] <<= scale;
   if ((size = iheight * iwidth) < 0x15550000)
-    fimg = (float *)malloc((size * 3 + iheight + iwidth + 128) * sizeof *fimg);
-  temp = fimg + size * 3;
+    fimg = (float *)malloc(size_t(size) * 3 * sizeof *fimg);
+#ifdef LIBRAW_USE_OPENMP
+  int buffer_count = omp_get_max_threads();
+#else
+  int buffer_count = 1;
+#endif
+  /* per thread: one image row + a column block tile */
+  char **buffers = malloc_omp_buffers(
+      buffer_count, (size_t(iheight) * HAT_COLS + iwidth) * sizeof(float));
+  const int nblocks = (iwidth + HAT_COLS - 1) / HAT_COLS;
   if ((nc = colors) == 3 && filters)
     nc++;
   FORC(nc)
   { /* denoise R,G1,B,G3 individually */
-	  for (i = 0; i < size; i++)
-		  fimg[i] = 256.f * sqrtf((float)(image[i][c] << scale));
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int i = 0; i < size; i++)
+      fimg[i] = 256.f * sqrtf((float)(image[i][c] << scale));
     for (hpass = lev = 0; lev < 5; lev++)
     {
       lpass = size * ((lev & 1) + 1);
-      for (row = 0; row < iheight; row++)
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+      for (int row = 0; row < iheight; row++)
       {
-        hat_transform(temp, fimg + hpass + row * iwidth, 1, iwidth, 1 << lev);
-        for (col = 0; col < iwidth; col++)
-          fimg[lpass + row * iwidth + col] = temp[col] * 0.25f;
+#ifdef LIBRAW_USE_OPENMP
+        float *temp = (float *)buffers[omp_get_thread_num()];
+#else
+        float *temp = (float *)buffers[0];
+#endif
+        float *dst = fimg + lpass + size_t(row) * iwidth;
+        hat_transform(temp, fimg + hpass + size_t(row) * iwidth, 1, iwidth,
+                      1 << lev);
+        for (int col = 0; col < iwidth; col++)
+          dst[col] = temp[col] * 0.25f;
       }
-      for (col = 0; col < iwidth; col++)
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+      for (int blk0 = 0; blk0 < nblocks; blk0++)
       {
-        hat_transform(temp, fimg + lpass + col, iwidth, iheight, 1 << lev);
-        for (row = 0; row < iheight; row++)
-          fimg[lpass + row * iwidth + col] = temp[row] * 0.25f;
+#ifdef LIBRAW_USE_OPENMP
+        float *tile = (float *)buffers[omp_get_thread_num()] + iwidth;
+#else
+        float *tile = (float *)buffers[0] + iwidth;
+#endif
+        int col0 = blk0 * HAT_COLS, ncols = MIN(HAT_COLS, iwidth - col0);
+        float *base = fimg + lpass + col0;
+        hat_transform_cols(tile, base, iwidth, iheight, 1 << lev, ncols);
+        for (int row = 0; row < iheight; row++)
+        {
+          float *dst = base + size_t(row) * iwidth;
+          const float *src = tile + row * ncols;
+          for (int k = 0; k < ncols; k++)
+            dst[k] = src[k] * 0.25f;
+        }
       }
-      thold = threshold * noise[lev];
-      for (i = 0; i < size; i++)
+      const float thold = threshold * noise[lev];
+      const int accumulate = hpass != 0;
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+      for (int row = 0; row < iheight; row++)
       {
-        fimg[hpass + i] -= fimg[lpass + i];
-        if (fimg[hpass + i] < -thold)
-          fimg[hpass + i] += thold;
-        else if (fimg[hpass + i] > thold)
-          fimg[hpass + i] -= thold;
-        else
-          fimg[hpass + i] = 0;
-        if (hpass)
-          fimg[i] += fimg[hpass + i];
+        float *out = fimg + size_t(row) * iwidth;
+        float *hp = out + hpass;
+        const float *lp = out + lpass;
+        for (int col = 0; col < iwidth; col++)
+        {
+          float h = hp[col] - lp[col];
+          h = h < -thold ? h + thold : (h > thold ? h - thold : 0);
+          hp[col] = h;
+        }
+        if (accumulate)
+          for (int col = 0; col < iwidth; col++)
+            out[col] += hp[col];
       }
       hpass = lpass;
     }
-    for (i = 0; i < size; i++)
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int i = 0; i < size; i++)
       image[i][c] = CLIP(SQR(fimg[i] + fimg[lpass + i]) / 0x10000);
   }
+  free_omp_buffers(buffers, buffer_count);
   if (filters && colors == 3)
   { /* pull G1 and G3 closer together */
-    for (row = 0; row < 2; row++)
+    for (int row = 0; row < 2; row++)
     {
       mul[row] = 0.125f * pre_mul[FC(row + 1, 0) | 1] / pre_mul[FC(row, 0) | 1];
       blk[row] = cblack[FC(row, 0) | 1];
     }
-    for (i = 0; i < 4; i++)
-      window[i] = (ushort *)fimg + width * i;
-    for (wlast = -1, row = 1; row < height - 1; row++)
+    /*
+     * Every row is corrected from the unmodified greens of its neighbours,
+     * so take a copy of the mosaic first and then correct rows in any order.
+     */
+    ushort *orig = (ushort *)fimg;
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int row = 0; row < height; row++)
+      for (int col = FC(row, 1) & 1; col < width; col += 2)
+        orig[size_t(row) * width + col] = BAYER(row, col);
+    const float thold = threshold / 512;
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int row = 1; row < height - 1; row++)
     {
-      while (wlast < row + 1)
+      const ushort *w0 = orig + size_t(row - 1) * width;
+      const ushort *w1 = w0 + width, *w2 = w1 + width;
+      for (int col = (FC(row, 0) & 1) + 1; col < width - 1; col += 2)
       {
-        for (wlast++, i = 0; i < 4; i++)
-          window[(i + 3) & 3] = window[i];
-        for (col = FC(wlast, 1) & 1; col < width; col += 2)
-          window[2][col] = BAYER(wlast, col);
-      }
-      thold = threshold / 512;
-      for (col = (FC(row, 0) & 1) + 1; col < width - 1; col += 2)
-      {
-        avg = (window[0][col - 1] + window[0][col + 1] + window[2][col - 1] +
-               window[2][col + 1] - blk[~row & 1] * 4) *
-                  mul[row & 1] +
-              (window[1][col] + blk[row & 1]) * 0.5f;
+        float avg = (w0[col - 1] + w0[col + 1] + w2[col - 1] + w2[col + 1] -
+                     blk[~row & 1] * 4) *
+                        mul[row & 1] +
+                    (w1[col] + blk[row & 1]) * 0.5f;
         avg = avg < 0 ? 0 : sqrt(avg);
-        diff = sqrtf((float)BAYER(row, col)) - avg;
+        float diff = sqrtf((float)w1[col]) - avg;
         if (diff < -thold)
           diff += thold;
         else if (diff > thold)
@@ -127,202 +206,230 @@ void LibRaw::wavelet_denoise()
   }
   free(fimg);
 }
-#else /* LIBRAW_USE_OPENMP */
-void LibRaw::wavelet_denoise()
+#undef HAT_COLS
+
+/*
+ * median_filter() works on R-G and B-G differences, both in one sweep. Rows
+ * are split into bands processed in parallel; a band keeps the differences
+ * of three source rows in a ring, so the image is updated in place. Rows
+ * just outside every band are captured before any band writes, so results
+ * do not depend on the thread count.
+ *
+ * The 3x3 median is med3(max of lows, med3 of mids, min of highs) over the
+ * column-sorted window. This is exact and shares each column sort between
+ * three neighbouring pixels; the inner loops are plain int min/max and are
+ * left to the compiler to vectorize.
+ */
+#define MEDIAN_BAND 64
+
+static inline int median3(int a, int b, int c)
 {
-  float *fimg = 0, *temp, thold, mul[2], avg, diff;
-  int scale = 1, size, lev, hpass, lpass, row, col, nc, c, i, wlast, blk[2];
-  ushort *window[4];
-  static const float noise[] = {0.8002, 0.2735, 0.1202, 0.0585,
-                                0.0291, 0.0152, 0.0080, 0.0044};
+  return MAX(MIN(a, b), MIN(MAX(a, b), c));
+}
 
-  if (iwidth < 65 || iheight < 65)
-    return;
+static void median_diff_row(const ushort (*pix)[4], int cols, int *d0, int *d2)
+{
+  for (int col = 0; col < cols; col++)
+  {
+    d0[col] = pix[col][0] - pix[col][1];
+    d2[col] = pix[col][2] - pix[col][1];
+  }
+}
 
-  while (maximum << scale < 0x10000)
-    scale++;
-  maximum <<= --scale;
-  black <<= scale;
-  FORC4 cblack[c] <<= scale;
-  if ((size = iheight * iwidth) < 0x15550000)
-    fimg = (float *)malloc((size * 3 + iheight + iwidth) * sizeof *fimg);
-  temp = fimg + size * 3;
-  if ((nc = colors) == 3 && filters)
-    nc++;
-#pragma omp parallel default(shared) private(                                  \
-    i, col, row, thold, lev, lpass, hpass, temp, c) firstprivate(scale, size)
+static void median_row(const int *up, const int *mid, const int *down,
+                       int cols, int *lo, int *me, int *hi, int *out)
+{
+  for (int col = 0; col < cols; col++)
   {
-    temp = (float *)malloc((iheight + iwidth) * sizeof *fimg);
-    FORC(nc)
-    { /* denoise R,G1,B,G3 individually */
-#pragma omp for
-      for (i = 0; i < size; i++)
-        fimg[i] = 256 * sqrt((double)(image[i][c] << scale));
-      for (hpass = lev = 0; lev < 5; lev++)
-      {
-        lpass = size * ((lev & 1) + 1);
-#pragma omp for
-        for (row = 0; row < iheight; row++)
-        {
-          hat_transform(temp, fimg + hpass + row * iwidth, 1, iwidth, 1 << lev);
-          for (col = 0; col < iwidth; col++)
-            fimg[lpass + row * iwidth + col] = temp[col] * 0.25;
-        }
-#pragma omp for
-        for (col = 0; col < iwidth; col++)
-        {
-          hat_transform(temp, fimg + lpass + col, iwidth, iheight, 1 << lev);
-          for (row = 0; row < iheight; row++)
-            fimg[lpass + row * iwidth + col] = temp[row] * 0.25;
-        }
-        thold = threshold * noise[lev];
-#pragma omp for
-        for (i = 0; i < size; i++)
-        {
-          fimg[hpass + i] -= fimg[lpass + i];
-          if (fimg[hpass + i] < -thold)
-            fimg[hpass + i] += thold;
-          else if (fimg[hpass + i] > thold)
-            fimg[hpass + i] -= thold;
-          else
-            fimg[hpass + i] = 0;
-          if (hpass)
-            fimg[i] += fimg[hpass + i];
-        }
-        hpass = lpass;
-      }
-#pragma omp for
-      for (i = 0; i < size; i++)
-        image[i][c] = CLIP(SQR(fimg[i] + fimg[lpass + i]) / 0x10000);
-    }
-    free(temp);
-  } /* end omp parallel */
-  /* the following loops are hard to parallelize, no idea yes,
-   * problem is wlast which is carrying dependency
-   * second part should be easier, but did not yet get it right.
-   */
-  if (filters && colors == 3)
-  { /* pull G1 and G3 closer together */
-    for (row = 0; row < 2; row++)
-    {
-      mul[row] = 0.125 * pre_mul[FC(row + 1, 0) | 1] / pre_mul[FC(row, 0) | 1];
-      blk[row] = cblack[FC(row, 0) | 1];
-    }
-    for (i = 0; i < 4; i++)
-      window[i] = (ushort *)fimg + width * i;
-    for (wlast = -1, row = 1; row < height - 1; row++)
-    {
-      while (wlast < row + 1)
-      {
-        for (wlast++, i = 0; i < 4; i++)
-          window[(i + 3) & 3] = window[i];
-        for (col = FC(wlast, 1) & 1; col < width; col += 2)
-          window[2][col] = BAYER(wlast, col);
-      }
-      thold = threshold / 512;
-      for (col = (FC(row, 0) & 1) + 1; col < width - 1; col += 2)
-      {
-        avg = (window[0][col - 1] + window[0][col + 1] + window[2][col - 1] +
-               window[2][col + 1] - blk[~row & 1] * 4) *
-                  mul[row & 1] +
-              (window[1][col] + blk[row & 1]) * 0.5;
-        avg = avg < 0 ? 0 : sqrt(avg);
-        diff = sqrt((double)BAYER(row, col)) - avg;
-        if (diff < -thold)
-          diff += thold;
-        else if (diff > thold)
-          diff -= thold;
-        else
-          diff = 0;
-        BAYER(row, col) = CLIP(SQR(avg + diff) + 0.5);
-      }
-    }
+    int a = up[col], b = mid[col], c = down[col];
+    lo[col] = MIN(MIN(a, b), c);
+    me[col] = median3(a, b, c);
+    hi[col] = MAX(MAX(a, b), c);
+  }
+  for (int col = 1; col < cols - 1; col++)
+  {
+    int maxlo = MAX(MAX(lo[col - 1], lo[col]), lo[col + 1]);
+    int minhi = MIN(MIN(hi[col - 1], hi[col]), hi[col + 1]);
+    out[col] = median3(maxlo, median3(me[col - 1], me[col], me[col + 1]),
+                       minhi);
   }
-  free(fimg);
 }
 
-#endif
 void LibRaw::median_filter()
 {
-  ushort(*pix)[4];
-  int pass, c, i, j, k, med[9];
-  static const uchar opt[] = /* Optimal 9-element median search */
-      {1, 2, 4, 5, 7, 8, 0, 1, 3, 4, 6, 7, 1, 2, 4, 5, 7, 8, 0,
-       3, 5, 8, 4, 7, 3, 6, 1, 4, 2, 5, 4, 7, 4, 2, 6, 4, 4, 2};
+  int nbands = (height - 2 + MEDIAN_BAND - 1) / MEDIAN_BAND;
+  if (nbands < 1)
+    return;
+  /* per band: R-G and B-G of the row above and the row below the band */
+  int *halo = (int *)malloc(size_t(nbands) * 4 * width * sizeof(int));
+#ifdef LIBRAW_USE_OPENMP
+  int buffer_count = omp_get_max_threads();
+#else
+  int buffer_count = 1;
+#endif
+  /* per thread: 3-row ring of both differences + lo/mid/hi/out rows */
+  char **buffers =
+      malloc_omp_buffers(buffer_count, size_t(width) * 10 * sizeof(int));
 
-  for (pass = 1; pass <= med_passes; pass++)
+  for (int pass = 1; pass <= med_passes; pass++)
   {
     RUN_CALLBACK(LIBRAW_PROGRESS_MEDIAN_FILTER, pass - 1, med_passes);
-    for (c = 0; c < 3; c += 2)
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int band = 0; band < nbands; band++)
     {
-      for (pix = image; pix < image + width * height; pix++)
-        pix[0][3] = pix[0][c];
-      for (pix = image + width; pix < image + width * (height - 1); pix++)
+      int top = 1 + band * MEDIAN_BAND;
+      int bottom = MIN(top + MEDIAN_BAND, height - 1);
+      int *h = halo + size_t(band) * 4 * width;
+      median_diff_row(image + size_t(top - 1) * width, width, h, h + width);
+      median_diff_row(image + size_t(bottom) * width, width, h + 2 * width,
+                      h + 3 * width);
+    }
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int band = 0; band < nbands; band++)
+    {
+#ifdef LIBRAW_USE_OPENMP
+      int *buf = (int *)buffers[omp_get_thread_num()];
+#else
+      int *buf = (int *)buffers[0];
+#endif
+      int *ring[3] = {buf, buf + 2 * width, buf + 4 * width};
+      int *lo = buf + 6 * width, *me = lo + width, *hi = me + width,
+          *out = hi + width;
+      int top = 1 + band * MEDIAN_BAND;
+      int bottom = MIN(top + MEDIAN_BAND, height - 1);
+      const int *h = halo + size_t(band) * 4 * width;
+      const int *up = h, *mid = ring[0], *down;
+      median_diff_row(image + size_t(top) * width, width, ring[0],
+                      ring[0] + width);
+      for (int row = top, k = 1; row < bottom; row++)
       {
-        if ((pix - image + 1) % width < 2)
-          continue;
-        for (k = 0, i = -width; i <= width; i += width)
-          for (j = i - 1; j <= i + 1; j++)
-            med[k++] = pix[j][3] - pix[j][1];
-        for (i = 0; i < int(sizeof opt); i += 2)
-          if (med[opt[i]] > med[opt[i + 1]])
-            SWAP(med[opt[i]], med[opt[i + 1]]);
-        pix[0][c] = CLIP(med[4] + pix[0][1]);
+        if (row + 1 < bottom)
+        {
+          median_diff_row(image + size_t(row + 1) * width, width, ring[k],
+                          ring[k] + width);
+          down = ring[k];
+          k = (k + 1) % 3;
+        }
+        else
+          down = h + 2 * width;
+        ushort(*pix)[4] = image + size_t(row) * width;
+        for (int c = 0; c < 3; c += 2)
+        {
+          int off = c ? width : 0;
+          median_row(up + off, mid + off, down + off, width, lo, me, hi, out);
+          for (int col = 1; col < width - 1; col++)
+            pix[col][c] = CLIP(out[col] + pix[col][1]);
+        }
+        up = mid;
+        mid = down;
       }
     }
   }
+  free_omp_buffers(buffers, buffer_count);
+  free(halo);
 }
+#undef MEDIAN_BAND
+
+/*
+ * blend_highlights() and recover_highlights() run row bands in parallel.
+ * Clipped pixels of a row are collected into lanes of HL_LANES and the
+ * colour transforms run lane-wise, so the float math vectorizes; per-pixel
+ * arithmetic and its order are unchanged.
+ */
+#define HL_LANES 16
 
 void LibRaw::blend_highlights()
 {
-  int clip = INT_MAX, row, col, c, i, j;
+  int clip = INT_MAX, c, i;
   static const float trans[2][4][4] = {
       {{1, 1, 1}, {1.7320508f, -1.7320508f, 0}, {-1, -1, 2}},
       {{1, 1, 1, 1}, {1, -1, 1, -1}, {1, 1, -1, -1}, {1, -1, -1, 1}}};
   static const float itrans[2][4][4] = {
       {{1, 0.8660254f, -0.5}, {1, -0.8660254f, -0.5}, {1, 0, 1}},
       {{1, 1, 1, 1}, {1, -1, 1, -1}, {1, 1, -1, -1}, {1, -1, -1, 1}}};
-  float cam[2][4], lab[2][4], sum[2], chratio;
 
   if ((unsigned)(colors - 3) > 1)
     return;
   RUN_CALLBACK(LIBRAW_PROGRESS_HIGHLIGHTS, 0, 2);
   FORCC if (clip > (i = int(65535.f * pre_mul[c]))) clip = i;
-  for (row = 0; row < height; row++)
-    for (col = 0; col < width; col++)
+  const int nc = colors;
+  const float(*tr)[4] = trans[nc - 3];
+  const float(*itr)[4] = itrans[nc - 3];
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(dynamic, 16)
+#endif
+  for (int row = 0; row < height; row++)
+  {
+    ushort(*pix)[4] = image + size_t(row) * width;
+    int idx[HL_LANES];
+    float cam[2][4][HL_LANES], lab[2][4][HL_LANES], sum[2][HL_LANES],
+        chratio[HL_LANES];
+    for (int col = 0; col < width;)
     {
-      FORCC if (image[row * width + col][c] > clip) break;
-      if (c == colors)
+      int n = 0;
+      for (; col < width && n < HL_LANES; col++)
+      {
+        int over = 0;
+        for (int k = 0; k < nc; k++)
+          over |= pix[col][k] > clip;
+        if (over)
+          idx[n++] = col;
+      }
+      if (!n)
         continue;
-      FORCC
+      for (int k = 0; k < nc; k++)
+        for (int l = 0; l < n; l++)
+        {
+          cam[0][k][l] = pix[idx[l]][k];
+          cam[1][k][l] = MIN(cam[0][k][l], clip);
+        }
+      for (int m = 0; m < 2; m++)
       {
-        cam[0][c] = image[row * width + col][c];
-        cam[1][c] = MIN(cam[0][c], clip);
+        for (int k = 0; k < nc; k++)
+        {
+          for (int l = 0; l < n; l++)
+            lab[m][k][l] = 0;
+          for (int j = 0; j < nc; j++)
+            for (int l = 0; l < n; l++)
+              lab[m][k][l] += int(tr[k][j] * cam[m][j][l]);
+        }
+        for (int l = 0; l < n; l++)
+          sum[m][l] = 0;
+        for (int k = 1; k < nc; k++)
+          for (int l = 0; l < n; l++)
+            sum[m][l] += SQR(lab[m][k][l]);
       }
-      for (i = 0; i < 2; i++)
+      for (int l = 0; l < n; l++)
+        chratio[l] = sqrt(sum[1][l] / sum[0][l]);
+      for (int k = 1; k < nc; k++)
+        for (int l = 0; l < n; l++)
+          lab[0][k][l] *= chratio[l];
+      for (int k = 0; k < nc; k++)
       {
-        FORCC for (lab[i][c] = 0, j = 0; j < colors; j++) lab[i][c] +=
-            int(trans[colors - 3][c][j] * cam[i][j]);
-        for (sum[i] = 0, c = 1; c < colors; c++)
-          sum[i] += SQR(lab[i][c]);
+        for (int l = 0; l < n; l++)
+          cam[0][k][l] = 0;
+        for (int j = 0; j < nc; j++)
+          for (int l = 0; l < n; l++)
+            cam[0][k][l] += itr[k][j] * lab[0][j][l];
       }
-      chratio = sqrt(sum[1] / sum[0]);
-      for (c = 1; c < colors; c++)
-        lab[0][c] *= chratio;
-      FORCC for (cam[0][c] = 0, j = 0; j < colors; j++) cam[0][c] +=
-          itrans[colors - 3][c][j] * lab[0][j];
-      FORCC image[row * width + col][c] = ushort(cam[0][c] / colors);
+      for (int k = 0; k < nc; k++)
+        for (int l = 0; l < n; l++)
+          pix[idx[l]][k] = ushort(cam[0][k][l] / nc);
     }
+  }
   RUN_CALLBACK(LIBRAW_PROGRESS_HIGHLIGHTS, 1, 2);
 }
 
 #define SCALE (4 >> shrink)
 void LibRaw::recover_highlights()
 {
-  float *map, sum, wgt, grow;
-  int hsat[4], count, spread, change, val, i;
-  unsigned high, wide, mrow, mcol, row, col, kc, c, d, y, x;
-  ushort *pixel;
+  float *map, grow;
+  int hsat[4], spread, change;
+  unsigned high, wide, kc, c;
   static const signed char dir[8][2] = {{-1, -1}, {-1, 0}, {-1, 1}, {0, 1},
                                         {1, 1},   {1, 0},  {1, -1}, {0, -1}};
 
@@ -336,43 +443,68 @@ void LibRaw::recover_highlights()
       kc = c;
   high = height / SCALE;
   wide = width / SCALE;
+  const int scale = SCALE;
   map = (float *)calloc(high, wide * sizeof *map);
+  /* rows of the map changed by the previous grow step, with a zero guard
+   * row on each side */
+  char *dirty = (char *)calloc(high + 2, 2);
   FORC(unsigned(colors)) if (c != kc)
   {
     RUN_CALLBACK(LIBRAW_PROGRESS_HIGHLIGHTS, c - 1, colors - 1);
-    memset(map, 0, high * wide * sizeof *map);
-    for (mrow = 0; mrow < high; mrow++)
-      for (mcol = 0; mcol < wide; mcol++)
+    /* pixel[c] / hsat == 1 and > 1, without the per-pixel divide */
+    const int sat_lo = hsat[c], sat_hi = 2 * hsat[c];
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int mrow = 0; mrow < int(high); mrow++)
+      for (unsigned mcol = 0; mcol < wide; mcol++)
       {
-        count = 0;
-		sum = wgt = 0;
-        for (row = mrow * SCALE; row < (mrow + 1) * SCALE; row++)
-          for (col = mcol * SCALE; col < (mcol + 1) * SCALE; col++)
+        int count = 0;
+        float sum = 0, wgt = 0;
+        for (int row = mrow * scale; row < (mrow + 1) * scale; row++)
+        {
+          ushort(*pix)[4] = image + size_t(row) * width + mcol * scale;
+          for (int col = 0; col < scale; col++)
           {
-            pixel = image[row * width + col];
-            if (pixel[c] / hsat[c] == 1 && pixel[kc] > 24000)
+            int v = pix[col][c];
+            if (v >= sat_lo && v < sat_hi && pix[col][kc] > 24000)
             {
-              sum += pixel[c];
-              wgt += pixel[kc];
+              sum += v;
+              wgt += pix[col][kc];
               count++;
             }
           }
-        if (count == SCALE * SCALE)
-          map[mrow * wide + mcol] = sum / wgt;
+        }
+        map[mrow * wide + mcol] = count == scale * scale ? sum / wgt : 0;
       }
+    /*
+     * Grow step: empty cells take a weighted average of their filled
+     * neighbours. New values are stored negated so they do not feed the same
+     * step, which makes rows independent. After the first step only rows next
+     * to a changed row can change, so the rest are skipped.
+     */
+    char *prev = dirty + 1, *next = dirty + high + 3;
+    memset(dirty, 0, (high + 2) * 2);
+    memset(prev, 1, high);
     for (spread = int(32.f / grow); spread--;)
     {
-      for (mrow = 0; mrow < high; mrow++)
-        for (mcol = 0; mcol < wide; mcol++)
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+      for (int mrow = 0; mrow < int(high); mrow++)
+      {
+        if (!(prev[mrow - 1] | prev[mrow] | prev[mrow + 1]))
+          continue;
+        for (unsigned mcol = 0; mcol < wide; mcol++)
         {
           if (map[mrow * wide + mcol])
             continue;
-		  sum = 0;
-		  count = 0;
-          for (d = 0; d < 8; d++)
+          float sum = 0;
+          int count = 0;
+          for (int d = 0; d < 8; d++)
           {
-            y = mrow + dir[d][0];
-            x = mcol + dir[d][1];
+            unsigned y = mrow + dir[d][0];
+            unsigned x = mcol + dir[d][1];
             if (y < high && x < wide && map[y * wide + x] > 0)
             {
               sum += (1 + (d & 1)) * map[y * wide + x];
@@ -382,34 +514,54 @@ void LibRaw::recover_highlights()
           if (count > 3)
             map[mrow * wide + mcol] = -(sum + grow) / (count + grow);
         }
-      for (change = i = 0; i < int(high * wide); i++)
-        if (map[i] < 0)
-        {
-          map[i] = -map[i];
-          change = 1;
-        }
+      }
+      change = 0;
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(static) reduction(| : change)
+#endif
+      for (int mrow = 0; mrow < int(high); mrow++)
+      {
+        char changed = 0;
+        float *m = map + mrow * wide;
+        for (unsigned mcol = 0; mcol < wide; mcol++)
+          if (m[mcol] < 0)
+          {
+            m[mcol] = -m[mcol];
+            changed = 1;
+          }
+        next[mrow] = changed;
+        change |= changed;
+      }
       if (!change)
         break;
+      char *t = prev;
+      prev = next;
+      next = t;
     }
-    for (i = 0; i < int(high * wide); i++)
-      if (map[i] == 0)
-        map[i] = 1;
-    for (mrow = 0; mrow < high; mrow++)
-      for (mcol = 0; mcol < wide; mcol++)
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int mrow = 0; mrow < int(high); mrow++)
+      for (unsigned mcol = 0; mcol < wide; mcol++)
       {
-        for (row = mrow * SCALE; row < (mrow + 1) * SCALE; row++)
-          for (col = mcol * SCALE; col < (mcol + 1) * SCALE; col++)
-          {
-            pixel = image[row * width + col];
-            if (pixel[c] / hsat[c] > 1)
+        float m = map[mrow * wide + mcol];
+        if (m == 0)
+          m = map[mrow * wide + mcol] = 1;
+        for (int row = mrow * scale; row < (mrow + 1) * scale; row++)
+        {
+          ushort(*pix)[4] = image + size_t(row) * width + mcol * scale;
+          for (int col = 0; col < scale; col++)
+            if (pix[col][c] >= sat_hi)
             {
-              val = int(pixel[kc] * map[mrow * wide + mcol]);
-              if (pixel[c] < val)
-                pixel[c] = CLIP(val);
+              int val = int(pix[col][kc] * m);
+              if (pix[col][c] < val)
+                pix[col][c] = CLIP(val);
             }
-          }
+        }
       }
   }
+  free(dirty);
   free(map);
 }
 #undef SCALE
+#undef HL_LANES
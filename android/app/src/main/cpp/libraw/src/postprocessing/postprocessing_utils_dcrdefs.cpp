@@ -21,6 +21,18 @@
 void LibRaw::convert_to_rgb()
 {
   float out_cam[3][4];
+  convert_to_rgb_prepare(out_cam);
+  convert_to_rgb_loop(out_cam);
+
+  if (colors == 4 && output_color)
+    colors = 3;
+
+  RUN_CALLBACK(LIBRAW_PROGRESS_CONVERT_RGB, 1, 2);
+}
+
+/* output profile and the camera to output matrix for convert_to_rgb_loop() */
+void LibRaw::convert_to_rgb_prepare(float out_cam[3][4])
+{
   double num, inverse[3][3];
   static const double(*out_rgb[])[3] = {
       LibRaw_constants::rgb_rgb,  LibRaw_constants::adobe_rgb,
@@ -51,7 +63,7 @@ void LibRaw::convert_to_rgb()
   RUN_CALLBACK(LIBRAW_PROGRESS_CONVERT_RGB, 0, 2);
 
   gamma_curve(gamm[0], gamm[1], 0, 0);
-  memcpy(out_cam, rgb_cam, sizeof out_cam);
+  memcpy(out_cam, rgb_cam, sizeof(float) * 3 * 4);
   raw_color |= colors == 1 || output_color < 1 || output_color > 8;
   if (!raw_color)
   {
@@ -100,17 +112,21 @@ void LibRaw::convert_to_rgb()
         for (out_cam[i][j] = 0.f, k = 0; k < 3; k++)
           out_cam[i][j] += float(out_rgb[output_color - 1][i][k] * rgb_cam[k][j]);
   }
-  convert_to_rgb_loop(out_cam);
-
-  if (colors == 4 && output_color)
-    colors = 3;
+}
 
-  RUN_CALLBACK(LIBRAW_PROGRESS_CONVERT_RGB, 1, 2);
+int LibRaw::needs_auto_wb()
+{
+  return use_auto_wb ||
+         (use_camera_wb &&
+          (cam_mul[0] < -0.5 // LibRaw 0.19 and older: fallback to auto only if cam_mul[0] is set to -1
+           || (cam_mul[0] <= 0.00001f // New default: fallback to auto if no cam_mul parsed from metadata
+               && !(imgdata.rawparams.options &
+                    LIBRAW_RAWOPTIONS_CAMERAWB_FALLBACK_TO_DAYLIGHT))));
 }
 
 void LibRaw::scale_colors()
 {
-  unsigned bottom, right, size, row, col, ur, uc, i, x, y, c, sum[8];
+  unsigned bottom, right, size, row, col, ur, uc, i, c, sum[8];
   int val;
   double dsum[8], dmin, dmax;
   float scale_mul[4], fr, fc;
@@ -120,44 +136,118 @@ void LibRaw::scale_colors()
 
   if (user_mul[0])
     memcpy(pre_mul, user_mul, sizeof pre_mul);
-  if (use_auto_wb || (use_camera_wb && 
-      (cam_mul[0] < -0.5  // LibRaw 0.19 and older: fallback to auto only if cam_mul[0] is set to -1
-          || (cam_mul[0] <= 0.00001f  // New default: fallback to auto if no cam_mul parsed from metadata
-              && !(imgdata.rawparams.options & LIBRAW_RAWOPTIONS_CAMERAWB_FALLBACK_TO_DAYLIGHT))
-          )))
+  ingest_stats_t &ingest = libraw_internal_data.ingest_stats;
+  if (needs_auto_wb())
   {
     memset(dsum, 0, sizeof dsum);
     bottom = MIN(greybox[1] + greybox[3], height);
     right = MIN(greybox[0] + greybox[2], width);
-    for (row = greybox[1]; row < bottom; row += 8)
-      for (col = greybox[0]; col < right; col += 8)
+    if (ingest.valid && filters && ingest.top == greybox[1] &&
+        ingest.left == greybox[0] && ingest.bottom == bottom &&
+        ingest.right == right &&
+        !(cblack[0] | cblack[1] | cblack[2] | cblack[3]))
+    {
+      /* block sums were taken by copy_bayer(); a block is skipped when any
+       * of its samples is near clipping, as below */
+      for (i = 0; i < ingest.rows * ingest.cols; i++)
       {
-        memset(sum, 0, sizeof sum);
-        for (y = row; y < row + 8 && y < bottom; y++)
-          for (x = col; x < col + 8 && x < right; x++)
-            FORC4
+        const wb_block_t &blk = ingest.blocks[i];
+        if (blk.max > (int)maximum - 25)
+          continue;
+        FORC4
+        {
+          dsum[c] += blk.sum[c];
+          dsum[c + 4] += blk.count[c];
+        }
+      }
+    }
+    else if (bottom > greybox[1] && right > greybox[0])
+    {
+      /*
+       * Rows of 8x8 blocks are gathered in parallel. A block is dropped when
+       * any of its samples is within 25 of maximum, so the block maximum is
+       * kept next to the sums instead of leaving the loop early; the inner
+       * loops then have no exits. Colours of a CFA row repeat every 48
+       * columns (Bayer 2, X-Trans 6, Leaf 16), so fcol() is looked up once
+       * per row and phase. dsum only ever holds integers, so the order the
+       * partial sums are merged in does not matter.
+       */
+      const int nbrows = (bottom - greybox[1] + 7) / 8;
+      const int thr = (int)maximum - 25;
+      const int cb[4] = {int(cblack[0]), int(cblack[1]), int(cblack[2]),
+                         int(cblack[3])};
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel
+#endif
+      {
+        double ldsum[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+        uchar cmap[8][48];
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+        for (int brow = 0; brow < nbrows; brow++)
+        {
+          const unsigned row0 = greybox[1] + brow * 8;
+          const unsigned row1 = MIN(row0 + 8, bottom);
+          if (filters)
+            for (unsigned yy = row0; yy < row1; yy++)
+              for (int k = 0; k < 48; k++)
+                cmap[yy - row0][k] = uchar(fcol(yy, k));
+          for (unsigned col0 = greybox[0]; col0 < right; col0 += 8)
+          {
+            const unsigned col1 = MIN(col0 + 8, right);
+            unsigned bsum[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+            int bmax = 0;
+            for (unsigned yy = row0; yy < row1; yy++)
             {
+              const ushort(*pix)[4] = image + size_t(yy >> shrink) * iwidth;
               if (filters)
               {
-                c = fcol(y, x);
-                val = BAYER2(y, x);
+                const uchar *cm = cmap[yy - row0];
+                for (unsigned xx = col0, k = col0 % 48; xx < col1; xx++)
+                {
+                  int cc = cm[k];
+                  int v = pix[xx >> shrink][cc];
+                  bmax = MAX(bmax, v);
+                  v = MAX(v - cb[cc], 0);
+                  bsum[cc] += v;
+                  bsum[cc + 4]++;
+                  if (++k == 48)
+                    k = 0;
+                }
               }
               else
-                val = image[y * width + x][c];
-              if (val > (int)maximum - 25)
-                goto skip_block;
-              if ((val -= cblack[c]) < 0)
-                val = 0;
-              sum[c] += val;
-              sum[c + 4]++;
-              if (filters)
-                break;
+                for (unsigned xx = col0; xx < col1; xx++)
+                  for (int cc = 0; cc < 4; cc++)
+                  {
+                    int v = image[yy * width + xx][cc];
+                    bmax = MAX(bmax, v);
+                    v = MAX(v - cb[cc], 0);
+                    bsum[cc] += v;
+                    bsum[cc + 4]++;
+                  }
             }
-        FORC(8) dsum[c] += sum[c];
-      skip_block:;
+            if (bmax > thr)
+              continue;
+            for (int k = 0; k < 8; k++)
+              ldsum[k] += bsum[k];
+          }
+        }
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp critical(scale_colors_wb)
+#endif
+        for (int k = 0; k < 8; k++)
+          dsum[k] += ldsum[k];
       }
+    }
     FORC4 if (dsum[c]) pre_mul[c] = float(dsum[c + 4] / dsum[c]);
   }
+  if (ingest.blocks)
+  {
+    free(ingest.blocks);
+    ingest.blocks = NULL;
+  }
+  ingest.valid = 0;
   if (use_camera_wb && cam_mul[0] > 0.00001f)
   {
     memset(sum, 0, sizeof sum);
@@ -257,16 +347,11 @@ void LibRaw::scale_colors()
 }
 
 // green equilibration
+#define GM_BAND 32 /* second-green rows per band */
 void LibRaw::green_matching()
 {
-  int i, j;
-  double m1, m2, c1, c2;
-  int o1_1, o1_2, o1_3, o1_4;
-  int o2_1, o2_2, o2_3, o2_4;
-  ushort(*img)[4];
   const int margin = 3;
   int oj = 2, oi = 2;
-  float f;
   const float thr = 0.01f;
   if (half_size || shrink)
     return;
@@ -277,36 +362,104 @@ void LibRaw::green_matching()
   if (FC(oj, oi) != 3)
     oj--;
 
-  img = (ushort(*)[4])calloc(height * width, sizeof *image);
-  memcpy(img, image, height * width * sizeof *image);
+  /* Rows oj, oj+2, ... are equalized in bands. Each row needs the original
+     second-green values of itself and of the rows two above and below, so a
+     band keeps them in a three-line ring and takes its edge rows from a halo
+     saved before any band starts. */
+  const int rows = (height - margin - oj + 1) / 2;
+  if (rows <= 0)
+    return;
+  const int bands = (rows + GM_BAND - 1) / GM_BAND;
+  const int w = width;
+  ushort *halo = (ushort *)malloc(size_t(bands) * 2 * w * sizeof(ushort));
 
-  for (j = oj; j < height - margin; j += 2)
-    for (i = oi; i < width - margin; i += 2)
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (int b = 0; b < bands; b++)
+  {
+    const int k1 = MIN(rows, (b + 1) * GM_BAND);
+    const ushort(*top)[4] = image + size_t(oj + 2 * (b * GM_BAND - 1)) * w;
+    const ushort(*bot)[4] = image + size_t(oj + 2 * k1) * w;
+    ushort *h = halo + size_t(b) * 2 * w;
+    for (int i = 0; i < w; i++)
     {
-      o1_1 = img[(j - 1) * width + i - 1][1];
-      o1_2 = img[(j - 1) * width + i + 1][1];
-      o1_3 = img[(j + 1) * width + i - 1][1];
-      o1_4 = img[(j + 1) * width + i + 1][1];
-      o2_1 = img[(j - 2) * width + i][3];
-      o2_2 = img[(j + 2) * width + i][3];
-      o2_3 = img[j * width + i - 2][3];
-      o2_4 = img[j * width + i + 2][3];
+      h[i] = top[i][3];
+      h[w + i] = bot[i][3];
+    }
+  }
+
+#ifdef LIBRAW_USE_OPENMP
+  int buffer_count = omp_get_max_threads();
+#else
+  int buffer_count = 1;
+#endif
+  char **buffers = malloc_omp_buffers(buffer_count, 3 * w * sizeof(ushort));
 
-      m1 = (o1_1 + o1_2 + o1_3 + o1_4) / 4.0;
-      m2 = (o2_1 + o2_2 + o2_3 + o2_4) / 4.0;
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (int b = 0; b < bands; b++)
+  {
+#ifdef LIBRAW_USE_OPENMP
+    ushort *ring = (ushort *)buffers[omp_get_thread_num()];
+#else
+    ushort *ring = (ushort *)buffers[0];
+#endif
+    const int k0 = b * GM_BAND, k1 = MIN(rows, k0 + GM_BAND);
+    const ushort *h = halo + size_t(b) * 2 * w;
+    memcpy(ring, h, w * sizeof(ushort));
+    ushort *line = ring + w;
+    for (int i = 0; i < w; i++)
+      line[i] = image[size_t(oj + 2 * k0) * w + i][3];
+
+    for (int k = k0; k < k1; k++)
+    {
+      const int j = oj + 2 * k;
+      const ushort *up = ring + (k - k0) % 3 * w;
+      const ushort *mid = ring + (k - k0 + 1) % 3 * w;
+      ushort *down = ring + (k - k0 + 2) % 3 * w;
+      if (k + 1 < k1)
+        for (int i = 0; i < w; i++)
+          down[i] = image[size_t(j + 2) * w + i][3];
+      else
+        memcpy(down, h + w, w * sizeof(ushort));
 
-      c1 = (abs(o1_1 - o1_2) + abs(o1_1 - o1_3) + abs(o1_1 - o1_4) +
-            abs(o1_2 - o1_3) + abs(o1_3 - o1_4) + abs(o1_2 - o1_4)) /
-           6.0;
-      c2 = (abs(o2_1 - o2_2) + abs(o2_1 - o2_3) + abs(o2_1 - o2_4) +
-            abs(o2_2 - o2_3) + abs(o2_3 - o2_4) + abs(o2_2 - o2_4)) /
-           6.0;
-      if ((img[j * width + i][3] < maximum * 0.95) && (c1 < maximum * thr) &&
-          (c2 < maximum * thr))
+      const ushort(*prow)[4] = image + size_t(j - 1) * w;
+      const ushort(*nrow)[4] = image + size_t(j + 1) * w;
+      ushort(*pix)[4] = image + size_t(j) * w;
+      for (int i = oi; i < w - margin; i += 2)
       {
-        f = float(image[j * width + i][3] * m1 / m2);
-        image[j * width + i][3] = f > 65535.f ? 0xffff : ushort(f);
+        const int o1_1 = prow[i - 1][1];
+        const int o1_2 = prow[i + 1][1];
+        const int o1_3 = nrow[i - 1][1];
+        const int o1_4 = nrow[i + 1][1];
+        const int o2_1 = up[i];
+        const int o2_2 = down[i];
+        const int o2_3 = mid[i - 2];
+        const int o2_4 = mid[i + 2];
+
+        const double m1 = (o1_1 + o1_2 + o1_3 + o1_4) / 4.0;
+        const double m2 = (o2_1 + o2_2 + o2_3 + o2_4) / 4.0;
+
+        const double c1 = (abs(o1_1 - o1_2) + abs(o1_1 - o1_3) +
+                           abs(o1_1 - o1_4) + abs(o1_2 - o1_3) +
+                           abs(o1_3 - o1_4) + abs(o1_2 - o1_4)) /
+                          6.0;
+        const double c2 = (abs(o2_1 - o2_2) + abs(o2_1 - o2_3) +
+                           abs(o2_1 - o2_4) + abs(o2_2 - o2_3) +
+                           abs(o2_3 - o2_4) + abs(o2_2 - o2_4)) /
+                          6.0;
+        if ((mid[i] < maximum * 0.95) && (c1 < maximum * thr) &&
+            (c2 < maximum * thr))
+        {
+          float f = float(mid[i] * m1 / m2);
+          pix[i][3] = f > 65535.f ? 0xffff : ushort(f);
+        }
       }
     }
-  free(img);
+  }
+  free_omp_buffers(buffers, buffer_count);
+  free(halo);
 }
+#undef GM_BAND
@@ -0,0 +1,312 @@
+/* -*- C++ -*-
+ * Copyright 2019-2025 LibRaw LLC (info@libraw.org)
+ *
+
+ LibRaw is free software; you can redistribute it and/or modify
+ it under the terms of the one of two licenses as you choose:
+
+1. GNU LESSER GENERAL PUBLIC LICENSE version 2.1
+   (See file LICENSE.LGPL provided in LibRaw distribution archive for details).
+
+2. COMMON DEVELOPMENT AND DISTRIBUTION LICENSE (CDDL) Version 1.0
+   (See file LICENSE.CDDL provided in LibRaw distribution archive for details).
+
+ */
+
+#include "../../internal/libraw_cxx_defs.h"
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#define RESAMPLE_AREA_RATIO 3   /* from this reduction on, average the area */
+#define RESAMPLE_CACHE_SIZE 8   /* axis tables kept, two per image size pair */
+
+/*
+ * Separable resampling of interleaved 8 or 16-bit bitmaps to an exact size.
+ * Reductions of RESAMPLE_AREA_RATIO and more average the covered source
+ * area; smaller ones and enlargements use the Mitchell-Netravali filter
+ * (B = C = 1/3), widened by the reduction ratio. Each output row is filtered
+ * vertically into a float row, then horizontally, so only one row per
+ * thread is buffered. Weight tables only depend on the sizes and are kept
+ * process-wide for the next image of the same size. An orientation is
+ * applied by where the filtered pixels are stored, not by another pass.
+ */
+namespace
+{
+struct resample_axis_t
+{
+  int src, dst;
+  int taps;                  /* weights per output pixel */
+  std::vector<int> first;    /* first source index per output pixel */
+  std::vector<float> weight; /* dst * taps, zero padded */
+};
+
+float mitchell(float x)
+{
+  x = fabsf(x);
+  if (x < 1.f)
+    return (7.f * x * x * x - 12.f * x * x + 16.f / 3.f) / 6.f;
+  if (x < 2.f)
+    return (-7.f / 3.f * x * x * x + 12.f * x * x - 20.f * x + 32.f / 3.f) /
+           6.f;
+  return 0.f;
+}
+
+std::shared_ptr<const resample_axis_t> resample_axis_build(int src, int dst)
+{
+  std::shared_ptr<resample_axis_t> axis(new resample_axis_t);
+  axis->src = src;
+  axis->dst = dst;
+  const double scale = double(src) / dst;
+  const bool area = scale >= RESAMPLE_AREA_RATIO;
+  const double support = area ? scale / 2 : 2 * MAX(scale, 1.0);
+  axis->taps = int(ceil(support * 2)) + 1;
+  axis->first.resize(dst);
+  axis->weight.assign(size_t(dst) * axis->taps, 0.f);
+
+  for (int i = 0; i < dst; i++)
+  {
+    const double center = (i + 0.5) * scale;
+    int lo = MAX(int(floor(center - support)), 0);
+    int hi = MIN(int(ceil(center + support)), src); /* exclusive */
+    if (hi - lo > axis->taps)
+      hi = lo + axis->taps;
+    float *w = &axis->weight[size_t(i) * axis->taps];
+    double sum = 0;
+    for (int j = lo; j < hi; j++)
+    {
+      double v;
+      if (area) /* overlap of source pixel j with the output pixel */
+        v = MAX(0.0, MIN(j + 1.0, center + support) -
+                         MAX(double(j), center - support));
+      else
+        v = mitchell(float((j + 0.5 - center) / MAX(scale, 1.0)));
+      w[j - lo] = float(v);
+      sum += v;
+    }
+    if (sum == 0) /* cannot happen with these filters, keep it defined */
+    {
+      lo = MIN(int(center), src - 1);
+      w[0] = 1.f;
+      sum = 1;
+      for (int j = 1; j < axis->taps; j++)
+        w[j] = 0.f;
+    }
+    for (int j = 0; j < axis->taps; j++)
+      w[j] = float(w[j] / sum);
+    axis->first[i] = lo;
+  }
+  return axis;
+}
+
+std::mutex resample_cache_lock;
+std::shared_ptr<const resample_axis_t> resample_cache[RESAMPLE_CACHE_SIZE];
+unsigned resample_cache_next;
+
+std::shared_ptr<const resample_axis_t> resample_axis(int src, int dst)
+{
+  {
+    std::lock_guard<std::mutex> lock(resample_cache_lock);
+    for (int i = 0; i < RESAMPLE_CACHE_SIZE; i++)
+      if (resample_cache[i] && resample_cache[i]->src == src &&
+          resample_cache[i]->dst == dst)
+        return resample_cache[i];
+  }
+  std::shared_ptr<const resample_axis_t> axis = resample_axis_build(src, dst);
+  std::lock_guard<std::mutex> lock(resample_cache_lock);
+  resample_cache[resample_cache_next++ % RESAMPLE_CACHE_SIZE] = axis;
+  return axis;
+}
+
+/* output pixel col of a row goes to dst + col * dst_step */
+template <typename pix_t>
+void resample_row(const pix_t *src, int src_stride, int colors,
+                  const resample_axis_t &ax, const resample_axis_t &ay,
+                  int row, float *line, pix_t *dst, ptrdiff_t dst_step,
+                  float maxval)
+{
+  const int n = ax.src * colors;
+  const float *wy = &ay.weight[size_t(row) * ay.taps];
+  const pix_t *s = src + size_t(ay.first[row]) * src_stride;
+  for (int i = 0; i < n; i++)
+    line[i] = wy[0] * s[i];
+  for (int t = 1; t < ay.taps && ay.first[row] + t < ay.src; t++)
+  {
+    const float w = wy[t];
+    s += src_stride;
+    if (w != 0.f)
+      for (int i = 0; i < n; i++)
+        line[i] += w * s[i];
+  }
+
+  for (int col = 0; col < ax.dst; col++)
+  {
+    const float *wx = &ax.weight[size_t(col) * ax.taps];
+    const float *l = line + ax.first[col] * colors;
+    const int taps = MIN(ax.taps, ax.src - ax.first[col]);
+    float sum[4] = {0.5f, 0.5f, 0.5f, 0.5f};
+    for (int t = 0; t < taps; t++, l += colors)
+      for (int c = 0; c < colors; c++)
+        sum[c] += wx[t] * l[c];
+    for (int c = 0; c < colors; c++)
+      dst[col * dst_step + c] =
+          pix_t(sum[c] < 0.f ? 0.f : sum[c] > maxval ? maxval : sum[c]);
+  }
+}
+
+/*
+ * Where pixel (row, col) of a rows x cols image lands after turning it by
+ * flip (as sizes.flip, the inverse of flip_index()), in pixels
+ */
+struct resample_flip_t
+{
+  ptrdiff_t origin, row_step, col_step;
+  resample_flip_t(int flip, int rows, int cols)
+  {
+    const int out_width = (flip & 4) ? rows : cols;
+    ptrdiff_t r0 = 0, c0 = 0, dr = 1, dc = 1;
+    if (flip & 2)
+    {
+      r0 = rows - 1;
+      dr = -1;
+    }
+    if (flip & 1)
+    {
+      c0 = cols - 1;
+      dc = -1;
+    }
+    if (flip & 4)
+    {
+      origin = c0 * out_width + r0;
+      row_step = dr;
+      col_step = dc * out_width;
+    }
+    else
+    {
+      origin = r0 * out_width + c0;
+      row_step = dr * out_width;
+      col_step = dc;
+    }
+  }
+};
+} // namespace
+
+libraw_processed_image_t *
+LibRaw::resample_mem_image(const libraw_processed_image_t *src, int width,
+                           int height, int *errcode, int flip)
+{
+  if (!src || src->type != LIBRAW_IMAGE_BITMAP || width <= 0 ||
+      height <= 0 || src->width < 1 || src->height < 1 || src->colors < 1 ||
+      src->colors > 4 || (src->bits != 8 && src->bits != 16) ||
+      src->data_size <
+          unsigned(src->width) * src->height * src->colors * (src->bits / 8))
+  {
+    if (errcode)
+      *errcode = LIBRAW_UNSUPPORTED_THUMBNAIL;
+    return NULL;
+  }
+  const int colors = src->colors, bytes = src->bits / 8;
+  const unsigned ds = unsigned(width) * height * colors * bytes;
+  libraw_processed_image_t *ret = (libraw_processed_image_t *)::malloc(
+      sizeof(libraw_processed_image_t) + ds);
+  if (!ret)
+  {
+    if (errcode)
+      *errcode = ENOMEM;
+    return NULL;
+  }
+  memset(ret, 0, sizeof(libraw_processed_image_t));
+  ret->type = LIBRAW_IMAGE_BITMAP;
+  ret->width = width;
+  ret->height = height;
+  ret->colors = colors;
+  ret->bits = src->bits;
+  ret->data_size = ds;
+
+  /* the size before turning */
+  flip &= 7;
+  const int rows = (flip & 4) ? width : height;
+  const int cols = (flip & 4) ? height : width;
+  const resample_flip_t to(flip, rows, cols);
+  const int pixel = colors * bytes;
+  if (cols == src->width && rows == src->height)
+  {
+    if (!flip)
+      memmove(ret->data, src->data, ds);
+    else
+    {
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+      for (int row = 0; row < rows; row++)
+      {
+        const uchar *s = src->data + size_t(row) * cols * pixel;
+        uchar *d = ret->data + (to.origin + row * to.row_step) * pixel;
+        for (int col = 0; col < cols; col++, s += pixel)
+          memcpy(d + col * to.col_step * pixel, s, pixel);
+      }
+    }
+    if (errcode)
+      *errcode = 0;
+    return ret;
+  }
+
+#ifdef LIBRAW_USE_OPENMP
+  int buffer_count = omp_get_max_threads();
+#else
+  int buffer_count = 1;
+#endif
+  std::shared_ptr<const resample_axis_t> ax, ay;
+  char **buffers;
+  /* callers are C, nothing may be thrown past here */
+  try
+  {
+    ax = resample_axis(src->width, cols);
+    ay = resample_axis(src->height, rows);
+    buffers = malloc_omp_buffers(buffer_count,
+                                 size_t(src->width) * colors * sizeof(float));
+  }
+  catch (const LibRaw_exceptions &)
+  {
+    buffers = NULL;
+  }
+  catch (const std::bad_alloc &)
+  {
+    buffers = NULL;
+  }
+  if (!buffers)
+  {
+    ::free(ret);
+    if (errcode)
+      *errcode = ENOMEM;
+    return NULL;
+  }
+
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (int row = 0; row < rows; row++)
+  {
+#ifdef LIBRAW_USE_OPENMP
+    float *line = (float *)buffers[omp_get_thread_num()];
+#else
+    float *line = (float *)buffers[0];
+#endif
+    const ptrdiff_t dst = (to.origin + row * to.row_step) * colors;
+    if (bytes == 1)
+      resample_row(src->data, src->width * colors, colors, *ax, *ay, row,
+                   line, ret->data + dst, to.col_step * colors, 255.f);
+    else
+      resample_row((const ushort *)src->data, src->width * colors, colors,
+                   *ax, *ay, row, line, (ushort *)ret->data + dst,
+                   to.col_step * colors, 65535.f);
+  }
+  free_omp_buffers(buffers, buffer_count);
+
+  if (errcode)
+    *errcode = 0;
+  return ret;
+}
+#undef RESAMPLE_AREA_RATIO
+#undef RESAMPLE_CACHE_SIZE
@@ -17,68 +17,160 @@
  */
 
 #include "../../internal/dcraw_fileio_defs.h"
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
 
 /*
-   Search from the current directory up to the root looking for
-   a ".badpixels" file, and fix those pixels now.
+ * Dark frames and bad pixel lists are usually shared by every frame of a
+ * session, so the parsed form of the last one of each is kept process-wide.
+ * A file is read again when its path, size or modification time changes.
  */
-void LibRaw::bad_pixels(const char *cfname)
+#define BAD_PIXEL_REACH 3 /* radius 2 neighbours, one more for half_size */
+
+namespace
 {
-  FILE *fp = NULL;
-  char *cp, line[128];
-  int time, row, col, r, c, rad, tot, n;
+struct calib_file_t
+{
+  std::string path;
+  INT64 size, mtime;
+  bool operator==(const calib_file_t &o) const
+  {
+    return size == o.size && mtime == o.mtime && path == o.path;
+  }
+};
 
-  if (!filters)
-    return;
-  RUN_CALLBACK(LIBRAW_PROGRESS_BAD_PIXELS, 0, 2);
-  if (cfname)
-    fp = fopen(cfname, "r");
-  if (!fp)
+bool calib_file_stat(const char *fname, calib_file_t &id)
+{
+#ifndef LIBRAW_WIN32_CALLS
+  struct stat st;
+  if (stat(fname, &st))
+    return false;
+#else
+  struct _stati64 st;
+  if (_stati64(fname, &st))
+    return false;
+#endif
+  id.path = fname;
+  id.size = st.st_size;
+  id.mtime = st.st_mtime;
+  return true;
+}
+
+struct dark_frame_t
+{
+  calib_file_t id;
+  int w, h, maxval;
+  std::vector<ushort> pix; /* host byte order */
+};
+
+struct bad_pixel_t
+{
+  int row, col, time;
+};
+
+struct bad_pixel_map_t
+{
+  calib_file_t id;
+  /* no other entry within BAD_PIXEL_REACH: order independent, sorted */
+  std::vector<bad_pixel_t> isolated;
+  /* neighbours of other entries: fixed one by one, in file order */
+  std::vector<bad_pixel_t> clustered;
+};
+
+std::mutex calib_cache_lock;
+std::shared_ptr<const dark_frame_t> dark_frame_cache;
+std::shared_ptr<const bad_pixel_map_t> bad_pixel_cache;
+
+bool bad_pixel_less(const bad_pixel_t &a, const bad_pixel_t &b)
+{
+  return a.row < b.row || (a.row == b.row && a.col < b.col);
+}
+
+std::shared_ptr<const bad_pixel_map_t> bad_pixel_map_load(const char *fname)
+{
+  calib_file_t id;
+  if (!calib_file_stat(fname, id))
+    return std::shared_ptr<const bad_pixel_map_t>();
   {
-    imgdata.process_warnings |= LIBRAW_WARN_NO_BADPIXELMAP;
-    return;
+    std::lock_guard<std::mutex> lock(calib_cache_lock);
+    if (bad_pixel_cache && bad_pixel_cache->id == id)
+      return bad_pixel_cache;
   }
+  FILE *fp = fopen(fname, "r");
+  if (!fp)
+    return std::shared_ptr<const bad_pixel_map_t>();
+
+  std::vector<bad_pixel_t> list;
+  char *cp, line[128];
+  bad_pixel_t bp;
   while (fgets(line, 128, fp))
   {
     cp = strchr(line, '#');
     if (cp)
       *cp = 0;
-    if (sscanf(line, "%d %d %d", &col, &row, &time) != 3)
-      continue;
-    if ((unsigned)col >= width || (unsigned)row >= height)
-      continue;
-    if (time > timestamp)
-      continue;
-    for (tot = n = 0, rad = 1; rad < 3 && n == 0; rad++)
-      for (r = row - rad; r <= row + rad; r++)
-        for (c = col - rad; c <= col + rad; c++)
-          if ((unsigned)r < height && (unsigned)c < width &&
-              (r != row || c != col) && fcol(r, c) == fcol(row, col))
-          {
-            tot += BAYER2(r, c);
-            n++;
-          }
-    if (n > 0)
-      BAYER2(row, col) = tot / n;
+    if (sscanf(line, "%d %d %d", &bp.col, &bp.row, &bp.time) == 3)
+      list.push_back(bp);
   }
   fclose(fp);
-  RUN_CALLBACK(LIBRAW_PROGRESS_BAD_PIXELS, 1, 2);
+
+  /* split the list by whether a fix can read another entry's pixel */
+  std::vector<bad_pixel_t> sorted(list);
+  std::sort(sorted.begin(), sorted.end(), bad_pixel_less);
+  std::shared_ptr<bad_pixel_map_t> map(new bad_pixel_map_t);
+  map->id = id;
+  for (size_t i = 0; i < list.size(); i++)
+  {
+    int near_by = 0;
+    for (int dr = -BAD_PIXEL_REACH; dr <= BAD_PIXEL_REACH && near_by < 2; dr++)
+    {
+      bad_pixel_t lo = {list[i].row + dr, list[i].col - BAD_PIXEL_REACH, 0};
+      for (std::vector<bad_pixel_t>::const_iterator it =
+               std::lower_bound(sorted.begin(), sorted.end(), lo,
+                                bad_pixel_less);
+           it != sorted.end() && it->row == lo.row &&
+           it->col <= list[i].col + BAD_PIXEL_REACH;
+           ++it)
+        near_by++; /* counts the entry itself once */
+    }
+    if (near_by > 1)
+      map->clustered.push_back(list[i]);
+    else
+      map->isolated.push_back(list[i]);
+  }
+  std::sort(map->isolated.begin(), map->isolated.end(), bad_pixel_less);
+
+  std::lock_guard<std::mutex> lock(calib_cache_lock);
+  bad_pixel_cache = map;
+  return map;
 }
 
-void LibRaw::subtract(const char *fname)
+/* error: 1 for an unreadable file, 2 for a malformed header */
+std::shared_ptr<const dark_frame_t> dark_frame_load(const char *fname,
+                                                    int &error)
 {
-  FILE *fp;
-  int dim[3] = {0, 0, 0}, comment = 0, number = 0, error = 0, nd = 0, c, row,
-      col;
-  RUN_CALLBACK(LIBRAW_PROGRESS_DARK_FRAME, 0, 2);
-
-  if (!(fp = fopen(fname, "rb")))
+  calib_file_t id;
+  error = 1;
+  if (!calib_file_stat(fname, id))
+    return std::shared_ptr<const dark_frame_t>();
   {
-    imgdata.process_warnings |= LIBRAW_WARN_BAD_DARKFRAME_FILE;
-    return;
+    std::lock_guard<std::mutex> lock(calib_cache_lock);
+    if (dark_frame_cache && dark_frame_cache->id == id)
+    {
+      error = 0;
+      return dark_frame_cache;
+    }
   }
+  FILE *fp = fopen(fname, "rb");
+  if (!fp)
+    return std::shared_ptr<const dark_frame_t>();
+
+  int dim[3] = {0, 0, 0}, comment = 0, number = 0, nd = 0, c;
+  error = 0;
   if (fgetc(fp) != 'P' || fgetc(fp) != '5')
-    error = 1;
+    error = 2;
   while (!error && nd < 3 && (c = fgetc(fp)) != EOF)
   {
     if (c == '#')
@@ -99,28 +191,154 @@ void LibRaw::subtract(const char *fname)
         nd++;
       }
       else
-        error = 1;
+        error = 2;
     }
   }
   if (error || nd < 3)
   {
+    error = 2;
     fclose(fp);
+    return std::shared_ptr<const dark_frame_t>();
+  }
+
+  std::shared_ptr<dark_frame_t> frame(new dark_frame_t);
+  frame->id = id;
+  frame->w = dim[0];
+  frame->h = dim[1];
+  frame->maxval = dim[2];
+  if (dim[2] == 65535 && INT64(dim[0]) * dim[1] < (INT64(1) << 31))
+  {
+    frame->pix.resize(size_t(dim[0]) * dim[1], 0);
+    fread(frame->pix.data(), 2, frame->pix.size(), fp);
+    ushort *pix = frame->pix.data();
+    for (size_t i = 0; i < frame->pix.size(); i++)
+      pix[i] = ntohs(pix[i]);
+  }
+  fclose(fp);
+
+  std::lock_guard<std::mutex> lock(calib_cache_lock);
+  dark_frame_cache = frame;
+  return frame;
+}
+} // namespace
+
+void LibRaw::clear_calibration_cache()
+{
+  std::lock_guard<std::mutex> lock(calib_cache_lock);
+  dark_frame_cache.reset();
+  bad_pixel_cache.reset();
+}
+
+void LibRaw::bad_pixel_fix(int row, int col)
+{
+  int r, c, rad, tot, n;
+  for (tot = n = 0, rad = 1; rad < 3 && n == 0; rad++)
+    for (r = row - rad; r <= row + rad; r++)
+      for (c = col - rad; c <= col + rad; c++)
+        if ((unsigned)r < height && (unsigned)c < width &&
+            (r != row || c != col) && fcol(r, c) == fcol(row, col))
+        {
+          tot += BAYER2(r, c);
+          n++;
+        }
+  if (n > 0)
+    BAYER2(row, col) = tot / n;
+}
+
+/*
+   Fix the pixels listed in a ".badpixels" file. Coordinates are in the
+   uncropped frame; crop_top/crop_left is where the current image starts.
+ */
+void LibRaw::bad_pixels(const char *cfname, int crop_top, int crop_left)
+{
+  if (!filters)
+    return;
+  RUN_CALLBACK(LIBRAW_PROGRESS_BAD_PIXELS, 0, 2);
+  std::shared_ptr<const bad_pixel_map_t> map;
+  if (cfname)
+    map = bad_pixel_map_load(cfname);
+  if (!map)
+  {
+    imgdata.process_warnings |= LIBRAW_WARN_NO_BADPIXELMAP;
     return;
   }
-  else if (dim[0] != width || dim[1] != height || dim[2] != 65535)
+
+  const bad_pixel_t *list = map->isolated.data();
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (int i = 0; i < int(map->isolated.size()); i++)
   {
-    imgdata.process_warnings |= LIBRAW_WARN_BAD_DARKFRAME_DIM;
-    fclose(fp);
+    const int row = list[i].row - crop_top, col = list[i].col - crop_left;
+    if ((unsigned)col < width && (unsigned)row < height &&
+        list[i].time <= timestamp)
+      bad_pixel_fix(row, col);
+  }
+
+  list = map->clustered.data();
+  for (int i = 0; i < int(map->clustered.size()); i++)
+  {
+    const int row = list[i].row - crop_top, col = list[i].col - crop_left;
+    if ((unsigned)col < width && (unsigned)row < height &&
+        list[i].time <= timestamp)
+      bad_pixel_fix(row, col);
+  }
+  RUN_CALLBACK(LIBRAW_PROGRESS_BAD_PIXELS, 1, 2);
+}
+
+/*
+   Subtract a 16-bit PGM dark frame of the uncropped frame size
+   (frame_width x frame_height, 0 for the current size).
+ */
+void LibRaw::subtract(const char *fname, int crop_top, int crop_left,
+                      int frame_width, int frame_height)
+{
+  RUN_CALLBACK(LIBRAW_PROGRESS_DARK_FRAME, 0, 2);
+
+  int error;
+  std::shared_ptr<const dark_frame_t> frame = dark_frame_load(fname, error);
+  if (error == 1)
+    imgdata.process_warnings |= LIBRAW_WARN_BAD_DARKFRAME_FILE;
+  if (!frame)
     return;
+  if (!frame_width || !frame_height)
+  {
+    frame_width = width;
+    frame_height = height;
   }
-  std::vector<ushort> pixel(width, 0);
-  for (row = 0; row < height; row++)
+  if (frame->w != frame_width || frame->h != frame_height ||
+      frame->maxval != 65535 || crop_top + height > frame->h ||
+      crop_left + width > frame->w)
   {
-    fread(pixel.data(), 2, width, fp);
-    for (col = 0; col < width; col++)
-      BAYER(row, col) = MAX(BAYER(row, col) - ntohs(pixel[col]), 0);
+    imgdata.process_warnings |= LIBRAW_WARN_BAD_DARKFRAME_DIM;
+    return;
   }
-  fclose(fp);
+
+  const ushort *dark = frame->pix.data();
+  /* row pairs: with half_size both rows land in the same image row */
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (int pair = 0; pair < (height + 1) / 2; pair++)
+    for (int row = pair * 2; row < MIN(pair * 2 + 2, int(height)); row++)
+    {
+      const ushort *drow =
+          dark + size_t(row + crop_top) * frame->w + crop_left;
+      if (!shrink)
+      {
+        /* FC() only depends on the column parity: one color per pass */
+        ushort(*irow)[4] = image + size_t(row) * iwidth;
+        for (int p = 0; p < 2; p++)
+        {
+          const int c = FC(row, p);
+          for (int col = p; col < width; col += 2)
+            irow[col][c] = MAX(irow[col][c] - drow[col], 0);
+        }
+      }
+      else
+        for (int col = 0; col < width; col++)
+          BAYER(row, col) = MAX(BAYER(row, col) - drow[col], 0);
+    }
   memset(cblack, 0, sizeof cblack);
   black = 0;
   RUN_CALLBACK(LIBRAW_PROGRESS_DARK_FRAME, 1, 2);
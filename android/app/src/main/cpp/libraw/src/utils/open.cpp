@@ -463,6 +463,159 @@ struct foveon_data_t
 };
 const int foveon_count = sizeof(foveon_data) / sizeof(foveon_data[0]);
 
+/*
+ * Plain JPEG files (camera and phone pictures, not raw data): loads the Exif
+ * thumbnail (IFD1) as unpack_thumb() would, with sizes.flip taken from the
+ * Orientation tag, for dcraw_make_mem_thumb(). other.timestamp gets the
+ * capture time, also when there is no thumbnail. Only the APP segments up
+ * to the Exif one and the thumbnail itself are read; nothing of the stream
+ * is kept.
+ */
+int LibRaw::open_jpeg_thumb(LibRaw_abstract_datastream *stream)
+{
+  if (!stream)
+    return ENOENT;
+  if (!stream->valid())
+    return LIBRAW_IO_ERROR;
+  recycle();
+
+  try
+  {
+    uchar mark[4];
+    stream->seek(0, SEEK_SET);
+    if (stream->read(mark, 1, 2) != 2 || mark[0] != 0xff || mark[1] != 0xd8)
+      return LIBRAW_FILE_UNSUPPORTED;
+
+    /* metadata segments come first; stop at the first one that is not APPn */
+    INT64 pos = 2;
+    uchar *exif = NULL;
+    unsigned exif_len = 0;
+    while (!exif && stream->read(mark, 1, 4) == 4 && mark[0] == 0xff &&
+           mark[1] >= 0xe0 && mark[1] <= 0xef)
+    {
+      const unsigned len = mark[2] << 8 | mark[3];
+      if (len < 2)
+        break;
+      if (mark[1] == 0xe1 && len > 2 + 6 + 8)
+      {
+        exif_len = len - 2;
+        exif = (uchar *)malloc(exif_len);
+        if (!exif)
+          return LIBRAW_UNSUFFICIENT_MEMORY;
+        if (stream->read(exif, 1, exif_len) != int(exif_len) ||
+            memcmp(exif, "Exif\0\0", 6))
+        {
+          free(exif);
+          exif = NULL;
+        }
+      }
+      pos += 2 + len;
+      stream->seek(pos, SEEK_SET);
+    }
+    if (!exif)
+      return LIBRAW_NO_THUMBNAIL;
+
+    /* TIFF structure after the Exif signature: IFD0 holds the orientation of
+       the picture, IFD1 the thumbnail, the Exif IFD the capture time */
+    uchar *tiff = exif + 6;
+    const unsigned tiff_len = exif_len - 6;
+    const INT64 tiff_base = pos - exif_len + 6;
+    unsigned toffset = 0, tlength = 0;
+    unsigned next = 0, exif_ifd = 0, date = 0, date_original = 0;
+    int flip = 0;
+    libraw_internal_data.unpacker_data.order =
+        tiff[0] == 'M' ? 0x4d4d : 0x4949;
+    const unsigned first = memcmp(tiff, "II", 2) && memcmp(tiff, "MM", 2)
+                               ? 0
+                               : sget4(tiff + 4);
+    for (int n = 0; n < 3; n++)
+    {
+      const unsigned ifd = n == 0 ? first : n == 1 ? next : exif_ifd;
+      if (!ifd || ifd >= tiff_len - 2)
+        continue;
+      const unsigned entries = sget2(tiff + ifd);
+      unsigned e = ifd + 2;
+      for (unsigned i = 0; i < entries && e + 12 <= tiff_len; i++, e += 12)
+      {
+        const unsigned tag = sget2(tiff + e), type = sget2(tiff + e + 2);
+        const unsigned val =
+            type == 3 ? sget2(tiff + e + 8) : sget4(tiff + e + 8);
+        if (n == 0 && tag == 274)
+          flip = "50132467"[val & 7] - '0';
+        else if (n == 0 && tag == 306)
+          date = val;
+        else if (n == 0 && tag == 34665)
+          exif_ifd = val;
+        else if (n == 1 && tag == 513)
+          toffset = val;
+        else if (n == 1 && tag == 514)
+          tlength = val;
+        else if (n == 2 && tag == 36867)
+          date_original = val;
+      }
+      if (n == 0)
+        next = e + 4 <= tiff_len ? sget4(tiff + e) : 0;
+    }
+
+    /* capture time the way get_timestamp() reads it from raw files */
+    const unsigned at = date_original ? date_original : date;
+    if (at && at < tiff_len && tiff_len - at >= 19)
+    {
+      struct tm t;
+      char str[20];
+      memcpy(str, tiff + at, 19);
+      str[19] = 0;
+      memset(&t, 0, sizeof t);
+      if (sscanf(str, "%d:%d:%d %d:%d:%d", &t.tm_year, &t.tm_mon, &t.tm_mday,
+                 &t.tm_hour, &t.tm_min, &t.tm_sec) == 6)
+      {
+        t.tm_year -= 1900;
+        t.tm_mon -= 1;
+        t.tm_isdst = -1;
+        if (mktime(&t) > 0)
+          imgdata.other.timestamp = mktime(&t);
+      }
+    }
+
+    int ret = LIBRAW_NO_THUMBNAIL;
+    if (toffset && tlength >= 64u &&
+        INT64(tlength) <= 1024LL * 1024LL * LIBRAW_MAX_THUMBNAIL_MB &&
+        tiff_base + toffset + tlength <= stream->size())
+    {
+      T.thumb = (char *)malloc(tlength);
+      if (!T.thumb)
+        ret = LIBRAW_UNSUFFICIENT_MEMORY;
+      else if (INT64(toffset) + tlength <= tiff_len)
+        memmove(T.thumb, tiff + toffset, tlength);
+      else
+      {
+        stream->seek(tiff_base + toffset, SEEK_SET);
+        if (stream->read(T.thumb, 1, tlength) != int(tlength))
+          T.thumb[0] = 0;
+      }
+      if (T.thumb && uchar(T.thumb[0]) == 0xff && uchar(T.thumb[1]) == 0xd8)
+      {
+        T.tlength = tlength;
+        T.tformat = LIBRAW_THUMBNAIL_JPEG;
+        S.flip = flip;
+        SET_PROC_FLAG(LIBRAW_PROGRESS_THUMB_LOAD);
+        ret = LIBRAW_SUCCESS;
+      }
+      else if (T.thumb)
+      {
+        free(T.thumb);
+        T.thumb = NULL;
+      }
+    }
+    free(exif);
+    return ret;
+  }
+  catch (const LibRaw_exceptions &err)
+  {
+    EXCEPTION_HANDLER(err);
+  }
+}
+
 int LibRaw::open_datastream(LibRaw_abstract_datastream *stream)
 {
 
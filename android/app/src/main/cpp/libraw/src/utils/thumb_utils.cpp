@@ -103,11 +103,12 @@ void LibRaw::kodak_thumb_loader()
     return;
   }
 
-  // from scale_colors
+  // from scale_colors and convert_to_rgb, fused per pixel; rows in parallel
+  // with a histogram per thread
+  float scale_mul[4];
   {
     double dmax;
-    float scale_mul[4];
-    int c, val;
+    int c;
     for (dmax = DBL_MAX, c = 0; c < 3; c++)
       if (dmax > C.pre_mul[c])
         dmax = C.pre_mul[c];
@@ -115,55 +116,67 @@ void LibRaw::kodak_thumb_loader()
     for (c = 0; c < 3; c++)
       scale_mul[c] = float((C.pre_mul[c] / dmax) * 65535. / C.maximum);
     scale_mul[3] = scale_mul[1];
+  }
+
+  // Skip color conversion for canon PPM tiffs
+  const bool to_rgb = imgdata.idata.maker_index != LIBRAW_CAMERAMAKER_Canon;
+  static const float out_cam[3][3] = {
+      {2.81761312f, -1.98369181f, 0.166078627f},
+      {-0.111855984f, 1.73688626f, -0.625030339f},
+      {-0.0379119813f, -0.891268849f, 1.92918086f}};
+  const int t_colors = MIN(MAX(int(P1.colors), 0), 4);
+  const int t_height = S.height, t_width = S.width;
+
+#ifdef LIBRAW_USE_OPENMP
+  int buffer_count = omp_get_max_threads();
+#else
+  int buffer_count = 1;
+#endif
+  char **buffers =
+      malloc_omp_buffers(buffer_count, 4 * LIBRAW_HISTOGRAM_SIZE * sizeof(int));
 
-    size_t size = S.height * S.width;
-    for (unsigned i = 0; i < size * 4; i++)
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (int row = 0; row < t_height; row++)
+  {
+#ifdef LIBRAW_USE_OPENMP
+    int(*hist)[LIBRAW_HISTOGRAM_SIZE] =
+        (int(*)[LIBRAW_HISTOGRAM_SIZE])buffers[omp_get_thread_num()];
+#else
+    int(*hist)[LIBRAW_HISTOGRAM_SIZE] = (int(*)[LIBRAW_HISTOGRAM_SIZE])buffers[0];
+#endif
+    ushort *img = imgdata.image[size_t(row) * t_width];
+    for (int col = 0; col < t_width; col++, img += 4)
     {
-      val = imgdata.image[0][i];
-      if (!val)
-        continue;
-      val = int(val * scale_mul[i & 3]);
-      imgdata.image[0][i] = CLIP(val);
+      for (int c = 0; c < 4; c++)
+      {
+        int val = int(img[c] * scale_mul[c]);
+        img[c] = CLIP(val);
+      }
+      if (to_rgb)
+      {
+        float out[3];
+        for (int c = 0; c < 3; c++)
+          out[c] = out_cam[c][0] * img[0] + out_cam[c][1] * img[1] +
+                   out_cam[c][2] * img[2];
+        for (int c = 0; c < 3; c++)
+          img[c] = CLIP((int)out[c]);
+      }
+      for (int c = 0; c < t_colors; c++)
+        hist[c][img[c] >> 3]++;
     }
   }
 
-  // from convert_to_rgb
-  ushort *img;
-  int row, col;
-
   int(*t_hist)[LIBRAW_HISTOGRAM_SIZE] =
       (int(*)[LIBRAW_HISTOGRAM_SIZE])calloc(sizeof(*t_hist), 4);
-
-  if (imgdata.idata.maker_index == LIBRAW_CAMERAMAKER_Canon) // Skip color conversion for canon PPM tiffs
+  for (int i = 0; i < buffer_count; i++)
   {
-    for (img = imgdata.image[0], row = 0; row < S.height; row++)
-      for (col = 0; col < S.width; col++, img += 4)
-        for (int c = 0; c < P1.colors; c++)
-          t_hist[c][img[c] >> 3]++;
-  }
-  else
-  {
-    float out[3], out_cam[3][4] = {{2.81761312f, -1.98369181f, 0.166078627f, 0},
-                                   {-0.111855984f, 1.73688626f, -0.625030339f, 0},
-                                   {-0.0379119813f, -0.891268849f, 1.92918086f, 0}};
-    
-	for (img = imgdata.image[0], row = 0; row < S.height; row++)
-      for (col = 0; col < S.width; col++, img += 4)
-      {
-        out[0] = out[1] = out[2] = 0;
-        int c;
-        for (c = 0; c < 3; c++)
-        {
-          out[0] += out_cam[0][c] * img[c];
-          out[1] += out_cam[1][c] * img[c];
-          out[2] += out_cam[2][c] * img[c];
-        }
-        for (c = 0; c < 3; c++)
-          img[c] = CLIP((int)out[c]);
-        for (c = 0; c < P1.colors; c++)
-          t_hist[c][img[c] >> 3]++;
-      }
+    const int *hist = (const int *)buffers[i];
+    for (int j = 0; j < 4 * LIBRAW_HISTOGRAM_SIZE; j++)
+      t_hist[0][j] += hist[j];
   }
+  free_omp_buffers(buffers, buffer_count);
 
   // from gamma_lut
   int(*save_hist)[LIBRAW_HISTOGRAM_SIZE] =
@@ -175,21 +188,10 @@ void LibRaw::kodak_thumb_loader()
   memmove(t_curve, C.curve, sizeof(C.curve));
   memset(C.curve, 0, sizeof(C.curve));
   {
-    int perc, val, total, t_white = 0x2000, c;
-
-    perc = int(S.width * S.height * 0.01f); /* 99th percentile white level */
+    int perc = int(S.width * S.height * 0.01f); /* 99th percentile white level */
     if (IO.fuji_width)
       perc /= 2;
-    if (!((O.highlight & ~2) || O.no_auto_bright))
-      for (t_white = c = 0; c < P1.colors; c++)
-      {
-        for (val = 0x2000, total = 0; --val > 32;)
-          if ((total += libraw_internal_data.output_data.histogram[c][val]) >
-              perc)
-            break;
-        if (t_white < val)
-          t_white = val;
-      }
+    int t_white = output_white_level(perc);
     gamma_curve(O.gamm[0], O.gamm[1], 2, int((t_white << 3) / O.bright));
   }
 
@@ -207,24 +209,40 @@ void LibRaw::kodak_thumb_loader()
   if (S.flip & 4)
     SWAP(S.height, S.width);
 
+  // 8-bit output in the requested layout: the source colors, or BGR with a
+  // grey source repeated
+  const int bgr =
+      (imgdata.rawparams.options & LIBRAW_RAWOPTIONS_BGR_BITMAP_THUMBS) ? 1 : 0;
+  const int o_colors = bgr ? 3 : P1.colors;
+  int cmap[4] = {0, 1, 2, 3};
+  if (bgr)
+    for (int c = 0; c < 3; c++)
+      cmap[c] = P1.colors >= 3 ? 2 - c : 0;
+
   if (T.thumb)
     free(T.thumb);
-  T.thumb = (char *)calloc(S.width * S.height, P1.colors);
-  T.tlength = S.width * S.height * P1.colors;
+  T.thumb = (char *)calloc(S.width * S.height, o_colors);
+  T.tlength = S.width * S.height * o_colors;
 
   // from write_tiff_ppm
   {
-    int soff = flip_index(0, 0);
-    int cstep = flip_index(0, 1) - soff;
-    int rstep = flip_index(1, 0) - flip_index(0, S.width);
-
-    for (int rr = 0; rr < S.height; rr++, soff += rstep)
+    const int soff0 = flip_index(0, 0);
+    const int cstep = flip_index(0, 1) - soff0;
+    const int rstep = flip_index(1, 0) - flip_index(0, S.width);
+    const int o_width = S.width, o_height = S.height;
+    const ushort *curve = imgdata.color.curve;
+
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int rr = 0; rr < o_height; rr++)
     {
-      char *ppm = T.thumb + rr * S.width * P1.colors;
-      for (int cc = 0; cc < S.width; cc++, soff += cstep)
-        for (int c = 0; c < P1.colors; c++)
-          ppm[cc * P1.colors + c] =
-              imgdata.color.curve[imgdata.image[soff][c]] >> 8;
+      const ushort(*src)[4] =
+          imgdata.image + soff0 + INT64(rr) * (INT64(o_width) * cstep + rstep);
+      uchar *ppm = (uchar *)T.thumb + size_t(rr) * o_width * o_colors;
+      for (int cc = 0; cc < o_width; cc++, src += cstep, ppm += o_colors)
+        for (int c = 0; c < o_colors; c++)
+          ppm[c] = curve[src[0][cmap[c]]] >> 8;
     }
   }
 
@@ -247,13 +265,65 @@ void LibRaw::kodak_thumb_loader()
   T.theight = S.height;
   S.height = s_height;
 
-  T.tcolors = P1.colors;
+  T.tcolors = o_colors;
   P1.colors = s_colors;
 
   P1.filters = s_filters;
   libraw_internal_data.unpacker_data.load_flags = s_flags;
 }
 
+/*
+ * With LIBRAW_RAWOPTIONS_BGR_BITMAP_THUMBS, turn an 8-bit RGB or grey bitmap
+ * thumbnail that was read from the file as is into packed BGR. Loaders that
+ * convert the pixels anyway write BGR directly.
+ */
+void LibRaw::bitmap_thumb_layout()
+{
+  if (!(imgdata.rawparams.options & LIBRAW_RAWOPTIONS_BGR_BITMAP_THUMBS) ||
+      T.tformat != LIBRAW_THUMBNAIL_BITMAP || !T.thumb)
+    return;
+  const int t_width = T.twidth, t_height = T.theight;
+  const INT64 pixels = INT64(t_width) * t_height;
+  if (T.tcolors == 3 && INT64(T.tlength) >= pixels * 3)
+  {
+    uchar *thumb = (uchar *)T.thumb;
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int row = 0; row < t_height; row++)
+    {
+      uchar *p = thumb + size_t(row) * t_width * 3;
+      for (int col = 0; col < t_width; col++, p += 3)
+      {
+        uchar r = p[0];
+        p[0] = p[2];
+        p[2] = r;
+      }
+    }
+  }
+  else if (T.tcolors == 1 && INT64(T.tlength) >= pixels)
+  {
+    uchar *grey = (uchar *)T.thumb;
+    uchar *bgr = (uchar *)malloc(size_t(pixels) * 3);
+    if (!bgr)
+      throw LIBRAW_EXCEPTION_ALLOC;
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int row = 0; row < t_height; row++)
+    {
+      const uchar *src = grey + size_t(row) * t_width;
+      uchar *dst = bgr + size_t(row) * t_width * 3;
+      for (int col = 0; col < t_width; col++, dst += 3)
+        dst[0] = dst[1] = dst[2] = src[col];
+    }
+    free(T.thumb);
+    T.thumb = (char *)bgr;
+    T.tlength = unsigned(pixels * 3);
+    T.tcolors = 3;
+  }
+}
+
 // ������� thumbnail �� �����, ������ thumb_format � ������������ � ��������
 
 int LibRaw::thumbOK(INT64 maxsz)
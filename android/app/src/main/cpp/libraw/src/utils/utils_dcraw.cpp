@@ -182,8 +182,7 @@ void LibRaw::remove_zeroes()
 }
 void LibRaw::crop_masked_pixels()
 {
-  int row, col;
-  unsigned c, m, zero, val;
+  unsigned c, m, zero;
 #define mblack imgdata.color.black_stat
 
   if (mask[0][3] > 0)
@@ -221,16 +220,77 @@ void LibRaw::crop_masked_pixels()
   }
 mask_set:
   memset(mblack, 0, sizeof mblack);
-  for (zero = m = 0; m < 8; m++)
-    for (row = MAX(mask[m][0], 0); row < MIN(mask[m][2], raw_height); row++)
-      for (col = MAX(mask[m][1], 0); col < MIN(mask[m][3], raw_width); col++)
+  zero = 0;
+  for (m = 0; m < 8; m++)
+  {
+    const int r0 = MAX(mask[m][0], 0), r1 = MIN(mask[m][2], int(raw_height));
+    const int c0 = MAX(mask[m][1], 0), c1 = MIN(mask[m][3], int(raw_width));
+    if (r0 >= r1 || c0 >= c1)
+      continue;
+    /* FC() only depends on column parity within a row, so each row reduces
+       to an even and an odd column sum. unsigned sums wrap the same way in
+       any order. */
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel
+#endif
+    {
+      unsigned sum[4] = {0, 0, 0, 0}, cnt[4] = {0, 0, 0, 0}, zeros = 0;
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp for schedule(static)
+#endif
+      for (int r = r0; r < r1; r++)
       {
         /* No need to subtract margins because full area and active area filters are the same */
-        c = FC(row, col);
-        mblack[c] += val = raw_image[(row)*raw_pitch / 2 + (col)];
-        mblack[4 + c]++;
-        zero += !val;
+        const ushort *src = raw_image + size_t(r) * raw_pitch / 2;
+        unsigned s[2] = {0, 0}, z[2] = {0, 0};
+        int cc = c0;
+        if (cc & 1)
+        {
+          s[1] += src[cc];
+          z[1] += !src[cc];
+          cc++;
+        }
+        unsigned se = 0, so = 0, ze = 0, zo = 0;
+        for (; cc + 1 < c1; cc += 2)
+        {
+          se += src[cc];
+          so += src[cc + 1];
+          ze += !src[cc];
+          zo += !src[cc + 1];
+        }
+        if (cc < c1)
+        {
+          se += src[cc];
+          ze += !src[cc];
+        }
+        s[0] += se;
+        s[1] += so;
+        z[0] += ze;
+        z[1] += zo;
+        for (int p = 0; p < 2; p++)
+        {
+          const int first = c0 + ((c0 & 1) != p);
+          if (first >= c1)
+            continue;
+          const int ci = FC(r, p);
+          sum[ci] += s[p];
+          cnt[ci] += (c1 - first + 1) / 2;
+          zeros += z[p];
+        }
       }
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp critical(crop_masked_pixels)
+#endif
+      {
+        for (int i = 0; i < 4; i++)
+        {
+          mblack[i] += sum[i];
+          mblack[4 + i] += cnt[i];
+        }
+        zero += zeros;
+      }
+    }
+  }
   if (load_raw == &LibRaw::canon_600_load_raw && width < raw_width)
   {
     black = (mblack[0] + mblack[1] + mblack[2] + mblack[3]) /
@@ -0,0 +1,588 @@
+/* -*- C++ -*-
+ * Copyright 2019-2025 LibRaw LLC (info@libraw.org)
+ *
+
+ LibRaw is free software; you can redistribute it and/or modify
+ it under the terms of the one of two licenses as you choose:
+
+1. GNU LESSER GENERAL PUBLIC LICENSE version 2.1
+   (See file LICENSE.LGPL provided in LibRaw distribution archive for details).
+
+2. COMMON DEVELOPMENT AND DISTRIBUTION LICENSE (CDDL) Version 1.0
+   (See file LICENSE.CDDL provided in LibRaw distribution archive for details).
+
+ */
+
+#include "../../internal/libraw_cxx_defs.h"
+#include <vector>
+
+#define EXPORT_BAND 64 /* output rows per band, a multiple of the MCU height */
+#define EXPORT_JPEG_MAX 65500 /* largest JPEG side libjpeg decodes */
+
+/*
+ * dcraw_export_writer() renders the processed image band by band, straight
+ * from imgdata.image, into a TIFF (as dcraw_ppm_tiff_writer()) or a
+ * baseline JPEG. Only one band of output rows is in memory at a time. The
+ * metadata is the tiff_head() set: make, model, date, exposure, GPS and
+ * the output profile. Progress goes to the progress callback as
+ * LIBRAW_PROGRESS_FLIP, one call per band; a non-zero return cancels and
+ * removes the partial file.
+ */
+int LibRaw::dcraw_export_writer(const char *filename, int format, int quality)
+{
+  CHECK_ORDER_LOW(LIBRAW_PROGRESS_LOAD_RAW);
+
+  if (!imgdata.image)
+    return LIBRAW_OUT_OF_ORDER_CALL;
+  if (!filename)
+    return ENOENT;
+  FILE *f = fopen(filename, "wb");
+  if (!f)
+    return errno;
+  int ret = export_writer(f, format, quality);
+  if (fclose(f) && ret == LIBRAW_SUCCESS)
+    ret = LIBRAW_IO_ERROR;
+  if (ret != LIBRAW_SUCCESS)
+    remove(filename);
+  return ret;
+}
+
+#if defined(_WIN32) || defined(WIN32)
+int LibRaw::dcraw_export_writer(const wchar_t *filename, int format,
+                                int quality)
+{
+  CHECK_ORDER_LOW(LIBRAW_PROGRESS_LOAD_RAW);
+
+  if (!imgdata.image)
+    return LIBRAW_OUT_OF_ORDER_CALL;
+  if (!filename)
+    return ENOENT;
+  FILE *f = _wfopen(filename, L"wb");
+  if (!f)
+    return errno;
+  int ret = export_writer(f, format, quality);
+  if (fclose(f) && ret == LIBRAW_SUCCESS)
+    ret = LIBRAW_IO_ERROR;
+  if (ret != LIBRAW_SUCCESS)
+    _wremove(filename);
+  return ret;
+}
+#endif
+
+int LibRaw::export_writer(FILE *f, int format, int quality)
+{
+  if ((imgdata.progress_flags & LIBRAW_PROGRESS_THUMB_MASK) <
+      LIBRAW_PROGRESS_PRE_INTERPOLATE)
+    return LIBRAW_OUT_OF_ORDER_CALL;
+  if (format != LIBRAW_EXPORT_TIFF && format != LIBRAW_EXPORT_JPEG)
+    return LIBRAW_NOT_IMPLEMENTED;
+  if (format == LIBRAW_EXPORT_JPEG &&
+      ((P1.colors != 1 && P1.colors != 3) || S.width > EXPORT_JPEG_MAX ||
+       S.height > EXPORT_JPEG_MAX))
+    return LIBRAW_NOT_IMPLEMENTED;
+
+  /* the sizes copy_mem_image() works with, restored on every exit */
+  const int s_iheight = S.iheight, s_iwidth = S.iwidth;
+  const int s_width = S.width, s_height = S.height;
+  const int s_bps = O.output_bps;
+  try
+  {
+    if (format == LIBRAW_EXPORT_JPEG)
+      O.output_bps = 8;
+    if (libraw_internal_data.output_data.histogram)
+    {
+      int perc = int(S.width * S.height * O.auto_bright_thr);
+      if (IO.fuji_width)
+        perc /= 2;
+      int t_white = output_white_level(perc);
+      gamma_curve(O.gamm[0], O.gamm[1], 2, int((t_white << 3) / O.bright));
+    }
+    S.iheight = S.height;
+    S.iwidth = S.width;
+    if (S.flip & 4)
+      SWAP(S.height, S.width);
+
+    if (format == LIBRAW_EXPORT_TIFF)
+      write_export_tiff(f);
+    else
+      write_export_jpeg(f, quality);
+  }
+  catch (const LibRaw_exceptions &err)
+  {
+    S.iheight = s_iheight;
+    S.iwidth = s_iwidth;
+    S.width = s_width;
+    S.height = s_height;
+    O.output_bps = s_bps;
+    EXCEPTION_HANDLER(err);
+  }
+  catch (const std::bad_alloc &)
+  {
+    S.iheight = s_iheight;
+    S.iwidth = s_iwidth;
+    S.width = s_width;
+    S.height = s_height;
+    O.output_bps = s_bps;
+    EXCEPTION_HANDLER(LIBRAW_EXCEPTION_ALLOC);
+  }
+  S.iheight = s_iheight;
+  S.iwidth = s_iwidth;
+  S.width = s_width;
+  S.height = s_height;
+  O.output_bps = s_bps;
+  return ferror(f) ? LIBRAW_IO_ERROR : LIBRAW_SUCCESS;
+}
+
+void LibRaw::write_export_tiff(FILE *f)
+{
+  struct tiff_hdr th;
+  const unsigned *prof = libraw_internal_data.output_data.oprof;
+  tiff_head(&th, 1);
+  fwrite(&th, sizeof th, 1, f);
+  if (prof)
+    fwrite(prof, ntohl(prof[0]), 1, f);
+
+  const int stride = S.width * P1.colors * O.output_bps / 8;
+  const int bands = (S.height + EXPORT_BAND - 1) / EXPORT_BAND;
+  std::vector<uchar> band(size_t(stride) * EXPORT_BAND);
+  for (int b = 0; b < bands; b++)
+  {
+    RUN_CALLBACK(LIBRAW_PROGRESS_FLIP, b, bands);
+    const int row0 = b * EXPORT_BAND;
+    const int rows = MIN(EXPORT_BAND, int(S.height) - row0);
+    copy_mem_rows(band.data(), stride, 0, row0, rows);
+    fwrite(band.data(), stride, rows, f);
+  }
+}
+
+/* Baseline JPEG: standard quantisation and Huffman tables (ITU T.81 K.1,
+   K.3), natural order index of each zigzag position */
+static const uchar jpeg_zigzag[64] = {
+    0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6,  7,  14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63};
+
+static const uchar jpeg_std_quant[2][64] = {
+    {16, 11, 10, 16, 24,  40,  51,  61,  12, 12, 14, 19, 26,  58,  60,  55,
+     14, 13, 16, 24, 40,  57,  69,  56,  14, 17, 22, 29, 51,  87,  80,  62,
+     18, 22, 37, 56, 68,  109, 103, 77,  24, 35, 55, 64, 81,  104, 113, 92,
+     49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99},
+    {17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99,
+     24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+     99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+     99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99}};
+
+static const uchar jpeg_dc_bits[2][16] = {
+    {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0},
+    {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0}};
+static const uchar jpeg_dc_vals[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+static const uchar jpeg_ac_bits[2][16] = {
+    {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d},
+    {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77}};
+static const uchar jpeg_ac_vals[2][162] = {
+    {0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06,
+     0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+     0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72,
+     0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+     0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45,
+     0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+     0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75,
+     0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+     0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3,
+     0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+     0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9,
+     0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+     0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4,
+     0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa},
+    {0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41,
+     0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+     0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1,
+     0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+     0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44,
+     0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+     0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74,
+     0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+     0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a,
+     0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+     0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
+     0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+     0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4,
+     0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa}};
+
+struct jpeg_huff_t
+{
+  ushort code[256];
+  uchar size[256];
+};
+
+static void jpeg_huff_build(jpeg_huff_t *h, const uchar *bits,
+                            const uchar *vals)
+{
+  memset(h, 0, sizeof(*h));
+  unsigned code = 0;
+  for (int len = 1, k = 0; len <= 16; len++, code <<= 1)
+    for (int i = 0; i < bits[len - 1]; i++, k++)
+    {
+      h->code[vals[k]] = code++;
+      h->size[vals[k]] = len;
+    }
+}
+
+/* entropy coded segment, 0xff bytes stuffed */
+struct jpeg_bits_t
+{
+  std::vector<uchar> out;
+  unsigned acc;
+  int n;
+  jpeg_bits_t() : acc(0), n(0) {}
+  void put(unsigned code, int size)
+  {
+    acc = (acc << size) | (code & ((1u << size) - 1));
+    n += size;
+    while (n >= 8)
+    {
+      const uchar c = uchar(acc >> (n - 8));
+      out.push_back(c);
+      if (c == 0xff)
+        out.push_back(0);
+      n -= 8;
+    }
+    acc &= (1u << n) - 1;
+  }
+  void flush()
+  {
+    if (n)
+      put(0x7f, 8 - n);
+  }
+};
+
+static void jpeg_put_coeff(jpeg_bits_t &bw, const jpeg_huff_t &h, int run,
+                           int v)
+{
+  int nb = 0;
+  for (int t = v < 0 ? -v : v; t; t >>= 1)
+    nb++;
+  const int sym = (run << 4) | nb;
+  bw.put(h.code[sym], h.size[sym]);
+  if (nb)
+    bw.put(v < 0 ? v - 1 : v, nb);
+}
+
+static void jpeg_encode_block(jpeg_bits_t &bw, const short *zz, int *pred,
+                              const jpeg_huff_t &dc, const jpeg_huff_t &ac)
+{
+  jpeg_put_coeff(bw, dc, 0, zz[0] - *pred);
+  *pred = zz[0];
+  int run = 0;
+  for (int k = 1; k < 64; k++)
+  {
+    if (!zz[k])
+    {
+      run++;
+      continue;
+    }
+    for (; run > 15; run -= 16)
+      bw.put(ac.code[0xf0], ac.size[0xf0]);
+    jpeg_put_coeff(bw, ac, run, zz[k]);
+    run = 0;
+  }
+  if (run)
+    bw.put(ac.code[0], ac.size[0]);
+}
+
+/* 1-D AAN DCT down the columns of an 8x8 block, then transposed, so two
+   calls make the 2-D transform. Each column is a vector lane. */
+static void jpeg_fdct_pass(float *d)
+{
+  float o[64];
+  for (int i = 0; i < 8; i++)
+  {
+    const float t0 = d[i] + d[56 + i], t7 = d[i] - d[56 + i];
+    const float t1 = d[8 + i] + d[48 + i], t6 = d[8 + i] - d[48 + i];
+    const float t2 = d[16 + i] + d[40 + i], t5 = d[16 + i] - d[40 + i];
+    const float t3 = d[24 + i] + d[32 + i], t4 = d[24 + i] - d[32 + i];
+
+    const float t10 = t0 + t3, t13 = t0 - t3;
+    const float t11 = t1 + t2, t12 = t1 - t2;
+    const float z1 = (t12 + t13) * 0.707106781f;
+    o[i] = t10 + t11;
+    o[32 + i] = t10 - t11;
+    o[16 + i] = t13 + z1;
+    o[48 + i] = t13 - z1;
+
+    const float t20 = t4 + t5, t21 = t5 + t6, t22 = t6 + t7;
+    const float z5 = (t20 - t22) * 0.382683433f;
+    const float z2 = 0.541196100f * t20 + z5;
+    const float z4 = 1.306562965f * t22 + z5;
+    const float z3 = t21 * 0.707106781f;
+    const float z11 = t7 + z3, z13 = t7 - z3;
+    o[40 + i] = z13 + z2;
+    o[24 + i] = z13 - z2;
+    o[8 + i] = z11 + z4;
+    o[56 + i] = z11 - z4;
+  }
+  for (int r = 0; r < 8; r++)
+    for (int c = 0; c < 8; c++)
+      d[c * 8 + r] = o[r * 8 + c];
+}
+
+/* level shifted samples of plane (stride pitch) at x0, y0 to zigzag ordered
+   quantised coefficients; qdiv is 1 / (quant * AAN scale) */
+static void jpeg_block(const float *plane, int pitch, int x0, int y0,
+                       const float *qdiv, short *zz)
+{
+  float d[64], q[64];
+  for (int r = 0; r < 8; r++)
+    for (int c = 0; c < 8; c++)
+      d[r * 8 + c] = plane[size_t(y0 + r) * pitch + x0 + c];
+  jpeg_fdct_pass(d);
+  jpeg_fdct_pass(d);
+  for (int i = 0; i < 64; i++)
+  {
+    const float v = d[i] * qdiv[i];
+    q[i] = LIM(v < 0 ? v - 0.5f : v + 0.5f, -1023.f, 1023.f);
+  }
+  for (int k = 0; k < 64; k++)
+    zz[k] = short(q[jpeg_zigzag[k]]);
+}
+
+static void jpeg_marker(std::vector<uchar> &h, int marker, int length)
+{
+  h.push_back(0xff);
+  h.push_back(uchar(marker));
+  h.push_back(uchar(length >> 8));
+  h.push_back(uchar(length));
+}
+
+void LibRaw::write_export_jpeg(FILE *f, int quality)
+{
+  const int w = S.width, h = S.height;
+  const int ncomp = P1.colors;
+  /* 4:2:0 chroma below quality 90, full resolution chroma above */
+  const int sub = ncomp == 3 && quality < 90 ? 2 : 1;
+  const int mcu = 8 * sub;
+  const int mcus_x = (w + mcu - 1) / mcu;
+  const int pitch = mcus_x * mcu;
+  const int cpitch = pitch / sub;
+  const int blocks = ncomp == 3 ? sub * sub + 2 : 1; /* per MCU */
+
+  /* quantisation tables, and their reciprocals scaled for the AAN DCT */
+  static const float aan[8] = {1.0f,         1.387039845f, 1.306562965f,
+                               1.175875602f, 1.0f,         0.785694958f,
+                               0.541196100f, 0.275899379f};
+  uchar qt[2][64];
+  float qdiv[2][64];
+  const int qual = LIM(quality, 1, 100);
+  const int scale = qual < 50 ? 5000 / qual : 200 - qual * 2;
+  for (int t = 0; t < 2; t++)
+    for (int i = 0; i < 64; i++)
+    {
+      qt[t][i] = uchar(LIM((jpeg_std_quant[t][i] * scale + 50) / 100, 1, 255));
+      qdiv[t][i] = 1.f / (qt[t][i] * aan[i / 8] * aan[i % 8] * 8.f);
+    }
+  jpeg_huff_t dc[2], ac[2];
+  for (int t = 0; t < 2; t++)
+  {
+    jpeg_huff_build(&dc[t], jpeg_dc_bits[t], jpeg_dc_vals);
+    jpeg_huff_build(&ac[t], jpeg_ac_bits[t], jpeg_ac_vals[t]);
+  }
+
+  /* SOI, Exif from tiff_head() (pixels are already rotated), ICC profile */
+  std::vector<uchar> hdr;
+  hdr.push_back(0xff);
+  hdr.push_back(0xd8);
+  {
+    struct tiff_hdr th;
+    const int s_flip = S.flip;
+    S.flip = 0;
+    tiff_head(&th, 0);
+    S.flip = s_flip;
+    jpeg_marker(hdr, 0xe1, int(8 + sizeof th));
+    hdr.insert(hdr.end(), "Exif\0", "Exif\0" + 6);
+    hdr.insert(hdr.end(), (uchar *)&th, (uchar *)&th + sizeof th);
+  }
+  if (const unsigned *prof = libraw_internal_data.output_data.oprof)
+  {
+    const int psize = ntohl(prof[0]);
+    const int chunks = (psize + 65518) / 65519;
+    for (int i = 0; i < chunks; i++)
+    {
+      const int len = MIN(65519, psize - i * 65519);
+      jpeg_marker(hdr, 0xe2, 16 + len);
+      hdr.insert(hdr.end(), "ICC_PROFILE", "ICC_PROFILE" + 12);
+      hdr.push_back(uchar(i + 1));
+      hdr.push_back(uchar(chunks));
+      hdr.insert(hdr.end(), (uchar *)prof + i * 65519,
+                 (uchar *)prof + i * 65519 + len);
+    }
+  }
+  const int ntables = ncomp == 3 ? 2 : 1;
+  jpeg_marker(hdr, 0xdb, 2 + 65 * ntables);
+  for (int t = 0; t < ntables; t++)
+  {
+    hdr.push_back(uchar(t));
+    for (int k = 0; k < 64; k++)
+      hdr.push_back(qt[t][jpeg_zigzag[k]]);
+  }
+  jpeg_marker(hdr, 0xc0, 8 + 3 * ncomp);
+  hdr.push_back(8);
+  hdr.push_back(uchar(h >> 8));
+  hdr.push_back(uchar(h));
+  hdr.push_back(uchar(w >> 8));
+  hdr.push_back(uchar(w));
+  hdr.push_back(uchar(ncomp));
+  for (int c = 0; c < ncomp; c++)
+  {
+    hdr.push_back(uchar(c + 1));
+    hdr.push_back(uchar(c ? 0x11 : sub * 0x11));
+    hdr.push_back(uchar(c ? 1 : 0));
+  }
+  for (int t = 0; t < ntables; t++)
+  {
+    int nvals = 0;
+    for (int i = 0; i < 16; i++)
+      nvals += jpeg_dc_bits[t][i];
+    jpeg_marker(hdr, 0xc4, 2 + 17 + nvals);
+    hdr.push_back(uchar(t));
+    hdr.insert(hdr.end(), jpeg_dc_bits[t], jpeg_dc_bits[t] + 16);
+    hdr.insert(hdr.end(), jpeg_dc_vals, jpeg_dc_vals + nvals);
+    nvals = 0;
+    for (int i = 0; i < 16; i++)
+      nvals += jpeg_ac_bits[t][i];
+    jpeg_marker(hdr, 0xc4, 2 + 17 + nvals);
+    hdr.push_back(uchar(0x10 | t));
+    hdr.insert(hdr.end(), jpeg_ac_bits[t], jpeg_ac_bits[t] + 16);
+    hdr.insert(hdr.end(), jpeg_ac_vals[t], jpeg_ac_vals[t] + nvals);
+  }
+  jpeg_marker(hdr, 0xda, 6 + 2 * ncomp);
+  hdr.push_back(uchar(ncomp));
+  for (int c = 0; c < ncomp; c++)
+  {
+    hdr.push_back(uchar(c + 1));
+    hdr.push_back(uchar(c ? 0x11 : 0));
+  }
+  hdr.push_back(0);
+  hdr.push_back(63);
+  hdr.push_back(0);
+  fwrite(hdr.data(), 1, hdr.size(), f);
+
+  /* per band: output rows, level shifted Y/Cb/Cr planes padded to whole
+     MCUs, then quantised coefficients of every block */
+  const int stride = w * ncomp;
+  std::vector<uchar> rgb(size_t(stride) * EXPORT_BAND);
+  std::vector<float> planes(size_t(pitch) * EXPORT_BAND * ncomp);
+  std::vector<float> chroma(sub > 1 ? size_t(cpitch) * EXPORT_BAND : 0);
+  std::vector<short> coeffs(size_t(mcus_x) * (EXPORT_BAND / mcu) * blocks *
+                            64);
+  float *yp = planes.data();
+  float *cbp = yp + size_t(pitch) * EXPORT_BAND;
+  float *crp = cbp + size_t(pitch) * EXPORT_BAND;
+  jpeg_bits_t bw;
+  int pred[3] = {0, 0, 0};
+
+  const int bands = (h + EXPORT_BAND - 1) / EXPORT_BAND;
+  for (int b = 0; b < bands; b++)
+  {
+    RUN_CALLBACK(LIBRAW_PROGRESS_FLIP, b, bands);
+    const int row0 = b * EXPORT_BAND;
+    const int rows = MIN(EXPORT_BAND, h - row0);
+    const int mcus_y = (rows + mcu - 1) / mcu;
+    const int prows = mcus_y * mcu;
+    copy_mem_rows(rgb.data(), stride, 0, row0, rows);
+
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int r = 0; r < prows; r++)
+    {
+      /* bottom padding repeats the last row, right padding the last pixel */
+      const uchar *src = rgb.data() + size_t(MIN(r, rows - 1)) * stride;
+      float *py = yp + size_t(r) * pitch;
+      if (ncomp == 1)
+      {
+        for (int x = 0; x < w; x++)
+          py[x] = src[x] - 128.f;
+      }
+      else
+      {
+        float *pcb = cbp + size_t(r) * pitch, *pcr = crp + size_t(r) * pitch;
+        for (int x = 0; x < w; x++)
+        {
+          const float rr = src[x * 3], gg = src[x * 3 + 1],
+                      bb = src[x * 3 + 2];
+          py[x] = 0.299f * rr + 0.587f * gg + 0.114f * bb - 128.f;
+          pcb[x] = -0.168735892f * rr - 0.331264108f * gg + 0.5f * bb;
+          pcr[x] = 0.5f * rr - 0.418687589f * gg - 0.081312411f * bb;
+        }
+        for (int x = w; x < pitch; x++)
+        {
+          pcb[x] = pcb[w - 1];
+          pcr[x] = pcr[w - 1];
+        }
+      }
+      for (int x = w; x < pitch; x++)
+        py[x] = py[w - 1];
+    }
+
+    if (sub > 1)
+    {
+      /* 2x2 box filtered chroma, Cb then Cr, back into the Cb/Cr planes */
+      for (int p = 0; p < 2; p++)
+      {
+        float *pl = p ? crp : cbp;
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+        for (int r = 0; r < prows / 2; r++)
+        {
+          const float *s0 = pl + size_t(r * 2) * pitch, *s1 = s0 + pitch;
+          float *dst = chroma.data() + size_t(r) * cpitch;
+          for (int x = 0; x < cpitch; x++)
+            dst[x] = 0.25f * (s0[x * 2] + s0[x * 2 + 1] + s1[x * 2] +
+                              s1[x * 2 + 1]);
+        }
+        memcpy(pl, chroma.data(), sizeof(float) * cpitch * (prows / 2));
+      }
+    }
+
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int m = 0; m < mcus_x * mcus_y; m++)
+    {
+      const int mx = m % mcus_x, my = m / mcus_x;
+      short *zz = coeffs.data() + size_t(m) * blocks * 64;
+      for (int by = 0; by < sub; by++)
+        for (int bx = 0; bx < sub; bx++, zz += 64)
+          jpeg_block(yp, pitch, mx * mcu + bx * 8, my * mcu + by * 8,
+                     qdiv[0], zz);
+      if (ncomp == 3)
+      {
+        jpeg_block(cbp, cpitch, mx * 8, my * 8, qdiv[1], zz);
+        jpeg_block(crp, cpitch, mx * 8, my * 8, qdiv[1], zz + 64);
+      }
+    }
+
+    /* Huffman coding is sequential (DC prediction, bit stream) */
+    for (int m = 0; m < mcus_x * mcus_y; m++)
+    {
+      const short *zz = coeffs.data() + size_t(m) * blocks * 64;
+      for (int k = 0; k < sub * sub; k++, zz += 64)
+        jpeg_encode_block(bw, zz, &pred[0], dc[0], ac[0]);
+      if (ncomp == 3)
+      {
+        jpeg_encode_block(bw, zz, &pred[1], dc[1], ac[1]);
+        jpeg_encode_block(bw, zz + 64, &pred[2], dc[1], ac[1]);
+      }
+    }
+    fwrite(bw.out.data(), 1, bw.out.size(), f);
+    bw.out.clear();
+  }
+  bw.flush();
+  bw.out.push_back(0xff);
+  bw.out.push_back(0xd9);
+  fwrite(bw.out.data(), 1, bw.out.size(), f);
+}
+#undef EXPORT_BAND
@@ -161,21 +161,13 @@ void LibRaw::write_ppm_tiff()
         struct tiff_hdr th;
         ushort *ppm2;
         int c, row, col, soff, rstep, cstep;
-        int perc, val, total, t_white = 0x2000;
+        int perc, t_white;
 
         perc = int(width * height * auto_bright_thr);
 
         if (fuji_width)
             perc /= 2;
-        if (!((highlight & ~2) || no_auto_bright))
-            for (t_white = c = 0; c < colors; c++)
-            {
-                for (val = 0x2000, total = 0; --val > 32;)
-                    if ((total += histogram[c][val]) > perc)
-                        break;
-                if (t_white < val)
-                    t_white = val;
-            }
+        t_white = output_white_level(perc);
         gamma_curve(gamm[0], gamm[1], 2, int((t_white << 3) / bright));
         iheight = height;
         iwidth = width;
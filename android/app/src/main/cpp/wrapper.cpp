@@ -1,8 +1,17 @@
 #include "libraw/libraw.h"
+#include <algorithm>
+#include <atomic>
 #include <cstring>
 #include <cstdlib>
+#include <new>
+#include <string>
+#include <thread>
 #include <vector>
 #include <android/log.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #define LOG_TAG "NativeLib"
 #define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
@@ -10,21 +19,117 @@
 
 #define EXPORT __attribute__((visibility("default"))) __attribute__((used))
 
+#define PYRAMID_TILE 256 // Tile edge of the preview pyramid levels
+#define RENDER_MAX_OUTPUTS 4 // Outputs of one render_outputs call
+
+// RenderSpec formats
+#define RENDER_BGR 0 // Packed BGR, as bitmap thumbnails
+#define RENDER_BGR_PYRAMID 1 // Packed BGR with pyramid, as get_preview
+#define RENDER_RGBA 2 // Packed RGBA, alpha 255
+
+// ScanEntry kinds
+#define SCAN_RAW 0 // Raw file signature, or opened by LibRaw with SCAN_CAPTURE_TIME
+#define SCAN_BITMAP 1 // JPEG, PNG or WebP
+// scan_directory flags
+#define SCAN_CAPTURE_TIME 1 // Identify the headers for capture times
+#define SCAN_MAX_THREADS 8 // Files scanned at once
+
+#define PREVIEW_BAND_ROWS 256 // Sensor rows per band of a progressive get_preview
+
 extern "C" {
 
-    struct ThumbnailResult {
-        uint8_t* data;
+    struct ImageResult {
+        uint8_t* data; // RGB data
         int size;
         int width;
         int height;
-        int format; // 0: JPEG, 1: RGB Bitmap
+        uint32_t* histogram; // 3 x 256 bins (R, G, B), free with free_buffer
+        uint8_t* pyramid; // BGR levels 1/2, 1/4, ... back to back, free with free_buffer
+        int levels; // Pyramid levels including the full-size image
     };
 
-    struct ImageResult {
-        uint8_t* data; // RGB data
+    struct ThumbnailResult {
+        uint8_t* data;
         int size;
         int width;
         int height;
+        int format; // 0: JPEG, 1: RGB Bitmap
+        // Orientation of the source as LibRaw flip (0: none, 3: 180, 5: 90 CCW,
+        // 6: 90 CW). Already applied to bitmaps; JPEG data carries it as its
+        // Exif orientation, which decoders apply while decoding.
+        int flip;
+        // With want_preview, when the thumbnail had to be rendered from the
+        // raw data: that half-size render as get_preview returns it
+        ImageResult preview;
+    };
+
+    // One output of render_outputs
+    struct RenderSpec {
+        int fit_width; // Scale down to fit fit_width x fit_height, 0 for full size
+        int fit_height;
+        int format; // RENDER_BGR, RENDER_BGR_PYRAMID or RENDER_RGBA
+    };
+
+    struct RenderOutputs {
+        ImageResult outputs[RENDER_MAX_OUTPUTS]; // In spec order; the largest has the histogram
+        int count;
+    };
+
+    // Settings that may change between renders of a develop session
+    struct DevelopParams {
+        float wb[4]; // R, G, B, G2 multipliers, all 0 for the camera white balance
+        float exposure; // Linear exposure shift, 1.0 for none (0.25 .. 8)
+        float exposure_preserve; // Keep highlights when brightening (0 .. 1)
+        int highlight; // 0: clip, 1: unclip, 2: blend, 3..9: rebuild
+        float gamma[2]; // Output curve power and toe slope, 2.222 4.5 is BT.709
+        float bright; // Output brightness, 1.0 by default
+    };
+
+    // Progress and cancel flag of one export_file call, shared with the caller
+    // while the export runs on another thread
+    struct ExportJob {
+        volatile int progress; // 0 .. 1000, written by the export
+        volatile int cancel; // Set non-zero to stop; the partial file is removed
+    };
+
+    // Rows of a full-size get_preview as they are rendered, scaled down to fit
+    // fit_width x fit_height and turned upright, for showing the preview fill
+    // in meanwhile. The caller polls bands and copies the filled part, which
+    // only grows.
+    struct PreviewBands {
+        uint8_t* pixels; // BGR, fit_width * fit_height * 3 bytes from the caller
+        int fit_width;
+        int fit_height;
+        volatile int width; // Scaled image, rows width * 3 bytes apart; set with the first band
+        volatile int height;
+        volatile int filled_x; // Part of the scaled image rendered so far
+        volatile int filled_y;
+        volatile int filled_width;
+        volatile int filled_height;
+        volatile int bands; // Bumped after each band
+        volatile int cancel; // Set non-zero to stop the render
+    };
+
+    // One file of a scan_directory result
+    struct ScanEntry {
+        int name; // Offset of the file name in ScanResult.names
+        int kind; // SCAN_RAW or SCAN_BITMAP
+        int64_t captured; // Capture time in seconds since 1970, 0 if unknown
+        int64_t modified; // Modification time in seconds since 1970
+    };
+
+    struct ScanResult {
+        ScanEntry* entries; // By capture time (modification time if unknown), then name
+        int count;
+        char* names; // NUL-terminated UTF-8 file names; free both with free_buffer
+    };
+
+    // An unpacked raw kept open between renders. LibRaw keeps the black
+    // subtracted image (develop_cache), so a render only redoes white balance
+    // onwards.
+    struct DevelopSession {
+        LibRaw processor;
+        std::vector<uint8_t> buffer; // File contents when opened from memory
     };
 
     // Helper function to free memory
@@ -34,13 +139,58 @@ extern "C" {
         }
     }
 
-    ThumbnailResult process_thumbnail(LibRaw& RawProcessor) {
-        ThumbnailResult result = {nullptr, 0, 0, 0, 0};
+    // Scale a rendered image or bitmap thumbnail down to fit within
+    // fit_width x fit_height, keeping the aspect ratio, and turn it upright by
+    // flip (as imgdata.sizes.flip) in the same pass. Returns the image itself
+    // when there is nothing to do, otherwise frees it.
+    libraw_processed_image_t* fit_image(LibRaw& RawProcessor, libraw_processed_image_t* image,
+                                        int fit_width, int fit_height, int flip = 0) {
+        if (!image || image->type != LIBRAW_IMAGE_BITMAP) {
+            return image;
+        }
+        // Upright size
+        int width = (flip & 4) ? image->height : image->width;
+        int height = (flip & 4) ? image->width : image->height;
+        if (fit_width > 0 && fit_height > 0 && (width > fit_width || height > fit_height)) {
+            double scale = std::min((double)fit_width / width, (double)fit_height / height);
+            width = std::max(1, std::min(fit_width, (int)(width * scale + 0.5)));
+            height = std::max(1, std::min(fit_height, (int)(height * scale + 0.5)));
+        } else if (!flip) {
+            return image;
+        }
+        libraw_processed_image_t* scaled =
+            RawProcessor.resample_mem_image(image, width, height, nullptr, flip);
+        if (!scaled) {
+            return image;
+        }
+        LibRaw::dcraw_clear_mem(image);
+        return scaled;
+    }
+
+    void render_outputs_from(LibRaw& RawProcessor, const RenderSpec* specs, int count,
+                             RenderOutputs* result);
+    void set_preview_params(LibRaw& RawProcessor, int half_size);
 
-        // Try to unpack thumbnail
+    ThumbnailResult process_thumbnail(LibRaw& RawProcessor, int fit_width, int fit_height,
+                                      int want_preview) {
+        ThumbnailResult result = {nullptr, 0, 0, 0, 0, 0, {nullptr, 0, 0, 0, nullptr, nullptr, 1}};
+
+        // Try to unpack thumbnail. Bitmap thumbnails are converted straight
+        // to BGR, as the BMP the caller wraps them in expects, and all come
+        // in sensor orientation; JPEGs get the orientation in their Exif.
+        RawProcessor.imgdata.rawparams.options |= LIBRAW_RAWOPTIONS_BGR_BITMAP_THUMBS |
+                                                  LIBRAW_RAWOPTIONS_NO_ROTATE_FOR_KODAK_THUMBNAILS |
+                                                  LIBRAW_RAWOPTIONS_THUMB_EXIF_ORIENTATION;
+        result.flip = RawProcessor.imgdata.sizes.flip;
         if (RawProcessor.unpack_thumb() == LIBRAW_SUCCESS) {
             int errc = 0;
             libraw_processed_image_t *thumb = RawProcessor.dcraw_make_mem_thumb(&errc);
+            if (thumb && thumb->type == LIBRAW_IMAGE_BITMAP && thumb->colors != 3) {
+                // Not RGB or grey: render from the raw data instead
+                LibRaw::dcraw_clear_mem(thumb);
+                thumb = nullptr;
+            }
+            thumb = fit_image(RawProcessor, thumb, fit_width, fit_height, result.flip);
             
             if (thumb) {
                 // Copy data
@@ -65,14 +215,39 @@ extern "C" {
             LOGD("unpack_thumb failed");
         }
         
-        // Fallback: Generate preview from raw data
+        // Fallback: Generate preview from raw data. When the caller is about
+        // to show the preview anyway, render it with the preview settings and
+        // hand back both from the one demosaic.
+        if (want_preview) {
+            set_preview_params(RawProcessor, 1);
+            if (RawProcessor.unpack() != LIBRAW_SUCCESS ||
+                RawProcessor.dcraw_process() != LIBRAW_SUCCESS) {
+                LOGD("preview render failed");
+                return result;
+            }
+            const RenderSpec specs[2] = {{fit_width, fit_height, RENDER_BGR},
+                                         {0, 0, RENDER_BGR_PYRAMID}};
+            RenderOutputs outputs;
+            render_outputs_from(RawProcessor, specs, 2, &outputs);
+            const ImageResult& thumb = outputs.outputs[0];
+            result.format = 1; // RGB Bitmap
+            result.data = thumb.data;
+            result.size = thumb.size;
+            result.width = thumb.width;
+            result.height = thumb.height;
+            result.preview = outputs.outputs[1];
+            return result;
+        }
+
         RawProcessor.imgdata.params.use_camera_wb = 1;
         RawProcessor.imgdata.params.half_size = 1; // Half size for speed
         RawProcessor.imgdata.params.output_bps = 8;
+        RawProcessor.imgdata.params.auto_bright_quant = 24; // Share cached output curves
         
         if (RawProcessor.unpack() == LIBRAW_SUCCESS) {
             if (RawProcessor.dcraw_process() == LIBRAW_SUCCESS) {
-                libraw_processed_image_t *image = RawProcessor.dcraw_make_mem_image();
+                libraw_processed_image_t *image = fit_image(
+                    RawProcessor, RawProcessor.dcraw_make_mem_image(), fit_width, fit_height);
                 
                 if (image) {
                     result.format = 1; // RGB Bitmap
@@ -105,52 +280,316 @@ extern "C" {
         return result;
     }
 
-    EXPORT ThumbnailResult get_thumbnail(const char* file_path) {
+    // fit_width/fit_height: scale bitmap results down to fit, 0 for full size.
+    // want_preview: see ThumbnailResult.preview
+    // Files LibRaw cannot open: the Exif thumbnail of a plain JPEG, read
+    // from the header without decoding the picture. It keeps the
+    // orientation in its Exif. Empty for anything else, which the caller
+    // decodes itself.
+    ThumbnailResult process_jpeg_thumbnail(LibRaw& RawProcessor,
+                                           LibRaw_abstract_datastream& stream) {
+        ThumbnailResult result = {nullptr, 0, 0, 0, 0, 0, {nullptr, 0, 0, 0, nullptr, nullptr, 1}};
+        if (RawProcessor.open_jpeg_thumb(&stream) != LIBRAW_SUCCESS) {
+            return result;
+        }
+        RawProcessor.imgdata.rawparams.options |= LIBRAW_RAWOPTIONS_THUMB_EXIF_ORIENTATION;
+        int errc = 0;
+        libraw_processed_image_t *thumb = RawProcessor.dcraw_make_mem_thumb(&errc);
+        if (thumb) {
+            result.data = (uint8_t*)malloc(thumb->data_size);
+            if (result.data) {
+                memcpy(result.data, thumb->data, thumb->data_size);
+                result.size = thumb->data_size;
+            }
+            result.format = 0; // JPEG
+            result.flip = RawProcessor.imgdata.sizes.flip;
+            LibRaw::dcraw_clear_mem(thumb);
+        }
+        return result;
+    }
+
+    EXPORT ThumbnailResult get_thumbnail(const char* file_path, int fit_width, int fit_height,
+                                         int want_preview) {
         LibRaw RawProcessor;
         int ret = RawProcessor.open_file(file_path);
         if (ret != LIBRAW_SUCCESS) {
-            LOGE("open_file failed: %d for %s", ret, file_path);
-            return {nullptr, 0, 0, 0, 0};
+            LibRaw_bigfile_datastream stream(file_path);
+            ThumbnailResult result = process_jpeg_thumbnail(RawProcessor, stream);
+            if (!result.data) {
+                LOGE("open_file failed: %d for %s", ret, file_path);
+            }
+            return result;
         }
         
-        ThumbnailResult result = process_thumbnail(RawProcessor);
+        ThumbnailResult result = process_thumbnail(RawProcessor, fit_width, fit_height, want_preview);
         RawProcessor.recycle();
         return result;
     }
 
-    EXPORT ThumbnailResult get_thumbnail_from_buffer(uint8_t* buffer, size_t size) {
+    EXPORT ThumbnailResult get_thumbnail_from_buffer(uint8_t* buffer, size_t size,
+                                                     int fit_width, int fit_height,
+                                                     int want_preview) {
         LibRaw RawProcessor;
         int ret = RawProcessor.open_buffer(buffer, size);
         if (ret != LIBRAW_SUCCESS) {
-             LOGE("open_buffer failed: %d", ret);
-             return {nullptr, 0, 0, 0, 0};
+             LibRaw_buffer_datastream stream(buffer, size);
+             ThumbnailResult result = process_jpeg_thumbnail(RawProcessor, stream);
+             if (!result.data) {
+                 LOGE("open_buffer failed: %d", ret);
+             }
+             return result;
         }
 
-        ThumbnailResult result = process_thumbnail(RawProcessor);
+        ThumbnailResult result = process_thumbnail(RawProcessor, fit_width, fit_height, want_preview);
         RawProcessor.recycle();
         return result;
     }
 
-    ImageResult process_preview(LibRaw& RawProcessor, int half_size) {
-        ImageResult result = {nullptr, 0, 0, 0};
+    // Fold LibRaw's linear output histogram (8192 bins per channel) through
+    // the output curve into 256 bins per channel of the 8-bit image.
+    uint32_t* output_histogram(LibRaw& RawProcessor) {
+        int (*hist)[LIBRAW_HISTOGRAM_SIZE] =
+            RawProcessor.get_internal_data_pointer()->output_data.histogram;
+        if (!hist) {
+            return nullptr;
+        }
+        uint32_t* bins = (uint32_t*)calloc(3 * 256, sizeof(uint32_t));
+        if (!bins) {
+            return nullptr;
+        }
+        const ushort* curve = RawProcessor.imgdata.color.curve;
+        for (int b = 0; b < LIBRAW_HISTOGRAM_SIZE; b++) {
+            int bin = curve[(b << 3) | 4] >> 8;
+            for (int c = 0; c < 3; c++) {
+                bins[c * 256 + bin] += hist[c][b];
+            }
+        }
+        return bins;
+    }
 
-        // Set parameters for speed, sacrificing some quality
-        RawProcessor.imgdata.params.use_camera_wb = 1;
-        RawProcessor.imgdata.params.half_size = half_size; // 1: Half size, 0: Full size
-        RawProcessor.imgdata.params.output_bps = 8; // 8-bit output
-        RawProcessor.imgdata.params.output_color = 1; // sRGB
+    // Number of pyramid levels, counting the full-size image, until a level
+    // fits in one tile.
+    int pyramid_levels(int width, int height) {
+        int levels = 1;
+        while (width > PYRAMID_TILE || height > PYRAMID_TILE) {
+            width = (width + 1) / 2;
+            height = (height + 1) / 2;
+            levels++;
+        }
+        return levels;
+    }
 
-        if (RawProcessor.unpack() != LIBRAW_SUCCESS) {
-            return result;
+    // 2x2 box filter of two BGR rows into one row of the next level. An odd
+    // last column or row is averaged with itself.
+    void pyramid_row(const uint8_t* row0, const uint8_t* row1, int width, uint8_t* dst) {
+        const int half = width / 2;
+        for (int x = 0; x < half; x++) {
+            const uint8_t* a = row0 + x * 6;
+            const uint8_t* b = row1 + x * 6;
+            uint8_t* d = dst + x * 3;
+            d[0] = (uint8_t)((a[0] + a[3] + b[0] + b[3] + 2) >> 2);
+            d[1] = (uint8_t)((a[1] + a[4] + b[1] + b[4] + 2) >> 2);
+            d[2] = (uint8_t)((a[2] + a[5] + b[2] + b[5] + 2) >> 2);
         }
-        
-        // dcraw_process
-        if (RawProcessor.dcraw_process() != LIBRAW_SUCCESS) {
-            return result;
+        if (width & 1) {
+            const int i = (width - 1) * 3;
+            for (int c = 0; c < 3; c++) {
+                dst[half * 3 + c] = (uint8_t)((row0[i + c] + row1[i + c] + 1) >> 1);
+            }
+        }
+    }
+
+    // Copy an RGB image to BGR and build the 1/2 level from each row pair
+    // while it is in cache, then the smaller levels from the 1/2 one.
+    uint8_t* copy_bgr_with_pyramid(uint8_t* dst, const uint8_t* src, int width, int height,
+                                   int* levels) {
+        *levels = pyramid_levels(width, height);
+        size_t total = 0;
+        for (int l = 1, w = width, h = height; l < *levels; l++) {
+            w = (w + 1) / 2;
+            h = (h + 1) / 2;
+            total += (size_t)w * h * 3;
+        }
+        uint8_t* pyramid = total ? (uint8_t*)malloc(total) : nullptr;
+        if (!pyramid) {
+            *levels = 1;
+        }
+
+        const size_t stride = (size_t)width * 3;
+        const int half_width = (width + 1) / 2;
+        for (int y = 0; y < height; y += 2) {
+            const int rows = y + 1 < height ? 2 : 1;
+            for (int r = 0; r < rows; r++) {
+                const uint8_t* s = src + (y + r) * stride;
+                uint8_t* d = dst + (y + r) * stride;
+                for (int x = 0; x < width * 3; x += 3) {
+                    d[x + 0] = s[x + 2]; // B
+                    d[x + 1] = s[x + 1]; // G
+                    d[x + 2] = s[x + 0]; // R
+                }
+            }
+            if (pyramid) {
+                pyramid_row(dst + y * stride, dst + (y + rows - 1) * stride, width,
+                            pyramid + (size_t)(y / 2) * half_width * 3);
+            }
+        }
+
+        uint8_t* level = pyramid;
+        for (int l = 2, w = half_width, h = (height + 1) / 2; l < *levels; l++) {
+            uint8_t* next = level + (size_t)w * h * 3;
+            for (int y = 0; y < h; y += 2) {
+                pyramid_row(level + (size_t)y * w * 3,
+                            level + (size_t)(y + 1 < h ? y + 1 : y) * w * 3, w,
+                            next + (size_t)(y / 2) * ((w + 1) / 2) * 3);
+            }
+            level = next;
+            w = (w + 1) / 2;
+            h = (h + 1) / 2;
+        }
+        return pyramid;
+    }
+
+    // Output size of a width x height image scaled down to fit fit_width x
+    // fit_height, as fit_image() makes it
+    void fit_size(int width, int height, int fit_width, int fit_height,
+                  int* out_width, int* out_height) {
+        *out_width = width;
+        *out_height = height;
+        if (fit_width <= 0 || fit_height <= 0 || (width <= fit_width && height <= fit_height)) {
+            return;
+        }
+        double scale = std::min((double)fit_width / width, (double)fit_height / height);
+        *out_width = std::max(1, std::min(fit_width, (int)(width * scale + 0.5)));
+        *out_height = std::max(1, std::min(fit_height, (int)(height * scale + 0.5)));
+    }
+
+    // Convert an 8-bit RGB image into an ImageResult of the given format
+    void fill_render_output(ImageResult* out, const libraw_processed_image_t* image,
+                            int format) {
+        const int pixels = image->width * image->height;
+        out->width = image->width;
+        out->height = image->height;
+        out->size = format == RENDER_RGBA ? pixels * 4 : pixels * 3;
+        out->data = (uint8_t*)malloc(out->size);
+        if (!out->data) {
+            out->size = 0;
+            return;
+        }
+        const uint8_t* src = image->data;
+        uint8_t* dst = out->data;
+        if (format == RENDER_BGR_PYRAMID) {
+            out->pyramid = copy_bgr_with_pyramid(dst, src, image->width, image->height,
+                                                 &out->levels);
+        } else if (format == RENDER_RGBA) {
+            for (int i = 0; i < pixels; i++) {
+                dst[i * 4 + 0] = src[i * 3 + 0];
+                dst[i * 4 + 1] = src[i * 3 + 1];
+                dst[i * 4 + 2] = src[i * 3 + 2];
+                dst[i * 4 + 3] = 255;
+            }
+        } else {
+            for (int i = 0; i < pixels; i++) {
+                dst[i * 3 + 0] = src[i * 3 + 2]; // B
+                dst[i * 3 + 1] = src[i * 3 + 1]; // G
+                dst[i * 3 + 2] = src[i * 3 + 0]; // R
+            }
+        }
+    }
+
+    // Make every spec'd output from the image dcraw_process() left in
+    // RawProcessor. Outputs are made largest first, each one scaled down from
+    // the previous (smallest so far) rather than from the full render.
+    void render_outputs_from(LibRaw& RawProcessor, const RenderSpec* specs, int count,
+                             RenderOutputs* result) {
+        memset(result, 0, sizeof(*result));
+        result->count = std::max(0, std::min(count, RENDER_MAX_OUTPUTS));
+        for (int i = 0; i < RENDER_MAX_OUTPUTS; i++) {
+            result->outputs[i].levels = 1;
+        }
+
+        libraw_processed_image_t* full = RawProcessor.dcraw_make_mem_image();
+        if (!full || full->type != LIBRAW_IMAGE_BITMAP || full->bits != 8 ||
+            full->colors != 3) {
+            LibRaw::dcraw_clear_mem(full);
+            return;
+        }
+
+        int order[RENDER_MAX_OUTPUTS], widths[RENDER_MAX_OUTPUTS], heights[RENDER_MAX_OUTPUTS];
+        for (int i = 0; i < result->count; i++) {
+            order[i] = i;
+            fit_size(full->width, full->height, specs[i].fit_width, specs[i].fit_height,
+                     &widths[i], &heights[i]);
+        }
+        std::stable_sort(order, order + result->count, [&](int a, int b) {
+            return (long long)widths[a] * heights[a] > (long long)widths[b] * heights[b];
+        });
+
+        libraw_processed_image_t* source = full;
+        for (int k = 0; k < result->count; k++) {
+            const int i = order[k];
+            libraw_processed_image_t* image = source;
+            if (widths[i] != source->width || heights[i] != source->height) {
+                image = RawProcessor.resample_mem_image(source, widths[i], heights[i]);
+                if (!image) {
+                    continue;
+                }
+            }
+            fill_render_output(&result->outputs[i], image, specs[i].format);
+            if (image != source) {
+                if (source != full) {
+                    LibRaw::dcraw_clear_mem(source);
+                }
+                source = image;
+            }
+        }
+        if (source != full) {
+            LibRaw::dcraw_clear_mem(source);
+        }
+        LibRaw::dcraw_clear_mem(full);
+
+        if (result->count > 0) {
+            result->outputs[order[0]].histogram = output_histogram(RawProcessor);
+        }
+    }
+
+    // Copy tile (tile_x, tile_y) of a pyramid level (1 = half size) as packed
+    // BGR into out, which holds at least PYRAMID_TILE^2 pixels. Edge tiles
+    // are smaller; their size is returned in tile_width/tile_height.
+    EXPORT int get_pyramid_tile(const uint8_t* pyramid, int width, int height, int level,
+                                int tile_x, int tile_y, uint8_t* out,
+                                int* tile_width, int* tile_height) {
+        if (!pyramid || level < 1 || level >= pyramid_levels(width, height) ||
+            tile_x < 0 || tile_y < 0) {
+            return -1;
+        }
+        const uint8_t* src = pyramid;
+        int w = (width + 1) / 2, h = (height + 1) / 2;
+        for (int l = 1; l < level; l++) {
+            src += (size_t)w * h * 3;
+            w = (w + 1) / 2;
+            h = (h + 1) / 2;
+        }
+        const int x0 = tile_x * PYRAMID_TILE, y0 = tile_y * PYRAMID_TILE;
+        if (x0 >= w || y0 >= h) {
+            return -1;
+        }
+        *tile_width = w - x0 < PYRAMID_TILE ? w - x0 : PYRAMID_TILE;
+        *tile_height = h - y0 < PYRAMID_TILE ? h - y0 : PYRAMID_TILE;
+        for (int y = 0; y < *tile_height; y++) {
+            memcpy(out + (size_t)y * *tile_width * 3,
+                   src + ((size_t)(y0 + y) * w + x0) * 3, (size_t)*tile_width * 3);
         }
+        return 0;
+    }
+
+    // Turn the image dcraw_process() left in RawProcessor into an
+    // ImageResult, scaled down to fit fit_width x fit_height unless those are 0
+    ImageResult rendered_image_result(LibRaw& RawProcessor, int fit_width, int fit_height) {
+        ImageResult result = {nullptr, 0, 0, 0, nullptr, nullptr, 1};
 
         // Convert to memory image
-        libraw_processed_image_t *image = RawProcessor.dcraw_make_mem_image();
+        libraw_processed_image_t *image = fit_image(
+            RawProcessor, RawProcessor.dcraw_make_mem_image(), fit_width, fit_height);
         
         if (image) {
             result.width = image->width;
@@ -158,47 +597,575 @@ extern "C" {
             result.size = image->data_size;
             result.data = (uint8_t*)malloc(result.size);
             if (result.data) {
-                // Copy data and swap R/B channels for BMP (BGR)
-                uint8_t* src = image->data;
-                uint8_t* dst = result.data;
-                int total_pixels = result.width * result.height;
-                
-                for (int i = 0; i < total_pixels; ++i) {
-                    dst[i * 3 + 0] = src[i * 3 + 2]; // B
-                    dst[i * 3 + 1] = src[i * 3 + 1]; // G
-                    dst[i * 3 + 2] = src[i * 3 + 0]; // R
-                }
+                // Swap R/B channels for BMP (BGR) and downsample for zooming out
+                result.pyramid = copy_bgr_with_pyramid(result.data, image->data,
+                                                       result.width, result.height,
+                                                       &result.levels);
             }
+            result.histogram = output_histogram(RawProcessor);
             LibRaw::dcraw_clear_mem(image);
         }
         
         return result;
     }
 
-    // Get preview image (fast decoding)
-    EXPORT ImageResult get_preview(const char* file_path, int half_size) {
+    // Set parameters for speed, sacrificing some quality
+    void set_preview_params(LibRaw& RawProcessor, int half_size) {
+        RawProcessor.imgdata.params.use_camera_wb = 1;
+        RawProcessor.imgdata.params.half_size = half_size; // 1: Half size, 0: Full size
+        RawProcessor.imgdata.params.output_bps = 8; // 8-bit output
+        RawProcessor.imgdata.params.output_color = 1; // sRGB
+        RawProcessor.imgdata.params.keep_histogram = 1; // For the viewer
+    }
+
+    // Where preview_band_progress puts the bands of one get_preview
+    struct BandTarget {
+        LibRaw* processor;
+        PreviewBands* bands;
+        int rows_done; // Sensor rows placed so far
+        int first_line; // Lines of the scaled image placed so far, along the sensor rows
+        int end_line;
+        std::vector<uint8_t> rows; // One band as copy_mem_band gives it
+    };
+
+    // LibRaw progress callback of a progressive get_preview: samples each
+    // finished band into bands->pixels and grows the filled part over it
+    int preview_band_progress(void* data, enum LibRaw_progress stage, int iteration, int expected) {
+        BandTarget* target = (BandTarget*)data;
+        PreviewBands* bands = target->bands;
+        if (stage != LIBRAW_PROGRESS_OUTPUT_BAND || iteration <= target->rows_done) {
+            return bands->cancel;
+        }
+        const int flip = target->processor->imgdata.sizes.flip;
+        const int width = target->processor->imgdata.sizes.width;
+        const int height = expected;
+        const int row0 = target->rows_done;
+        int out_width, out_height;
+        fit_size((flip & 4) ? height : width, (flip & 4) ? width : height,
+                 bands->fit_width, bands->fit_height, &out_width, &out_height);
+        // Sensor rows run along image columns when turned by 90 degrees
+        const int lines = (flip & 4) ? out_width : out_height;
+        const int across = (flip & 4) ? out_height : out_width;
+        if (row0 == 0) {
+            bands->width = out_width;
+            bands->height = out_height;
+            target->first_line = lines;
+            target->end_line = 0;
+        }
+
+        target->rows.resize((size_t)(iteration - row0) * width * 3);
+        if (target->processor->copy_mem_band(target->rows.data(), width * 3, 1, row0,
+                                             iteration - row0) != LIBRAW_SUCCESS) {
+            return bands->cancel;
+        }
+        for (int line = 0; line < lines; line++) {
+            int row = (int)((2 * (int64_t)line + 1) * height / (2 * lines));
+            if (flip & 2) {
+                row = height - 1 - row;
+            }
+            if (row < row0 || row >= iteration) {
+                continue;
+            }
+            const uint8_t* src = target->rows.data() + (size_t)(row - row0) * width * 3;
+            for (int i = 0; i < across; i++) {
+                int col = (int)((2 * (int64_t)i + 1) * width / (2 * across));
+                if (flip & 1) {
+                    col = width - 1 - col;
+                }
+                size_t offset = (flip & 4) ? (size_t)i * out_width + line
+                                           : (size_t)line * out_width + i;
+                memcpy(bands->pixels + offset * 3, src + (size_t)col * 3, 3);
+            }
+            target->first_line = std::min(target->first_line, line);
+            target->end_line = std::max(target->end_line, line + 1);
+        }
+        target->rows_done = iteration;
+
+        // Pixels first, then the part that covers them
+        std::atomic_thread_fence(std::memory_order_release);
+        if (target->end_line > target->first_line) {
+            const int extent = target->end_line - target->first_line;
+            bands->filled_x = (flip & 4) ? target->first_line : 0;
+            bands->filled_y = (flip & 4) ? 0 : target->first_line;
+            bands->filled_width = (flip & 4) ? extent : out_width;
+            bands->filled_height = (flip & 4) ? out_height : extent;
+        }
+        bands->bands = bands->bands + 1;
+        return bands->cancel;
+    }
+
+    ImageResult process_preview(LibRaw& RawProcessor, int half_size, int fit_width, int fit_height,
+                                PreviewBands* bands) {
+        ImageResult result = {nullptr, 0, 0, 0, nullptr, nullptr, 1};
+
+        set_preview_params(RawProcessor, half_size);
+        BandTarget target = {&RawProcessor, bands, 0, 0, 0, {}};
+        if (bands) {
+            if (bands->pixels && bands->fit_width > 0 && bands->fit_height > 0) {
+                RawProcessor.imgdata.params.progressive_rows = PREVIEW_BAND_ROWS;
+            }
+            RawProcessor.set_progress_handler(preview_band_progress, &target);
+        }
+
+        if (RawProcessor.unpack() != LIBRAW_SUCCESS) {
+            return result;
+        }
+        
+        // dcraw_process
+        if (RawProcessor.dcraw_process() != LIBRAW_SUCCESS) {
+            return result;
+        }
+
+        return rendered_image_result(RawProcessor, fit_width, fit_height);
+    }
+
+    // Get preview image (fast decoding), scaled down to fit fit_width x
+    // fit_height unless those are 0. With bands, a full-size render also
+    // fills those in as it goes and stops once bands->cancel is set.
+    EXPORT ImageResult get_preview(const char* file_path, int half_size,
+                                   int fit_width, int fit_height, PreviewBands* bands) {
         LibRaw RawProcessor;
         int ret = RawProcessor.open_file(file_path);
         if (ret != LIBRAW_SUCCESS) {
             LOGE("get_preview open_file failed: %d", ret);
-            return {nullptr, 0, 0, 0};
+            return {nullptr, 0, 0, 0, nullptr, nullptr, 1};
         }
 
-        ImageResult result = process_preview(RawProcessor, half_size);
+        ImageResult result = process_preview(RawProcessor, half_size, fit_width, fit_height, bands);
         RawProcessor.recycle();
         return result;
     }
 
-    EXPORT ImageResult get_preview_from_buffer(uint8_t* buffer, size_t size, int half_size) {
+    EXPORT ImageResult get_preview_from_buffer(uint8_t* buffer, size_t size, int half_size,
+                                               int fit_width, int fit_height,
+                                               PreviewBands* bands) {
         LibRaw RawProcessor;
         int ret = RawProcessor.open_buffer(buffer, size);
         if (ret != LIBRAW_SUCCESS) {
             LOGE("get_preview open_buffer failed: %d", ret);
-            return {nullptr, 0, 0, 0};
+            return {nullptr, 0, 0, 0, nullptr, nullptr, 1};
+        }
+
+        ImageResult result = process_preview(RawProcessor, half_size, fit_width, fit_height, bands);
+        RawProcessor.recycle();
+        return result;
+    }
+
+    RenderOutputs process_render_outputs(LibRaw& RawProcessor, int half_size,
+                                         const RenderSpec* specs, int count) {
+        RenderOutputs result;
+        memset(&result, 0, sizeof(result));
+        set_preview_params(RawProcessor, half_size);
+        if (RawProcessor.unpack() != LIBRAW_SUCCESS ||
+            RawProcessor.dcraw_process() != LIBRAW_SUCCESS) {
+            return result;
+        }
+        render_outputs_from(RawProcessor, specs, count, &result);
+        return result;
+    }
+
+    // Render once with the preview settings and return up to
+    // RENDER_MAX_OUTPUTS sizes/formats of the result, e.g. the screen preview
+    // and a grid thumbnail. Unset outputs have null data.
+    EXPORT RenderOutputs render_outputs(const char* file_path, int half_size,
+                                        const RenderSpec* specs, int count) {
+        LibRaw RawProcessor;
+        int ret = RawProcessor.open_file(file_path);
+        if (ret != LIBRAW_SUCCESS) {
+            LOGE("render_outputs open_file failed: %d", ret);
+            RenderOutputs result;
+            memset(&result, 0, sizeof(result));
+            return result;
+        }
+
+        RenderOutputs result = process_render_outputs(RawProcessor, half_size, specs, count);
+        RawProcessor.recycle();
+        return result;
+    }
+
+    EXPORT RenderOutputs render_outputs_from_buffer(uint8_t* buffer, size_t size, int half_size,
+                                                    const RenderSpec* specs, int count) {
+        LibRaw RawProcessor;
+        int ret = RawProcessor.open_buffer(buffer, size);
+        if (ret != LIBRAW_SUCCESS) {
+            LOGE("render_outputs open_buffer failed: %d", ret);
+            RenderOutputs result;
+            memset(&result, 0, sizeof(result));
+            return result;
+        }
+
+        RenderOutputs result = process_render_outputs(RawProcessor, half_size, specs, count);
+        RawProcessor.recycle();
+        return result;
+    }
+
+    // Set the output parameters of a develop render or export from params
+    void apply_develop_params(LibRaw& RawProcessor, const DevelopParams* params) {
+        libraw_output_params_t& O = RawProcessor.imgdata.params;
+        const bool custom_wb = params->wb[0] > 0 && params->wb[1] > 0 && params->wb[2] > 0;
+        for (int c = 0; c < 4; c++) {
+            O.user_mul[c] = custom_wb ? params->wb[c] : 0;
+        }
+        O.use_camera_wb = !custom_wb; // Would override user_mul
+        O.exp_shift = std::min(8.0f, std::max(0.25f, params->exposure));
+        O.exp_correc = O.exp_shift != 1.0f;
+        O.exp_preser = std::min(1.0f, std::max(0.0f, params->exposure_preserve));
+        O.highlight = std::min(9, std::max(0, params->highlight));
+        O.gamm[0] = params->gamma[0] > 0 ? 1.0 / params->gamma[0] : 0.45;
+        O.gamm[1] = params->gamma[0] > 0 ? params->gamma[1] : 4.5;
+        O.bright = params->bright > 0 ? params->bright : 1.0f;
+    }
+
+    // Unpack a freshly opened session with the preview settings. Deletes the
+    // session and returns null on failure.
+    DevelopSession* start_develop(DevelopSession* session, int half_size) {
+        LibRaw& RawProcessor = session->processor;
+        set_preview_params(RawProcessor, half_size);
+        RawProcessor.imgdata.params.develop_cache = 1;
+
+        int ret = RawProcessor.unpack();
+        if (ret != LIBRAW_SUCCESS) {
+            LOGE("develop_open unpack failed: %d", ret);
+            delete session;
+            return nullptr;
+        }
+        return session;
+    }
+
+    // Open a raw for repeated renders with develop_render(). Returns null on
+    // failure; close with develop_close.
+    EXPORT void* develop_open(const char* file_path, int half_size) {
+        DevelopSession* session = new (std::nothrow) DevelopSession;
+        if (!session) {
+            return nullptr;
+        }
+        int ret = session->processor.open_file(file_path);
+        if (ret != LIBRAW_SUCCESS) {
+            LOGE("develop_open open_file failed: %d for %s", ret, file_path);
+            delete session;
+            return nullptr;
+        }
+        return start_develop(session, half_size);
+    }
+
+    // The session keeps its own copy of buffer
+    EXPORT void* develop_open_from_buffer(uint8_t* buffer, size_t size, int half_size) {
+        DevelopSession* session = new (std::nothrow) DevelopSession;
+        if (!session) {
+            return nullptr;
+        }
+        session->buffer.assign(buffer, buffer + size);
+        int ret = session->processor.open_buffer(session->buffer.data(), size);
+        if (ret != LIBRAW_SUCCESS) {
+            LOGE("develop_open open_buffer failed: %d", ret);
+            delete session;
+            return nullptr;
+        }
+        return start_develop(session, half_size);
+    }
+
+    // Render a session with new settings. Only the first render, or one after
+    // the cached stages were invalidated, pays for the raw to image copy and
+    // black subtraction.
+    EXPORT ImageResult develop_render(void* handle, const DevelopParams* params,
+                                      int fit_width, int fit_height) {
+        DevelopSession* session = (DevelopSession*)handle;
+        if (!session || !params) {
+            return {nullptr, 0, 0, 0, nullptr, nullptr, 1};
+        }
+        apply_develop_params(session->processor, params);
+
+        int ret = session->processor.dcraw_process();
+        if (ret != LIBRAW_SUCCESS) {
+            LOGE("develop_render dcraw_process failed: %d", ret);
+            return {nullptr, 0, 0, 0, nullptr, nullptr, 1};
+        }
+        return rendered_image_result(session->processor, fit_width, fit_height);
+    }
+
+    EXPORT void develop_close(void* handle) {
+        delete (DevelopSession*)handle;
+    }
+
+    // Raw-domain exposure statistics for clipping warnings. Only unpacks the
+    // raw data, no demosaic. mask may be null.
+    int process_raw_stats(LibRaw& RawProcessor, libraw_raw_stats_t* stats,
+                          uint8_t* mask, int mask_width, int mask_height) {
+        int ret = RawProcessor.unpack();
+        if (ret != LIBRAW_SUCCESS) {
+            return ret;
+        }
+        return RawProcessor.get_raw_stats(stats, mask, mask_width, mask_height);
+    }
+
+    EXPORT int get_raw_stats(const char* file_path, libraw_raw_stats_t* stats,
+                             uint8_t* mask, int mask_width, int mask_height) {
+        LibRaw RawProcessor;
+        int ret = RawProcessor.open_file(file_path);
+        if (ret != LIBRAW_SUCCESS) {
+            LOGE("get_raw_stats open_file failed: %d", ret);
+            return ret;
+        }
+
+        ret = process_raw_stats(RawProcessor, stats, mask, mask_width, mask_height);
+        RawProcessor.recycle();
+        return ret;
+    }
+
+    EXPORT int get_raw_stats_from_buffer(uint8_t* buffer, size_t size,
+                                         libraw_raw_stats_t* stats, uint8_t* mask,
+                                         int mask_width, int mask_height) {
+        LibRaw RawProcessor;
+        int ret = RawProcessor.open_buffer(buffer, size);
+        if (ret != LIBRAW_SUCCESS) {
+            LOGE("get_raw_stats open_buffer failed: %d", ret);
+            return ret;
+        }
+
+        ret = process_raw_stats(RawProcessor, stats, mask, mask_width, mask_height);
+        RawProcessor.recycle();
+        return ret;
+    }
+
+    // LibRaw progress callback of export_file: decoding and processing fill
+    // the first half of job->progress, writing the bands the second
+    int export_progress(void* data, enum LibRaw_progress stage, int iteration, int expected) {
+        ExportJob* job = (ExportJob*)data;
+        int progress;
+        if (stage == LIBRAW_PROGRESS_FLIP && expected > 0) {
+            progress = 500 + 500 * iteration / expected;
+        } else {
+            // dcraw_process stages are bits, roughly in pipeline order
+            int bit = 0;
+            while (bit < 20 && (1 << bit) < (int)stage) {
+                bit++;
+            }
+            progress = bit * 25;
+        }
+        if (progress > job->progress) {
+            job->progress = progress;
+        }
+        return job->cancel;
+    }
+
+    int process_export(LibRaw& RawProcessor, const char* dst_path, int format, int quality,
+                       int half_size, const DevelopParams* params, ExportJob* job) {
+        set_preview_params(RawProcessor, half_size);
+        RawProcessor.imgdata.params.keep_histogram = 0; // No viewer histogram
+        if (format == LIBRAW_EXPORT_TIFF) {
+            RawProcessor.imgdata.params.output_bps = 16;
+        }
+        if (params) {
+            apply_develop_params(RawProcessor, params);
+        }
+        if (job) {
+            RawProcessor.set_progress_handler(export_progress, job);
+        }
+
+        int ret = RawProcessor.unpack();
+        if (ret == LIBRAW_SUCCESS) {
+            ret = RawProcessor.dcraw_process();
+        }
+        if (ret == LIBRAW_SUCCESS) {
+            ret = RawProcessor.dcraw_export_writer(dst_path, format, quality);
+        }
+        if (ret == LIBRAW_SUCCESS && job) {
+            job->progress = 1000;
+        }
+        return ret;
+    }
+
+    // Develop a raw at full quality and write it to dst_path as a 16-bit TIFF
+    // (format LIBRAW_EXPORT_TIFF) or an 8-bit JPEG (LIBRAW_EXPORT_JPEG,
+    // quality 1 .. 100), with the camera metadata. params null for the
+    // preview look, half_size 1 for a smaller, faster export. Returns a LibRaw
+    // error code, LIBRAW_CANCELLED_BY_CALLBACK when job->cancel was set.
+    EXPORT int export_file(const char* src_path, const char* dst_path, int format, int quality,
+                           int half_size, const DevelopParams* params, ExportJob* job) {
+        LibRaw RawProcessor;
+        int ret = RawProcessor.open_file(src_path);
+        if (ret != LIBRAW_SUCCESS) {
+            LOGE("export_file open_file failed: %d for %s", ret, src_path);
+            return ret;
+        }
+
+        ret = process_export(RawProcessor, dst_path, format, quality, half_size, params, job);
+        if (ret != LIBRAW_SUCCESS) {
+            LOGE("export_file failed: %d for %s", ret, src_path);
+        }
+        RawProcessor.recycle();
+        return ret;
+    }
+
+    EXPORT int export_file_from_buffer(uint8_t* buffer, size_t size, const char* dst_path,
+                                       int format, int quality, int half_size,
+                                       const DevelopParams* params, ExportJob* job) {
+        LibRaw RawProcessor;
+        int ret = RawProcessor.open_buffer(buffer, size);
+        if (ret != LIBRAW_SUCCESS) {
+            LOGE("export_file open_buffer failed: %d", ret);
+            return ret;
         }
 
-        ImageResult result = process_preview(RawProcessor, half_size);
+        ret = process_export(RawProcessor, dst_path, format, quality, half_size, params, job);
         RawProcessor.recycle();
+        return ret;
+    }
+
+    // Kind of a file from its first bytes, -1 for neither. TIFF based raws
+    // share their signature with plain TIFF files; identify tells them apart.
+    int scan_kind(const unsigned char* head, int len) {
+        static const struct {
+            int offset;
+            const char* bytes;
+            int length;
+        } raw_signatures[] = {
+            {0, "II*\0", 4}, {0, "MM\0*", 4}, {0, "IIRO", 4}, {0, "IIRS", 4},
+            {0, "MMOR", 4}, {0, "IIU\0", 4}, {6, "HEAPCCDR", 8}, {0, "FUJIFILM", 8},
+            {0, "\0MRM", 4}, {0, "FOVb", 4}, {0, "IIII", 4}, {4, "ftypcrx ", 8},
+        };
+        if (len >= 3 && head[0] == 0xff && head[1] == 0xd8 && head[2] == 0xff) {
+            return SCAN_BITMAP;
+        }
+        if (len >= 8 && !memcmp(head, "\x89PNG\r\n\x1a\n", 8)) {
+            return SCAN_BITMAP;
+        }
+        if (len >= 12 && !memcmp(head, "RIFF", 4) && !memcmp(head + 8, "WEBP", 4)) {
+            return SCAN_BITMAP;
+        }
+        for (const auto& signature : raw_signatures) {
+            if (len >= signature.offset + signature.length &&
+                !memcmp(head + signature.offset, signature.bytes, signature.length)) {
+                return SCAN_RAW;
+            }
+        }
+        return -1;
+    }
+
+    struct ScanItem {
+        std::string name;
+        int kind; // -1 until scanned, and for files that are not media
+        int64_t captured;
+        int64_t modified;
+    };
+
+    // Classify one file by its first bytes and, with SCAN_CAPTURE_TIME and a
+    // processor, read its capture time from the header. Raws LibRaw does not
+    // open are dropped then.
+    void scan_file(LibRaw* RawProcessor, const std::string& path, int flags, ScanItem& item) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        unsigned char head[16];
+        ssize_t len = read(fd, head, sizeof(head));
+        struct stat st;
+        if (len > 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            item.kind = scan_kind(head, (int)len);
+            item.modified = st.st_mtime;
+        }
+        close(fd);
+        if (item.kind < 0 || !RawProcessor || !(flags & SCAN_CAPTURE_TIME)) {
+            return;
+        }
+
+        if (item.kind == SCAN_RAW) {
+            // Only identifies; nothing of the raw data is read
+            if (RawProcessor->open_file(path.c_str()) == LIBRAW_SUCCESS) {
+                item.captured = RawProcessor->imgdata.other.timestamp;
+            } else {
+                item.kind = -1;
+            }
+        } else if (head[0] == 0xff) {
+            LibRaw_bigfile_datastream stream(path.c_str());
+            RawProcessor->open_jpeg_thumb(&stream);
+            item.captured = RawProcessor->imgdata.other.timestamp;
+        }
+        RawProcessor->recycle();
+    }
+
+    // Media files in dir_path, not descending into subdirectories. Files are
+    // told apart by their first bytes, not their names, on a few threads; with
+    // SCAN_CAPTURE_TIME their headers are identified too. Nothing beyond the
+    // headers is read.
+    EXPORT ScanResult scan_directory(const char* dir_path, int flags) {
+        ScanResult result = {nullptr, 0, nullptr};
+        DIR* dir = opendir(dir_path);
+        if (!dir) {
+            LOGE("opendir failed for %s", dir_path);
+            return result;
+        }
+        std::vector<ScanItem> items;
+        while (struct dirent* entry = readdir(dir)) {
+            // d_type spares a stat for directories and the like; files of
+            // unknown type are checked when they are read
+            if (entry->d_name[0] == '.' ||
+                (entry->d_type != DT_REG && entry->d_type != DT_LNK &&
+                 entry->d_type != DT_UNKNOWN)) {
+                continue;
+            }
+            items.push_back({entry->d_name, -1, 0, 0});
+        }
+        closedir(dir);
+
+        std::string base(dir_path);
+        if (!base.empty() && base[base.size() - 1] != '/') {
+            base += '/';
+        }
+        std::atomic<size_t> next(0);
+        auto scan = [&]() {
+            // Too big for a thread's stack
+            LibRaw* RawProcessor = new (std::nothrow) LibRaw;
+            for (size_t i; (i = next++) < items.size();) {
+                scan_file(RawProcessor, base + items[i].name, flags, items[i]);
+            }
+            delete RawProcessor;
+        };
+        size_t threads = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()),
+                                          SCAN_MAX_THREADS);
+        threads = std::max<size_t>(1, std::min(threads, items.size()));
+        std::vector<std::thread> pool;
+        for (size_t t = 1; t < threads; t++) {
+            pool.emplace_back(scan);
+        }
+        scan();
+        for (std::thread& thread : pool) {
+            thread.join();
+        }
+
+        items.erase(std::remove_if(items.begin(), items.end(),
+                                   [](const ScanItem& item) { return item.kind < 0; }),
+                    items.end());
+        std::sort(items.begin(), items.end(), [](const ScanItem& a, const ScanItem& b) {
+            int64_t time_a = a.captured ? a.captured : a.modified;
+            int64_t time_b = b.captured ? b.captured : b.modified;
+            return time_a != time_b ? time_a < time_b : a.name < b.name;
+        });
+        if (items.empty()) {
+            return result;
+        }
+
+        size_t names_size = 0;
+        for (const ScanItem& item : items) {
+            names_size += item.name.size() + 1;
+        }
+        result.entries = (ScanEntry*)malloc(items.size() * sizeof(ScanEntry));
+        result.names = (char*)malloc(names_size);
+        if (!result.entries || !result.names) {
+            free(result.entries);
+            free(result.names);
+            return {nullptr, 0, nullptr};
+        }
+        size_t offset = 0;
+        for (const ScanItem& item : items) {
+            ScanEntry& entry = result.entries[result.count++];
+            entry.name = (int)offset;
+            entry.kind = item.kind;
+            entry.captured = item.captured;
+            entry.modified = item.modified;
+            memcpy(result.names + offset, item.name.c_str(), item.name.size() + 1);
+            offset += item.name.size() + 1;
+        }
         return result;
     }
 }
@@ -1,5 +1,6 @@
 import 'dart:async';
 import 'dart:io';
+import 'dart:math' as math;
 import 'dart:typed_data';
 import 'package:exif/exif.dart';
 import 'package:flutter/gestures.dart';
@@ -81,6 +82,12 @@ class _TimestampRepository {
     return _futureCache.putIfAbsent(filePath, () => _readTimestampInfo(filePath));
   }
 
+  // Timestamps already known, e.g. from a folder scan, so the tiles do not
+  // read the files for them
+  void seed(String filePath, _MediaTimestampInfo info) {
+    _futureCache[filePath] = Future.value(info);
+  }
+
   void clear() {
     _futureCache.clear();
   }
@@ -184,12 +191,22 @@ class _HomePageState extends State<HomePage> {
     unawaited(_listenForDesktopOpenRequests());
   }
 
+  @override
+  void didChangeDependencies() {
+    super.didChangeDependencies();
+    // Scale bitmap thumbnails natively to the screen in either orientation
+    // instead of handing full renders to Flutter.
+    final screen = View.of(context).physicalSize;
+    final side = math.max(screen.width, screen.height).ceil();
+    WorkerService().setDisplaySize(side, side);
+  }
+
   void _initCache() {
     // maxCacheSize is in MB, convert to bytes
     final int maxBytes = _settings.maxCacheSize * 1024 * 1024;
     _imageCache = LruCache(
       maxBytes,
-      sizeOf: (image) => image.data.length,
+      sizeOf: (image) => image.data.length + (image.pyramid?.byteSize ?? 0),
     );
   }
 
@@ -288,7 +305,13 @@ class _HomePageState extends State<HomePage> {
     }
 
     if (directories.isNotEmpty) {
-      final directoryFiles = directories.expand(_listRawFilesInDirectory);
+      final scans =
+          await Future.wait(directories.map(WorkerService().scanDirectory));
+      final scannedFiles = scans.expand((scan) => scan).toList();
+      final directoryFiles = scannedFiles.map((file) => _MediaFile(
+            path: file.path,
+            kind: file.isRaw ? _MediaKind.raw : _MediaKind.bitmap,
+          ));
       final nextFiles = _deduplicateMediaFiles([...directoryFiles, ...files]);
       _applyOpenedFiles(
         files: nextFiles,
@@ -296,6 +319,15 @@ class _HomePageState extends State<HomePage> {
         title: _folderSelectionTitle(directories),
         clearCache: true,
       );
+      for (final file in scannedFiles) {
+        _timestampRepository.seed(
+          file.path,
+          _MediaTimestampInfo(
+            capturedAt: file.capturedAt,
+            modifiedAt: file.modifiedAt,
+          ),
+        );
+      }
       return;
     }
 
@@ -337,17 +369,6 @@ class _HomePageState extends State<HomePage> {
     });
   }
 
-  List<_MediaFile> _listRawFilesInDirectory(String directoryPath) {
-    final files = Directory(directoryPath)
-        .listSync()
-        .whereType<File>()
-        .map((file) => _mediaFileFromPath(file.path))
-        .whereType<_MediaFile>()
-        .toList()
-      ..sort((a, b) => a.path.compareTo(b.path));
-    return files;
-  }
-
   List<_MediaFile> _deduplicateMediaFiles(Iterable<_MediaFile> files) {
     final seen = <String>{};
     final result = <_MediaFile>[];
@@ -577,18 +598,8 @@ class _RawThumbnailState extends State<RawThumbnail> {
   }
 
   void _loadThumbnail() {
-    if (!widget.mediaFile.isRaw) {
-      _thumbFuture = Future<ViewerImage?>(() async {
-        final bytes = await File(widget.filePath).readAsBytes();
-        final image = ViewerImage.fromEncodedBytes(bytes);
-        if (mounted) {
-          widget.onCacheUpdate(image);
-        }
-        return image;
-      });
-      return;
-    }
-
+    // Bitmap files come as their Exif thumbnail or a scaled decode, never
+    // the whole file
     final task = WorkerService().requestThumbnail(widget.filePath);
     _thumbTask = task;
     _thumbFuture = task.result.then((image) {
@@ -596,7 +607,8 @@ class _RawThumbnailState extends State<RawThumbnail> {
       if (image == null) {
         return null;
       }
-      final viewerImage = ViewerImage.fromRaw(image);
+      final viewerImage =
+          ViewerImage.fromRaw(image, isRaw: widget.mediaFile.isRaw);
       widget.onCacheUpdate(viewerImage);
       return viewerImage;
     });
@@ -805,20 +817,15 @@ class _ImagePreviewPageState extends State<ImagePreviewPage> {
       final String filePath = mediaFile.path;
       final thumbKey = '$filePath:thumb';
       if (widget.imageCache.get(thumbKey) == null) {
-        if (mediaFile.isRaw) {
-          WorkerService()
-              .requestThumbnail(filePath, priority: TaskPriority.low)
-              .result
-              .then((thumb) {
-            if (thumb != null) {
-              widget.imageCache.put(thumbKey, ViewerImage.fromRaw(thumb));
-            }
-          });
-        } else {
-          File(filePath).readAsBytes().then((bytes) {
-            widget.imageCache.put(thumbKey, ViewerImage.fromEncodedBytes(bytes));
-          });
-        }
+        WorkerService()
+            .requestThumbnail(filePath, priority: TaskPriority.low)
+            .result
+            .then((thumb) {
+          if (thumb != null) {
+            widget.imageCache.put(
+                thumbKey, ViewerImage.fromRaw(thumb, isRaw: mediaFile.isRaw));
+          }
+        });
       }
     }
   }
@@ -1027,6 +1034,7 @@ class _SingleImagePreviewState extends State<SingleImagePreview> {
         if (mounted) {
           setState(() {
             _isLoadingPreview = false;
+            _stopBands();
           });
         }
       }
@@ -1043,6 +1051,7 @@ class _SingleImagePreviewState extends State<SingleImagePreview> {
       _currentTask?.cancel();
       _currentTask = null;
       _isLoadingPreview = false;
+      _stopBands();
 
       // Reload logic will skip if _thumbnail/_preview are already set
       _loadImages();
@@ -1051,9 +1060,33 @@ class _SingleImagePreviewState extends State<SingleImagePreview> {
 
   WorkerTask<LibRawImage?>? _currentTask;
 
+  // Part of a progressive full-size render, shown over the thumbnail until
+  // the preview arrives
+  PreviewBandsFrame? _bandsFrame;
+  Timer? _bandsTimer;
+
+  void _pollBands(PreviewBands bands) {
+    _bandsTimer?.cancel();
+    _bandsTimer = Timer.periodic(const Duration(milliseconds: 100), (_) {
+      final frame = bands.frame();
+      if (frame != null && mounted) {
+        setState(() {
+          _bandsFrame = frame;
+        });
+      }
+    });
+  }
+
+  void _stopBands() {
+    _bandsTimer?.cancel();
+    _bandsTimer = null;
+    _bandsFrame = null;
+  }
+
   @override
   void dispose() {
     _currentTask?.cancel();
+    _stopBands();
     _transformationController.removeListener(_onTransformationChange);
     _transformationController.dispose();
     super.dispose();
@@ -1087,18 +1120,20 @@ class _SingleImagePreviewState extends State<SingleImagePreview> {
             ? TaskPriority.low
             : TaskPriority.high;
         ViewerImage? thumb;
-        if (widget.isRaw) {
-          final task = WorkerService()
-              .requestThumbnail(widget.filePath, priority: thumbPriority);
-          _currentTask = task;
-          final rawThumb = await task.result;
-          _currentTask = null;
-          if (rawThumb != null) {
-            thumb = ViewerImage.fromRaw(rawThumb);
-          }
-        } else {
-          final bytes = await File(widget.filePath).readAsBytes();
-          thumb = ViewerImage.fromEncodedBytes(bytes);
+        // The preview is loaded next; if a raw file has no embedded
+        // thumbnail both come from the same render
+        final withPreview = widget.isRaw &&
+            widget.isActive &&
+            !widget.isFastScrolling &&
+            !_useEmbeddedPreview &&
+            _halfSize == 1;
+        final task = WorkerService().requestThumbnail(widget.filePath,
+            priority: thumbPriority, withPreview: withPreview);
+        _currentTask = task;
+        final rawThumb = await task.result;
+        _currentTask = null;
+        if (rawThumb != null) {
+          thumb = ViewerImage.fromRaw(rawThumb, isRaw: widget.isRaw);
         }
 
         if (mounted && thumb != null) {
@@ -1120,13 +1155,18 @@ class _SingleImagePreviewState extends State<SingleImagePreview> {
         if (mounted) {
           setState(() {
             _isLoadingPreview = false;
+            _stopBands();
           });
         }
       }
       return;
     }
 
-    if (!widget.isRaw || _useEmbeddedPreview) return;
+    if (!widget.isRaw) {
+      await _loadFullBitmap();
+      return;
+    }
+    if (_useEmbeddedPreview) return;
     if (_preview != null) return;
 
     // Check cache for preview
@@ -1146,10 +1186,14 @@ class _SingleImagePreviewState extends State<SingleImagePreview> {
     }
 
     const priority = TaskPriority.high;
+    // Full-size renders take a while; show their bands as they come
     final task = WorkerService().requestPreview(widget.filePath,
-        halfSize: _halfSize, priority: priority);
+        halfSize: _halfSize, priority: priority, progressive: _halfSize == 0);
     _currentTask = task;
+    final bands = task.bands;
+    if (bands != null) _pollBands(bands);
     final rawPreview = await task.result;
+    if (_currentTask == task) _stopBands();
     _currentTask = null;
     final preview = rawPreview == null ? null : ViewerImage.fromRaw(rawPreview);
 
@@ -1165,6 +1209,27 @@ class _SingleImagePreviewState extends State<SingleImagePreview> {
     }
   }
 
+  // Bitmap files: the thumbnail is a small decode, the file itself is shown
+  // over it once the page is settled on
+  Future<void> _loadFullBitmap() async {
+    if (_preview != null) return;
+    final previewKey = '${widget.filePath}:preview';
+    final cachedPreview = widget.imageCache.get(previewKey);
+    final preview = cachedPreview ??
+        ViewerImage.fromEncodedBytes(
+            await File(widget.filePath).readAsBytes());
+    if (!mounted) return;
+    setState(() {
+      _preview = preview;
+    });
+    if (cachedPreview == null) {
+      Future(() => widget.imageCache.put(previewKey, preview));
+    }
+  }
+
+  // Raw files show the embedded thumbnail alone when asked to
+  bool get _showsPreview => !widget.isRaw || !_useEmbeddedPreview;
+
   void _togglePreviewMode() {
     setState(() {
       _useEmbeddedPreview = !_useEmbeddedPreview;
@@ -1288,16 +1353,21 @@ class _SingleImagePreviewState extends State<SingleImagePreview> {
                       image: _thumbnail!,
                       fit: BoxFit.contain,
                     ),
-                  if (_preview != null && !_useEmbeddedPreview)
-                    RawImageWidget(image: _preview!, fit: BoxFit.contain),
+                  if (_bandsFrame != null && _preview == null && _showsPreview)
+                    _PreviewBandsView(frame: _bandsFrame!),
+                  if (_preview != null && _showsPreview)
+                    PyramidImageWidget(
+                      image: _preview!,
+                      transformationController: _transformationController,
+                    ),
                   if (_thumbnail == null &&
-                      (_preview == null || _useEmbeddedPreview))
+                      (_preview == null || !_showsPreview))
                     const Center(
                         child: ExcludeSemantics(
                             child: CircularProgressIndicator())),
                   if (_isLoadingPreview &&
                       _preview == null &&
-                      !_useEmbeddedPreview)
+                      _showsPreview)
                     const Center(
                         child: ExcludeSemantics(
                       child: CircularProgressIndicator(
@@ -1331,6 +1401,41 @@ class _SingleImagePreviewState extends State<SingleImagePreview> {
   }
 }
 
+// The filled part of a progressive preview, placed where it falls in the
+// whole image fitted to the page
+class _PreviewBandsView extends StatelessWidget {
+  final PreviewBandsFrame frame;
+
+  const _PreviewBandsView({required this.frame});
+
+  @override
+  Widget build(BuildContext context) {
+    return LayoutBuilder(builder: (context, constraints) {
+      final bounds = Offset.zero & constraints.biggest;
+      final fitted = applyBoxFit(BoxFit.contain,
+          Size(frame.width.toDouble(), frame.height.toDouble()), bounds.size);
+      final image = Alignment.center.inscribe(fitted.destination, bounds);
+      final scale = image.width / frame.width;
+      return Stack(
+        children: [
+          Positioned.fromRect(
+            rect: Rect.fromLTWH(
+                image.left + frame.left * scale,
+                image.top + frame.top * scale,
+                frame.image.width * scale,
+                frame.image.height * scale),
+            child: Image.memory(
+              frame.image.data,
+              fit: BoxFit.fill,
+              gaplessPlayback: true, // Keep the last bands while these decode
+            ),
+          ),
+        ],
+      );
+    });
+  }
+}
+
 class RawImageWidget extends StatelessWidget {
   final ViewerImage image;
   final BoxFit? fit;
@@ -1367,6 +1472,83 @@ class RawImageWidget extends StatelessWidget {
   }
 }
 
+// Shows a rendered preview through its pyramid: while the full-size image
+// would be shrunk on screen, only the visible tiles of the smallest level that
+// still covers the display resolution are drawn.
+class PyramidImageWidget extends StatelessWidget {
+  final ViewerImage image;
+  final TransformationController transformationController;
+
+  const PyramidImageWidget({
+    super.key,
+    required this.image,
+    required this.transformationController,
+  });
+
+  @override
+  Widget build(BuildContext context) {
+    final pyramid = image.pyramid;
+    if (pyramid == null) {
+      return RawImageWidget(image: image, fit: BoxFit.contain);
+    }
+    final devicePixelRatio = MediaQuery.devicePixelRatioOf(context);
+
+    return LayoutBuilder(builder: (context, constraints) {
+      final viewport = Offset.zero & constraints.biggest;
+      final fitted = applyBoxFit(
+        BoxFit.contain,
+        Size(pyramid.width.toDouble(), pyramid.height.toDouble()),
+        viewport.size,
+      ).destination;
+      final imageRect = Alignment.center.inscribe(fitted, viewport);
+
+      return AnimatedBuilder(
+        animation: transformationController,
+        builder: (context, _) {
+          final matrix = transformationController.value;
+          final level = pyramid.levelFor(
+              imageRect.width * matrix.getMaxScaleOnAxis() * devicePixelRatio);
+          if (level == 0) {
+            return RawImageWidget(image: image, fit: BoxFit.contain);
+          }
+
+          final visible = MatrixUtils.inverseTransformRect(matrix, viewport);
+          final scaleX = imageRect.width / pyramid.levelWidth(level);
+          final scaleY = imageRect.height / pyramid.levelHeight(level);
+          final tiles = <Widget>[];
+          for (int y = 0; y < pyramid.tilesY(level); y++) {
+            for (int x = 0; x < pyramid.tilesX(level); x++) {
+              final left = x * pyramidTileSize;
+              final top = y * pyramidTileSize;
+              final right =
+                  math.min(left + pyramidTileSize, pyramid.levelWidth(level));
+              final bottom =
+                  math.min(top + pyramidTileSize, pyramid.levelHeight(level));
+              final tileRect = Rect.fromLTRB(
+                imageRect.left + left * scaleX,
+                imageRect.top + top * scaleY,
+                imageRect.left + right * scaleX,
+                imageRect.top + bottom * scaleY,
+              );
+              if (!tileRect.overlaps(visible)) continue;
+              tiles.add(Positioned.fromRect(
+                rect: tileRect,
+                child: Image.memory(
+                  pyramid.tile(level, x, y),
+                  fit: BoxFit.fill,
+                  gaplessPlayback: true,
+                  filterQuality: FilterQuality.medium,
+                ),
+              ));
+            }
+          }
+          return Stack(children: tiles);
+        },
+      );
+    });
+  }
+}
+
 class FastPageScrollPhysics extends PageScrollPhysics {
   const FastPageScrollPhysics({super.parent});
 
@@ -1,10 +1,17 @@
 import 'dart:ffi';
 import 'dart:io';
+import 'dart:math' as math;
 import 'dart:typed_data';
 import 'package:ffi/ffi.dart';
 import 'package:path/path.dart' as path;
 
 DynamicLibrary _openNativeLibrary() {
+  // A desktop build of the wrapper, for the tests run on the host
+  final override = Platform.environment['RAWVIEWER_NATIVE_LIB'];
+  if (override != null && override.isNotEmpty) {
+    return DynamicLibrary.open(override);
+  }
+
   if (Platform.isWindows) {
     return DynamicLibrary.open('native_lib.dll');
   }
@@ -39,6 +46,14 @@ final class ThumbnailResult extends Struct {
   external int height;
   @Int32()
   external int format; // 0: JPEG, 1: RGB
+  // Orientation of the source as LibRaw flip (0: none, 3: 180, 5: 90 CCW,
+  // 6: 90 CW). Already applied to bitmaps; JPEG data carries it as its Exif
+  // orientation, which the image decoder applies
+  @Int32()
+  external int flip;
+  // With wantPreview, the half-size render a thumbnail was made from when
+  // the file had no usable embedded one (null data otherwise)
+  external ImageResult preview;
 }
 
 final class ImageResult extends Struct {
@@ -49,43 +64,434 @@ final class ImageResult extends Struct {
   external int width;
   @Int32()
   external int height;
+  external Pointer<Uint32> histogram; // 3 x 256 bins (R, G, B) or null
+  external Pointer<Uint8> pyramid; // BGR levels 1/2, 1/4, ... or null
+  @Int32()
+  external int levels; // Pyramid levels including the full-size image
 }
 
-typedef GetThumbnailC = ThumbnailResult Function(Pointer<Utf16> path);
-typedef GetThumbnailDart = ThumbnailResult Function(Pointer<Utf16> path);
+// fitWidth/fitHeight: scale bitmap results down to fit, 0 for full size
+typedef GetThumbnailC = ThumbnailResult Function(
+    Pointer<Utf16> path, Int32 fitWidth, Int32 fitHeight, Int32 wantPreview);
+typedef GetThumbnailDart = ThumbnailResult Function(
+    Pointer<Utf16> path, int fitWidth, int fitHeight, int wantPreview);
 
-typedef GetThumbnailC_Posix = ThumbnailResult Function(Pointer<Utf8> path);
-typedef GetThumbnailDart_Posix = ThumbnailResult Function(Pointer<Utf8> path);
+typedef GetThumbnailC_Posix = ThumbnailResult Function(
+    Pointer<Utf8> path, Int32 fitWidth, Int32 fitHeight, Int32 wantPreview);
+typedef GetThumbnailDart_Posix = ThumbnailResult Function(
+    Pointer<Utf8> path, int fitWidth, int fitHeight, int wantPreview);
 
-typedef GetThumbnailC_Buffer = ThumbnailResult Function(
-    Pointer<Uint8> buffer, Int32 size);
+typedef GetThumbnailC_Buffer = ThumbnailResult Function(Pointer<Uint8> buffer,
+    Int32 size, Int32 fitWidth, Int32 fitHeight, Int32 wantPreview);
 typedef GetThumbnailDart_Buffer = ThumbnailResult Function(
-    Pointer<Uint8> buffer, int size);
+    Pointer<Uint8> buffer,
+    int size,
+    int fitWidth,
+    int fitHeight,
+    int wantPreview);
+
+// Mirrors PreviewBands in the native wrappers: a progressive preview render
+// writes its finished bands into pixels, scaled to the fit box, while the
+// UI isolate polls bands and the filled rectangle
+final class PreviewBandsStruct extends Struct {
+  external Pointer<Uint8> pixels; // BGR, fitWidth * fitHeight * 3 bytes
+  @Int32()
+  external int fitWidth;
+  @Int32()
+  external int fitHeight;
+  @Int32()
+  external int width; // Scaled image, rows width * 3 bytes apart
+  @Int32()
+  external int height;
+  @Int32()
+  external int filledX; // Part of the scaled image rendered so far
+  @Int32()
+  external int filledY;
+  @Int32()
+  external int filledWidth;
+  @Int32()
+  external int filledHeight;
+  @Int32()
+  external int bands; // Bumped after each band
+  @Int32()
+  external int cancel;
+}
+
+typedef GetPreviewC = ImageResult Function(Pointer<Utf16> path,
+    Int32 halfSize, Int32 fitWidth, Int32 fitHeight,
+    Pointer<PreviewBandsStruct> bands);
+typedef GetPreviewDart = ImageResult Function(Pointer<Utf16> path,
+    int halfSize, int fitWidth, int fitHeight,
+    Pointer<PreviewBandsStruct> bands);
+
+typedef GetPreviewC_Posix = ImageResult Function(Pointer<Utf8> path,
+    Int32 halfSize, Int32 fitWidth, Int32 fitHeight,
+    Pointer<PreviewBandsStruct> bands);
+typedef GetPreviewDart_Posix = ImageResult Function(Pointer<Utf8> path,
+    int halfSize, int fitWidth, int fitHeight,
+    Pointer<PreviewBandsStruct> bands);
+
+typedef GetPreviewC_Buffer = ImageResult Function(
+    Pointer<Uint8> buffer,
+    Int32 size,
+    Int32 halfSize,
+    Int32 fitWidth,
+    Int32 fitHeight,
+    Pointer<PreviewBandsStruct> bands);
+typedef GetPreviewDart_Buffer = ImageResult Function(
+    Pointer<Uint8> buffer,
+    int size,
+    int halfSize,
+    int fitWidth,
+    int fitHeight,
+    Pointer<PreviewBandsStruct> bands);
+
+// Outputs of one render_outputs call, as in the native wrappers
+const int renderMaxOutputs = 4;
+
+// RenderSpec formats
+const int renderBgr = 0; // BMP, as bitmap thumbnails
+const int renderBgrPyramid = 1; // BMP with pyramid and histogram, as previews
+const int renderRgba = 2; // Raw RGBA pixels
+
+final class RenderSpecStruct extends Struct {
+  @Int32()
+  external int fitWidth;
+  @Int32()
+  external int fitHeight;
+  @Int32()
+  external int format;
+}
+
+final class RenderOutputsStruct extends Struct {
+  @Array(renderMaxOutputs)
+  external Array<ImageResult> outputs;
+  @Int32()
+  external int count;
+}
+
+typedef RenderOutputsC = RenderOutputsStruct Function(Pointer<Utf16> path,
+    Int32 halfSize, Pointer<RenderSpecStruct> specs, Int32 count);
+typedef RenderOutputsDart = RenderOutputsStruct Function(Pointer<Utf16> path,
+    int halfSize, Pointer<RenderSpecStruct> specs, int count);
+
+typedef RenderOutputsC_Posix = RenderOutputsStruct Function(Pointer<Utf8> path,
+    Int32 halfSize, Pointer<RenderSpecStruct> specs, Int32 count);
+typedef RenderOutputsDart_Posix = RenderOutputsStruct Function(
+    Pointer<Utf8> path,
+    int halfSize,
+    Pointer<RenderSpecStruct> specs,
+    int count);
+
+typedef RenderOutputsC_Buffer = RenderOutputsStruct Function(
+    Pointer<Uint8> buffer,
+    Size size,
+    Int32 halfSize,
+    Pointer<RenderSpecStruct> specs,
+    Int32 count);
+typedef RenderOutputsDart_Buffer = RenderOutputsStruct Function(
+    Pointer<Uint8> buffer,
+    int size,
+    int halfSize,
+    Pointer<RenderSpecStruct> specs,
+    int count);
+
+typedef GetPyramidTileC = Int32 Function(
+    Pointer<Uint8> pyramid,
+    Int32 width,
+    Int32 height,
+    Int32 level,
+    Int32 tileX,
+    Int32 tileY,
+    Pointer<Uint8> out,
+    Pointer<Int32> tileWidth,
+    Pointer<Int32> tileHeight);
+typedef GetPyramidTileDart = int Function(
+    Pointer<Uint8> pyramid,
+    int width,
+    int height,
+    int level,
+    int tileX,
+    int tileY,
+    Pointer<Uint8> out,
+    Pointer<Int32> tileWidth,
+    Pointer<Int32> tileHeight);
 
-typedef GetPreviewC = ImageResult Function(Pointer<Utf16> path, Int32 halfSize);
-typedef GetPreviewDart = ImageResult Function(
+// Mirrors libraw_raw_stats_t
+final class RawStatsStruct extends Struct {
+  @Array(4)
+  external Array<Uint32> pixels;
+  @Array(4)
+  external Array<Uint32> clipped;
+  @Array(4)
+  external Array<Uint32> crushed;
+  @Array(4)
+  external Array<Float> blackMean;
+  @Array(4)
+  external Array<Float> blackNoise;
+  @Uint32()
+  external int white;
+  @Int32()
+  external int histShift;
+  @Array(4, 256)
+  external Array<Array<Uint32>> histogram;
+}
+
+typedef GetRawStatsC = Int32 Function(Pointer<Utf16> path,
+    Pointer<RawStatsStruct> stats, Pointer<Uint8> mask, Int32 maskWidth,
+    Int32 maskHeight);
+typedef GetRawStatsDart = int Function(Pointer<Utf16> path,
+    Pointer<RawStatsStruct> stats, Pointer<Uint8> mask, int maskWidth,
+    int maskHeight);
+
+typedef GetRawStatsC_Posix = Int32 Function(Pointer<Utf8> path,
+    Pointer<RawStatsStruct> stats, Pointer<Uint8> mask, Int32 maskWidth,
+    Int32 maskHeight);
+typedef GetRawStatsDart_Posix = int Function(Pointer<Utf8> path,
+    Pointer<RawStatsStruct> stats, Pointer<Uint8> mask, int maskWidth,
+    int maskHeight);
+
+typedef GetRawStatsC_Buffer = Int32 Function(
+    Pointer<Uint8> buffer,
+    Size size,
+    Pointer<RawStatsStruct> stats,
+    Pointer<Uint8> mask,
+    Int32 maskWidth,
+    Int32 maskHeight);
+typedef GetRawStatsDart_Buffer = int Function(
+    Pointer<Uint8> buffer,
+    int size,
+    Pointer<RawStatsStruct> stats,
+    Pointer<Uint8> mask,
+    int maskWidth,
+    int maskHeight);
+
+// Mirrors DevelopParams in the native wrappers
+final class DevelopParamsStruct extends Struct {
+  @Array(4)
+  external Array<Float> wb;
+  @Float()
+  external double exposure;
+  @Float()
+  external double exposurePreserve;
+  @Int32()
+  external int highlight;
+  @Array(2)
+  external Array<Float> gamma;
+  @Float()
+  external double bright;
+}
+
+typedef DevelopOpenC = Pointer<Void> Function(
+    Pointer<Utf16> path, Int32 halfSize);
+typedef DevelopOpenDart = Pointer<Void> Function(
     Pointer<Utf16> path, int halfSize);
 
-typedef GetPreviewC_Posix = ImageResult Function(
+typedef DevelopOpenC_Posix = Pointer<Void> Function(
     Pointer<Utf8> path, Int32 halfSize);
-typedef GetPreviewDart_Posix = ImageResult Function(
+typedef DevelopOpenDart_Posix = Pointer<Void> Function(
     Pointer<Utf8> path, int halfSize);
 
-typedef GetPreviewC_Buffer = ImageResult Function(
-    Pointer<Uint8> buffer, Int32 size, Int32 halfSize);
-typedef GetPreviewDart_Buffer = ImageResult Function(
+typedef DevelopOpenC_Buffer = Pointer<Void> Function(
+    Pointer<Uint8> buffer, Size size, Int32 halfSize);
+typedef DevelopOpenDart_Buffer = Pointer<Void> Function(
     Pointer<Uint8> buffer, int size, int halfSize);
 
+typedef DevelopRenderC = ImageResult Function(Pointer<Void> session,
+    Pointer<DevelopParamsStruct> params, Int32 fitWidth, Int32 fitHeight);
+typedef DevelopRenderDart = ImageResult Function(Pointer<Void> session,
+    Pointer<DevelopParamsStruct> params, int fitWidth, int fitHeight);
+
+typedef DevelopCloseC = Void Function(Pointer<Void> session);
+typedef DevelopCloseDart = void Function(Pointer<Void> session);
+
+// Mirrors ExportJob in the native wrappers: written by the exporting worker,
+// polled by the UI isolate
+final class ExportJobStruct extends Struct {
+  @Int32()
+  external int progress; // 0 .. 1000
+  @Int32()
+  external int cancel;
+}
+
+// Export formats, as LibRaw_export_formats
+const int exportTiff = 0; // 16-bit TIFF
+const int exportJpeg = 1; // 8-bit baseline JPEG
+
+// LIBRAW_CANCELLED_BY_CALLBACK, returned by a cancelled export
+const int librawCancelled = -100010;
+
+typedef ExportFileC = Int32 Function(
+    Pointer<Utf16> srcPath,
+    Pointer<Utf16> dstPath,
+    Int32 format,
+    Int32 quality,
+    Int32 halfSize,
+    Pointer<DevelopParamsStruct> params,
+    Pointer<ExportJobStruct> job);
+typedef ExportFileDart = int Function(
+    Pointer<Utf16> srcPath,
+    Pointer<Utf16> dstPath,
+    int format,
+    int quality,
+    int halfSize,
+    Pointer<DevelopParamsStruct> params,
+    Pointer<ExportJobStruct> job);
+
+typedef ExportFileC_Posix = Int32 Function(
+    Pointer<Utf8> srcPath,
+    Pointer<Utf8> dstPath,
+    Int32 format,
+    Int32 quality,
+    Int32 halfSize,
+    Pointer<DevelopParamsStruct> params,
+    Pointer<ExportJobStruct> job);
+typedef ExportFileDart_Posix = int Function(
+    Pointer<Utf8> srcPath,
+    Pointer<Utf8> dstPath,
+    int format,
+    int quality,
+    int halfSize,
+    Pointer<DevelopParamsStruct> params,
+    Pointer<ExportJobStruct> job);
+
+typedef ExportFileC_Buffer = Int32 Function(
+    Pointer<Uint8> buffer,
+    Size size,
+    Pointer<Utf8> dstPath,
+    Int32 format,
+    Int32 quality,
+    Int32 halfSize,
+    Pointer<DevelopParamsStruct> params,
+    Pointer<ExportJobStruct> job);
+typedef ExportFileDart_Buffer = int Function(
+    Pointer<Uint8> buffer,
+    int size,
+    Pointer<Utf8> dstPath,
+    int format,
+    int quality,
+    int halfSize,
+    Pointer<DevelopParamsStruct> params,
+    Pointer<ExportJobStruct> job);
+
+// Mirrors ScanEntry and ScanResult in the native wrappers
+final class ScanEntryStruct extends Struct {
+  @Int32()
+  external int name; // Offset into ScanResultStruct.names, in code units
+  @Int32()
+  external int kind; // scanRaw or scanBitmap
+  @Int64()
+  external int captured; // Seconds since 1970, 0 if unknown
+  @Int64()
+  external int modified;
+}
+
+final class ScanResultStruct extends Struct {
+  external Pointer<ScanEntryStruct> entries;
+  @Int32()
+  external int count;
+  external Pointer<Void> names; // UTF-16 on Windows, UTF-8 elsewhere
+}
+
+// ScanEntryStruct kinds, found from the file contents
+const int scanRaw = 0;
+const int scanBitmap = 1;
+
+// scan_directory flags: read capture times from the file headers
+const int scanCaptureTime = 1;
+
+typedef ScanDirectoryC = ScanResultStruct Function(
+    Pointer<Utf16> path, Int32 flags);
+typedef ScanDirectoryDart = ScanResultStruct Function(
+    Pointer<Utf16> path, int flags);
+
+typedef ScanDirectoryC_Posix = ScanResultStruct Function(
+    Pointer<Utf8> path, Int32 flags);
+typedef ScanDirectoryDart_Posix = ScanResultStruct Function(
+    Pointer<Utf8> path, int flags);
+
 typedef FreeBufferC = Void Function(Pointer<Uint8> buffer);
 typedef FreeBufferDart = void Function(Pointer<Uint8> buffer);
 
+// Edge of the pyramid tiles, as in the native wrappers
+const int pyramidTileSize = 256;
+
+// Downsampled copies of a rendered preview for zooming out, cut into
+// pyramidTileSize tiles. Level 1 is half size, level 2 a quarter, ...; level 0
+// is the preview itself and has no tiles.
+class ImagePyramid {
+  final int width; // Full-size image
+  final int height;
+  final int levels; // Including the full-size image
+  // BMP bytes per level (index level - 1), row-major tiles
+  final List<List<Uint8List>> tiles;
+
+  ImagePyramid(this.width, this.height, this.levels, this.tiles);
+
+  int levelWidth(int level) {
+    int w = width;
+    for (int l = 0; l < level; l++) {
+      w = (w + 1) ~/ 2;
+    }
+    return w;
+  }
+
+  int levelHeight(int level) {
+    int h = height;
+    for (int l = 0; l < level; l++) {
+      h = (h + 1) ~/ 2;
+    }
+    return h;
+  }
+
+  int tilesX(int level) =>
+      (levelWidth(level) + pyramidTileSize - 1) ~/ pyramidTileSize;
+
+  int tilesY(int level) =>
+      (levelHeight(level) + pyramidTileSize - 1) ~/ pyramidTileSize;
+
+  Uint8List tile(int level, int x, int y) =>
+      tiles[level - 1][y * tilesX(level) + x];
+
+  // Smallest level still at least displayWidth pixels wide
+  int levelFor(double displayWidth) {
+    int level = 0;
+    while (level + 1 < levels && levelWidth(level + 1) >= displayWidth) {
+      level++;
+    }
+    return level;
+  }
+
+  int get byteSize {
+    int size = 0;
+    for (final level in tiles) {
+      for (final tile in level) {
+        size += tile.length;
+      }
+    }
+    return size;
+  }
+}
+
 class LibRawImage {
   final Uint8List data;
   final int width;
   final int height;
-  final int format; // 0: JPEG, 1: BMP (Converted from RGB)
+  // 0: JPEG (PNG for engine-decoded thumbnails), 1: BMP (Converted from
+  // RGB), 2: RGBA pixels
+  final int format;
+  // Output histogram of rendered previews: 256 R bins, then G, then B
+  final Uint32List? histogram;
+  final ImagePyramid? pyramid;
+  // Thumbnails asked for with a preview: the half-size render they were
+  // made from, when there was no usable embedded thumbnail
+  final LibRawImage? renderedPreview;
+  // LibRaw flip of the source; already applied to the pixels or, for JPEG
+  // thumbnails, carried in their Exif orientation
+  final int flip;
 
-  LibRawImage(this.data, this.width, this.height, this.format);
+  LibRawImage(this.data, this.width, this.height, this.format,
+      {this.histogram, this.pyramid, this.renderedPreview, this.flip = 0});
 }
 
 class ViewerImage {
@@ -93,6 +499,8 @@ class ViewerImage {
   final int? width;
   final int? height;
   final int? format;
+  final Uint32List? histogram;
+  final ImagePyramid? pyramid;
   final bool isRaw;
 
   const ViewerImage({
@@ -101,15 +509,20 @@ class ViewerImage {
     this.width,
     this.height,
     this.format,
+    this.histogram,
+    this.pyramid,
   });
 
-  factory ViewerImage.fromRaw(LibRawImage image) {
+  // isRaw false for thumbnails of bitmap files, which come the same way
+  factory ViewerImage.fromRaw(LibRawImage image, {bool isRaw = true}) {
     return ViewerImage(
       data: image.data,
       width: image.width,
       height: image.height,
       format: image.format,
-      isRaw: true,
+      histogram: image.histogram,
+      pyramid: image.pyramid,
+      isRaw: isRaw,
     );
   }
 
@@ -172,8 +585,22 @@ Uint8List _addBmpHeader(Uint8List rgbData, int width, int height) {
   }
 }
 
+class ThumbnailRequest {
+  final String path;
+  // Bitmap thumbnails are scaled down to fit, 0 for full size
+  final int fitWidth;
+  final int fitHeight;
+  // Keep the half-size render if the thumbnail has to be made from the raw
+  // data, see LibRawImage.renderedPreview
+  final bool withPreview;
+
+  ThumbnailRequest(this.path,
+      {this.fitWidth = 0, this.fitHeight = 0, this.withPreview = false});
+}
+
 // Worker function for compute
-LibRawImage? getThumbnailSync(String path) {
+LibRawImage? getThumbnailSync(ThumbnailRequest request) {
+  final path = request.path;
   final FreeBufferDart freeBufferFunc =
       nativeLib.lookup<NativeFunction<FreeBufferC>>('free_buffer').asFunction();
 
@@ -184,7 +611,8 @@ LibRawImage? getThumbnailSync(String path) {
 
     final pathPtr = path.toNativeUtf16();
     try {
-      final result = getThumbnailFunc(pathPtr);
+      final result = getThumbnailFunc(pathPtr, request.fitWidth,
+          request.fitHeight, request.withPreview ? 1 : 0);
       return _processThumbnailResult(result, freeBufferFunc);
     } finally {
       calloc.free(pathPtr);
@@ -198,7 +626,8 @@ LibRawImage? getThumbnailSync(String path) {
     final pathPtr = path.toNativeUtf8();
     ThumbnailResult result;
     try {
-      result = getThumbnailFunc(pathPtr);
+      result = getThumbnailFunc(pathPtr, request.fitWidth, request.fitHeight,
+          request.withPreview ? 1 : 0);
     } finally {
       calloc.free(pathPtr);
     }
@@ -208,7 +637,7 @@ LibRawImage? getThumbnailSync(String path) {
     }
 
     // Fallback: Try reading file to memory and passing buffer (Fix for Android Scoped Storage)
-    if (Platform.isAndroid) {
+    if (Platform.isAndroid && !_noNativeThumbnail(path)) {
       try {
         final file = File(path);
         if (!file.existsSync()) return null;
@@ -224,7 +653,8 @@ LibRawImage? getThumbnailSync(String path) {
             .asFunction();
 
         try {
-          final resultBuffer = getThumbnailBufferFunc(bufferPtr, bytes.length);
+          final resultBuffer = getThumbnailBufferFunc(bufferPtr, bytes.length,
+              request.fitWidth, request.fitHeight, request.withPreview ? 1 : 0);
           return _processThumbnailResult(resultBuffer, freeBufferFunc);
         } finally {
           calloc.free(bufferPtr);
@@ -239,8 +669,15 @@ LibRawImage? getThumbnailSync(String path) {
   }
 }
 
+// Formats nothing native reads a thumbnail from, decoded by the engine
+bool _noNativeThumbnail(String filePath) {
+  final extension = path.extension(filePath).toLowerCase();
+  return extension == '.png' || extension == '.webp';
+}
+
 LibRawImage? _processThumbnailResult(
     ThumbnailResult result, FreeBufferDart freeBufferFunc) {
+  final renderedPreview = _processPreviewResult(result.preview, freeBufferFunc);
   if (result.data == nullptr || result.size == 0) {
     return null;
   }
@@ -266,20 +703,27 @@ LibRawImage? _processThumbnailResult(
 
   freeBufferFunc(result.data);
 
-  return LibRawImage(finalData, width, height, finalFormat);
+  return LibRawImage(finalData, width, height, finalFormat,
+      renderedPreview: renderedPreview, flip: result.flip);
 }
 
 class PreviewRequest {
   final String path;
   final int halfSize;
+  // Scale the render down to fit, 0 for full size
+  final int fitWidth;
+  final int fitHeight;
+  final int bandsAddress; // PreviewBandsStruct owned by the caller, 0 for none
 
-  PreviewRequest(this.path, this.halfSize);
+  PreviewRequest(this.path, this.halfSize,
+      {this.fitWidth = 0, this.fitHeight = 0, this.bandsAddress = 0});
 }
 
 // Worker function for compute
 LibRawImage? getPreviewSync(PreviewRequest request) {
   final FreeBufferDart freeBufferFunc =
       nativeLib.lookup<NativeFunction<FreeBufferC>>('free_buffer').asFunction();
+  final bands = Pointer<PreviewBandsStruct>.fromAddress(request.bandsAddress);
 
   if (Platform.isWindows) {
     final GetPreviewDart getPreviewFunc = nativeLib
@@ -288,7 +732,8 @@ LibRawImage? getPreviewSync(PreviewRequest request) {
 
     final pathPtr = request.path.toNativeUtf16();
     try {
-      final result = getPreviewFunc(pathPtr, request.halfSize);
+      final result = getPreviewFunc(pathPtr, request.halfSize,
+          request.fitWidth, request.fitHeight, bands);
       return _processPreviewResult(result, freeBufferFunc);
     } finally {
       calloc.free(pathPtr);
@@ -302,7 +747,8 @@ LibRawImage? getPreviewSync(PreviewRequest request) {
     final pathPtr = request.path.toNativeUtf8();
     ImageResult result;
     try {
-      result = getPreviewFunc(pathPtr, request.halfSize);
+      result = getPreviewFunc(pathPtr, request.halfSize, request.fitWidth,
+          request.fitHeight, bands);
     } finally {
       calloc.free(pathPtr);
     }
@@ -328,8 +774,8 @@ LibRawImage? getPreviewSync(PreviewRequest request) {
             .asFunction();
 
         try {
-          final resultBuffer =
-              getPreviewBufferFunc(bufferPtr, bytes.length, request.halfSize);
+          final resultBuffer = getPreviewBufferFunc(bufferPtr, bytes.length,
+              request.halfSize, request.fitWidth, request.fitHeight, bands);
           return _processPreviewResult(resultBuffer, freeBufferFunc);
         } finally {
           calloc.free(bufferPtr);
@@ -346,6 +792,20 @@ LibRawImage? getPreviewSync(PreviewRequest request) {
 
 LibRawImage? _processPreviewResult(
     ImageResult result, FreeBufferDart freeBufferFunc) {
+  Uint32List? histogram;
+  if (result.histogram != nullptr) {
+    histogram = Uint32List.fromList(result.histogram.asTypedList(3 * 256));
+    freeBufferFunc(result.histogram.cast<Uint8>());
+  }
+
+  ImagePyramid? pyramid;
+  if (result.pyramid != nullptr) {
+    if (result.data != nullptr && result.levels > 1) {
+      pyramid = _copyPyramidTiles(result);
+    }
+    freeBufferFunc(result.pyramid);
+  }
+
   if (result.data == nullptr || result.size == 0) {
     return null;
   }
@@ -361,7 +821,611 @@ LibRawImage? _processPreviewResult(
 
   freeBufferFunc(result.data);
 
-  return LibRawImage(finalData, width, height, 1);
+  return LibRawImage(finalData, width, height, 1,
+      histogram: histogram, pyramid: pyramid);
+}
+
+// The part of a progressive preview rendered so far: image covers left, top
+// of a width x height preview
+class PreviewBandsFrame {
+  final LibRawImage image;
+  final int left;
+  final int top;
+  final int width;
+  final int height;
+
+  PreviewBandsFrame(this.image, this.left, this.top, this.width, this.height);
+}
+
+// Copies out the filled part of a progressive render, null before the first
+// band. The render keeps writing, so the rectangle is clamped to the image
+PreviewBandsFrame? readPreviewBands(Pointer<PreviewBandsStruct> bands) {
+  final ref = bands.ref;
+  final width = ref.width;
+  final height = ref.height;
+  final left = ref.filledX;
+  final top = ref.filledY;
+  if (width <= 0 || height <= 0 || left < 0 || top < 0) return null;
+  if (width * height > ref.fitWidth * ref.fitHeight) return null;
+  final partWidth = math.min(ref.filledWidth, width - left);
+  final partHeight = math.min(ref.filledHeight, height - top);
+  if (partWidth <= 0 || partHeight <= 0) return null;
+
+  final pixels = ref.pixels.asTypedList(width * height * 3);
+  final part = Uint8List(partWidth * partHeight * 3);
+  for (int row = 0; row < partHeight; row++) {
+    final from = ((top + row) * width + left) * 3;
+    part.setRange(
+        row * partWidth * 3, (row + 1) * partWidth * 3, pixels, from);
+  }
+  return PreviewBandsFrame(
+      LibRawImage(_addBmpHeader(part, partWidth, partHeight), partWidth,
+          partHeight, 1),
+      left,
+      top,
+      width,
+      height);
+}
+
+// One output of renderOutputsSync
+class RenderSpec {
+  final int fitWidth; // Scale down to fit, 0 for full size
+  final int fitHeight;
+  final int format; // renderBgr, renderBgrPyramid or renderRgba
+
+  const RenderSpec(
+      {this.fitWidth = 0, this.fitHeight = 0, this.format = renderBgr});
+}
+
+class RenderRequest {
+  final String path;
+  final int halfSize;
+  final List<RenderSpec> specs; // Up to renderMaxOutputs
+
+  RenderRequest(this.path, this.specs, {this.halfSize = 1});
+}
+
+// Worker function for compute: decode and demosaic once, one image per spec
+// (null where it failed). Smaller outputs are scaled down natively from the
+// larger ones.
+List<LibRawImage?> renderOutputsSync(RenderRequest request) {
+  final FreeBufferDart freeBufferFunc =
+      nativeLib.lookup<NativeFunction<FreeBufferC>>('free_buffer').asFunction();
+
+  final count = request.specs.length < renderMaxOutputs
+      ? request.specs.length
+      : renderMaxOutputs;
+  final specsPtr = calloc<RenderSpecStruct>(renderMaxOutputs);
+  try {
+    for (int i = 0; i < count; i++) {
+      specsPtr[i].fitWidth = request.specs[i].fitWidth;
+      specsPtr[i].fitHeight = request.specs[i].fitHeight;
+      specsPtr[i].format = request.specs[i].format;
+    }
+
+    RenderOutputsStruct result;
+    if (Platform.isWindows) {
+      final RenderOutputsDart renderOutputsFunc = nativeLib
+          .lookup<NativeFunction<RenderOutputsC>>('render_outputs')
+          .asFunction();
+      final pathPtr = request.path.toNativeUtf16();
+      try {
+        result = renderOutputsFunc(pathPtr, request.halfSize, specsPtr, count);
+      } finally {
+        calloc.free(pathPtr);
+      }
+    } else {
+      final RenderOutputsDart_Posix renderOutputsFunc = nativeLib
+          .lookup<NativeFunction<RenderOutputsC_Posix>>('render_outputs')
+          .asFunction();
+      final pathPtr = request.path.toNativeUtf8();
+      try {
+        result = renderOutputsFunc(pathPtr, request.halfSize, specsPtr, count);
+      } finally {
+        calloc.free(pathPtr);
+      }
+
+      // Fallback: Try buffer (Android Scoped Storage)
+      if (result.count == 0 && Platform.isAndroid) {
+        final file = File(request.path);
+        if (file.existsSync()) {
+          final bytes = file.readAsBytesSync();
+          final bufferPtr = calloc<Uint8>(bytes.length);
+          bufferPtr.asTypedList(bytes.length).setAll(0, bytes);
+
+          final RenderOutputsDart_Buffer renderOutputsBufferFunc = nativeLib
+              .lookup<NativeFunction<RenderOutputsC_Buffer>>(
+                  'render_outputs_from_buffer')
+              .asFunction();
+          try {
+            result = renderOutputsBufferFunc(
+                bufferPtr, bytes.length, request.halfSize, specsPtr, count);
+          } finally {
+            calloc.free(bufferPtr);
+          }
+        }
+      }
+    }
+
+    final images = <LibRawImage?>[];
+    for (int i = 0; i < count; i++) {
+      if (i >= result.count) {
+        images.add(null);
+      } else if (request.specs[i].format == renderRgba) {
+        images.add(_processRgbaResult(result.outputs[i], freeBufferFunc));
+      } else {
+        // BMP, with the pyramid and histogram where the native side made them
+        images.add(_processPreviewResult(result.outputs[i], freeBufferFunc));
+      }
+    }
+    return images;
+  } finally {
+    calloc.free(specsPtr);
+  }
+}
+
+LibRawImage? _processRgbaResult(
+    ImageResult result, FreeBufferDart freeBufferFunc) {
+  Uint32List? histogram;
+  if (result.histogram != nullptr) {
+    histogram = Uint32List.fromList(result.histogram.asTypedList(3 * 256));
+    freeBufferFunc(result.histogram.cast<Uint8>());
+  }
+  if (result.data == nullptr || result.size == 0) {
+    return null;
+  }
+
+  final data = Uint8List.fromList(result.data.asTypedList(result.size));
+  freeBufferFunc(result.data);
+
+  return LibRawImage(data, result.width, result.height, 2,
+      histogram: histogram);
+}
+
+// Cut the native pyramid into BMP tiles, ready for Image.memory
+ImagePyramid _copyPyramidTiles(ImageResult result) {
+  final GetPyramidTileDart getPyramidTileFunc = nativeLib
+      .lookup<NativeFunction<GetPyramidTileC>>('get_pyramid_tile')
+      .asFunction();
+
+  final pyramid = ImagePyramid(result.width, result.height, result.levels, []);
+  final out = calloc<Uint8>(pyramidTileSize * pyramidTileSize * 3);
+  final tileWidth = calloc<Int32>();
+  final tileHeight = calloc<Int32>();
+  try {
+    for (int level = 1; level < result.levels; level++) {
+      final tiles = <Uint8List>[];
+      for (int y = 0; y < pyramid.tilesY(level); y++) {
+        for (int x = 0; x < pyramid.tilesX(level); x++) {
+          getPyramidTileFunc(result.pyramid, result.width, result.height,
+              level, x, y, out, tileWidth, tileHeight);
+          final w = tileWidth.value;
+          final h = tileHeight.value;
+          tiles.add(_addBmpHeader(
+              Uint8List.fromList(out.asTypedList(w * h * 3)), w, h));
+        }
+      }
+      pyramid.tiles.add(tiles);
+    }
+  } finally {
+    calloc.free(out);
+    calloc.free(tileWidth);
+    calloc.free(tileHeight);
+  }
+  return pyramid;
+}
+
+// Raw-domain exposure statistics, per CFA color (R, G, B, G2)
+class RawStats {
+  final List<int> pixels;
+  final List<int> clipped; // at or above the white level
+  final List<int> crushed; // at or below the black level
+  final List<double> blackMean; // masked sensor area, 0 if none
+  final List<double> blackNoise;
+  final int white;
+  final int histShift; // histogram bin = raw value >> histShift
+  final Uint32List histogram; // 4 x 256 bins
+  // One byte per cell: bit c clipped in color c, bit c + 4 crushed
+  final Uint8List? clipMask;
+  final int maskWidth;
+  final int maskHeight;
+
+  RawStats({
+    required this.pixels,
+    required this.clipped,
+    required this.crushed,
+    required this.blackMean,
+    required this.blackNoise,
+    required this.white,
+    required this.histShift,
+    required this.histogram,
+    this.clipMask,
+    this.maskWidth = 0,
+    this.maskHeight = 0,
+  });
+
+  double clippedFraction(int color) =>
+      pixels[color] == 0 ? 0 : clipped[color] / pixels[color];
+
+  double crushedFraction(int color) =>
+      pixels[color] == 0 ? 0 : crushed[color] / pixels[color];
+}
+
+class RawStatsRequest {
+  final String path;
+  final int maskWidth;
+  final int maskHeight;
+
+  RawStatsRequest(this.path, {this.maskWidth = 0, this.maskHeight = 0});
+}
+
+// Worker function for compute
+RawStats? getRawStatsSync(RawStatsRequest request) {
+  final maskSize = request.maskWidth * request.maskHeight;
+  final statsPtr = calloc<RawStatsStruct>();
+  final maskPtr = maskSize > 0 ? calloc<Uint8>(maskSize) : nullptr;
+  try {
+    int ret;
+    if (Platform.isWindows) {
+      final GetRawStatsDart getRawStatsFunc = nativeLib
+          .lookup<NativeFunction<GetRawStatsC>>('get_raw_stats')
+          .asFunction();
+      final pathPtr = request.path.toNativeUtf16();
+      try {
+        ret = getRawStatsFunc(pathPtr, statsPtr, maskPtr, request.maskWidth,
+            request.maskHeight);
+      } finally {
+        calloc.free(pathPtr);
+      }
+    } else {
+      final GetRawStatsDart_Posix getRawStatsFunc = nativeLib
+          .lookup<NativeFunction<GetRawStatsC_Posix>>('get_raw_stats')
+          .asFunction();
+      final pathPtr = request.path.toNativeUtf8();
+      try {
+        ret = getRawStatsFunc(pathPtr, statsPtr, maskPtr, request.maskWidth,
+            request.maskHeight);
+      } finally {
+        calloc.free(pathPtr);
+      }
+
+      // Fallback: Try buffer (Android Scoped Storage)
+      if (ret != 0 && Platform.isAndroid) {
+        final file = File(request.path);
+        if (!file.existsSync()) return null;
+
+        final bytes = file.readAsBytesSync();
+        final bufferPtr = calloc<Uint8>(bytes.length);
+        bufferPtr.asTypedList(bytes.length).setAll(0, bytes);
+
+        final GetRawStatsDart_Buffer getRawStatsBufferFunc = nativeLib
+            .lookup<NativeFunction<GetRawStatsC_Buffer>>(
+                'get_raw_stats_from_buffer')
+            .asFunction();
+        try {
+          ret = getRawStatsBufferFunc(bufferPtr, bytes.length, statsPtr,
+              maskPtr, request.maskWidth, request.maskHeight);
+        } finally {
+          calloc.free(bufferPtr);
+        }
+      }
+    }
+    if (ret != 0) {
+      return null;
+    }
+
+    final stats = statsPtr.ref;
+    final histogram = Uint32List(4 * 256);
+    for (int c = 0; c < 4; c++) {
+      for (int i = 0; i < 256; i++) {
+        histogram[c * 256 + i] = stats.histogram[c][i];
+      }
+    }
+    return RawStats(
+      pixels: List<int>.generate(4, (c) => stats.pixels[c]),
+      clipped: List<int>.generate(4, (c) => stats.clipped[c]),
+      crushed: List<int>.generate(4, (c) => stats.crushed[c]),
+      blackMean: List<double>.generate(4, (c) => stats.blackMean[c]),
+      blackNoise: List<double>.generate(4, (c) => stats.blackNoise[c]),
+      white: stats.white,
+      histShift: stats.histShift,
+      histogram: histogram,
+      clipMask: maskSize > 0
+          ? Uint8List.fromList(maskPtr.asTypedList(maskSize))
+          : null,
+      maskWidth: request.maskWidth,
+      maskHeight: request.maskHeight,
+    );
+  } finally {
+    calloc.free(statsPtr);
+    if (maskPtr != nullptr) {
+      calloc.free(maskPtr);
+    }
+  }
+}
+
+// Adjustments a develop session can re-render quickly
+class DevelopSettings {
+  // R, G, B, G2 multipliers, null for the camera white balance
+  final List<double>? wb;
+  final double exposure; // Linear, 1.0 for none (0.25 .. 8)
+  final double exposurePreserve; // Keep highlights when brightening (0 .. 1)
+  final int highlight; // 0: clip, 1: unclip, 2: blend, 3..9: rebuild
+  final double gamma; // Output curve power
+  final double toeSlope; // Output curve slope near black
+  final double bright;
+
+  const DevelopSettings({
+    this.wb,
+    this.exposure = 1.0,
+    this.exposurePreserve = 0.0,
+    this.highlight = 0,
+    this.gamma = 2.222,
+    this.toeSlope = 4.5,
+    this.bright = 1.0,
+  });
+
+  void _fill(DevelopParamsStruct params) {
+    final wb = this.wb;
+    for (int c = 0; c < 4; c++) {
+      params.wb[c] = wb == null ? 0 : wb[c < wb.length ? c : 1];
+    }
+    params.exposure = exposure;
+    params.exposurePreserve = exposurePreserve;
+    params.highlight = highlight;
+    params.gamma[0] = gamma;
+    params.gamma[1] = toeSlope;
+    params.bright = bright;
+  }
+}
+
+// A raw kept unpacked in native memory so new settings only re-run white
+// balance onwards. Only holds the native address, so it can be sent to a
+// worker isolate; use it from one isolate at a time.
+class DevelopSession {
+  final String path;
+  final int _address;
+
+  DevelopSession._(this.path, this._address);
+
+  // Worker function: opens and unpacks path, null on failure
+  static DevelopSession? open(String path, {int halfSize = 1}) {
+    Pointer<Void> session;
+    if (Platform.isWindows) {
+      final DevelopOpenDart developOpenFunc = nativeLib
+          .lookup<NativeFunction<DevelopOpenC>>('develop_open')
+          .asFunction();
+      final pathPtr = path.toNativeUtf16();
+      try {
+        session = developOpenFunc(pathPtr, halfSize);
+      } finally {
+        calloc.free(pathPtr);
+      }
+    } else {
+      final DevelopOpenDart_Posix developOpenFunc = nativeLib
+          .lookup<NativeFunction<DevelopOpenC_Posix>>('develop_open')
+          .asFunction();
+      final pathPtr = path.toNativeUtf8();
+      try {
+        session = developOpenFunc(pathPtr, halfSize);
+      } finally {
+        calloc.free(pathPtr);
+      }
+
+      // Fallback: Try buffer (Android Scoped Storage), the session keeps a
+      // copy
+      if (session == nullptr && Platform.isAndroid) {
+        final file = File(path);
+        if (!file.existsSync()) return null;
+
+        final bytes = file.readAsBytesSync();
+        final bufferPtr = calloc<Uint8>(bytes.length);
+        bufferPtr.asTypedList(bytes.length).setAll(0, bytes);
+
+        final DevelopOpenDart_Buffer developOpenBufferFunc = nativeLib
+            .lookup<NativeFunction<DevelopOpenC_Buffer>>(
+                'develop_open_from_buffer')
+            .asFunction();
+        try {
+          session = developOpenBufferFunc(bufferPtr, bytes.length, halfSize);
+        } finally {
+          calloc.free(bufferPtr);
+        }
+      }
+    }
+    if (session == nullptr) {
+      return null;
+    }
+    return DevelopSession._(path, session.address);
+  }
+
+  // Worker function: renders with settings, scaled down to fit unless
+  // fitWidth/fitHeight are 0
+  LibRawImage? render(DevelopSettings settings,
+      {int fitWidth = 0, int fitHeight = 0}) {
+    final FreeBufferDart freeBufferFunc = nativeLib
+        .lookup<NativeFunction<FreeBufferC>>('free_buffer')
+        .asFunction();
+    final DevelopRenderDart developRenderFunc = nativeLib
+        .lookup<NativeFunction<DevelopRenderC>>('develop_render')
+        .asFunction();
+
+    final paramsPtr = calloc<DevelopParamsStruct>();
+    try {
+      settings._fill(paramsPtr.ref);
+      final result = developRenderFunc(
+          Pointer<Void>.fromAddress(_address), paramsPtr, fitWidth, fitHeight);
+      return _processPreviewResult(result, freeBufferFunc);
+    } finally {
+      calloc.free(paramsPtr);
+    }
+  }
+
+  // Worker function: frees the native session
+  void close() {
+    final DevelopCloseDart developCloseFunc = nativeLib
+        .lookup<NativeFunction<DevelopCloseC>>('develop_close')
+        .asFunction();
+    developCloseFunc(Pointer<Void>.fromAddress(_address));
+  }
+}
+
+class ExportRequest {
+  final String path;
+  final String destination;
+  final int format;
+  final int quality;
+  final int halfSize;
+  final DevelopSettings? settings; // null for the preview look
+  final int jobAddress; // ExportJobStruct owned by the caller, 0 for none
+
+  ExportRequest(this.path, this.destination,
+      {this.format = exportJpeg,
+      this.quality = 90,
+      this.halfSize = 0,
+      this.settings,
+      this.jobAddress = 0});
+}
+
+// Worker function: develops path at full quality and writes it to
+// destination. Returns 0 or a LibRaw error code, librawCancelled when the
+// job was cancelled.
+int exportFileSync(ExportRequest request) {
+  final job = Pointer<ExportJobStruct>.fromAddress(request.jobAddress);
+  if (job != nullptr && job.ref.cancel != 0) {
+    return librawCancelled;
+  }
+
+  final settings = request.settings;
+  final paramsPtr = settings == null ? nullptr : calloc<DevelopParamsStruct>();
+  try {
+    if (settings != null) {
+      settings._fill(paramsPtr.ref);
+    }
+    int ret;
+    if (Platform.isWindows) {
+      final ExportFileDart exportFileFunc = nativeLib
+          .lookup<NativeFunction<ExportFileC>>('export_file')
+          .asFunction();
+      final pathPtr = request.path.toNativeUtf16();
+      final dstPtr = request.destination.toNativeUtf16();
+      try {
+        ret = exportFileFunc(pathPtr, dstPtr, request.format, request.quality,
+            request.halfSize, paramsPtr, job);
+      } finally {
+        calloc.free(pathPtr);
+        calloc.free(dstPtr);
+      }
+    } else {
+      final ExportFileDart_Posix exportFileFunc = nativeLib
+          .lookup<NativeFunction<ExportFileC_Posix>>('export_file')
+          .asFunction();
+      final pathPtr = request.path.toNativeUtf8();
+      final dstPtr = request.destination.toNativeUtf8();
+      try {
+        ret = exportFileFunc(pathPtr, dstPtr, request.format, request.quality,
+            request.halfSize, paramsPtr, job);
+
+        // Fallback: Try buffer (Android Scoped Storage), unless the source
+        // was opened and the export failed or was cancelled later on
+        final opened = job != nullptr && job.ref.progress > 0;
+        if (ret != 0 &&
+            ret != librawCancelled &&
+            !opened &&
+            Platform.isAndroid) {
+          final file = File(request.path);
+          if (!file.existsSync()) return ret;
+
+          final bytes = file.readAsBytesSync();
+          final bufferPtr = calloc<Uint8>(bytes.length);
+          bufferPtr.asTypedList(bytes.length).setAll(0, bytes);
+
+          final ExportFileDart_Buffer exportFileBufferFunc = nativeLib
+              .lookup<NativeFunction<ExportFileC_Buffer>>(
+                  'export_file_from_buffer')
+              .asFunction();
+          try {
+            ret = exportFileBufferFunc(bufferPtr, bytes.length, dstPtr,
+                request.format, request.quality, request.halfSize, paramsPtr,
+                job);
+          } finally {
+            calloc.free(bufferPtr);
+          }
+        }
+      } finally {
+        calloc.free(pathPtr);
+        calloc.free(dstPtr);
+      }
+    }
+    return ret;
+  } finally {
+    if (paramsPtr != nullptr) {
+      calloc.free(paramsPtr);
+    }
+  }
+}
+
+// A media file found by scanDirectorySync
+class ScannedFile {
+  final String path;
+  final bool isRaw;
+  final DateTime? capturedAt;
+  final DateTime modifiedAt;
+
+  ScannedFile(this.path, this.isRaw, this.capturedAt, this.modifiedAt);
+}
+
+DateTime _fromUnixSeconds(int seconds) =>
+    DateTime.fromMillisecondsSinceEpoch(seconds * 1000);
+
+// Worker function: the raw and bitmap files in directory (not its
+// subdirectories), told apart by their contents and sorted by capture time,
+// or modification time where there is none. Only the file headers are read.
+List<ScannedFile> scanDirectorySync(String directory,
+    {int flags = scanCaptureTime}) {
+  final FreeBufferDart freeBufferFunc =
+      nativeLib.lookup<NativeFunction<FreeBufferC>>('free_buffer').asFunction();
+
+  ScanResultStruct result;
+  if (Platform.isWindows) {
+    final ScanDirectoryDart scanDirectoryFunc = nativeLib
+        .lookup<NativeFunction<ScanDirectoryC>>('scan_directory')
+        .asFunction();
+    final pathPtr = directory.toNativeUtf16();
+    try {
+      result = scanDirectoryFunc(pathPtr, flags);
+    } finally {
+      calloc.free(pathPtr);
+    }
+  } else {
+    final ScanDirectoryDart_Posix scanDirectoryFunc = nativeLib
+        .lookup<NativeFunction<ScanDirectoryC_Posix>>('scan_directory')
+        .asFunction();
+    final pathPtr = directory.toNativeUtf8();
+    try {
+      result = scanDirectoryFunc(pathPtr, flags);
+    } finally {
+      calloc.free(pathPtr);
+    }
+  }
+
+  final files = <ScannedFile>[];
+  for (int i = 0; i < result.count; i++) {
+    final entry = result.entries[i];
+    final name = Platform.isWindows
+        ? Pointer<Utf16>.fromAddress(result.names.address + 2 * entry.name)
+            .toDartString()
+        : Pointer<Utf8>.fromAddress(result.names.address + entry.name)
+            .toDartString();
+    files.add(ScannedFile(
+        path.join(directory, name),
+        entry.kind == scanRaw,
+        entry.captured == 0 ? null : _fromUnixSeconds(entry.captured),
+        _fromUnixSeconds(entry.modified)));
+  }
+  freeBufferFunc(result.entries.cast<Uint8>());
+  freeBufferFunc(result.names.cast<Uint8>());
+  return files;
 }
 
 // Future<LibRawImage?> getThumbnail(String path) async {
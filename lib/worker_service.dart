@@ -1,5 +1,12 @@
 import 'dart:async';
+import 'dart:ffi';
+import 'dart:io';
 import 'dart:isolate';
+import 'dart:math' as math;
+import 'dart:ui' as ui;
+
+import 'package:ffi/ffi.dart';
+import 'package:path/path.dart' as p;
 
 import 'native_lib.dart';
 
@@ -22,8 +29,49 @@ class WorkerService {
   // Track active requests to cancel them if needed (best effort)
   final Set<int> _cancelledRequests = {};
 
+  // Bitmap thumbnails are scaled down natively to fit this box (physical
+  // pixels), 0 for full size
+  int _thumbnailFitWidth = 0;
+  int _thumbnailFitHeight = 0;
+
+  // Half-size renders that came with thumbnails requested withPreview, kept
+  // for the preview request of the same file that usually follows
+  static const int _maxRenderedPreviews = 2;
+  final Map<String, LibRawImage> _renderedPreviews = {};
+
+  // Develop renders run on their own isolate, which keeps the session of the
+  // last developed image open. While one renders, only the newest request
+  // waits; older ones complete with null.
+  SendPort? _developSendPort;
+  Isolate? _developIsolate;
+  Completer<LibRawImage?>? _developInFlight;
+  _DevelopRequest? _developQueued;
+  Completer<LibRawImage?>? _developQueuedCompleter;
+
+  // Exports run on the pool after the decode requests queued with them
+  final Map<int, ExportTask> _exportTasks = {};
+
+  // Bands of progressive previews handed to a worker, until it is done with
+  // them
+  final Map<int, PreviewBands> _previewBands = {};
+
+  // Thumbnails of files the pool found none in, decoded by the engine: see
+  // _decodeScaledThumbnail
+  static const List<String> _engineDecodedExtensions = [
+    '.jpg',
+    '.jpeg',
+    '.png',
+    '.webp',
+  ];
+  final Map<String, Future<LibRawImage?>> _engineDecodes = {};
+
   WorkerService._internal();
 
+  void setDisplaySize(int width, int height) {
+    _thumbnailFitWidth = width;
+    _thumbnailFitHeight = height;
+  }
+
   Future<void> init() async {
     if (_isolates[0] != null) return;
 
@@ -43,7 +91,11 @@ class WorkerService {
   }
 
   void _handleResponse(dynamic message) {
-    if (message is _WorkerResponse) {
+    if (message is _ExportResponse) {
+      _exportTasks.remove(message.requestId)?._workerFinished(message.code);
+    } else if (message is _BandsDone) {
+      _previewBands.remove(message.requestId)?._workerFinished();
+    } else if (message is _WorkerResponse) {
       final completer = _pendingRequests.remove(message.requestId);
 
       // Also remove from deduplication map
@@ -65,24 +117,45 @@ class WorkerService {
     }
   }
 
+  // withPreview: if the thumbnail has to be rendered from the raw data, keep
+  // the half-size render too, so a following requestPreview(path) with
+  // halfSize 1 does not decode the file again
   WorkerTask<LibRawImage?> requestThumbnail(String path,
-      {TaskPriority priority = TaskPriority.high}) {
+      {TaskPriority priority = TaskPriority.high, bool withPreview = false}) {
     final requestId = _nextRequestId++;
     return WorkerTask(this, requestId, path, _RequestType.thumbnail,
-        priority: priority);
+        priority: priority, withPreview: withPreview);
   }
 
+  // progressive: a full-size (halfSize 0) render also fills in the task's
+  // bands, scaled to the display size, while it runs
   WorkerTask<LibRawImage?> requestPreview(String path,
-      {int halfSize = 1, TaskPriority priority = TaskPriority.high}) {
+      {int halfSize = 1,
+      TaskPriority priority = TaskPriority.high,
+      bool progressive = false}) {
     final requestId = _nextRequestId++;
+    final bands = progressive &&
+            halfSize == 0 &&
+            _thumbnailFitWidth > 0 &&
+            _thumbnailFitHeight > 0
+        ? PreviewBands._(_thumbnailFitWidth, _thumbnailFitHeight)
+        : null;
     return WorkerTask(this, requestId, path, _RequestType.preview,
-        halfSize: halfSize, priority: priority);
+        halfSize: halfSize, priority: priority, bands: bands);
   }
 
   Future<T> _executeTask<T>(int requestId, String path, _RequestType type,
-      {int halfSize = 1, TaskPriority priority = TaskPriority.high}) async {
+      {int halfSize = 1,
+      TaskPriority priority = TaskPriority.high,
+      bool withPreview = false,
+      PreviewBands? bands}) async {
     await init();
 
+    if (type == _RequestType.preview && halfSize == 1) {
+      final preview = _renderedPreviews.remove(path);
+      if (preview != null) return preview as T;
+    }
+
     final dedupeKey = '$path:${type.name}:$halfSize';
     if (_activeRequestsByKey.containsKey(dedupeKey)) {
       final existingReqId = _activeRequestsByKey[dedupeKey]!;
@@ -91,7 +164,7 @@ class WorkerService {
 
       if (_pendingRequests.containsKey(existingReqId)) {
         final result = await _pendingRequests[existingReqId]!.future;
-        return result as T;
+        return await _withEngineDecode(path, type, result) as T;
       }
     }
 
@@ -99,6 +172,12 @@ class WorkerService {
     final completer = Completer<LibRawImage?>();
     _pendingRequests[requestId] = completer;
 
+    if (bands != null && (bands._sent || bands._released)) bands = null;
+    if (bands != null) {
+      bands._sent = true;
+      _previewBands[requestId] = bands;
+    }
+
     final workerIndex = _nextWorkerIndex;
     _nextWorkerIndex = (_nextWorkerIndex + 1) % _poolSize;
 
@@ -108,10 +187,197 @@ class WorkerService {
       type: type,
       halfSize: halfSize,
       priority: priority,
+      fitWidth: type == _RequestType.thumbnail ? _thumbnailFitWidth : 0,
+      fitHeight: type == _RequestType.thumbnail ? _thumbnailFitHeight : 0,
+      withPreview: withPreview,
+      bandsAddress: bands?._bands.address ?? 0,
     ));
 
     final result = await completer.future;
-    return result as T;
+    return await _withEngineDecode(path, type, result) as T;
+  }
+
+  Future<LibRawImage?> _withEngineDecode(
+      String path, _RequestType type, LibRawImage? result) async {
+    if (result != null ||
+        type != _RequestType.thumbnail ||
+        !_engineDecodedExtensions.contains(p.extension(path).toLowerCase())) {
+      return _stashRenderedPreview(path, result);
+    }
+    final decode = _engineDecodes.putIfAbsent(
+        path,
+        () => _decodeScaledThumbnail(path)
+            .whenComplete(() => _engineDecodes.remove(path)));
+    return decode;
+  }
+
+  // PNG, WebP and JPEG without an Exif thumbnail: decode straight at the
+  // thumbnail size, which for JPEG the engine does as a DCT-scaled decode,
+  // and keep the result as PNG, so caches hold the small image rather than
+  // the file
+  Future<LibRawImage?> _decodeScaledThumbnail(String path) async {
+    try {
+      final bytes = await File(path).readAsBytes();
+      final buffer = await ui.ImmutableBuffer.fromUint8List(bytes);
+      final codec = await ui.instantiateImageCodecWithSize(buffer,
+          getTargetSize: (width, height) {
+        if (_thumbnailFitWidth <= 0 ||
+            _thumbnailFitHeight <= 0 ||
+            (width <= _thumbnailFitWidth && height <= _thumbnailFitHeight)) {
+          return ui.TargetImageSize(width: width, height: height);
+        }
+        final scale = math.min(
+            _thumbnailFitWidth / width, _thumbnailFitHeight / height);
+        return ui.TargetImageSize(
+            width: math.max(1, (width * scale).round()),
+            height: math.max(1, (height * scale).round()));
+      });
+      final frame = await codec.getNextFrame();
+      codec.dispose();
+      final image = frame.image;
+      final png = await image.toByteData(format: ui.ImageByteFormat.png);
+      final result = png == null
+          ? null
+          : LibRawImage(png.buffer.asUint8List(), image.width, image.height, 0);
+      image.dispose();
+      return result;
+    } catch (_) {
+      return null;
+    }
+  }
+
+  // Keep the render a thumbnail came with and hand out the thumbnail alone,
+  // so caches holding thumbnails do not hold the render as well
+  LibRawImage? _stashRenderedPreview(String path, LibRawImage? image) {
+    final preview = image?.renderedPreview;
+    if (image == null || preview == null) return image;
+
+    _renderedPreviews.remove(path);
+    _renderedPreviews[path] = preview;
+    while (_renderedPreviews.length > _maxRenderedPreviews) {
+      _renderedPreviews.remove(_renderedPreviews.keys.first);
+    }
+    return LibRawImage(image.data, image.width, image.height, image.format,
+        flip: image.flip);
+  }
+
+  // Develop path at full quality (halfSize 0) and write it to destination as
+  // a 16-bit TIFF or a JPEG, with settings or the preview look. The task
+  // reports progress and can be cancelled while it runs.
+  ExportTask exportFile(String path, String destination,
+      {int format = exportJpeg,
+      int quality = 90,
+      int halfSize = 0,
+      DevelopSettings? settings}) {
+    final requestId = _nextRequestId++;
+    final task = ExportTask._(path, destination);
+    final request = ExportRequest(path, destination,
+        format: format,
+        quality: quality,
+        halfSize: halfSize,
+        settings: settings,
+        jobAddress: task._job.address);
+    _executeExport(requestId, request, task);
+    return task;
+  }
+
+  // Export each of paths into directory, named after the source file
+  List<ExportTask> exportFiles(List<String> paths, String directory,
+      {int format = exportJpeg,
+      int quality = 90,
+      int halfSize = 0,
+      DevelopSettings? settings}) {
+    final extension = format == exportTiff ? '.tif' : '.jpg';
+    return [
+      for (final path in paths)
+        exportFile(path,
+            p.join(directory, '${p.basenameWithoutExtension(path)}$extension'),
+            format: format,
+            quality: quality,
+            halfSize: halfSize,
+            settings: settings)
+    ];
+  }
+
+  Future<void> _executeExport(
+      int requestId, ExportRequest request, ExportTask task) async {
+    try {
+      await init();
+    } catch (error, stackTrace) {
+      task._notSent(error, stackTrace);
+      return;
+    }
+
+    _exportTasks[requestId] = task;
+
+    final workerIndex = _nextWorkerIndex;
+    _nextWorkerIndex = (_nextWorkerIndex + 1) % _poolSize;
+    _workerSendPorts[workerIndex]!.send(_ExportRequest(requestId, request));
+  }
+
+  // List the media files of a folder with their capture times. Runs on its
+  // own short-lived isolate, since the native scan keeps a thread pool busy
+  // for a while on a large card and the decode pool should not wait for it.
+  Future<List<ScannedFile>> scanDirectory(String path) {
+    return Isolate.run(() => scanDirectorySync(path));
+  }
+
+  // Re-render path with new settings, e.g. while a slider is dragged.
+  // Completes with null when a newer request replaced this one.
+  Future<LibRawImage?> develop(String path, DevelopSettings settings,
+      {int halfSize = 1, int fitWidth = 0, int fitHeight = 0}) async {
+    await _initDevelop();
+
+    final request = _DevelopRequest(path, settings, halfSize,
+        fitWidth: fitWidth, fitHeight: fitHeight);
+    final completer = Completer<LibRawImage?>();
+    if (_developInFlight == null) {
+      _developInFlight = completer;
+      _developSendPort!.send(request);
+    } else {
+      _developQueuedCompleter?.complete(null);
+      _developQueued = request;
+      _developQueuedCompleter = completer;
+    }
+    return completer.future;
+  }
+
+  // Free the open develop session, e.g. when leaving the image
+  void closeDevelop() {
+    _developSendPort?.send(const _DevelopClose());
+  }
+
+  Future<void> _initDevelop() async {
+    if (_developIsolate != null) return;
+
+    final receivePort = ReceivePort();
+    _developIsolate = await Isolate.spawn(_developEntry, receivePort.sendPort);
+    final responsePort = ReceivePort();
+    _developSendPort = await receivePort.first as SendPort;
+    _developSendPort!.send(responsePort.sendPort);
+    responsePort.listen(_handleDevelopResponse);
+  }
+
+  void _handleDevelopResponse(dynamic message) {
+    if (message is! _WorkerResponse) return;
+
+    final completer = _developInFlight;
+    _developInFlight = null;
+    if (completer != null) {
+      if (message.error != null) {
+        completer.completeError(message.error!);
+      } else {
+        completer.complete(message.image);
+      }
+    }
+
+    final queued = _developQueued;
+    if (queued != null) {
+      _developInFlight = _developQueuedCompleter;
+      _developQueued = null;
+      _developQueuedCompleter = null;
+      _developSendPort!.send(queued);
+    }
   }
 
   void bumpRequest(int requestId, TaskPriority priority) {
@@ -145,6 +411,28 @@ class WorkerService {
     }
     _pendingRequests.clear();
     _cancelledRequests.clear();
+    // A killed worker may still be inside export_file: stop the exports
+    // there and leave their jobs allocated, no reply will come to free them
+    for (final task in _exportTasks.values) {
+      task._abandon();
+    }
+    _exportTasks.clear();
+    // Likewise for the bands of progressive previews
+    for (final bands in _previewBands.values) {
+      bands._cancel();
+    }
+    _previewBands.clear();
+
+    // Let the develop isolate free its session and exit on its own; a kill
+    // could land before the session is closed
+    _developSendPort?.send(const _DevelopClose(shutdown: true));
+    _developIsolate = null;
+    _developSendPort = null;
+    _developInFlight?.complete(null);
+    _developInFlight = null;
+    _developQueuedCompleter?.complete(null);
+    _developQueued = null;
+    _developQueuedCompleter = null;
   }
 }
 
@@ -157,15 +445,128 @@ class WorkerTask<T> {
   final _RequestType type;
   final int halfSize;
   final TaskPriority priority;
+  final bool withPreview;
+  // Set for progressive previews: poll bands.frame() while result is pending
+  final PreviewBands? bands;
 
   WorkerTask(this._service, this.requestId, this.path, this.type,
-      {this.halfSize = 1, this.priority = TaskPriority.high});
-
-  Future<T> get result => _service._executeTask<T>(requestId, path, type,
-      halfSize: halfSize, priority: priority);
+      {this.halfSize = 1,
+      this.priority = TaskPriority.high,
+      this.withPreview = false,
+      this.bands});
+
+  Future<T> get result => _service
+      ._executeTask<T>(requestId, path, type,
+          halfSize: halfSize,
+          priority: priority,
+          withPreview: withPreview,
+          bands: bands)
+      .whenComplete(() => bands?._release());
 
   void cancel() {
+    bands?._cancel();
     _service.cancelRequest(requestId);
+    bands?._release();
+  }
+}
+
+// The part of a progressive preview rendered so far. The worker writes the
+// native bands until it is done with the request; they are freed once that
+// is the case and the task no longer reads them.
+class PreviewBands {
+  final Pointer<PreviewBandsStruct> _bands;
+  int _seen = 0;
+  bool _sent = false; // Handed to a worker
+  bool _workerDone = false;
+  bool _released = false; // Result arrived or the task was cancelled
+  bool _freed = false;
+
+  PreviewBands._(int fitWidth, int fitHeight)
+      : _bands = calloc<PreviewBandsStruct>() {
+    _bands.ref.pixels = calloc<Uint8>(fitWidth * fitHeight * 3);
+    _bands.ref.fitWidth = fitWidth;
+    _bands.ref.fitHeight = fitHeight;
+  }
+
+  // The filled part, or null when no band came since the last call
+  PreviewBandsFrame? frame() {
+    if (_released) return null;
+    final bands = _bands.ref.bands;
+    if (bands == _seen) return null;
+    _seen = bands;
+    return readPreviewBands(_bands);
+  }
+
+  // Stops the native render at its next band
+  void _cancel() {
+    if (!_freed) _bands.ref.cancel = 1;
+  }
+
+  void _release() {
+    _released = true;
+    _freeIfUnused();
+  }
+
+  void _workerFinished() {
+    _workerDone = true;
+    _freeIfUnused();
+  }
+
+  void _freeIfUnused() {
+    if (_freed || !_released || (_sent && !_workerDone)) return;
+    _freed = true;
+    calloc.free(_bands.ref.pixels);
+    calloc.free(_bands);
+  }
+}
+
+// A running or queued export. Poll progress, e.g. from a timer, while
+// result is pending. The worker writes the native job until it replies, so
+// it is only freed then.
+class ExportTask {
+  final String path;
+  final String destination;
+  final Pointer<ExportJobStruct> _job = calloc<ExportJobStruct>();
+  final Completer<int> _result = Completer<int>();
+  bool _done = false;
+  int _finalProgress = 0;
+
+  ExportTask._(this.path, this.destination);
+
+  // 0 or a LibRaw error code
+  Future<int> get result => _result.future;
+
+  // 0 .. 1
+  double get progress => (_done ? _finalProgress : _job.ref.progress) / 1000;
+
+  // Stops the export at its next progress step, result completes with
+  // librawCancelled and the partial file is removed
+  void cancel() {
+    if (!_done) {
+      _job.ref.cancel = 1;
+    }
+  }
+
+  void _workerFinished(int code) {
+    _finalProgress = code == 0 ? 1000 : _job.ref.progress;
+    _done = true;
+    calloc.free(_job);
+    _result.complete(code);
+  }
+
+  void _notSent(Object error, StackTrace stackTrace) {
+    _done = true;
+    calloc.free(_job);
+    _result.completeError(error, stackTrace);
+  }
+
+  // The pool is going away under the export: stop it at its next progress
+  // step. The job is never freed, the worker may still be writing it.
+  void _abandon() {
+    _job.ref.cancel = 1;
+    _finalProgress = _job.ref.progress;
+    _done = true;
+    _result.complete(librawCancelled);
   }
 }
 
@@ -177,6 +578,10 @@ class _WorkerRequest {
   final _RequestType type;
   final int halfSize;
   final TaskPriority priority;
+  final int fitWidth;
+  final int fitHeight;
+  final bool withPreview;
+  final int bandsAddress; // PreviewBandsStruct of a progressive preview, or 0
 
   _WorkerRequest({
     required this.requestId,
@@ -184,9 +589,47 @@ class _WorkerRequest {
     required this.type,
     this.halfSize = 1,
     this.priority = TaskPriority.high,
+    this.fitWidth = 0,
+    this.fitHeight = 0,
+    this.withPreview = false,
+    this.bandsAddress = 0,
   });
 }
 
+class _DevelopRequest {
+  final String path;
+  final DevelopSettings settings;
+  final int halfSize;
+  final int fitWidth;
+  final int fitHeight;
+
+  _DevelopRequest(this.path, this.settings, this.halfSize,
+      {this.fitWidth = 0, this.fitHeight = 0});
+}
+
+class _DevelopClose {
+  final bool shutdown; // Also stop the develop isolate
+  const _DevelopClose({this.shutdown = false});
+}
+
+class _ExportRequest {
+  final int requestId;
+  final ExportRequest request;
+  _ExportRequest(this.requestId, this.request);
+}
+
+class _ExportResponse {
+  final int requestId;
+  final int code;
+  _ExportResponse(this.requestId, this.code);
+}
+
+// The worker no longer writes the bands of this request
+class _BandsDone {
+  final int requestId;
+  _BandsDone(this.requestId);
+}
+
 class _CancelRequest {
   final int requestId;
   _CancelRequest(this.requestId);
@@ -219,14 +662,39 @@ void _workerEntry(SendPort mainSendPort) {
   // Use two lists for priority handling
   final List<_WorkerRequest> highPriorityRequests = [];
   final List<_WorkerRequest> lowPriorityRequests = [];
+  // Exports are long and run in order, once no decode request is waiting
+  final List<_ExportRequest> exportRequests = [];
   bool isProcessing = false;
 
+  // The main isolate frees the bands of a progressive preview on this
+  void releaseBands(_WorkerRequest request) {
+    if (request.bandsAddress != 0) {
+      replyPort?.send(_BandsDone(request.requestId));
+    }
+  }
+
   // Process the queue
   Future<void> processQueue() async {
     if (isProcessing) return;
     isProcessing = true;
 
-    while (highPriorityRequests.isNotEmpty || lowPriorityRequests.isNotEmpty) {
+    while (highPriorityRequests.isNotEmpty ||
+        lowPriorityRequests.isNotEmpty ||
+        exportRequests.isNotEmpty) {
+      if (highPriorityRequests.isEmpty && lowPriorityRequests.isEmpty) {
+        final exportRequest = exportRequests.removeAt(0);
+        int code;
+        try {
+          code = exportFileSync(exportRequest.request);
+        } catch (e) {
+          code = -1; // LIBRAW_UNSPECIFIED_ERROR
+        }
+        // Always reply, the main isolate frees the job on the response
+        replyPort?.send(_ExportResponse(exportRequest.requestId, code));
+        await Future.delayed(Duration.zero);
+        continue;
+      }
+
       // Prioritize high priority requests, then low priority
       // Use LIFO for both queues (take the last request)
       _WorkerRequest request;
@@ -238,6 +706,7 @@ void _workerEntry(SendPort mainSendPort) {
 
       if (cancelledIds.contains(request.requestId)) {
         cancelledIds.remove(request.requestId);
+        releaseBands(request);
         continue;
       }
 
@@ -249,10 +718,15 @@ void _workerEntry(SendPort mainSendPort) {
       try {
         LibRawImage? result;
         if (request.type == _RequestType.thumbnail) {
-          result = getThumbnailSync(request.path);
+          result = getThumbnailSync(ThumbnailRequest(request.path,
+              fitWidth: request.fitWidth,
+              fitHeight: request.fitHeight,
+              withPreview: request.withPreview));
         } else {
-          result =
-              getPreviewSync(PreviewRequest(request.path, request.halfSize));
+          result = getPreviewSync(PreviewRequest(request.path, request.halfSize,
+              fitWidth: request.fitWidth,
+              fitHeight: request.fitHeight,
+              bandsAddress: request.bandsAddress));
         }
 
         // Check cancellation again after processing
@@ -274,6 +748,8 @@ void _workerEntry(SendPort mainSendPort) {
           requestId: request.requestId,
           error: e.toString(),
         ));
+      } finally {
+        releaseBands(request);
       }
 
       // Yield to event loop to allow incoming messages (like Cancel or new Requests)
@@ -288,8 +764,12 @@ void _workerEntry(SendPort mainSendPort) {
     } else if (message is _CancelRequest) {
       cancelledIds.add(message.requestId);
       // Optimization: Remove from pending queues immediately if present
+      final removed = [...highPriorityRequests, ...lowPriorityRequests]
+          .where((r) => r.requestId == message.requestId)
+          .toList();
       highPriorityRequests.removeWhere((r) => r.requestId == message.requestId);
       lowPriorityRequests.removeWhere((r) => r.requestId == message.requestId);
+      removed.forEach(releaseBands);
     } else if (message is _BumpRequest) {
       _WorkerRequest? foundRequest;
 
@@ -317,6 +797,11 @@ void _workerEntry(SendPort mainSendPort) {
           processQueue();
         }
       }
+    } else if (message is _ExportRequest) {
+      exportRequests.add(message);
+      if (!isProcessing) {
+        processQueue();
+      }
     } else if (message is _WorkerRequest) {
       if (message.priority == TaskPriority.high) {
         highPriorityRequests.add(message);
@@ -329,3 +814,45 @@ void _workerEntry(SendPort mainSendPort) {
     }
   });
 }
+
+void _developEntry(SendPort mainSendPort) {
+  final receivePort = ReceivePort();
+  mainSendPort.send(receivePort.sendPort);
+
+  SendPort? replyPort;
+  DevelopSession? session;
+  int sessionHalfSize = 0;
+
+  void closeSession() {
+    session?.close();
+    session = null;
+  }
+
+  receivePort.listen((message) {
+    if (message is SendPort) {
+      replyPort = message;
+    } else if (message is _DevelopClose) {
+      closeSession();
+      if (message.shutdown) {
+        receivePort.close();
+      }
+    } else if (message is _DevelopRequest) {
+      try {
+        // Keep the session while the same image is developed
+        if (session == null ||
+            session!.path != message.path ||
+            sessionHalfSize != message.halfSize) {
+          closeSession();
+          session =
+              DevelopSession.open(message.path, halfSize: message.halfSize);
+          sessionHalfSize = message.halfSize;
+        }
+        final image = session?.render(message.settings,
+            fitWidth: message.fitWidth, fitHeight: message.fitHeight);
+        replyPort?.send(_WorkerResponse(requestId: -1, image: image));
+      } catch (e) {
+        replyPort?.send(_WorkerResponse(requestId: -1, error: e.toString()));
+      }
+    }
+  });
+}
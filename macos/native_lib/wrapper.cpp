@@ -1,31 +1,156 @@
 #include "libraw/libraw.h"
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
 
 #define EXPORT __attribute__((visibility("default"))) __attribute__((used))
 
-struct ThumbnailResult {
+// Tile edge of the preview pyramid levels.
+constexpr int kPyramidTile = 256;
+
+// Outputs of one render_outputs() call.
+constexpr int kRenderMaxOutputs = 4;
+
+// RenderSpec formats.
+enum RenderFormat {
+  kRenderBgr = 0,         // Packed BGR, as bitmap thumbnails.
+  kRenderBgrPyramid = 1,  // Packed BGR with pyramid, as get_preview().
+  kRenderRgba = 2,        // Packed RGBA, alpha 255.
+};
+
+// ScanEntry kinds.
+enum ScanKind {
+  kScanRaw = 0,     // Raw signature, or identified by LibRaw.
+  kScanBitmap = 1,  // JPEG, PNG or WebP.
+};
+
+// scan_directory() flags: identify the headers for capture times.
+constexpr int kScanCaptureTime = 1;
+
+// Files scan_directory() reads at once.
+constexpr int kScanMaxThreads = 8;
+
+// Sensor rows per band of a progressive get_preview().
+constexpr int kPreviewBandRows = 256;
+
+struct ImageResult {
   uint8_t* data;
   int size;
   int width;
   int height;
-  int format;
+  uint32_t* histogram;
+  uint8_t* pyramid;  // BGR levels 1/2, 1/4, ... back to back.
+  int levels;        // Pyramid levels including the full-size image.
 };
 
-struct ImageResult {
+struct ThumbnailResult {
   uint8_t* data;
   int size;
   int width;
   int height;
+  int format;
+  // Orientation of the source as LibRaw flip (0: none, 3: 180, 5: 90 CCW,
+  // 6: 90 CW). Already applied to bitmaps; JPEG data carries it as its Exif
+  // orientation, which decoders apply while decoding.
+  int flip;
+  // With want_preview, when the thumbnail had to be rendered from the raw
+  // data: that half-size render as get_preview() returns it.
+  ImageResult preview;
+};
+
+// One output of render_outputs().
+struct RenderSpec {
+  int fit_width;  // Scale down to fit fit_width x fit_height; 0 keeps full size.
+  int fit_height;
+  int format;  // RenderFormat.
+};
+
+struct RenderOutputs {
+  // In spec order; the largest one carries the histogram.
+  ImageResult outputs[kRenderMaxOutputs];
+  int count;
+};
+
+// Settings that may change between renders of a develop session.
+struct DevelopParams {
+  float wb[4];              // R, G, B, G2; all 0 for the camera white balance.
+  float exposure;           // Linear exposure shift, 1.0 for none (0.25-8).
+  float exposure_preserve;  // Keep highlights when brightening (0-1).
+  int highlight;            // 0 clip, 1 unclip, 2 blend, 3-9 rebuild.
+  float gamma[2];           // Output curve power and toe slope.
+  float bright;             // Output brightness, 1.0 by default.
+};
+
+// Progress and cancel flag of one export_file() call, shared with the caller
+// while the export runs on another thread.
+struct ExportJob {
+  volatile int progress;  // 0-1000, written by the export.
+  volatile int cancel;    // Non-zero stops it; the partial file is removed.
+};
+
+// Rows of a full-size get_preview() as they are rendered, scaled down to fit
+// fit_width x fit_height and turned upright, for showing the preview fill in
+// meanwhile. The caller polls bands and copies the filled part, which only
+// grows.
+struct PreviewBands {
+  uint8_t* pixels;  // BGR, fit_width * fit_height * 3 bytes from the caller.
+  int fit_width;
+  int fit_height;
+  // Scaled image, rows width * 3 bytes apart; set with the first band.
+  volatile int width;
+  volatile int height;
+  // Part of the scaled image rendered so far.
+  volatile int filled_x;
+  volatile int filled_y;
+  volatile int filled_width;
+  volatile int filled_height;
+  volatile int bands;   // Bumped after each band.
+  volatile int cancel;  // Non-zero stops the render.
+};
+
+// One file of a scan_directory() result.
+struct ScanEntry {
+  int name;          // Offset of the file name in ScanResult::names.
+  int kind;          // ScanKind.
+  int64_t captured;  // Capture time in seconds since 1970, 0 if unknown.
+  int64_t modified;  // Modification time in seconds since 1970.
+};
+
+struct ScanResult {
+  // By capture time (modification time if unknown), then name.
+  ScanEntry* entries;
+  int count;
+  char* names;  // NUL-terminated UTF-8; free both with free_buffer().
 };
 
 namespace {
 
-ThumbnailResult empty_thumbnail() { return {nullptr, 0, 0, 0, 0}; }
+ImageResult empty_image() { return {nullptr, 0, 0, 0, nullptr, nullptr, 1}; }
+
+ThumbnailResult empty_thumbnail() {
+  return {nullptr, 0, 0, 0, 0, 0, empty_image()};
+}
 
-ImageResult empty_image() { return {nullptr, 0, 0, 0}; }
+RenderOutputs empty_outputs() {
+  RenderOutputs outputs;
+  for (ImageResult& output : outputs.outputs) {
+    output = empty_image();
+  }
+  outputs.count = 0;
+  return outputs;
+}
 
 void copy_rgb_to_bgr(uint8_t* destination,
                      const uint8_t* source,
@@ -39,13 +164,318 @@ void copy_rgb_to_bgr(uint8_t* destination,
   }
 }
 
-ThumbnailResult process_thumbnail(LibRaw& raw_processor) {
+// Number of pyramid levels, counting the full-size image, until a level fits
+// in one tile.
+int pyramid_levels(int width, int height) {
+  int levels = 1;
+  while (width > kPyramidTile || height > kPyramidTile) {
+    width = (width + 1) / 2;
+    height = (height + 1) / 2;
+    ++levels;
+  }
+  return levels;
+}
+
+// 2x2 box filter of two BGR rows into one row of the next level. An odd last
+// column or row is averaged with itself.
+void pyramid_row(const uint8_t* row0,
+                 const uint8_t* row1,
+                 int width,
+                 uint8_t* destination) {
+  const int half = width / 2;
+  for (int x = 0; x < half; ++x) {
+    const uint8_t* a = row0 + x * 6;
+    const uint8_t* b = row1 + x * 6;
+    uint8_t* d = destination + x * 3;
+    d[0] = static_cast<uint8_t>((a[0] + a[3] + b[0] + b[3] + 2) >> 2);
+    d[1] = static_cast<uint8_t>((a[1] + a[4] + b[1] + b[4] + 2) >> 2);
+    d[2] = static_cast<uint8_t>((a[2] + a[5] + b[2] + b[5] + 2) >> 2);
+  }
+  if (width & 1) {
+    const int i = (width - 1) * 3;
+    for (int c = 0; c < 3; ++c) {
+      destination[half * 3 + c] =
+          static_cast<uint8_t>((row0[i + c] + row1[i + c] + 1) >> 1);
+    }
+  }
+}
+
+// Copies an RGB image to BGR and builds the 1/2 level from each row pair while
+// it is in cache, then the smaller levels from the 1/2 one.
+uint8_t* copy_rgb_to_bgr_with_pyramid(uint8_t* destination,
+                                      const uint8_t* source,
+                                      int width,
+                                      int height,
+                                      int* levels) {
+  *levels = pyramid_levels(width, height);
+  size_t total = 0;
+  for (int l = 1, w = width, h = height; l < *levels; ++l) {
+    w = (w + 1) / 2;
+    h = (h + 1) / 2;
+    total += static_cast<size_t>(w) * h * 3;
+  }
+  uint8_t* pyramid =
+      total > 0 ? static_cast<uint8_t*>(malloc(total)) : nullptr;
+  if (pyramid == nullptr) {
+    *levels = 1;
+  }
+
+  const size_t stride = static_cast<size_t>(width) * 3;
+  const int half_width = (width + 1) / 2;
+  for (int y = 0; y < height; y += 2) {
+    const int rows = y + 1 < height ? 2 : 1;
+    copy_rgb_to_bgr(destination + y * stride, source + y * stride, width, rows);
+    if (pyramid != nullptr) {
+      pyramid_row(destination + y * stride,
+                  destination + (y + rows - 1) * stride, width,
+                  pyramid + static_cast<size_t>(y / 2) * half_width * 3);
+    }
+  }
+
+  uint8_t* level = pyramid;
+  for (int l = 2, w = half_width, h = (height + 1) / 2; l < *levels; ++l) {
+    uint8_t* next = level + static_cast<size_t>(w) * h * 3;
+    for (int y = 0; y < h; y += 2) {
+      pyramid_row(level + static_cast<size_t>(y) * w * 3,
+                  level + static_cast<size_t>(y + 1 < h ? y + 1 : y) * w * 3,
+                  w, next + static_cast<size_t>(y / 2) * ((w + 1) / 2) * 3);
+    }
+    level = next;
+    w = (w + 1) / 2;
+    h = (h + 1) / 2;
+  }
+  return pyramid;
+}
+
+// Scales a rendered image or bitmap thumbnail down to fit within
+// fit_width x fit_height, keeping the aspect ratio, and turns it upright by
+// flip (as imgdata.sizes.flip) in the same pass. Returns the image itself
+// when there is nothing to do, otherwise frees it.
+libraw_processed_image_t* fit_image(LibRaw& raw_processor,
+                                    libraw_processed_image_t* image,
+                                    int fit_width,
+                                    int fit_height,
+                                    int flip = 0) {
+  if (image == nullptr || image->type != LIBRAW_IMAGE_BITMAP) {
+    return image;
+  }
+  // Upright size.
+  int width = (flip & 4) ? image->height : image->width;
+  int height = (flip & 4) ? image->width : image->height;
+  if (fit_width > 0 && fit_height > 0 &&
+      (width > fit_width || height > fit_height)) {
+    const double scale =
+        std::min(static_cast<double>(fit_width) / width,
+                 static_cast<double>(fit_height) / height);
+    width = std::max(
+        1, std::min(fit_width, static_cast<int>(width * scale + 0.5)));
+    height = std::max(
+        1, std::min(fit_height, static_cast<int>(height * scale + 0.5)));
+  } else if (flip == 0) {
+    return image;
+  }
+  libraw_processed_image_t* scaled =
+      raw_processor.resample_mem_image(image, width, height, nullptr, flip);
+  if (scaled == nullptr) {
+    return image;
+  }
+  LibRaw::dcraw_clear_mem(image);
+  return scaled;
+}
+
+// Folds LibRaw's linear output histogram through the output curve into
+// 3 x 256 bins of the 8-bit image.
+uint32_t* output_histogram(LibRaw& raw_processor) {
+  int(*hist)[LIBRAW_HISTOGRAM_SIZE] =
+      raw_processor.get_internal_data_pointer()->output_data.histogram;
+  if (hist == nullptr) {
+    return nullptr;
+  }
+  uint32_t* bins = static_cast<uint32_t*>(calloc(3 * 256, sizeof(uint32_t)));
+  if (bins == nullptr) {
+    return nullptr;
+  }
+  const ushort* curve = raw_processor.imgdata.color.curve;
+  for (int b = 0; b < LIBRAW_HISTOGRAM_SIZE; ++b) {
+    const int bin = curve[(b << 3) | 4] >> 8;
+    for (int c = 0; c < 3; ++c) {
+      bins[c * 256 + bin] += static_cast<uint32_t>(hist[c][b]);
+    }
+  }
+  return bins;
+}
+
+void set_preview_params(LibRaw& raw_processor, int half_size) {
+  raw_processor.imgdata.params.use_camera_wb = 1;
+  raw_processor.imgdata.params.half_size = half_size;
+  raw_processor.imgdata.params.output_bps = 8;
+  raw_processor.imgdata.params.output_color = 1;
+  raw_processor.imgdata.params.keep_histogram = 1;
+}
+
+// Output size of a width x height image scaled down to fit fit_width x
+// fit_height, as fit_image() makes it.
+void fit_size(int width,
+              int height,
+              int fit_width,
+              int fit_height,
+              int* out_width,
+              int* out_height) {
+  *out_width = width;
+  *out_height = height;
+  if (fit_width <= 0 || fit_height <= 0 ||
+      (width <= fit_width && height <= fit_height)) {
+    return;
+  }
+  const double scale = std::min(static_cast<double>(fit_width) / width,
+                                static_cast<double>(fit_height) / height);
+  *out_width =
+      std::max(1, std::min(fit_width, static_cast<int>(width * scale + 0.5)));
+  *out_height =
+      std::max(1, std::min(fit_height, static_cast<int>(height * scale + 0.5)));
+}
+
+// Converts an 8-bit RGB image into an ImageResult of the given format.
+void fill_render_output(ImageResult* output,
+                        const libraw_processed_image_t* image,
+                        int format) {
+  const int pixels = image->width * image->height;
+  output->width = image->width;
+  output->height = image->height;
+  output->size = format == kRenderRgba ? pixels * 4 : pixels * 3;
+  output->data =
+      static_cast<uint8_t*>(malloc(static_cast<size_t>(output->size)));
+  if (output->data == nullptr) {
+    output->size = 0;
+    return;
+  }
+  if (format == kRenderBgrPyramid) {
+    output->pyramid = copy_rgb_to_bgr_with_pyramid(
+        output->data, image->data, image->width, image->height,
+        &output->levels);
+  } else if (format == kRenderRgba) {
+    for (int i = 0; i < pixels; ++i) {
+      output->data[i * 4 + 0] = image->data[i * 3 + 0];
+      output->data[i * 4 + 1] = image->data[i * 3 + 1];
+      output->data[i * 4 + 2] = image->data[i * 3 + 2];
+      output->data[i * 4 + 3] = 255;
+    }
+  } else {
+    copy_rgb_to_bgr(output->data, image->data, image->width, image->height);
+  }
+}
+
+// Makes every spec'd output from the image dcraw_process() left in
+// raw_processor. Outputs are made largest first, each one scaled down from the
+// previous (smallest so far) rather than from the full render.
+RenderOutputs render_outputs_from(LibRaw& raw_processor,
+                                  const RenderSpec* specs,
+                                  int count) {
+  RenderOutputs result = empty_outputs();
+  result.count = std::max(0, std::min(count, kRenderMaxOutputs));
+
+  libraw_processed_image_t* full = raw_processor.dcraw_make_mem_image();
+  if (full == nullptr || full->type != LIBRAW_IMAGE_BITMAP ||
+      full->bits != 8 || full->colors != 3) {
+    LibRaw::dcraw_clear_mem(full);
+    return result;
+  }
+
+  int order[kRenderMaxOutputs];
+  int widths[kRenderMaxOutputs];
+  int heights[kRenderMaxOutputs];
+  for (int i = 0; i < result.count; ++i) {
+    order[i] = i;
+    fit_size(full->width, full->height, specs[i].fit_width,
+             specs[i].fit_height, &widths[i], &heights[i]);
+  }
+  std::stable_sort(order, order + result.count, [&](int a, int b) {
+    return static_cast<int64_t>(widths[a]) * heights[a] >
+           static_cast<int64_t>(widths[b]) * heights[b];
+  });
+
+  libraw_processed_image_t* source = full;
+  for (int k = 0; k < result.count; ++k) {
+    const int i = order[k];
+    libraw_processed_image_t* image = source;
+    if (widths[i] != source->width || heights[i] != source->height) {
+      image = raw_processor.resample_mem_image(source, widths[i], heights[i]);
+      if (image == nullptr) {
+        continue;
+      }
+    }
+    fill_render_output(&result.outputs[i], image, specs[i].format);
+    if (image != source) {
+      if (source != full) {
+        LibRaw::dcraw_clear_mem(source);
+      }
+      source = image;
+    }
+  }
+  if (source != full) {
+    LibRaw::dcraw_clear_mem(source);
+  }
+  LibRaw::dcraw_clear_mem(full);
+
+  if (result.count > 0) {
+    result.outputs[order[0]].histogram = output_histogram(raw_processor);
+  }
+  return result;
+}
+
+// Files LibRaw cannot open: the Exif thumbnail of a plain JPEG, read from the
+// header without decoding the picture. It keeps the orientation in its Exif.
+// Empty for anything else, which the caller decodes itself.
+ThumbnailResult process_jpeg_thumbnail(LibRaw& raw_processor,
+                                       LibRaw_abstract_datastream& stream) {
+  ThumbnailResult result = empty_thumbnail();
+  if (raw_processor.open_jpeg_thumb(&stream) != LIBRAW_SUCCESS) {
+    return result;
+  }
+  raw_processor.imgdata.rawparams.options |=
+      LIBRAW_RAWOPTIONS_THUMB_EXIF_ORIENTATION;
+  int error_code = 0;
+  libraw_processed_image_t* thumb =
+      raw_processor.dcraw_make_mem_thumb(&error_code);
+  if (thumb == nullptr) {
+    return result;
+  }
+  result.data = static_cast<uint8_t*>(malloc(thumb->data_size));
+  if (result.data != nullptr) {
+    memcpy(result.data, thumb->data, thumb->data_size);
+    result.size = thumb->data_size;
+  }
+  result.format = 0;  // JPEG
+  result.flip = raw_processor.imgdata.sizes.flip;
+  LibRaw::dcraw_clear_mem(thumb);
+  return result;
+}
+
+ThumbnailResult process_thumbnail(LibRaw& raw_processor,
+                                  int fit_width,
+                                  int fit_height,
+                                  int want_preview) {
   ThumbnailResult result = empty_thumbnail();
 
+  // Bitmap thumbnails are converted straight to BGR, as the BMP the caller
+  // wraps them in expects, and all come in sensor orientation; JPEGs get the
+  // orientation in their Exif.
+  raw_processor.imgdata.rawparams.options |=
+      LIBRAW_RAWOPTIONS_BGR_BITMAP_THUMBS |
+      LIBRAW_RAWOPTIONS_NO_ROTATE_FOR_KODAK_THUMBNAILS |
+      LIBRAW_RAWOPTIONS_THUMB_EXIF_ORIENTATION;
+  result.flip = raw_processor.imgdata.sizes.flip;
   if (raw_processor.unpack_thumb() == LIBRAW_SUCCESS) {
     int error_code = 0;
     libraw_processed_image_t* thumb =
         raw_processor.dcraw_make_mem_thumb(&error_code);
+    if (thumb != nullptr && thumb->type == LIBRAW_IMAGE_BITMAP &&
+        thumb->colors != 3) {
+      // Not RGB or grey: render from the raw data instead.
+      LibRaw::dcraw_clear_mem(thumb);
+      thumb = nullptr;
+    }
+    thumb = fit_image(raw_processor, thumb, fit_width, fit_height, result.flip);
 
     if (thumb != nullptr) {
       result.size = thumb->data_size;
@@ -67,13 +497,37 @@ ThumbnailResult process_thumbnail(LibRaw& raw_processor) {
     }
   }
 
+  // The caller is about to show the preview anyway: render it with the
+  // preview settings and hand back both from the one demosaic.
+  if (want_preview) {
+    set_preview_params(raw_processor, 1);
+    if (raw_processor.unpack() != LIBRAW_SUCCESS ||
+        raw_processor.dcraw_process() != LIBRAW_SUCCESS) {
+      return result;
+    }
+    const RenderSpec specs[2] = {{fit_width, fit_height, kRenderBgr},
+                                 {0, 0, kRenderBgrPyramid}};
+    const RenderOutputs outputs = render_outputs_from(raw_processor, specs, 2);
+    const ImageResult& thumb = outputs.outputs[0];
+    result.format = 1;
+    result.data = thumb.data;
+    result.size = thumb.size;
+    result.width = thumb.width;
+    result.height = thumb.height;
+    result.preview = outputs.outputs[1];
+    return result;
+  }
+
   raw_processor.imgdata.params.use_camera_wb = 1;
   raw_processor.imgdata.params.half_size = 1;
   raw_processor.imgdata.params.output_bps = 8;
+  raw_processor.imgdata.params.auto_bright_quant = 24;
 
   if (raw_processor.unpack() == LIBRAW_SUCCESS &&
       raw_processor.dcraw_process() == LIBRAW_SUCCESS) {
-    libraw_processed_image_t* image = raw_processor.dcraw_make_mem_image();
+    libraw_processed_image_t* image = fit_image(
+        raw_processor, raw_processor.dcraw_make_mem_image(), fit_width,
+        fit_height);
 
     if (image != nullptr) {
       result.format = 1;
@@ -93,34 +547,272 @@ ThumbnailResult process_thumbnail(LibRaw& raw_processor) {
   return result;
 }
 
-ImageResult process_preview(LibRaw& raw_processor, int half_size) {
+// Converts the image dcraw_process() left in raw_processor, scaled down to
+// fit fit_width x fit_height unless those are 0.
+ImageResult rendered_image_result(LibRaw& raw_processor,
+                                  int fit_width,
+                                  int fit_height) {
   ImageResult result = empty_image();
 
-  raw_processor.imgdata.params.use_camera_wb = 1;
-  raw_processor.imgdata.params.half_size = half_size;
-  raw_processor.imgdata.params.output_bps = 8;
-  raw_processor.imgdata.params.output_color = 1;
-
-  if (raw_processor.unpack() != LIBRAW_SUCCESS ||
-      raw_processor.dcraw_process() != LIBRAW_SUCCESS) {
-    return result;
-  }
-
-  libraw_processed_image_t* image = raw_processor.dcraw_make_mem_image();
+  libraw_processed_image_t* image =
+      fit_image(raw_processor, raw_processor.dcraw_make_mem_image(),
+                fit_width, fit_height);
   if (image != nullptr) {
     result.width = image->width;
     result.height = image->height;
     result.size = image->data_size;
     result.data = static_cast<uint8_t*>(malloc(static_cast<size_t>(result.size)));
     if (result.data != nullptr) {
-      copy_rgb_to_bgr(result.data, image->data, result.width, result.height);
+      result.pyramid = copy_rgb_to_bgr_with_pyramid(
+          result.data, image->data, result.width, result.height,
+          &result.levels);
     }
+    result.histogram = output_histogram(raw_processor);
     LibRaw::dcraw_clear_mem(image);
   }
 
   return result;
 }
 
+// Where preview_band_progress() puts the bands of one get_preview().
+struct BandTarget {
+  LibRaw* processor;
+  PreviewBands* bands;
+  int rows_done;  // Sensor rows placed so far.
+  // Lines of the scaled image placed so far, along the sensor rows.
+  int first_line;
+  int end_line;
+  std::vector<uint8_t> rows;  // One band as copy_mem_band() gives it.
+};
+
+// LibRaw progress callback of a progressive get_preview(): samples each
+// finished band into bands->pixels and grows the filled part over it.
+int preview_band_progress(void* data,
+                          enum LibRaw_progress stage,
+                          int iteration,
+                          int expected) {
+  BandTarget* target = static_cast<BandTarget*>(data);
+  PreviewBands* bands = target->bands;
+  if (stage != LIBRAW_PROGRESS_OUTPUT_BAND || iteration <= target->rows_done) {
+    return bands->cancel;
+  }
+  const int flip = target->processor->imgdata.sizes.flip;
+  const int width = target->processor->imgdata.sizes.width;
+  const int height = expected;
+  const int row0 = target->rows_done;
+  const bool turned = (flip & 4) != 0;
+  int out_width, out_height;
+  fit_size(turned ? height : width, turned ? width : height, bands->fit_width,
+           bands->fit_height, &out_width, &out_height);
+  // Sensor rows run along image columns when turned by 90 degrees.
+  const int lines = turned ? out_width : out_height;
+  const int across = turned ? out_height : out_width;
+  if (row0 == 0) {
+    bands->width = out_width;
+    bands->height = out_height;
+    target->first_line = lines;
+    target->end_line = 0;
+  }
+
+  target->rows.resize(static_cast<size_t>(iteration - row0) * width * 3);
+  if (target->processor->copy_mem_band(target->rows.data(), width * 3, 1,
+                                       row0, iteration - row0) !=
+      LIBRAW_SUCCESS) {
+    return bands->cancel;
+  }
+  for (int line = 0; line < lines; ++line) {
+    int row = static_cast<int>((2 * static_cast<int64_t>(line) + 1) * height /
+                               (2 * lines));
+    if (flip & 2) {
+      row = height - 1 - row;
+    }
+    if (row < row0 || row >= iteration) {
+      continue;
+    }
+    const uint8_t* src =
+        target->rows.data() + static_cast<size_t>(row - row0) * width * 3;
+    for (int i = 0; i < across; ++i) {
+      int col = static_cast<int>((2 * static_cast<int64_t>(i) + 1) * width /
+                                 (2 * across));
+      if (flip & 1) {
+        col = width - 1 - col;
+      }
+      const size_t offset = turned
+                                ? static_cast<size_t>(i) * out_width + line
+                                : static_cast<size_t>(line) * out_width + i;
+      memcpy(bands->pixels + offset * 3, src + static_cast<size_t>(col) * 3,
+             3);
+    }
+    target->first_line = std::min(target->first_line, line);
+    target->end_line = std::max(target->end_line, line + 1);
+  }
+  target->rows_done = iteration;
+
+  // Pixels first, then the part that covers them.
+  std::atomic_thread_fence(std::memory_order_release);
+  if (target->end_line > target->first_line) {
+    const int extent = target->end_line - target->first_line;
+    bands->filled_x = turned ? target->first_line : 0;
+    bands->filled_y = turned ? 0 : target->first_line;
+    bands->filled_width = turned ? extent : out_width;
+    bands->filled_height = turned ? out_height : extent;
+  }
+  bands->bands = bands->bands + 1;
+  return bands->cancel;
+}
+
+ImageResult process_preview(LibRaw& raw_processor,
+                            int half_size,
+                            int fit_width,
+                            int fit_height,
+                            PreviewBands* bands) {
+  set_preview_params(raw_processor, half_size);
+  BandTarget target = {&raw_processor, bands, 0, 0, 0, {}};
+  if (bands != nullptr) {
+    if (bands->pixels != nullptr && bands->fit_width > 0 &&
+        bands->fit_height > 0) {
+      raw_processor.imgdata.params.progressive_rows = kPreviewBandRows;
+    }
+    raw_processor.set_progress_handler(preview_band_progress, &target);
+  }
+
+  if (raw_processor.unpack() != LIBRAW_SUCCESS ||
+      raw_processor.dcraw_process() != LIBRAW_SUCCESS) {
+    return empty_image();
+  }
+
+  return rendered_image_result(raw_processor, fit_width, fit_height);
+}
+
+// Sets the output parameters of a develop render or export from params.
+void apply_develop_params(LibRaw& raw_processor, const DevelopParams* params) {
+  libraw_output_params_t& options = raw_processor.imgdata.params;
+  const bool custom_wb =
+      params->wb[0] > 0 && params->wb[1] > 0 && params->wb[2] > 0;
+  for (int c = 0; c < 4; ++c) {
+    options.user_mul[c] = custom_wb ? params->wb[c] : 0;
+  }
+  options.use_camera_wb = custom_wb ? 0 : 1;  // Would override user_mul.
+  options.exp_shift = std::min(8.0f, std::max(0.25f, params->exposure));
+  options.exp_correc = options.exp_shift != 1.0f;
+  options.exp_preser =
+      std::min(1.0f, std::max(0.0f, params->exposure_preserve));
+  options.highlight = std::min(9, std::max(0, params->highlight));
+  options.gamm[0] = params->gamma[0] > 0 ? 1.0 / params->gamma[0] : 0.45;
+  options.gamm[1] = params->gamma[0] > 0 ? params->gamma[1] : 4.5;
+  options.bright = params->bright > 0 ? params->bright : 1.0f;
+}
+
+// LibRaw progress callback of export_file(): decoding and processing fill
+// the first half of job->progress, writing the bands the second.
+int export_progress(void* data,
+                    enum LibRaw_progress stage,
+                    int iteration,
+                    int expected) {
+  ExportJob* job = static_cast<ExportJob*>(data);
+  int progress;
+  if (stage == LIBRAW_PROGRESS_FLIP && expected > 0) {
+    progress = 500 + 500 * iteration / expected;
+  } else {
+    // dcraw_process() stages are bits, roughly in pipeline order.
+    int bit = 0;
+    while (bit < 20 && (1 << bit) < static_cast<int>(stage)) {
+      ++bit;
+    }
+    progress = bit * 25;
+  }
+  if (progress > job->progress) {
+    job->progress = progress;
+  }
+  return job->cancel;
+}
+
+// An unpacked raw kept open between renders. LibRaw keeps the black
+// subtracted image (develop_cache), so a render only redoes white balance
+// onwards.
+struct DevelopSession {
+  LibRaw raw_processor;
+};
+
+// Kind of a file from its first bytes, -1 for neither. TIFF based raws share
+// their signature with plain TIFF files; identify tells them apart.
+int scan_kind(const unsigned char* head, int length) {
+  static const struct {
+    int offset;
+    const char* bytes;
+    int length;
+  } kRawSignatures[] = {
+      {0, "II*\0", 4},     {0, "MM\0*", 4},     {0, "IIRO", 4},
+      {0, "IIRS", 4},      {0, "MMOR", 4},      {0, "IIU\0", 4},
+      {6, "HEAPCCDR", 8},  {0, "FUJIFILM", 8},  {0, "\0MRM", 4},
+      {0, "FOVb", 4},      {0, "IIII", 4},      {4, "ftypcrx ", 8},
+  };
+  if (length >= 3 && head[0] == 0xff && head[1] == 0xd8 && head[2] == 0xff) {
+    return kScanBitmap;
+  }
+  if (length >= 8 && memcmp(head, "\x89PNG\r\n\x1a\n", 8) == 0) {
+    return kScanBitmap;
+  }
+  if (length >= 12 && memcmp(head, "RIFF", 4) == 0 &&
+      memcmp(head + 8, "WEBP", 4) == 0) {
+    return kScanBitmap;
+  }
+  for (const auto& signature : kRawSignatures) {
+    if (length >= signature.offset + signature.length &&
+        memcmp(head + signature.offset, signature.bytes, signature.length) ==
+            0) {
+      return kScanRaw;
+    }
+  }
+  return -1;
+}
+
+struct ScanItem {
+  std::string name;
+  int kind;  // -1 until scanned, and for files that are not media.
+  int64_t captured;
+  int64_t modified;
+};
+
+// Classifies one file by its first bytes and, with kScanCaptureTime and a
+// processor, reads its capture time from the header. Raws LibRaw does not
+// open are dropped then.
+void scan_file(LibRaw* raw_processor,
+               const std::string& path,
+               int flags,
+               ScanItem* item) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return;
+  }
+  unsigned char head[16];
+  const ssize_t length = read(fd, head, sizeof(head));
+  struct stat st;
+  if (length > 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    item->kind = scan_kind(head, static_cast<int>(length));
+    item->modified = st.st_mtime;
+  }
+  close(fd);
+  if (item->kind < 0 || raw_processor == nullptr ||
+      (flags & kScanCaptureTime) == 0) {
+    return;
+  }
+
+  if (item->kind == kScanRaw) {
+    // Only identifies; nothing of the raw data is read.
+    if (raw_processor->open_file(path.c_str()) == LIBRAW_SUCCESS) {
+      item->captured = raw_processor->imgdata.other.timestamp;
+    } else {
+      item->kind = -1;
+    }
+  } else if (head[0] == 0xff) {
+    LibRaw_bigfile_datastream stream(path.c_str());
+    raw_processor->open_jpeg_thumb(&stream);
+    item->captured = raw_processor->imgdata.other.timestamp;
+  }
+  raw_processor->recycle();
+}
+
 }  // namespace
 
 extern "C" {
@@ -131,22 +823,33 @@ EXPORT void free_buffer(uint8_t* buffer) {
   }
 }
 
-EXPORT ThumbnailResult get_thumbnail(const char* file_path) {
+// fit_width/fit_height scale bitmap results down to fit; 0 keeps full size.
+// want_preview: see ThumbnailResult::preview.
+EXPORT ThumbnailResult get_thumbnail(const char* file_path,
+                                     int fit_width,
+                                     int fit_height,
+                                     int want_preview) {
   if (file_path == nullptr) {
     return empty_thumbnail();
   }
 
   LibRaw raw_processor;
   if (raw_processor.open_file(file_path) != LIBRAW_SUCCESS) {
-    return empty_thumbnail();
+    LibRaw_bigfile_datastream stream(file_path);
+    return process_jpeg_thumbnail(raw_processor, stream);
   }
 
-  ThumbnailResult result = process_thumbnail(raw_processor);
+  ThumbnailResult result =
+      process_thumbnail(raw_processor, fit_width, fit_height, want_preview);
   raw_processor.recycle();
   return result;
 }
 
-EXPORT ThumbnailResult get_thumbnail_from_buffer(uint8_t* buffer, int size) {
+EXPORT ThumbnailResult get_thumbnail_from_buffer(uint8_t* buffer,
+                                                 int size,
+                                                 int fit_width,
+                                                 int fit_height,
+                                                 int want_preview) {
   if (buffer == nullptr || size <= 0) {
     return empty_thumbnail();
   }
@@ -154,15 +857,23 @@ EXPORT ThumbnailResult get_thumbnail_from_buffer(uint8_t* buffer, int size) {
   LibRaw raw_processor;
   if (raw_processor.open_buffer(buffer, static_cast<size_t>(size)) !=
       LIBRAW_SUCCESS) {
-    return empty_thumbnail();
+    LibRaw_buffer_datastream stream(buffer, static_cast<size_t>(size));
+    return process_jpeg_thumbnail(raw_processor, stream);
   }
 
-  ThumbnailResult result = process_thumbnail(raw_processor);
+  ThumbnailResult result =
+      process_thumbnail(raw_processor, fit_width, fit_height, want_preview);
   raw_processor.recycle();
   return result;
 }
 
-EXPORT ImageResult get_preview(const char* file_path, int half_size) {
+// With bands, a full-size render also fills those in as it goes and stops
+// once bands->cancel is set.
+EXPORT ImageResult get_preview(const char* file_path,
+                               int half_size,
+                               int fit_width,
+                               int fit_height,
+                               PreviewBands* bands) {
   if (file_path == nullptr) {
     return empty_image();
   }
@@ -172,14 +883,18 @@ EXPORT ImageResult get_preview(const char* file_path, int half_size) {
     return empty_image();
   }
 
-  ImageResult result = process_preview(raw_processor, half_size);
+  ImageResult result = process_preview(raw_processor, half_size, fit_width,
+                                       fit_height, bands);
   raw_processor.recycle();
   return result;
 }
 
 EXPORT ImageResult get_preview_from_buffer(uint8_t* buffer,
                                            int size,
-                                           int half_size) {
+                                           int half_size,
+                                           int fit_width,
+                                           int fit_height,
+                                           PreviewBands* bands) {
   if (buffer == nullptr || size <= 0) {
     return empty_image();
   }
@@ -190,9 +905,298 @@ EXPORT ImageResult get_preview_from_buffer(uint8_t* buffer,
     return empty_image();
   }
 
-  ImageResult result = process_preview(raw_processor, half_size);
+  ImageResult result = process_preview(raw_processor, half_size, fit_width,
+                                       fit_height, bands);
+  raw_processor.recycle();
+  return result;
+}
+
+// Renders once with the preview settings and returns up to kRenderMaxOutputs
+// sizes/formats of the result, e.g. the screen preview and a grid thumbnail.
+// Unset outputs have null data.
+EXPORT RenderOutputs render_outputs(const char* file_path,
+                                    int half_size,
+                                    const RenderSpec* specs,
+                                    int count) {
+  if (file_path == nullptr || specs == nullptr) {
+    return empty_outputs();
+  }
+
+  LibRaw raw_processor;
+  set_preview_params(raw_processor, half_size);
+  if (raw_processor.open_file(file_path) != LIBRAW_SUCCESS ||
+      raw_processor.unpack() != LIBRAW_SUCCESS ||
+      raw_processor.dcraw_process() != LIBRAW_SUCCESS) {
+    return empty_outputs();
+  }
+
+  RenderOutputs result = render_outputs_from(raw_processor, specs, count);
+  raw_processor.recycle();
+  return result;
+}
+
+EXPORT RenderOutputs render_outputs_from_buffer(uint8_t* buffer,
+                                                int size,
+                                                int half_size,
+                                                const RenderSpec* specs,
+                                                int count) {
+  if (buffer == nullptr || size <= 0 || specs == nullptr) {
+    return empty_outputs();
+  }
+
+  LibRaw raw_processor;
+  set_preview_params(raw_processor, half_size);
+  if (raw_processor.open_buffer(buffer, static_cast<size_t>(size)) !=
+          LIBRAW_SUCCESS ||
+      raw_processor.unpack() != LIBRAW_SUCCESS ||
+      raw_processor.dcraw_process() != LIBRAW_SUCCESS) {
+    return empty_outputs();
+  }
+
+  RenderOutputs result = render_outputs_from(raw_processor, specs, count);
   raw_processor.recycle();
   return result;
 }
 
+// Copies tile (tile_x, tile_y) of a pyramid level (1 = half size) as packed
+// BGR into out, which holds at least kPyramidTile^2 pixels. Edge tiles are
+// smaller; their size is returned in tile_width/tile_height.
+EXPORT int get_pyramid_tile(const uint8_t* pyramid,
+                            int width,
+                            int height,
+                            int level,
+                            int tile_x,
+                            int tile_y,
+                            uint8_t* out,
+                            int* tile_width,
+                            int* tile_height) {
+  if (pyramid == nullptr || level < 1 ||
+      level >= pyramid_levels(width, height) || tile_x < 0 || tile_y < 0) {
+    return -1;
+  }
+  const uint8_t* source = pyramid;
+  int w = (width + 1) / 2;
+  int h = (height + 1) / 2;
+  for (int l = 1; l < level; ++l) {
+    source += static_cast<size_t>(w) * h * 3;
+    w = (w + 1) / 2;
+    h = (h + 1) / 2;
+  }
+  const int x0 = tile_x * kPyramidTile;
+  const int y0 = tile_y * kPyramidTile;
+  if (x0 >= w || y0 >= h) {
+    return -1;
+  }
+  *tile_width = w - x0 < kPyramidTile ? w - x0 : kPyramidTile;
+  *tile_height = h - y0 < kPyramidTile ? h - y0 : kPyramidTile;
+  for (int y = 0; y < *tile_height; ++y) {
+    memcpy(out + static_cast<size_t>(y) * *tile_width * 3,
+           source + (static_cast<size_t>(y0 + y) * w + x0) * 3,
+           static_cast<size_t>(*tile_width) * 3);
+  }
+  return 0;
+}
+
+// Opens a raw for repeated renders with develop_render(). Returns null on
+// failure; close with develop_close().
+EXPORT void* develop_open(const char* file_path, int half_size) {
+  if (file_path == nullptr) {
+    return nullptr;
+  }
+
+  DevelopSession* session = new (std::nothrow) DevelopSession;
+  if (session == nullptr) {
+    return nullptr;
+  }
+  LibRaw& raw_processor = session->raw_processor;
+  set_preview_params(raw_processor, half_size);
+  raw_processor.imgdata.params.develop_cache = 1;
+
+  if (raw_processor.open_file(file_path) != LIBRAW_SUCCESS ||
+      raw_processor.unpack() != LIBRAW_SUCCESS) {
+    delete session;
+    return nullptr;
+  }
+  return session;
+}
+
+// Renders a session with new settings. Only the first render, or one after
+// the cached stages were invalidated, pays for the raw to image copy and
+// black subtraction.
+EXPORT ImageResult develop_render(void* handle,
+                                  const DevelopParams* params,
+                                  int fit_width,
+                                  int fit_height) {
+  DevelopSession* session = static_cast<DevelopSession*>(handle);
+  if (session == nullptr || params == nullptr) {
+    return empty_image();
+  }
+
+  apply_develop_params(session->raw_processor, params);
+  if (session->raw_processor.dcraw_process() != LIBRAW_SUCCESS) {
+    return empty_image();
+  }
+  return rendered_image_result(session->raw_processor, fit_width, fit_height);
+}
+
+EXPORT void develop_close(void* handle) {
+  delete static_cast<DevelopSession*>(handle);
+}
+
+EXPORT int get_raw_stats(const char* file_path,
+                         libraw_raw_stats_t* stats,
+                         uint8_t* mask,
+                         int mask_width,
+                         int mask_height) {
+  if (file_path == nullptr || stats == nullptr) {
+    return LIBRAW_UNSPECIFIED_ERROR;
+  }
+
+  LibRaw raw_processor;
+  int ret = raw_processor.open_file(file_path);
+  if (ret == LIBRAW_SUCCESS) {
+    ret = raw_processor.unpack();
+  }
+  if (ret == LIBRAW_SUCCESS) {
+    ret = raw_processor.get_raw_stats(stats, mask, mask_width, mask_height);
+  }
+  raw_processor.recycle();
+  return ret;
+}
+
+// Develops a raw at full quality and writes it to dst_path as a 16-bit TIFF
+// (LIBRAW_EXPORT_TIFF) or an 8-bit JPEG (LIBRAW_EXPORT_JPEG, quality 1-100)
+// with the camera metadata. params may be null for the preview look; job may
+// be null. Returns a LibRaw error code, LIBRAW_CANCELLED_BY_CALLBACK when
+// job->cancel was set.
+EXPORT int export_file(const char* src_path,
+                       const char* dst_path,
+                       int format,
+                       int quality,
+                       int half_size,
+                       const DevelopParams* params,
+                       ExportJob* job) {
+  if (src_path == nullptr || dst_path == nullptr) {
+    return LIBRAW_UNSPECIFIED_ERROR;
+  }
+
+  LibRaw raw_processor;
+  int ret = raw_processor.open_file(src_path);
+  if (ret == LIBRAW_SUCCESS) {
+    set_preview_params(raw_processor, half_size);
+    raw_processor.imgdata.params.keep_histogram = 0;  // No viewer histogram.
+    if (format == LIBRAW_EXPORT_TIFF) {
+      raw_processor.imgdata.params.output_bps = 16;
+    }
+    if (params != nullptr) {
+      apply_develop_params(raw_processor, params);
+    }
+    if (job != nullptr) {
+      raw_processor.set_progress_handler(export_progress, job);
+    }
+    ret = raw_processor.unpack();
+  }
+  if (ret == LIBRAW_SUCCESS) {
+    ret = raw_processor.dcraw_process();
+  }
+  if (ret == LIBRAW_SUCCESS) {
+    ret = raw_processor.dcraw_export_writer(dst_path, format, quality);
+  }
+  if (ret == LIBRAW_SUCCESS && job != nullptr) {
+    job->progress = 1000;
+  }
+  raw_processor.recycle();
+  return ret;
+}
+
+// Media files in dir_path, not descending into subdirectories. Files are told
+// apart by their first bytes, not their names, on a few threads; with
+// kScanCaptureTime their headers are identified too. Nothing beyond the
+// headers is read.
+EXPORT ScanResult scan_directory(const char* dir_path, int flags) {
+  ScanResult result = {nullptr, 0, nullptr};
+  if (dir_path == nullptr) {
+    return result;
+  }
+  DIR* dir = opendir(dir_path);
+  if (dir == nullptr) {
+    return result;
+  }
+  std::vector<ScanItem> items;
+  while (const struct dirent* entry = readdir(dir)) {
+    // d_type spares a stat for directories and the like; files of unknown
+    // type are checked when they are read.
+    if (entry->d_name[0] == '.' ||
+        (entry->d_type != DT_REG && entry->d_type != DT_LNK &&
+         entry->d_type != DT_UNKNOWN)) {
+      continue;
+    }
+    items.push_back({entry->d_name, -1, 0, 0});
+  }
+  closedir(dir);
+
+  std::string base(dir_path);
+  if (!base.empty() && base.back() != '/') {
+    base += '/';
+  }
+  std::atomic<size_t> next(0);
+  auto scan = [&]() {
+    // Too big for a thread's stack.
+    LibRaw* raw_processor = new (std::nothrow) LibRaw;
+    for (size_t i; (i = next++) < items.size();) {
+      scan_file(raw_processor, base + items[i].name, flags, &items[i]);
+    }
+    delete raw_processor;
+  };
+  size_t threads = std::min<size_t>(
+      std::max(1u, std::thread::hardware_concurrency()), kScanMaxThreads);
+  threads = std::max<size_t>(1, std::min(threads, items.size()));
+  std::vector<std::thread> pool;
+  for (size_t t = 1; t < threads; ++t) {
+    pool.emplace_back(scan);
+  }
+  scan();
+  for (std::thread& thread : pool) {
+    thread.join();
+  }
+
+  items.erase(
+      std::remove_if(items.begin(), items.end(),
+                     [](const ScanItem& item) { return item.kind < 0; }),
+      items.end());
+  std::sort(items.begin(), items.end(),
+            [](const ScanItem& a, const ScanItem& b) {
+              const int64_t time_a = a.captured != 0 ? a.captured : a.modified;
+              const int64_t time_b = b.captured != 0 ? b.captured : b.modified;
+              return time_a != time_b ? time_a < time_b : a.name < b.name;
+            });
+  if (items.empty()) {
+    return result;
+  }
+
+  size_t names_size = 0;
+  for (const ScanItem& item : items) {
+    names_size += item.name.size() + 1;
+  }
+  result.entries =
+      static_cast<ScanEntry*>(malloc(items.size() * sizeof(ScanEntry)));
+  result.names = static_cast<char*>(malloc(names_size));
+  if (result.entries == nullptr || result.names == nullptr) {
+    free(result.entries);
+    free(result.names);
+    return {nullptr, 0, nullptr};
+  }
+  size_t offset = 0;
+  for (const ScanItem& item : items) {
+    ScanEntry& entry = result.entries[result.count++];
+    entry.name = static_cast<int>(offset);
+    entry.kind = item.kind;
+    entry.captured = item.captured;
+    entry.modified = item.modified;
+    memcpy(result.names + offset, item.name.c_str(), item.name.size() + 1);
+    offset += item.name.size() + 1;
+  }
+  return result;
+}
+
 }  // extern "C"
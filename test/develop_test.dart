@@ -0,0 +1,83 @@
+import 'package:flutter_test/flutter_test.dart';
+import 'package:rawviewer/native_lib.dart';
+
+import 'native_test_utils.dart';
+
+// Mean blue and red of a BMP from LibRawImage
+(double, double) _meanBlueRed(LibRawImage image) {
+  final stride = (image.width * 3 + 3) & ~3;
+  int blue = 0;
+  int red = 0;
+  for (int y = 0; y < image.height; y++) {
+    for (int x = 0; x < image.width; x++) {
+      blue += image.data[54 + y * stride + x * 3];
+      red += image.data[54 + y * stride + x * 3 + 2];
+    }
+  }
+  final pixels = image.width * image.height;
+  return (blue / pixels, red / pixels);
+}
+
+void main() {
+  group('DevelopSession', () {
+    const neutral = DevelopSettings();
+    const brighter = DevelopSettings(exposure: 2.0);
+    const warmer = DevelopSettings(wb: [3.0, 1.0, 1.5, 1.0]);
+
+    late DevelopSession session;
+
+    setUp(() {
+      session = DevelopSession.open(samplePath)!;
+    });
+
+    tearDown(() {
+      session.close();
+    });
+
+    test('renders the same settings the same way again', () {
+      final first = session.render(neutral)!;
+      expect((first.width, first.height), (300, 24));
+      expect(session.render(neutral)!.data, first.data);
+
+      session.render(brighter);
+      session.render(warmer);
+      expect(session.render(neutral)!.data, first.data);
+    });
+
+    test('renders from the cache what a fresh session renders', () {
+      session.render(neutral);
+      session.render(warmer);
+      final cachedBrighter = session.render(brighter)!;
+      final cachedWarmer = session.render(warmer)!;
+
+      for (final (settings, cached) in [
+        (brighter, cachedBrighter),
+        (warmer, cachedWarmer),
+      ]) {
+        final fresh = DevelopSession.open(samplePath)!;
+        try {
+          expect(fresh.render(settings)!.data, cached.data);
+        } finally {
+          fresh.close();
+        }
+      }
+    });
+
+    test('applies exposure and white balance', () {
+      final base = session.render(neutral)!;
+      final exposed = session.render(brighter)!;
+      expect(bmpMeanGreen(exposed, 0, 0, exposed.width, exposed.height),
+          greaterThan(bmpMeanGreen(base, 0, 0, base.width, base.height)));
+
+      final (baseBlue, baseRed) = _meanBlueRed(base);
+      final (warmBlue, warmRed) = _meanBlueRed(session.render(warmer)!);
+      expect(warmRed - warmBlue, greaterThan(baseRed - baseBlue + 10));
+    });
+
+    test('scales the render down to fit', () {
+      final fitted = session.render(neutral, fitWidth: 40, fitHeight: 40)!;
+      expect((fitted.width, fitted.height), (40, 3));
+      expect(bmpSize(fitted.data), (40, 3));
+    });
+  }, skip: nativeLibSkip);
+}
@@ -0,0 +1,98 @@
+import 'dart:ffi';
+import 'dart:io';
+import 'dart:typed_data';
+
+import 'package:ffi/ffi.dart';
+import 'package:flutter_test/flutter_test.dart';
+import 'package:path/path.dart' as path;
+import 'package:rawviewer/native_lib.dart';
+
+import 'native_test_utils.dart';
+
+// Tags of the first IFD of a TIFF, the first value of each
+Map<int, int> _tiffTags(Uint8List file) {
+  final data = ByteData.sublistView(file);
+  final endian = file[0] == 0x49 ? Endian.little : Endian.big;
+  final ifd = data.getUint32(4, endian);
+  final tags = <int, int>{};
+  for (int i = 0; i < data.getUint16(ifd, endian); i++) {
+    final entry = ifd + 2 + 12 * i;
+    final type = data.getUint16(entry + 2, endian);
+    final count = data.getUint32(entry + 4, endian);
+    final size = type == 3 ? 2 : 4;
+    final at = count * size > 4 ? data.getUint32(entry + 8, endian) : entry + 8;
+    tags[data.getUint16(entry, endian)] = size == 2
+        ? data.getUint16(at, endian)
+        : data.getUint32(at, endian);
+  }
+  return tags;
+}
+
+// Width and height in the SOF marker of a JPEG
+(int, int) _jpegSize(Uint8List file) {
+  final data = ByteData.sublistView(file);
+  int at = 2;
+  while (at + 9 <= file.length) {
+    final marker = file[at + 1];
+    if (marker >= 0xc0 && marker <= 0xc2) {
+      return (data.getUint16(at + 7), data.getUint16(at + 5));
+    }
+    at += 2 + data.getUint16(at + 2);
+  }
+  return (0, 0);
+}
+
+void main() {
+  group('exportFileSync', () {
+    late Directory dir;
+
+    setUp(() {
+      dir = Directory.systemTemp.createTempSync('rawviewer_export');
+    });
+
+    tearDown(() {
+      dir.deleteSync(recursive: true);
+    });
+
+    test('writes an upright full-size 16-bit TIFF', () {
+      final destination = path.join(dir.path, 'sample.tiff');
+      expect(
+          exportFileSync(
+              ExportRequest(samplePath, destination, format: exportTiff)),
+          0);
+
+      final tags = _tiffTags(File(destination).readAsBytesSync());
+      expect(tags[256], 600);
+      expect(tags[257], 48);
+      expect(tags[258], 16);
+      expect(tags[277], 3);
+    });
+
+    test('writes an upright full-size JPEG', () {
+      final destination = path.join(dir.path, 'sample.jpg');
+      expect(
+          exportFileSync(
+              ExportRequest(samplePath, destination, format: exportJpeg)),
+          0);
+
+      expect(_jpegSize(File(destination).readAsBytesSync()), (600, 48));
+    });
+
+    test('halves the size and reports progress', () {
+      final destination = path.join(dir.path, 'half.tiff');
+      final job = calloc<ExportJobStruct>();
+      try {
+        expect(
+            exportFileSync(ExportRequest(samplePath, destination,
+                format: exportTiff, halfSize: 1, jobAddress: job.address)),
+            0);
+        expect(job.ref.progress, 1000);
+      } finally {
+        calloc.free(job);
+      }
+
+      final tags = _tiffTags(File(destination).readAsBytesSync());
+      expect((tags[256], tags[257]), (300, 24));
+    });
+  }, skip: nativeLibSkip);
+}
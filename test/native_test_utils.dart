@@ -0,0 +1,66 @@
+// Shared by the tests of the native library. They call it through FFI, so
+// they need a desktop build of the wrapper: set RAWVIEWER_NATIVE_LIB to
+// native_lib.dll, or to macos/native_lib/wrapper.cpp built with LibRaw as a
+// .dylib/.so (see build_native_lib.sh). They are skipped without it.
+
+import 'dart:io';
+import 'dart:typed_data';
+
+import 'package:path/path.dart' as path;
+import 'package:rawviewer/native_lib.dart';
+
+final String? nativeLibSkip =
+    (Platform.environment['RAWVIEWER_NATIVE_LIB'] ?? '').isEmpty
+        ? 'RAWVIEWER_NATIVE_LIB is not set'
+        : null;
+
+// fixtures/sample.dng: a 48 x 600 RGGB raw, 16-bit, black 64, white 4095,
+// shot at sampleCaptureTime with Orientation 6 (90 CW, upright 600 x 48).
+// Sensor rows 0-99 are saturated and rows 500-599 at black; the rows in
+// between ramp up across the sensor columns. IFD0 holds a 12 x 150 RGB
+// thumbnail of the same scene.
+final String samplePath = path.join('test', 'fixtures', 'sample.dng');
+const int sampleRawWidth = 48;
+const int sampleRawHeight = 600;
+const int sampleWhite = 4095;
+const int sampleClippedRows = 100;
+const int sampleCrushedRows = 100;
+const int sampleFlip = 6;
+const String sampleCaptureTime = '2024:05:01 10:00:00';
+
+// Width and height a BMP from LibRawImage says it has
+(int, int) bmpSize(Uint8List bmp) {
+  final header = ByteData.sublistView(bmp, 0, 54);
+  return (
+    header.getInt32(18, Endian.little),
+    -header.getInt32(22, Endian.little)
+  );
+}
+
+// Mean green of a rectangle of a BMP from LibRawImage
+double bmpMeanGreen(LibRawImage image, int left, int top, int width,
+    int height) {
+  final stride = (image.width * 3 + 3) & ~3;
+  int sum = 0;
+  for (int y = top; y < top + height; y++) {
+    for (int x = left; x < left + width; x++) {
+      sum += image.data[54 + y * stride + x * 3 + 1];
+    }
+  }
+  return sum / (width * height);
+}
+
+// Mean green of the left, right, top and bottom quarters of an image. With
+// the sample upright, the saturated sensor rows are on the right and the
+// ramp brightens towards the bottom.
+({double left, double right, double top, double bottom}) bmpQuarters(
+    LibRawImage image) {
+  final w = image.width;
+  final h = image.height;
+  return (
+    left: bmpMeanGreen(image, 0, 0, w ~/ 4, h),
+    right: bmpMeanGreen(image, w - w ~/ 4, 0, w ~/ 4, h),
+    top: bmpMeanGreen(image, 0, 0, w, h ~/ 4),
+    bottom: bmpMeanGreen(image, 0, h - h ~/ 4, w, h ~/ 4),
+  );
+}
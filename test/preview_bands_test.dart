@@ -0,0 +1,66 @@
+import 'dart:ffi';
+
+import 'package:ffi/ffi.dart';
+import 'package:flutter_test/flutter_test.dart';
+import 'package:rawviewer/native_lib.dart';
+
+import 'native_test_utils.dart';
+
+void main() {
+  group('progressive getPreviewSync', () {
+    const fit = 100;
+
+    test('fills the fitted, upright preview band by band', () {
+      final bands = calloc<PreviewBandsStruct>();
+      final pixels = calloc<Uint8>(fit * fit * 3);
+      try {
+        bands.ref
+          ..pixels = pixels
+          ..fitWidth = fit
+          ..fitHeight = fit;
+        expect(readPreviewBands(bands), isNull);
+
+        final preview = getPreviewSync(PreviewRequest(samplePath, 0,
+            fitWidth: fit, fitHeight: fit, bandsAddress: bands.address))!;
+        // 600 sensor rows, 256 a band
+        expect(bands.ref.bands, 3);
+
+        final frame = readPreviewBands(bands)!;
+        expect((frame.left, frame.top), (0, 0));
+        expect((frame.width, frame.height), (preview.width, preview.height));
+        expect((frame.image.width, frame.image.height), (100, 8));
+
+        // Sampled rather than filtered, but the same picture
+        final sampled = bmpQuarters(frame.image);
+        final rendered = bmpQuarters(preview);
+        expect(sampled.left, closeTo(rendered.left, 6));
+        expect(sampled.right, closeTo(rendered.right, 6));
+        expect(sampled.top, closeTo(rendered.top, 6));
+        expect(sampled.bottom, closeTo(rendered.bottom, 6));
+      } finally {
+        calloc.free(pixels);
+        calloc.free(bands);
+      }
+    });
+
+    test('stops once cancelled', () {
+      final bands = calloc<PreviewBandsStruct>();
+      final pixels = calloc<Uint8>(fit * fit * 3);
+      try {
+        bands.ref
+          ..pixels = pixels
+          ..fitWidth = fit
+          ..fitHeight = fit
+          ..cancel = 1;
+        expect(
+            getPreviewSync(PreviewRequest(samplePath, 0,
+                fitWidth: fit, fitHeight: fit, bandsAddress: bands.address)),
+            isNull);
+        expect(bands.ref.bands, 0);
+      } finally {
+        calloc.free(pixels);
+        calloc.free(bands);
+      }
+    });
+  }, skip: nativeLibSkip);
+}
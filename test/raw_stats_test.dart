@@ -0,0 +1,39 @@
+import 'package:flutter_test/flutter_test.dart';
+import 'package:rawviewer/native_lib.dart';
+
+import 'native_test_utils.dart';
+
+void main() {
+  group('getRawStatsSync', () {
+    test('counts every pixel once per color', () {
+      final stats = getRawStatsSync(RawStatsRequest(samplePath))!;
+      expect(stats.pixels.reduce((a, b) => a + b),
+          sampleRawWidth * sampleRawHeight);
+      for (int c = 0; c < 4; c++) {
+        final bins = stats.histogram.sublist(c * 256, (c + 1) * 256);
+        expect(bins.reduce((a, b) => a + b), stats.pixels[c],
+            reason: 'histogram of color $c');
+      }
+    });
+
+    test('counts the saturated and black rows', () {
+      final stats = getRawStatsSync(RawStatsRequest(samplePath))!;
+      expect(stats.white, sampleWhite);
+      for (int c = 0; c < 4; c++) {
+        expect(stats.clipped[c], sampleClippedRows * sampleRawWidth ~/ 4);
+        expect(stats.crushed[c], sampleCrushedRows * sampleRawWidth ~/ 4);
+      }
+    });
+
+    test('marks them in the clip mask', () {
+      // One mask row per 100 sensor rows
+      final stats = getRawStatsSync(
+          RawStatsRequest(samplePath, maskWidth: 4, maskHeight: 6))!;
+      expect(stats.clipMask, [
+        ...List.filled(4, 0x0f),
+        ...List.filled(16, 0),
+        ...List.filled(4, 0xf0),
+      ]);
+    });
+  }, skip: nativeLibSkip);
+}
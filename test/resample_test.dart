@@ -0,0 +1,49 @@
+import 'package:flutter_test/flutter_test.dart';
+import 'package:rawviewer/native_lib.dart';
+
+import 'native_test_utils.dart';
+
+void main() {
+  group('resample_mem_image', () {
+    test('turns the bitmap thumbnail upright', () {
+      final thumb = getThumbnailSync(ThumbnailRequest(samplePath))!;
+      expect(thumb.format, 1);
+      expect(thumb.flip, sampleFlip);
+      expect((thumb.width, thumb.height), (150, 12));
+      expect(bmpSize(thumb.data), (150, 12));
+
+      final quarters = bmpQuarters(thumb);
+      expect(quarters.right, greaterThan(quarters.left + 100));
+      expect(quarters.bottom, greaterThan(quarters.top + 30));
+    });
+
+    test('scales the thumbnail down to fit while turning it', () {
+      final thumb = getThumbnailSync(
+          ThumbnailRequest(samplePath, fitWidth: 60, fitHeight: 60))!;
+      expect((thumb.width, thumb.height), (60, 5));
+      expect(bmpSize(thumb.data), (60, 5));
+
+      final quarters = bmpQuarters(thumb);
+      expect(quarters.right, greaterThan(quarters.left + 100));
+      expect(quarters.bottom, greaterThan(quarters.top + 30));
+    });
+
+    test('scales the preview down to fit', () {
+      final full = getPreviewSync(PreviewRequest(samplePath, 0))!;
+      expect((full.width, full.height), (600, 48));
+
+      final fitted = getPreviewSync(
+          PreviewRequest(samplePath, 0, fitWidth: 100, fitHeight: 100))!;
+      expect((fitted.width, fitted.height), (100, 8));
+      expect(bmpSize(fitted.data), (100, 8));
+
+      // Same picture, only smaller
+      final a = bmpQuarters(full);
+      final b = bmpQuarters(fitted);
+      expect(b.left, closeTo(a.left, 4));
+      expect(b.right, closeTo(a.right, 4));
+      expect(b.top, closeTo(a.top, 4));
+      expect(b.bottom, closeTo(a.bottom, 4));
+    });
+  }, skip: nativeLibSkip);
+}
@@ -0,0 +1,60 @@
+import 'dart:io';
+import 'dart:typed_data';
+
+import 'package:flutter_test/flutter_test.dart';
+import 'package:path/path.dart' as path;
+import 'package:rawviewer/native_lib.dart';
+
+import 'native_test_utils.dart';
+
+// Writes a copy of the sample shot at captured, modified at modified
+void _writeSample(String file, String captured, DateTime modified) {
+  final bytes = Uint8List.fromList(File(samplePath).readAsBytesSync());
+  final at = String.fromCharCodes(bytes).indexOf(sampleCaptureTime);
+  bytes.setAll(at, captured.codeUnits);
+  File(file)
+    ..writeAsBytesSync(bytes)
+    ..setLastModifiedSync(modified);
+}
+
+void main() {
+  group('scanDirectorySync', () {
+    late Directory dir;
+
+    setUp(() {
+      dir = Directory.systemTemp.createTempSync('rawviewer_scan');
+      // Shot in the opposite order to their names and modification times
+      _writeSample(path.join(dir.path, 'a.dng'), '2024:05:03 10:00:00',
+          DateTime(2024, 6, 1));
+      _writeSample(path.join(dir.path, 'b.dng'), '2024:05:02 10:00:00',
+          DateTime(2024, 6, 2));
+      _writeSample(path.join(dir.path, 'c.dng'), '2024:05:01 10:00:00',
+          DateTime(2024, 6, 3));
+      File(path.join(dir.path, 'notes.txt')).writeAsStringSync('not media');
+      Directory(path.join(dir.path, 'sub')).createSync();
+      _writeSample(path.join(dir.path, 'sub', 'd.dng'), sampleCaptureTime,
+          DateTime(2024, 6, 4));
+    });
+
+    tearDown(() {
+      dir.deleteSync(recursive: true);
+    });
+
+    test('sorts by capture time', () {
+      final files = scanDirectorySync(dir.path);
+      expect(files.map((file) => path.basename(file.path)),
+          ['c.dng', 'b.dng', 'a.dng']);
+      expect(files.every((file) => file.isRaw), isTrue);
+      expect(files.first.capturedAt, DateTime(2024, 5, 1, 10));
+      expect(files.first.modifiedAt, DateTime(2024, 6, 3));
+    });
+
+    test('sorts by modification time without capture times', () {
+      final files = scanDirectorySync(dir.path, flags: 0);
+      expect(files.map((file) => path.basename(file.path)),
+          ['a.dng', 'b.dng', 'c.dng']);
+      expect(files.every((file) => file.isRaw), isTrue);
+      expect(files.every((file) => file.capturedAt == null), isTrue);
+    });
+  }, skip: nativeLibSkip);
+}
@@ -18,13 +18,18 @@
 
 #include "../../internal/dcraw_defs.h"
 
+/*
+ * fuji_rotate() resamples rows in parallel. Source coordinates and weights
+ * for a run of FUJI_LANES output pixels are computed first, in a loop the
+ * compiler can vectorize, then the pixels are blended with the same
+ * expression as before.
+ */
+#define FUJI_LANES 64
+
 void LibRaw::fuji_rotate()
 {
-  int i, row, col;
   double step;
-  float r, c, fr, fc;
-  unsigned ur, uc;
-  ushort wide, high, (*img)[4], (*pix)[4];
+  ushort wide, high, (*img)[4];
 
   if (!fuji_width)
     return;
@@ -42,22 +47,42 @@ void LibRaw::fuji_rotate()
 
   RUN_CALLBACK(LIBRAW_PROGRESS_FUJI_ROTATE, 0, 2);
 
-  for (row = 0; row < high; row++)
-    for (col = 0; col < wide; col++)
+  const int fw = fuji_width;
+  const unsigned maxr = (unsigned)height - 2, maxc = (unsigned)width - 2;
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(dynamic, 16)
+#endif
+  for (int row = 0; row < high; row++)
+  {
+    unsigned ur[FUJI_LANES], uc[FUJI_LANES];
+    float fr[FUJI_LANES], fc[FUJI_LANES];
+    ushort(*out)[4] = img + size_t(row) * wide;
+    for (int col0 = 0; col0 < wide; col0 += FUJI_LANES)
     {
-      ur = unsigned( r = float(fuji_width + (row - col) * step));
-      uc = unsigned( c = float( (row + col) * step));
-      if (ur > (unsigned)height - 2 || uc > (unsigned)width - 2)
-        continue;
-      fr = r - ur;
-      fc = c - uc;
-      pix = image + ur * width + uc;
-      for (i = 0; i < colors; i++)
-        img[row * wide + col][i] =
-		  ushort(
-            (pix[0][i] * (1 - fc) + pix[1][i] * fc) * (1 - fr) +
-            (pix[width][i] * (1 - fc) + pix[width + 1][i] * fc) * fr);
+      const int n = MIN(FUJI_LANES, wide - col0);
+      for (int l = 0; l < n; l++)
+      {
+        int col = col0 + l;
+        float r = float(fw + (row - col) * step);
+        float c = float((row + col) * step);
+        ur[l] = unsigned(r);
+        uc[l] = unsigned(c);
+        fr[l] = r - ur[l];
+        fc[l] = c - uc[l];
+      }
+      for (int l = 0; l < n; l++)
+      {
+        if (ur[l] > maxr || uc[l] > maxc)
+          continue;
+        const ushort(*pix)[4] = image + ur[l] * width + uc[l];
+        const float wr = fr[l], wc = fc[l];
+        for (int i = 0; i < colors; i++)
+          out[col0 + l][i] =
+              ushort((pix[0][i] * (1 - wc) + pix[1][i] * wc) * (1 - wr) +
+                     (pix[width][i] * (1 - wc) + pix[width + 1][i] * wc) * wr);
+      }
     }
+  }
 
   free(image);
   width = wide;
@@ -66,12 +91,22 @@ void LibRaw::fuji_rotate()
   fuji_width = 0;
   RUN_CALLBACK(LIBRAW_PROGRESS_FUJI_ROTATE, 1, 2);
 }
+#undef FUJI_LANES
 
+/*
+ * The interpolation fraction in stretch() has always been truncated to an
+ * integer, i.e. zero, so stretching repeats whole source rows or columns.
+ * The image is therefore grown in place instead of being copied into a
+ * second buffer. Source indices only ever trail their destination, so
+ * the work runs from the end of the buffer backwards, in chunks whose
+ * destinations do not overlap any source still to be read; each chunk is
+ * split between threads.
+ */
 void LibRaw::stretch()
 {
-  ushort newdim, (*img)[4], *pix0, *pix1;
-  int row, col, c;
-  double rc, frac;
+  ushort newdim;
+  int row, col;
+  double rc;
 
   if (pixel_aspect == 1)
     return;
@@ -79,36 +114,66 @@ void LibRaw::stretch()
   if (pixel_aspect < 1)
   {
     newdim = ushort(height / pixel_aspect + 0.5);
-    img = (ushort(*)[4])calloc(width, newdim * sizeof *img);
+    int *src = (int *)malloc(newdim * sizeof(int));
     for (rc = row = 0; row < newdim; row++, rc += pixel_aspect)
+      src[row] = int(rc);
+    image = (ushort(*)[4])realloc(image, size_t(newdim) * width * sizeof *image);
+    const size_t rowbytes = size_t(width) * sizeof *image;
+    for (int end = newdim; end > 0;)
     {
-      frac = int(rc - double(c = int(rc)));
-      pix0 = pix1 = image[c * width];
-      if (c + 1 < height)
-        pix1 += width * 4;
-      for (col = 0; col < width; col++, pix0 += 4, pix1 += 4)
-        FORCC img[row * width + col][c] =
-            ushort(pix0[c] * (1 - frac) + pix1[c] * frac + 0.5);
+      /* rows [start, end) read only rows below start */
+      int start = MIN(src[end - 1] + 1, end - 1);
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+      for (int r = start; r < end; r++)
+        if (src[r] != r)
+          memmove(image + size_t(r) * width, image + size_t(src[r]) * width,
+                  rowbytes);
+      end = start;
     }
+    free(src);
     height = newdim;
   }
   else
   {
     newdim = ushort(width * pixel_aspect + 0.5);
-    img = (ushort(*)[4])calloc(height, newdim * sizeof *img);
+    int *src = (int *)malloc(newdim * sizeof(int));
     for (rc = col = 0; col < newdim; col++, rc += 1 / pixel_aspect)
+      src[col] = int(rc);
+    image = (ushort(*)[4])realloc(image, size_t(newdim) * height * sizeof *image);
+    for (int end = height; end > 0;)
     {
-      frac = int(rc - double(c = int(rc)));
-      pix0 = pix1 = image[c];
-      if (c + 1 < width)
-        pix1 += 4;
-      for (row = 0; row < height; row++, pix0 += width * 4, pix1 += width * 4)
-        FORCC img[row * newdim + col][c] =
-            ushort(pix0[c] * (1 - frac) + pix1[c] * frac + 0.5);
+      /* row r moves to r * newdim: rows [start, end) land past every row
+       * they could overwrite, the last single row is done in place */
+      int start = int((INT64(end) * width + newdim - 1) / newdim);
+      start = MIN(start, end - 1);
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+      for (int r = start; r < end; r++)
+      {
+        ushort(*dst)[4] = image + size_t(r) * newdim;
+        const ushort(*pix)[4] = image + size_t(r) * width;
+        for (int c = newdim - 1; c >= 0; c--)
+          memmove(dst[c], pix[src[c]], sizeof *image);
+      }
+      end = start;
     }
+    free(src);
     width = newdim;
   }
-  free(image);
-  image = img;
+  if (colors < 4)
+  {
+    /* channels past colors used to come out cleared */
+    const int nc = colors;
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int r = 0; r < height; r++)
+      for (int c = 0; c < width; c++)
+        for (int k = nc; k < 4; k++)
+          image[size_t(r) * width + c][k] = 0;
+  }
   RUN_CALLBACK(LIBRAW_PROGRESS_STRETCH, 1, 2);
 }
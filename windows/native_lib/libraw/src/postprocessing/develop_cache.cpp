@@ -0,0 +1,130 @@
+/* -*- C++ -*-
+ * Copyright 2019-2025 LibRaw LLC (info@libraw.org)
+ *
+ LibRaw is free software; you can redistribute it and/or modify
+ it under the terms of the one of two licenses as you choose:
+
+1. GNU LESSER GENERAL PUBLIC LICENSE version 2.1
+   (See file LICENSE.LGPL provided in LibRaw distribution archive for details).
+
+2. COMMON DEVELOPMENT AND DISTRIBUTION LICENSE (CDDL) Version 1.0
+   (See file LICENSE.CDDL provided in LibRaw distribution archive for details).
+
+ */
+
+#include "../../internal/libraw_cxx_defs.h"
+
+static int develop_same_path(const char *a, const char *b)
+{
+  if (!a || !b)
+    return a == b;
+  return !strcmp(a, b);
+}
+
+static char *develop_copy_path(const char *a)
+{
+  if (!a)
+    return NULL;
+  char *p = (char *)malloc(strlen(a) + 1);
+  if (p)
+    strcpy(p, a);
+  return p;
+}
+
+/*
+ * dcraw_process() up to and including black subtraction only depends on
+ * the unpacked raw data and the parameters kept here. With
+ * params.develop_cache set, its result is saved once and restored by later
+ * calls, so a white balance, exposure, highlight or output change re-runs
+ * scale_colors() onwards only.
+ */
+int LibRaw::develop_cache_restore()
+{
+  develop_cache_t &dc = libraw_internal_data.develop_cache;
+  if (!O.develop_cache)
+  {
+    develop_cache_free();
+    return 0;
+  }
+  if (!dc.image || dc.half_size != O.half_size ||
+      dc.threshold != O.threshold || dc.aber[0] != O.aber[0] ||
+      dc.aber[2] != O.aber[2] ||
+      memcmp(dc.cropbox, O.cropbox, sizeof(dc.cropbox)) ||
+      dc.user_flip != O.user_flip || dc.user_black != O.user_black ||
+      memcmp(dc.user_cblack, O.user_cblack, sizeof(dc.user_cblack)) ||
+      dc.use_p1_correction != O.use_p1_correction ||
+      dc.user_sat != O.user_sat ||
+      dc.adjust_maximum_thr != O.adjust_maximum_thr ||
+      !develop_same_path(dc.bad_pixels, O.bad_pixels) ||
+      !develop_same_path(dc.dark_frame, O.dark_frame) ||
+      dc.pre_subtractblack_cb != callbacks.pre_subtractblack_cb)
+    return 0;
+
+  /* same padding as raw2image_ex() allocates, zeroed the same way */
+  int extra = dc.idata.filters ? (dc.idata.filters == 9 ? 6 : 2) : 0;
+  size_t alloc_sz = size_t(dc.sizes.iheight + extra) * (dc.sizes.iwidth + extra);
+  ushort(*img)[4] =
+      (ushort(*)[4])realloc(imgdata.image, alloc_sz * sizeof(*imgdata.image));
+  if (!img)
+    throw LIBRAW_EXCEPTION_ALLOC;
+  imgdata.image = img;
+  memcpy(imgdata.image, dc.image, dc.pixels * sizeof(*imgdata.image));
+  memset(imgdata.image + dc.pixels, 0,
+         (alloc_sz - dc.pixels) * sizeof(*imgdata.image));
+  memmove(&imgdata.color, &dc.color, sizeof(imgdata.color));
+  memmove(&imgdata.sizes, &dc.sizes, sizeof(imgdata.sizes));
+  memmove(&imgdata.idata, &dc.idata, sizeof(imgdata.idata));
+  memmove(&libraw_internal_data.internal_output_params, &dc.ioparams,
+          sizeof(libraw_internal_data.internal_output_params));
+  imgdata.progress_flags = dc.progress_flags;
+  imgdata.process_warnings = dc.process_warnings;
+  /* the white balance block sums went with the first scale_colors() */
+  libraw_internal_data.ingest_stats.valid = 0;
+  return 1;
+}
+
+void LibRaw::develop_cache_store()
+{
+  develop_cache_free();
+  develop_cache_t &dc = libraw_internal_data.develop_cache;
+  dc.pixels = size_t(S.iheight) * S.iwidth;
+  dc.image = (ushort(*)[4])malloc(dc.pixels * sizeof(*imgdata.image));
+  if (!dc.image)
+    return; /* not fatal, the next call just does the full run */
+  memcpy(dc.image, imgdata.image, dc.pixels * sizeof(*imgdata.image));
+  memmove(&dc.color, &imgdata.color, sizeof(dc.color));
+  memmove(&dc.sizes, &imgdata.sizes, sizeof(dc.sizes));
+  memmove(&dc.idata, &imgdata.idata, sizeof(dc.idata));
+  memmove(&dc.ioparams, &libraw_internal_data.internal_output_params,
+          sizeof(dc.ioparams));
+  dc.progress_flags = imgdata.progress_flags;
+  dc.process_warnings = imgdata.process_warnings;
+
+  dc.half_size = O.half_size;
+  dc.threshold = O.threshold;
+  memmove(dc.aber, O.aber, sizeof(dc.aber));
+  memmove(dc.cropbox, O.cropbox, sizeof(dc.cropbox));
+  dc.user_flip = O.user_flip;
+  dc.user_black = O.user_black;
+  memmove(dc.user_cblack, O.user_cblack, sizeof(dc.user_cblack));
+  dc.use_p1_correction = O.use_p1_correction;
+  dc.user_sat = O.user_sat;
+  dc.adjust_maximum_thr = O.adjust_maximum_thr;
+  dc.bad_pixels = develop_copy_path(O.bad_pixels);
+  dc.dark_frame = develop_copy_path(O.dark_frame);
+  dc.pre_subtractblack_cb = callbacks.pre_subtractblack_cb;
+  if ((O.bad_pixels && !dc.bad_pixels) || (O.dark_frame && !dc.dark_frame))
+    develop_cache_free();
+}
+
+void LibRaw::develop_cache_free()
+{
+  develop_cache_t &dc = libraw_internal_data.develop_cache;
+  if (dc.image)
+    free(dc.image);
+  if (dc.bad_pixels)
+    free(dc.bad_pixels);
+  if (dc.dark_frame)
+    free(dc.dark_frame);
+  memset(&dc, 0, sizeof(dc));
+}
@@ -14,6 +14,47 @@
 
 #include "../../internal/libraw_cxx_defs.h"
 
+/*
+ * Offset of the orientation value in the Exif APP1 right after SOI of a
+ * JPEG, 0 when there is none; *motorola is set for big endian Exif data
+ */
+static unsigned exif_orientation_offset(const uchar *jpeg, unsigned length,
+                                        int *motorola)
+{
+  if (length < 20 || jpeg[2] != 0xff || jpeg[3] != 0xe1 ||
+      memcmp(jpeg + 6, "Exif\0\0", 6))
+    return 0;
+  const unsigned tiff_len =
+      MIN(unsigned(jpeg[4] << 8 | jpeg[5]), length - 4) - 8;
+  const uchar *tiff = jpeg + 12;
+  if (tiff_len < 8 || tiff_len > length - 12 ||
+      (memcmp(tiff, "II", 2) && memcmp(tiff, "MM", 2)))
+    return 0;
+  *motorola = tiff[0] == 'M';
+#define EXIF16(p) (*motorola ? (p)[0] << 8 | (p)[1] : (p)[1] << 8 | (p)[0])
+#define EXIF32(p)                                                              \
+  (*motorola ? unsigned((p)[0]) << 24 | (p)[1] << 16 | (p)[2] << 8 | (p)[3]    \
+             : unsigned((p)[3]) << 24 | (p)[2] << 16 | (p)[1] << 8 | (p)[0])
+  const unsigned ifd = EXIF32(tiff + 4);
+  unsigned ret = 0;
+  if (ifd < tiff_len && tiff_len - ifd >= 2)
+  {
+    const unsigned entries = EXIF16(tiff + ifd);
+    for (unsigned i = 0; i < entries && !ret; i++)
+    {
+      const unsigned e = ifd + 2 + i * 12;
+      if (e + 12 > tiff_len)
+        break;
+      if (EXIF16(tiff + e) == 274 && EXIF16(tiff + e + 2) == 3 &&
+          EXIF32(tiff + e + 4) == 1)
+        ret = 12 + e + 8;
+    }
+  }
+#undef EXIF16
+#undef EXIF32
+  return ret;
+}
+
 libraw_processed_image_t *LibRaw::dcraw_make_mem_thumb(int *errcode)
 {
   if (!T.thumb)
@@ -77,9 +118,19 @@ libraw_processed_image_t *LibRaw::dcraw_make_mem_thumb(int *errcode)
   else if (T.tformat == LIBRAW_THUMBNAIL_JPEG)
   {
     ushort exif[5];
-    int mk_exif = 0;
+    int mk_exif = 0, motorola = 0;
+    unsigned orientation_at = 0;
     if (strcmp(T.thumb + 6, "Exif"))
       mk_exif = 1;
+    else if (imgdata.rawparams.options &
+             LIBRAW_RAWOPTIONS_THUMB_EXIF_ORIENTATION)
+    {
+      /* set the orientation in the Exif there is, or put ours in front */
+      orientation_at = exif_orientation_offset((const uchar *)T.thumb,
+                                               T.tlength, &motorola);
+      if (!orientation_at)
+        mk_exif = 1;
+    }
 
     int dsize = T.tlength + mk_exif * (sizeof(exif) + sizeof(tiff_hdr));
 
@@ -114,6 +165,12 @@ libraw_processed_image_t *LibRaw::dcraw_make_mem_thumb(int *errcode)
     else
     {
       memmove(ret->data + 2, T.thumb + 2, T.tlength - 2);
+      if (orientation_at)
+      {
+        const uchar orientation = "12435867"[S.flip & 7] - '0';
+        ret->data[orientation_at] = motorola ? 0 : orientation;
+        ret->data[orientation_at + 1] = motorola ? orientation : 0;
+      }
     }
     if (errcode)
       *errcode = 0;
@@ -183,56 +240,27 @@ void LibRaw::get_mem_image_format(int *width, int *height, int *colors,
   *bps = O.output_bps;
 }
 
-int LibRaw::copy_mem_image(void *scan0, int stride, int bgr)
-
+/*
+ * Output rows [row0, row0 + rows) of copy_mem_image() into scan0. Expects
+ * the sizes copy_mem_image() sets up: S.iwidth/S.iheight as the image,
+ * S.width/S.height in output orientation.
+ */
+void LibRaw::copy_mem_rows(void *scan0, int stride, int bgr, int row0,
+                           int rows)
 {
-  // the image memory pointed to by scan0 is assumed to be in the format
-  // returned by get_mem_image_format
-  if ((imgdata.progress_flags & LIBRAW_PROGRESS_THUMB_MASK) <
-      LIBRAW_PROGRESS_PRE_INTERPOLATE)
-    return LIBRAW_OUT_OF_ORDER_CALL;
-
-  if (libraw_internal_data.output_data.histogram)
+  /* flip_index() is linear in both row and col */
+  const int soff0 = flip_index(0, 0);
+  const int cstep = flip_index(0, 1) - soff0;
+  const int rstep = flip_index(1, 0) - soff0;
+
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (int r = 0; r < rows; r++)
   {
-    int perc, val, total, t_white = 0x2000, c;
-    perc = int(S.width * S.height * O.auto_bright_thr);
-    if (IO.fuji_width)
-      perc /= 2;
-    if (!((O.highlight & ~2) || O.no_auto_bright))
-      for (t_white = c = 0; c < P1.colors; c++)
-      {
-        for (val = 0x2000, total = 0; --val > 32;)
-          if ((total += libraw_internal_data.output_data.histogram[c][val]) >
-              perc)
-            break;
-        if (t_white < val)
-          t_white = val;
-      }
-    gamma_curve(O.gamm[0], O.gamm[1], 2, int((t_white << 3) / O.bright));
-  }
-
-  int s_iheight = S.iheight;
-  int s_iwidth = S.iwidth;
-  int s_width = S.width;
-  int s_hwight = S.height;
-
-  S.iheight = S.height;
-  S.iwidth = S.width;
-
-  if (S.flip & 4)
-    SWAP(S.height, S.width);
-  uchar *ppm;
-  ushort *ppm2;
-  int c, row, col, soff, rstep, cstep;
-
-  soff = flip_index(0, 0);
-  cstep = flip_index(0, 1) - soff;
-  rstep = flip_index(1, 0) - flip_index(0, S.width);
-
-  for (row = 0; row < S.height; row++, soff += rstep)
-  {
-    uchar *bufp = ((uchar *)scan0) + row * stride;
-    ppm2 = (ushort *)(ppm = bufp);
+    uchar *ppm = ((uchar *)scan0) + size_t(r) * stride;
+    ushort *ppm2 = (ushort *)ppm;
+    int c, col, soff = soff0 + (row0 + r) * rstep;
     // keep trivial decisions in the outer loop for speed
     if (bgr)
     {
@@ -260,10 +288,40 @@ int LibRaw::copy_mem_image(void *scan0, int stride, int bgr)
           FORRGB *ppm2++ = imgdata.color.curve[imgdata.image[soff][c]];
       }
     }
+  }
+}
+
+int LibRaw::copy_mem_image(void *scan0, int stride, int bgr)
+
+{
+  // the image memory pointed to by scan0 is assumed to be in the format
+  // returned by get_mem_image_format
+  if ((imgdata.progress_flags & LIBRAW_PROGRESS_THUMB_MASK) <
+      LIBRAW_PROGRESS_PRE_INTERPOLATE)
+    return LIBRAW_OUT_OF_ORDER_CALL;
 
-    //            bufp += stride;           // go to the next line
+  if (libraw_internal_data.output_data.histogram)
+  {
+    int perc = int(S.width * S.height * O.auto_bright_thr);
+    if (IO.fuji_width)
+      perc /= 2;
+    int t_white = output_white_level(perc);
+    gamma_curve(O.gamm[0], O.gamm[1], 2, int((t_white << 3) / O.bright));
   }
 
+  int s_iheight = S.iheight;
+  int s_iwidth = S.iwidth;
+  int s_width = S.width;
+  int s_hwight = S.height;
+
+  S.iheight = S.height;
+  S.iwidth = S.width;
+
+  if (S.flip & 4)
+    SWAP(S.height, S.width);
+
+  copy_mem_rows(scan0, stride, bgr, 0, S.height);
+
   S.iheight = s_iheight;
   S.iwidth = s_iwidth;
   S.width = s_width;
@@ -271,6 +329,40 @@ int LibRaw::copy_mem_image(void *scan0, int stride, int bgr)
 
   return 0;
 }
+
+/*
+ * Rows [row0, row0 + rows) of a progressive dcraw_process() after
+ * LIBRAW_PROGRESS_OUTPUT_BAND has reported them, 3 bytes per pixel in sensor
+ * orientation. The curve is set from the histogram of the rows so far, so
+ * early bands may come out brighter or darker than the finished image.
+ */
+int LibRaw::copy_mem_band(void *scan0, int stride, int bgr, int row0,
+                          int rows)
+{
+  int(*hist)[LIBRAW_HISTOGRAM_SIZE] =
+      libraw_internal_data.output_data.histogram;
+  if (!hist || !imgdata.image)
+    return LIBRAW_OUT_OF_ORDER_CALL;
+  if (row0 < 0 || rows < 0 || row0 + rows > S.height)
+    return LIBRAW_BAD_CROP;
+
+  INT64 counted = 0;
+  for (int i = 0; i < LIBRAW_HISTOGRAM_SIZE; i++)
+    counted += hist[0][i];
+  int t_white = output_white_level(int(counted * O.auto_bright_thr));
+  gamma_curve(O.gamm[0], O.gamm[1], 2, int((t_white << 3) / O.bright));
+
+  const int first = bgr ? 2 : 0, step = bgr ? -1 : 1;
+  for (int r = 0; r < rows; r++)
+  {
+    uchar *ppm = ((uchar *)scan0) + size_t(r) * stride;
+    ushort(*pix)[4] = imgdata.image + size_t(row0 + r) * S.width;
+    for (int col = 0; col < S.width; col++, ppm += 3)
+      for (int c = 0; c < 3; c++)
+        ppm[c] = imgdata.color.curve[pix[col][first + c * step]] >> 8;
+  }
+  return 0;
+}
 #undef FORBGR
 #undef FORRGB
 
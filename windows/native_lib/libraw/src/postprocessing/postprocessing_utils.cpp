@@ -16,7 +16,7 @@
 
 #define TBLN 65535
 
-void LibRaw::exp_bef(float shift, float smooth)
+static void exp_bef_curve(float shift, float smooth, ushort *lut)
 {
   // params limits
   if (shift > 8)
@@ -28,8 +28,6 @@ void LibRaw::exp_bef(float shift, float smooth)
   if (smooth > 1.0)
     smooth = 1.0;
 
-  unsigned short *lut = (ushort *)malloc((TBLN + 1) * sizeof(unsigned short));
-
   if (shift <= 1.0)
   {
     for (int i = 0; i <= TBLN; i++)
@@ -61,12 +59,44 @@ void LibRaw::exp_bef(float shift, float smooth)
         lut[i] = Y < 0 ? 0 : (Y > TBLN ? TBLN : (unsigned short)(Y));
     }
   }
-  for (int i = 0; i < S.height * S.width; i++)
+}
+
+/*
+ * Builds the exp_bef() curve ahead of scale_colors(), so that
+ * scale_colors_loop() applies it on its pass. exp_bef() then only adjusts
+ * the maximums. The curve maps 0 to 0, so pixels scale_colors_loop() skips
+ * and those pre_interpolate() adds come out the same.
+ */
+void LibRaw::exp_bef_prepare(float shift, float smooth)
+{
+  output_data_t &od = libraw_internal_data.output_data;
+  if (!od.exp_lut)
+    od.exp_lut = (ushort *)malloc((TBLN + 1) * sizeof(unsigned short));
+  od.exp_lut_applied = 0;
+  exp_bef_curve(shift, smooth, od.exp_lut);
+}
+
+void LibRaw::exp_bef(float shift, float smooth)
+{
+  output_data_t &od = libraw_internal_data.output_data;
+  unsigned short *lut = od.exp_lut;
+
+  if (!lut || !od.exp_lut_applied)
   {
-    imgdata.image[i][0] = lut[imgdata.image[i][0]];
-    imgdata.image[i][1] = lut[imgdata.image[i][1]];
-    imgdata.image[i][2] = lut[imgdata.image[i][2]];
-    imgdata.image[i][3] = lut[imgdata.image[i][3]];
+    if (!lut)
+      lut = (ushort *)malloc((TBLN + 1) * sizeof(unsigned short));
+    exp_bef_curve(shift, smooth, lut);
+    const int size = S.height * S.width;
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int i = 0; i < size; i++)
+    {
+      imgdata.image[i][0] = lut[imgdata.image[i][0]];
+      imgdata.image[i][1] = lut[imgdata.image[i][1]];
+      imgdata.image[i][2] = lut[imgdata.image[i][2]];
+      imgdata.image[i][3] = lut[imgdata.image[i][3]];
+    }
   }
 
   if (C.data_maximum <= TBLN)
@@ -74,117 +104,173 @@ void LibRaw::exp_bef(float shift, float smooth)
   if (C.maximum <= TBLN)
     C.maximum = lut[C.maximum];
   free(lut);
+  od.exp_lut = NULL;
+  od.exp_lut_applied = 0;
 }
 
+#define HIST_LANES 2 /* sub-histograms per thread, by column parity */
+
 void LibRaw::convert_to_rgb_loop(float out_cam[3][4])
 {
-  int row, col, c;
-  float out[3];
-  ushort *img;
-  memset(libraw_internal_data.output_data.histogram, 0,
-         sizeof(int) * LIBRAW_HISTOGRAM_SIZE * 4);
-  if (libraw_internal_data.internal_output_params.raw_color)
+  int(*hist)[LIBRAW_HISTOGRAM_SIZE] =
+      libraw_internal_data.output_data.histogram;
+  memset(hist, 0, sizeof(int) * LIBRAW_HISTOGRAM_SIZE * 4);
+
+  const int ncolors = imgdata.idata.colors;
+  const int raw_color = libraw_internal_data.internal_output_params.raw_color;
+  if (!raw_color && ncolors != 3 && ncolors != 4)
+    return;
+  /* only auto-brightness reads the histogram, unless the caller wants it */
+  const bool need_hist =
+      O.keep_histogram || !((O.highlight & ~2) || O.no_auto_bright);
+  if (raw_color && !need_hist)
+    return;
+  const int hist_colors = raw_color ? ncolors : (ncolors == 4 ? 4 : 3);
+
+  /* Each thread counts into its own sub-histograms, one per column parity
+     so that runs of equal values do not serialize on a single counter. */
+#ifdef LIBRAW_USE_OPENMP
+  int buffer_count = omp_get_max_threads();
+#else
+  int buffer_count = 1;
+#endif
+  const size_t lane_size = size_t(LIBRAW_HISTOGRAM_SIZE) * 4;
+  char **buffers =
+      need_hist ? malloc_omp_buffers(buffer_count,
+                                     HIST_LANES * lane_size * sizeof(int))
+                : NULL;
+
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (int row = 0; row < S.height; row++)
   {
-    for (img = imgdata.image[0], row = 0; row < S.height; row++)
+    ushort(*pix)[4] = imgdata.image + size_t(row) * S.width;
+    int *sub = NULL;
+    if (need_hist)
+#ifdef LIBRAW_USE_OPENMP
+      sub = (int *)buffers[omp_get_thread_num()];
+#else
+      sub = (int *)buffers[0];
+#endif
+    for (int col = 0; col < S.width; col++)
     {
-      for (col = 0; col < S.width; col++, img += 4)
+      ushort *img = pix[col];
+      if (!raw_color)
       {
-        for (c = 0; c < imgdata.idata.colors; c++)
+        float out[3];
+        if (ncolors == 3)
         {
-          libraw_internal_data.output_data.histogram[c][img[c] >> 3]++;
+          out[0] = out_cam[0][0] * img[0] + out_cam[0][1] * img[1] +
+                   out_cam[0][2] * img[2];
+          out[1] = out_cam[1][0] * img[0] + out_cam[1][1] * img[1] +
+                   out_cam[1][2] * img[2];
+          out[2] = out_cam[2][0] * img[0] + out_cam[2][1] * img[1] +
+                   out_cam[2][2] * img[2];
+        }
+        else
+        {
+          out[0] = out_cam[0][0] * img[0] + out_cam[0][1] * img[1] +
+                   out_cam[0][2] * img[2] + out_cam[0][3] * img[3];
+          out[1] = out_cam[1][0] * img[0] + out_cam[1][1] * img[1] +
+                   out_cam[1][2] * img[2] + out_cam[1][3] * img[3];
+          out[2] = out_cam[2][0] * img[0] + out_cam[2][1] * img[1] +
+                   out_cam[2][2] * img[2] + out_cam[2][3] * img[3];
         }
-      }
-    }
-  }
-  else if (imgdata.idata.colors == 3)
-  {
-    for (img = imgdata.image[0], row = 0; row < S.height; row++)
-    {
-      for (col = 0; col < S.width; col++, img += 4)
-      {
-        out[0] = out_cam[0][0] * img[0] + out_cam[0][1] * img[1] +
-                 out_cam[0][2] * img[2];
-        out[1] = out_cam[1][0] * img[0] + out_cam[1][1] * img[1] +
-                 out_cam[1][2] * img[2];
-        out[2] = out_cam[2][0] * img[0] + out_cam[2][1] * img[1] +
-                 out_cam[2][2] * img[2];
         img[0] = CLIP((int)out[0]);
         img[1] = CLIP((int)out[1]);
         img[2] = CLIP((int)out[2]);
-        libraw_internal_data.output_data.histogram[0][img[0] >> 3]++;
-        libraw_internal_data.output_data.histogram[1][img[1] >> 3]++;
-        libraw_internal_data.output_data.histogram[2][img[2] >> 3]++;
       }
-    }
-  }
-  else if (imgdata.idata.colors == 4)
-  {
-    for (img = imgdata.image[0], row = 0; row < S.height; row++)
-    {
-      for (col = 0; col < S.width; col++, img += 4)
+      if (sub)
       {
-        out[0] = out_cam[0][0] * img[0] + out_cam[0][1] * img[1] +
-                 out_cam[0][2] * img[2] + out_cam[0][3] * img[3];
-        out[1] = out_cam[1][0] * img[0] + out_cam[1][1] * img[1] +
-                 out_cam[1][2] * img[2] + out_cam[1][3] * img[3];
-        out[2] = out_cam[2][0] * img[0] + out_cam[2][1] * img[1] +
-                 out_cam[2][2] * img[2] + out_cam[2][3] * img[3];
-        img[0] = CLIP((int)out[0]);
-        img[1] = CLIP((int)out[1]);
-        img[2] = CLIP((int)out[2]);
-        libraw_internal_data.output_data.histogram[0][img[0] >> 3]++;
-        libraw_internal_data.output_data.histogram[1][img[1] >> 3]++;
-        libraw_internal_data.output_data.histogram[2][img[2] >> 3]++;
-        libraw_internal_data.output_data.histogram[3][img[3] >> 3]++;
+        int *lane = sub + (col & (HIST_LANES - 1)) * lane_size;
+        for (int c = 0; c < hist_colors; c++)
+          lane[c * LIBRAW_HISTOGRAM_SIZE + (img[c] >> 3)]++;
       }
     }
   }
+
+  if (!buffers)
+    return;
+  int *total = hist[0];
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (int i = 0; i < int(lane_size); i++)
+  {
+    int sum = 0;
+    for (int t = 0; t < buffer_count; t++)
+      for (int l = 0; l < HIST_LANES; l++)
+        sum += ((int *)buffers[t])[l * lane_size + i];
+    total[i] = sum;
+  }
+  free_omp_buffers(buffers, buffer_count);
 }
+#undef HIST_LANES
 
 void LibRaw::scale_colors_loop(float scale_mul[4])
 {
-  unsigned size = S.iheight * S.iwidth;
+  const int ih = S.iheight, iw = S.iwidth;
+  const unsigned pat_rows = C.cblack[4], pat_cols = C.cblack[5];
+  const bool use_pattern = pat_rows && pat_cols;
+  const bool use_black =
+      use_pattern || C.cblack[0] || C.cblack[1] || C.cblack[2] || C.cblack[3];
+  const int cblk[4] = {int(C.cblack[0]), int(C.cblack[1]), int(C.cblack[2]),
+                       int(C.cblack[3])};
+  const float mul[4] = {scale_mul[0], scale_mul[1], scale_mul[2],
+                        scale_mul[3]};
+  /* exp_bef() curve, when it was folded in here */
+  const ushort *lut = libraw_internal_data.output_data.exp_lut;
 
-  if (C.cblack[4] && C.cblack[5])
-  {
-    int val;
-    for (unsigned i = 0; i < size; i++)
-    {
-      for (unsigned c = 0; c < 4; c++)
-      {
-        if (!(val = imgdata.image[i][c])) continue;
-        val -= C.cblack[6 + i / S.iwidth % C.cblack[4] * C.cblack[5] +
-                        i % S.iwidth % C.cblack[5]];
-        val -= C.cblack[c];
-        val = int(val * scale_mul[c]);
-        imgdata.image[i][c] = CLIP(val);
-      }
-    }
-  }
-  else if (C.cblack[0] || C.cblack[1] || C.cblack[2] || C.cblack[3])
+#ifdef LIBRAW_USE_OPENMP
+  int buffer_count = omp_get_max_threads();
+#else
+  int buffer_count = 1;
+#endif
+  /* per thread: the cblack pattern expanded over one image row */
+  char **buffers =
+      use_pattern ? malloc_omp_buffers(buffer_count, iw * sizeof(int)) : NULL;
+
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (int row = 0; row < ih; row++)
   {
-    for (unsigned i = 0; i < size; i++)
+    ushort(*pix)[4] = imgdata.image + size_t(row) * iw;
+    int *pat = NULL;
+    if (use_pattern)
     {
-      for (unsigned c = 0; c < 4; c++)
+#ifdef LIBRAW_USE_OPENMP
+      pat = (int *)buffers[omp_get_thread_num()];
+#else
+      pat = (int *)buffers[0];
+#endif
+      const unsigned *prow = C.cblack + 6 + row % pat_rows * pat_cols;
+      for (int col = 0, pc = 0; col < iw; col++)
       {
-        int val = imgdata.image[i][c];
-        if (!val) continue;
-        val -= C.cblack[c];
-        val = int(val * scale_mul[c]);
-        imgdata.image[i][c] = CLIP(val);
+        pat[col] = prow[pc];
+        if (++pc == int(pat_cols))
+          pc = 0;
       }
     }
-  }
-  else // BL is zero
-  {
-    for (unsigned i = 0; i < size; i++)
-    {
-      for (unsigned c = 0; c < 4; c++)
+    for (int col = 0; col < iw; col++)
+      for (int c = 0; c < 4; c++)
       {
-        int val = imgdata.image[i][c];
-        val = int(val * scale_mul[c]);
-        imgdata.image[i][c] = CLIP(val);
+        int val = pix[col][c];
+        if (use_black)
+        {
+          if (!val)
+            continue;
+          if (pat)
+            val -= pat[col];
+          val -= cblk[c];
+        }
+        val = int(val * mul[c]);
+        pix[col][c] = lut ? lut[CLIP(val)] : CLIP(val);
       }
-    }
   }
+  if (buffers)
+    free_omp_buffers(buffers, buffer_count);
+  if (lut)
+    libraw_internal_data.output_data.exp_lut_applied = 1;
 }
@@ -272,28 +272,55 @@ void LibRaw::copy_bayer(unsigned short cblack[4], unsigned short *dmaxp)
 {
   // Both cropped and uncropped
   int maxHeight = MIN(int(S.height),int(S.raw_height)-int(S.top_margin));
+  ingest_stats_t &ingest = libraw_internal_data.ingest_stats;
+  // auto-WB block sums are only exact if every pixel gets copied
+  wb_block_t *blocks =
+      ingest.blocks && maxHeight == S.height &&
+              S.left_margin + S.width <= S.raw_width
+          ? ingest.blocks
+          : NULL;
+  // rows go in groups of 8 aligned to the greybox, so that a group owns
+  // one row of blocks
+  const int shift = blocks ? (8 - int(ingest.top % 8)) % 8 : 0;
+  const int groups = (maxHeight + shift + 7) / 8;
 #if defined(LIBRAW_USE_OPENMP)
-#pragma omp parallel for schedule(dynamic) default(none) shared(dmaxp) firstprivate(cblack, maxHeight)
+#pragma omp parallel for schedule(dynamic)
 #endif
-  for (int row = 0; row < maxHeight ; row++)
+  for (int group = 0; group < groups; group++)
   {
-    int col;
     unsigned short ldmax = 0;
-    for (col = 0; col < S.width && col + S.left_margin < S.raw_width; col++)
+    int rowend = MIN(group * 8 + 8 - shift, maxHeight);
+    for (int row = MAX(group * 8 - shift, 0); row < rowend; row++)
     {
-      unsigned short val =
-          imgdata.rawdata.raw_image[(row + S.top_margin) * S.raw_pitch / 2 +
-                                    (col + S.left_margin)];
-      int cc = fcol(row, col);
-      if (val > cblack[cc])
+      wb_block_t *brow =
+          blocks && unsigned(row) >= ingest.top && unsigned(row) < ingest.bottom
+              ? blocks + (row - ingest.top) / 8 * ingest.cols
+              : NULL;
+      int col;
+      for (col = 0; col < S.width && col + S.left_margin < S.raw_width; col++)
       {
-        val -= cblack[cc];
-        if (val > ldmax)
-          ldmax = val;
+        unsigned short val =
+            imgdata.rawdata.raw_image[(row + S.top_margin) * S.raw_pitch / 2 +
+                                      (col + S.left_margin)];
+        int cc = fcol(row, col);
+        if (val > cblack[cc])
+        {
+          val -= cblack[cc];
+          if (val > ldmax)
+            ldmax = val;
+        }
+        else
+          val = 0;
+        imgdata.image[((row) >> IO.shrink) * S.iwidth + ((col) >> IO.shrink)][cc] = val;
+        if (brow && unsigned(col) - ingest.left < ingest.right - ingest.left)
+        {
+          wb_block_t &blk = brow[(col - ingest.left) / 8];
+          blk.sum[cc] += val;
+          blk.count[cc]++;
+          if (val > blk.max)
+            blk.max = val;
+        }
       }
-      else
-        val = 0;
-      imgdata.image[((row) >> IO.shrink) * S.iwidth + ((col) >> IO.shrink)][cc] = val;
     }
 #if defined(LIBRAW_USE_OPENMP)
 #pragma omp critical(dataupdate)
@@ -303,6 +330,7 @@ void LibRaw::copy_bayer(unsigned short cblack[4], unsigned short *dmaxp)
         *dmaxp = ldmax;
     }
   }
+  ingest.valid = blocks != NULL;
 }
 
 int LibRaw::raw2image_ex(int do_subtract_black)
@@ -426,6 +454,32 @@ int LibRaw::raw2image_ex(int do_subtract_black)
         cblack[i] = (unsigned short)C.cblack[i];
     }
 
+    // Auto white balance sums for scale_colors(), taken by copy_bayer() on
+    // the same pass. Only done when black goes inline; anything else that
+    // changes the image before scale_colors() clears ingest.valid.
+    ingest_stats_t &ingest = libraw_internal_data.ingest_stats;
+    if (ingest.blocks)
+    {
+      free(ingest.blocks);
+      ingest.blocks = NULL;
+    }
+    ingest.valid = 0;
+    if (do_subtract_black && imgdata.idata.filters && !IO.fuji_width &&
+        !O.no_auto_scale && needs_auto_wb())
+    {
+      ingest.top = O.greybox[1];
+      ingest.left = O.greybox[0];
+      ingest.bottom = MIN(O.greybox[1] + O.greybox[3], unsigned(S.height));
+      ingest.right = MIN(O.greybox[0] + O.greybox[2], unsigned(S.width));
+      if (ingest.bottom > ingest.top && ingest.right > ingest.left)
+      {
+        ingest.rows = (ingest.bottom - ingest.top + 7) / 8;
+        ingest.cols = (ingest.right - ingest.left + 7) / 8;
+        ingest.blocks = (wb_block_t *)calloc(size_t(ingest.rows) * ingest.cols,
+                                             sizeof(wb_block_t));
+      }
+    }
+
     // Max area size to definitely not overrun in/out buffers
     int copyheight = MAX(0, MIN(int(S.height), int(S.raw_height) - int(S.top_margin)));
     int copywidth = MAX(0, MIN(int(S.width), int(S.raw_width) - int(S.left_margin)));
@@ -27,6 +27,7 @@ int LibRaw::subtract_black_internal()
 
   try
   {
+    libraw_internal_data.ingest_stats.valid = 0;
     if (!is_phaseone_compressed() &&
         (C.cblack[0] || C.cblack[1] || C.cblack[2] || C.cblack[3] ||
          (C.cblack[4] && C.cblack[5])))
@@ -35,36 +36,71 @@ int LibRaw::subtract_black_internal()
       for (i = 0; i < 4; i++)
         cblk[i] = C.cblack[i];
 
-      int size = S.iheight * S.iwidth;
+      const int iw = S.iwidth, ih = S.iheight;
+      const unsigned pat_rows = C.cblack[4], pat_cols = C.cblack[5];
+      const bool use_pattern = pat_rows && pat_cols;
       int dmax = 0;
-      if (C.cblack[4] && C.cblack[5])
+#ifdef LIBRAW_USE_OPENMP
+      int buffer_count = omp_get_max_threads();
+#else
+      int buffer_count = 1;
+#endif
+      /* per thread: the cblack pattern expanded over one image row */
+      char **buffers = use_pattern
+                           ? malloc_omp_buffers(buffer_count, iw * sizeof(int))
+                           : NULL;
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel
+#endif
       {
-        for (unsigned q = 0; q < (unsigned)size; q++)
+        int ldmax = 0;
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp for schedule(static)
+#endif
+        for (int row = 0; row < ih; row++)
         {
-          for (unsigned c = 0; c < 4; c++)
+          ushort(*pix)[4] = imgdata.image + size_t(row) * iw;
+          if (use_pattern)
           {
-            int val = imgdata.image[q][c];
-            val -= C.cblack[6 + q / S.iwidth % C.cblack[4] * C.cblack[5] +
-                            q % S.iwidth % C.cblack[5]];
-            val -= cblk[c];
-            imgdata.image[q][c] = CLIP(val);
-            if (dmax < val) dmax = val;
+#ifdef LIBRAW_USE_OPENMP
+            int *pat = (int *)buffers[omp_get_thread_num()];
+#else
+            int *pat = (int *)buffers[0];
+#endif
+            const unsigned *prow = C.cblack + 6 + row % pat_rows * pat_cols;
+            for (int col = 0, pc = 0; col < iw; col++)
+            {
+              pat[col] = prow[pc];
+              if (++pc == int(pat_cols))
+                pc = 0;
+            }
+            for (int col = 0; col < iw; col++)
+              for (int c = 0; c < 4; c++)
+              {
+                int val = pix[col][c] - pat[col] - cblk[c];
+                pix[col][c] = CLIP(val);
+                ldmax = MAX(ldmax, val);
+              }
           }
+          else
+            for (int col = 0; col < iw; col++)
+              for (int c = 0; c < 4; c++)
+              {
+                int val = pix[col][c] - cblk[c];
+                pix[col][c] = CLIP(val);
+                ldmax = MAX(ldmax, val);
+              }
         }
-      }
-      else
-      {
-        for (unsigned q = 0; q < (unsigned)size; q++)
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp critical(dataupdate)
+#endif
         {
-          for (unsigned c = 0; c < 4; c++)
-          {
-            int val = imgdata.image[q][c];
-            val -= cblk[c];
-            imgdata.image[q][c] = CLIP(val);
-            if (dmax < val) dmax = val;
-          }
+          if (dmax < ldmax)
+            dmax = ldmax;
         }
       }
+      if (buffers)
+        free_omp_buffers(buffers, buffer_count);
       C.data_maximum = dmax & 0xffff;
       C.maximum -= C.black;
       ZERO(C.cblack); // Yeah, we used cblack[6+] values too!
@@ -74,12 +110,31 @@ int LibRaw::subtract_black_internal()
     {
       // Nothing to Do, maximum is already calculated, black level is 0, so no
       // change only calculate channel maximum;
-      int idx;
-      ushort *p = (ushort *)imgdata.image;
+      const ushort *p = (const ushort *)imgdata.image;
+      const int ih = S.iheight, rowlen = S.iwidth * 4;
       int dmax = 0;
-      for (idx = 0; idx < S.iheight * S.iwidth * 4; idx++)
-        if (dmax < p[idx])
-          dmax = p[idx];
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel
+#endif
+      {
+        int ldmax = 0;
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp for schedule(static)
+#endif
+        for (int row = 0; row < ih; row++)
+        {
+          const ushort *r = p + size_t(row) * rowlen;
+          for (int idx = 0; idx < rowlen; idx++)
+            ldmax = MAX(ldmax, int(r[idx]));
+        }
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp critical(dataupdate)
+#endif
+        {
+          if (dmax < ldmax)
+            dmax = ldmax;
+        }
+      }
       C.data_maximum = dmax;
     }
     return 0;
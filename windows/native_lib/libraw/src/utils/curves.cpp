@@ -17,6 +17,7 @@
  */
 
 #include "../../internal/dcraw_defs.h"
+#include <mutex>
 
 void LibRaw::cubic_spline(const int *x_, const int *y_, const int len)
 {
@@ -89,6 +90,61 @@ void LibRaw::cubic_spline(const int *x_, const int *y_, const int len)
   }
   free(A);
 }
+/*
+ * Output curves are rebuilt for every rendered image, nearly always with the
+ * same gamma and a white point that varies little between files. The last
+ * few curves are kept process-wide, keyed by everything the table depends on.
+ */
+#define GAMMA_CACHE_SIZE 4
+
+namespace
+{
+struct gamma_cache_entry_t
+{
+  double pwr, ts;
+  int mode, imax;
+  unsigned stamp; /* 0: unused */
+  ushort table[0x10000];
+};
+
+gamma_cache_entry_t gamma_cache[GAMMA_CACHE_SIZE];
+unsigned gamma_cache_clock;
+std::mutex gamma_cache_lock;
+
+bool gamma_cache_get(double pwr, double ts, int mode, int imax, ushort *dst)
+{
+  std::lock_guard<std::mutex> lock(gamma_cache_lock);
+  for (int i = 0; i < GAMMA_CACHE_SIZE; i++)
+  {
+    gamma_cache_entry_t &e = gamma_cache[i];
+    if (e.stamp && e.pwr == pwr && e.ts == ts && e.mode == mode &&
+        e.imax == imax)
+    {
+      e.stamp = ++gamma_cache_clock;
+      memcpy(dst, e.table, sizeof e.table);
+      return true;
+    }
+  }
+  return false;
+}
+
+void gamma_cache_put(double pwr, double ts, int mode, int imax,
+                     const ushort *src)
+{
+  std::lock_guard<std::mutex> lock(gamma_cache_lock);
+  gamma_cache_entry_t *lru = gamma_cache;
+  for (int i = 1; i < GAMMA_CACHE_SIZE; i++)
+    if (gamma_cache[i].stamp < lru->stamp)
+      lru = gamma_cache + i;
+  lru->pwr = pwr;
+  lru->ts = ts;
+  lru->mode = mode;
+  lru->imax = imax;
+  lru->stamp = ++gamma_cache_clock;
+  memcpy(lru->table, src, sizeof lru->table);
+}
+} // namespace
+
 void LibRaw::gamma_curve(double pwr, double ts, int mode, int imax)
 {
   int i;
@@ -120,11 +176,14 @@ void LibRaw::gamma_curve(double pwr, double ts, int mode, int imax)
     g[5] = 1 / (g[1] * SQR(g[3]) / 2 + 1 - g[2] - g[3] -
                 g[2] * g[3] * (log(g[3]) - 1)) -
            1;
-  if (!mode--)
+  if (!mode)
   {
     memcpy(gamm, g, sizeof gamm);
     return;
   }
+  if (gamma_cache_get(pwr, ts, mode, imax, curve))
+    return;
+  const int key_mode = mode--;
   for (i = 0; i < 0x10000; i++)
   {
     curve[i] = 0xffff;
@@ -140,6 +199,35 @@ void LibRaw::gamma_curve(double pwr, double ts, int mode, int imax)
                                     : exp((r - 1) / g[2]))))
 			);
   }
+  gamma_cache_put(pwr, ts, key_mode, imax, curve);
+}
+
+/*
+ * White level for the output curve: the auto_bright_thr percentile of the
+ * histogram, or 0x2000 when auto brightness is off. With auto_bright_quant
+ * set it is rounded up to the next 1/auto_bright_quant stop, so that similar
+ * exposures share a cached curve.
+ */
+int LibRaw::output_white_level(int perc)
+{
+  int c, val, total, t_white = 0x2000;
+  if ((highlight & ~2) || no_auto_bright)
+    return t_white;
+  for (t_white = c = 0; c < colors; c++)
+  {
+    for (val = 0x2000, total = 0; --val > 32;)
+      if ((total += histogram[c][val]) > perc)
+        break;
+    if (t_white < val)
+      t_white = val;
+  }
+  if (auto_bright_quant > 0)
+  {
+    const int q = auto_bright_quant;
+    double stops = ceil(log(double(t_white)) / log(2.0) * q - 1e-9) / q;
+    t_white = MIN(0x2000, int(ceil(pow(2.0, stops) - 1e-9)));
+  }
+  return t_white;
 }
 
 void LibRaw::linear_table(unsigned len)
@@ -80,6 +80,10 @@ LibRaw::LibRaw(unsigned int flags) : memmgr(1024)
   imgdata.params.use_p1_correction = 1;
   imgdata.params.exp_shift = 1.0;
   imgdata.params.auto_bright_thr = LIBRAW_DEFAULT_AUTO_BRIGHTNESS_THRESHOLD;
+  imgdata.params.auto_bright_quant = 0;
+  imgdata.params.keep_histogram = 0;
+  imgdata.params.develop_cache = 0;
+  imgdata.params.progressive_rows = 0;
   imgdata.params.adjust_maximum_thr = LIBRAW_DEFAULT_ADJUST_MAXIMUM_THRESHOLD;
   imgdata.rawparams.use_rawspeed = 1;
   imgdata.rawparams.use_dngsdk = LIBRAW_DNG_DEFAULT;
@@ -148,6 +152,9 @@ void LibRaw::recycle()
   FREE(libraw_internal_data.internal_data.meta_data);
   FREE(libraw_internal_data.output_data.histogram);
   FREE(libraw_internal_data.output_data.oprof);
+  FREE(libraw_internal_data.output_data.exp_lut);
+  FREE(libraw_internal_data.ingest_stats.blocks);
+  develop_cache_free();
   FREE(imgdata.color.profile);
   FREE(imgdata.rawdata.ph1_cblack);
   FREE(imgdata.rawdata.ph1_rblack);
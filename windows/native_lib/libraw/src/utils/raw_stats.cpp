@@ -0,0 +1,233 @@
+/* -*- C++ -*-
+ * Copyright 2019-2025 LibRaw LLC (info@libraw.org)
+ *
+
+ LibRaw is free software; you can redistribute it and/or modify
+ it under the terms of the one of two licenses as you choose:
+
+1. GNU LESSER GENERAL PUBLIC LICENSE version 2.1
+   (See file LICENSE.LGPL provided in LibRaw distribution archive for details).
+
+2. COMMON DEVELOPMENT AND DISTRIBUTION LICENSE (CDDL) Version 1.0
+   (See file LICENSE.CDDL provided in LibRaw distribution archive for details).
+
+ */
+
+#include "../../internal/libraw_cxx_defs.h"
+
+#define STATS_CMAP 48 /* period of every CFA layout: 2, 6 (X-Trans), 8, 16 */
+#define STATS_BAND 16 /* rows per band when no clip mask is requested */
+
+/*
+ * Exposure statistics straight from the unpacked raw data: clipped and
+ * crushed pixel counts, a coarse histogram and a clip mask, per CFA color.
+ * Only reads rawdata, so it can run right after unpack() without
+ * raw2image() or any postprocessing.
+ */
+int LibRaw::get_raw_stats(libraw_raw_stats_t *stats, uchar *clip_mask,
+                          int mask_width, int mask_height)
+{
+  CHECK_ORDER_LOW(LIBRAW_PROGRESS_LOAD_RAW);
+  if (!stats)
+    return LIBRAW_UNSPECIFIED_ERROR;
+  const ushort *raw = imgdata.rawdata.raw_image;
+  const ushort(*raw4)[4] = imgdata.rawdata.color4_image;
+  const ushort(*raw3)[3] = imgdata.rawdata.color3_image;
+  if (!raw && !raw4 && !raw3)
+    return LIBRAW_NOT_IMPLEMENTED; /* floating point data only */
+
+  memset(stats, 0, sizeof(*stats));
+
+  /* the same black and white levels raw2image_ex()/dcraw_process() use */
+  unsigned cblk[4];
+  unsigned blk = O.user_black >= 0 ? O.user_black : C.black;
+  bool pattern = C.cblack[4] && C.cblack[5];
+  for (int c = 0; c < 4; c++)
+  {
+    if (O.user_cblack[c] > -1000000)
+    {
+      cblk[c] = O.user_cblack[c];
+      pattern = false;
+    }
+    else
+      cblk[c] = C.cblack[c];
+    if (O.user_black >= 0)
+      pattern = false;
+  }
+  const unsigned white = O.user_sat > 0 ? O.user_sat : C.maximum;
+  int shift = 0;
+  while ((white >> shift) >= LIBRAW_RAW_STATS_BINS)
+    shift++;
+  stats->white = white;
+  stats->hist_shift = shift;
+
+  const int rows = MAX(0, MIN(int(S.height), int(S.raw_height) - int(S.top_margin)));
+  const int cols = MAX(0, MIN(int(S.width), int(S.raw_width) - int(S.left_margin)));
+  if (!rows || !cols)
+    return LIBRAW_SUCCESS;
+
+  uchar cmap[STATS_CMAP][STATS_CMAP];
+  for (int r = 0; r < STATS_CMAP; r++)
+    for (int c = 0; c < STATS_CMAP; c++)
+    {
+      int f = P1.filters ? COLOR(r, c) : 0;
+      cmap[r][c] = f > 3 ? 0 : f;
+    }
+
+  /* clip mask geometry: band b holds the rows that land in mask row b */
+  if (!clip_mask || mask_width <= 0 || mask_height <= 0)
+  {
+    clip_mask = NULL;
+    mask_width = 0;
+    mask_height = (rows + STATS_BAND - 1) / STATS_BAND;
+  }
+  if (clip_mask)
+    memset(clip_mask, 0, size_t(mask_width) * mask_height);
+  int *mask_col = clip_mask ? (int *)malloc(cols * sizeof(int)) : NULL;
+  for (int col = 0; mask_col && col < cols; col++)
+    mask_col[col] = int(INT64(col) * mask_width / cols);
+
+#ifdef LIBRAW_USE_OPENMP
+  int buffer_count = omp_get_max_threads();
+#else
+  int buffer_count = 1;
+#endif
+  /* per thread: a histogram, then the black level of the current row */
+  const size_t hist_size = sizeof(stats->histogram);
+  char **buffers =
+      malloc_omp_buffers(buffer_count, hist_size + cols * sizeof(unsigned));
+
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (int band = 0; band < mask_height; band++)
+  {
+#ifdef LIBRAW_USE_OPENMP
+    char *buffer = buffers[omp_get_thread_num()];
+#else
+    char *buffer = buffers[0];
+#endif
+    unsigned(*hist)[LIBRAW_RAW_STATS_BINS] =
+        (unsigned(*)[LIBRAW_RAW_STATS_BINS])buffer;
+    unsigned *black_line = (unsigned *)(buffer + hist_size);
+    uchar *mask_row = clip_mask ? clip_mask + size_t(band) * mask_width : NULL;
+    unsigned pixels[4] = {0, 0, 0, 0}, clipped[4] = {0, 0, 0, 0},
+             crushed[4] = {0, 0, 0, 0};
+    const int r0 = int((INT64(band) * rows + mask_height - 1) / mask_height);
+    const int r1 =
+        int((INT64(band + 1) * rows + mask_height - 1) / mask_height);
+
+    for (int row = r0; row < r1; row++)
+    {
+      const size_t rrow = size_t(row + S.top_margin);
+      if (raw)
+      {
+        const ushort *src = raw + rrow * (S.raw_pitch / 2) + S.left_margin;
+        const uchar *crow = cmap[row % STATS_CMAP];
+        if (pattern)
+        {
+          const unsigned *prow =
+              C.cblack + 6 + row % C.cblack[4] * C.cblack[5];
+          for (int col = 0, pc = 0; col < cols; col++)
+          {
+            black_line[col] = blk + cblk[crow[col % STATS_CMAP]] + prow[pc];
+            if (++pc == int(C.cblack[5]))
+              pc = 0;
+          }
+        }
+        else
+          for (int col = 0; col < cols; col++)
+            black_line[col] = blk + cblk[crow[col % STATS_CMAP]];
+
+        for (int col = 0; col < cols; col++)
+        {
+          const unsigned val = src[col];
+          const int c = crow[col % STATS_CMAP];
+          const int over = val >= white;
+          const int under = val <= black_line[col];
+          pixels[c]++;
+          clipped[c] += over;
+          crushed[c] += under;
+          hist[c][MIN(val >> shift, LIBRAW_RAW_STATS_BINS - 1)]++;
+          if (mask_row && (over | under))
+            mask_row[mask_col[col]] |= (over << c) | (under << (c + 4));
+        }
+      }
+      else
+      {
+        const int nc = raw4 ? 4 : 3;
+        const ushort *src =
+            raw4 ? raw4[rrow * (S.raw_pitch / 8) + S.left_margin]
+                 : raw3[rrow * (S.raw_pitch / 6) + S.left_margin];
+        const int ncolors = MIN(int(P1.colors), nc);
+        for (int col = 0; col < cols; col++, src += nc)
+          for (int c = 0; c < ncolors; c++)
+          {
+            const unsigned val = src[c];
+            const int over = val >= white;
+            const int under = val <= blk + cblk[c];
+            pixels[c]++;
+            clipped[c] += over;
+            crushed[c] += under;
+            hist[c][MIN(val >> shift, LIBRAW_RAW_STATS_BINS - 1)]++;
+            if (mask_row && (over | under))
+              mask_row[mask_col[col]] |= (over << c) | (under << (c + 4));
+          }
+      }
+    }
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp critical(raw_stats)
+#endif
+    for (int c = 0; c < 4; c++)
+    {
+      stats->pixels[c] += pixels[c];
+      stats->clipped[c] += clipped[c];
+      stats->crushed[c] += crushed[c];
+    }
+  }
+
+  for (int t = 0; t < buffer_count; t++)
+  {
+    const unsigned(*hist)[LIBRAW_RAW_STATS_BINS] =
+        (const unsigned(*)[LIBRAW_RAW_STATS_BINS])buffers[t];
+    for (int c = 0; c < 4; c++)
+      for (int bin = 0; bin < LIBRAW_RAW_STATS_BINS; bin++)
+        stats->histogram[c][bin] += hist[c][bin];
+  }
+  free_omp_buffers(buffers, buffer_count);
+  if (mask_col)
+    free(mask_col);
+
+  /* black level noise over the masked areas crop_masked_pixels() set up */
+  if (raw)
+  {
+    double sum[4] = {0, 0, 0, 0}, sum2[4] = {0, 0, 0, 0};
+    unsigned count[4] = {0, 0, 0, 0};
+    for (int m = 0; m < 8; m++)
+      for (int row = MAX(int(S.mask[m][0]), 0);
+           row < MIN(int(S.mask[m][2]), int(S.raw_height)); row++)
+      {
+        const ushort *src = raw + size_t(row) * (S.raw_pitch / 2);
+        for (int col = MAX(int(S.mask[m][1]), 0);
+             col < MIN(int(S.mask[m][3]), int(S.raw_width)); col++)
+        {
+          /* full area and active area filters are the same */
+          const int c = P1.filters ? FC(row, col) : 0;
+          sum[c] += src[col];
+          sum2[c] += double(src[col]) * src[col];
+          count[c]++;
+        }
+      }
+    for (int c = 0; c < 4; c++)
+      if (count[c])
+      {
+        double mean = sum[c] / count[c];
+        stats->black_mean[c] = float(mean);
+        stats->black_noise[c] =
+            float(sqrt(MAX(0.0, sum2[c] / count[c] - mean * mean)));
+      }
+  }
+  return LIBRAW_SUCCESS;
+}
+#undef STATS_CMAP
+#undef STATS_BAND
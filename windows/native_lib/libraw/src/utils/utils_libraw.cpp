@@ -408,6 +408,8 @@ const char *LibRaw::strprogress(enum LibRaw_progress p)
     return "Converting to RGB";
   case LIBRAW_PROGRESS_STRETCH:
     return "Stretching image";
+  case LIBRAW_PROGRESS_OUTPUT_BAND:
+    return "Output band ready";
   case LIBRAW_PROGRESS_THUMB_LOAD:
     return "Loading thumbnail";
   default: